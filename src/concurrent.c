@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Concurrent tables are split in stripes, each stripe being a regular table
+ * protected by a read-write lock. The stripe of a key is selected with the
+ * highest bits of its mixed hash, which are not used to select buckets or
+ * groups, so that keys are distributed evenly inside each stripe.
+ *
+ * Since each stripe grows and shrinks on its own, a resize only blocks the
+ * threads accessing the stripe being resized. */
+
+#define HT_CONCURRENT_DEFAULT_NB_STRIPES 64
+
+#define HT_CONCURRENT_STRIPE_ALIGNMENT 64
+
+struct ht_concurrent_stripe {
+    pthread_rwlock_t lock;
+    struct ht_table *table;
+} __attribute__((aligned(HT_CONCURRENT_STRIPE_ALIGNMENT)));
+
+struct ht_concurrent_table {
+    struct ht_allocator allocator;
+
+    struct ht_concurrent_stripe *stripes;
+    size_t nb_stripes;
+
+    /* Allocators only guarantee the alignment of malloc: the stripes are
+     * aligned inside a larger block. */
+    void *stripes_block;
+    size_t stripes_block_sz;
+
+    unsigned int stripe_bits;
+
+    ht_equal_func equal_func;
+};
+
+static struct ht_concurrent_stripe *
+ht_concurrent_table_stripe(const struct ht_concurrent_table *, uint64_t);
+
+struct ht_concurrent_table *
+ht_concurrent_table_new(ht_hash_func hash_func, ht_equal_func equal_func,
+                        const struct ht_table_options *options,
+                        size_t nb_stripes) {
+    const struct ht_allocator *allocator;
+    struct ht_concurrent_table *table;
+    struct ht_table_options stripe_options;
+
+    if (nb_stripes == 0)
+        nb_stripes = HT_CONCURRENT_DEFAULT_NB_STRIPES;
+
+    if ((nb_stripes & (nb_stripes - 1)) != 0) {
+        ht_set_error("number of stripes must be a power of two");
+        return NULL;
+    }
+
+    if (options) {
+        stripe_options = *options;
+    } else {
+        memset(&stripe_options, 0, sizeof(struct ht_table_options));
+    }
+
+    /* Lookups in chained tables migrate buckets during incremental
+     * resizing, they could not be done with a shared lock. */
+    if (stripe_options.incremental_resize) {
+        ht_set_error("incremental resizing is not supported by concurrent "
+                     "tables");
+        return NULL;
+    }
+
+    if (stripe_options.single_writer) {
+        ht_set_error("single writer mode is not supported by concurrent "
+                     "tables");
+        return NULL;
+    }
+
+    /* All stripes must hash keys identically. */
+    if (stripe_options.random_seed) {
+        stripe_options.seed = ht_random_seed();
+        stripe_options.random_seed = false;
+    }
+
+    stripe_options.capacity =
+        (stripe_options.capacity + nb_stripes - 1) / nb_stripes;
+
+    allocator = ht_options_allocator(options);
+    if (!allocator)
+        return NULL;
+
+    table = ht_allocator_malloc(allocator, sizeof(struct ht_concurrent_table));
+    if (!table) {
+        ht_set_error("cannot allocate table: %m");
+        return NULL;
+    }
+
+    memset(table, 0, sizeof(struct ht_concurrent_table));
+
+    table->allocator = *allocator;
+    table->equal_func = equal_func;
+
+    table->stripes_block = ht_allocator_calloc(allocator, nb_stripes + 1,
+                                               sizeof(struct
+                                                      ht_concurrent_stripe));
+    if (!table->stripes_block) {
+        ht_set_error("cannot allocate stripes: %m");
+        ht_concurrent_table_delete(table);
+        return NULL;
+    }
+
+    table->stripes_block_sz =
+        (nb_stripes + 1) * sizeof(struct ht_concurrent_stripe);
+
+    table->stripes = (struct ht_concurrent_stripe *)
+        (((uintptr_t)table->stripes_block + HT_CONCURRENT_STRIPE_ALIGNMENT - 1)
+         & ~(uintptr_t)(HT_CONCURRENT_STRIPE_ALIGNMENT - 1));
+
+    while (((size_t)1 << table->stripe_bits) < nb_stripes)
+        table->stripe_bits++;
+
+    for (size_t i = 0; i < nb_stripes; i++) {
+        struct ht_concurrent_stripe *stripe;
+        int ret;
+
+        stripe = table->stripes + i;
+
+        stripe->table = ht_table_new_ex(hash_func, equal_func,
+                                        &stripe_options);
+        if (!stripe->table) {
+            ht_concurrent_table_delete(table);
+            return NULL;
+        }
+
+        ret = pthread_rwlock_init(&stripe->lock, NULL);
+        if (ret != 0) {
+            ht_set_error("cannot initialize lock: %s", strerror(ret));
+            ht_table_delete(stripe->table);
+            stripe->table = NULL;
+            ht_concurrent_table_delete(table);
+            return NULL;
+        }
+
+        table->nb_stripes++;
+    }
+
+    return table;
+}
+
+void
+ht_concurrent_table_delete(struct ht_concurrent_table *table) {
+    struct ht_allocator allocator;
+
+    if (!table)
+        return;
+
+    for (size_t i = 0; i < table->nb_stripes; i++) {
+        struct ht_concurrent_stripe *stripe;
+
+        stripe = table->stripes + i;
+
+        pthread_rwlock_destroy(&stripe->lock);
+        ht_table_delete(stripe->table);
+    }
+
+    allocator = table->allocator;
+
+    ht_allocator_free(&allocator, table->stripes_block,
+                      table->stripes_block_sz);
+
+    memset(table, 0, sizeof(struct ht_concurrent_table));
+    ht_allocator_free(&allocator, table, sizeof(struct ht_concurrent_table));
+}
+
+size_t
+ht_concurrent_table_nb_entries(struct ht_concurrent_table *table) {
+    size_t nb_entries;
+
+    nb_entries = 0;
+
+    for (size_t i = 0; i < table->nb_stripes; i++) {
+        struct ht_concurrent_stripe *stripe;
+
+        stripe = table->stripes + i;
+
+        pthread_rwlock_rdlock(&stripe->lock);
+        nb_entries += stripe->table->nb_entries;
+        pthread_rwlock_unlock(&stripe->lock);
+    }
+
+    return nb_entries;
+}
+
+void
+ht_concurrent_table_clear(struct ht_concurrent_table *table) {
+    for (size_t i = 0; i < table->nb_stripes; i++) {
+        struct ht_concurrent_stripe *stripe;
+
+        stripe = table->stripes + i;
+
+        pthread_rwlock_wrlock(&stripe->lock);
+        ht_table_clear(stripe->table);
+        pthread_rwlock_unlock(&stripe->lock);
+    }
+}
+
+int
+ht_concurrent_table_insert(struct ht_concurrent_table *table,
+                           void *key, void *value) {
+    return ht_concurrent_table_insert2(table, key, value, NULL, NULL);
+}
+
+int
+ht_concurrent_table_insert2(struct ht_concurrent_table *table,
+                            void *key, void *value,
+                            void **old_key, void **old_value) {
+    struct ht_concurrent_stripe *stripe;
+    struct ht_table_entry *entry;
+    uint64_t hash;
+    int ret;
+
+    /* Hash functions and seeds are the same for all stripes and never
+     * change, so the key can be hashed before taking the lock. */
+    hash = ht_table_hash(table->stripes[0].table, key);
+    stripe = ht_concurrent_table_stripe(table, hash);
+
+    pthread_rwlock_wrlock(&stripe->lock);
+
+    ret = ht_table_upsert_entry(stripe->table, key, hash, &entry);
+    if (ret != -1) {
+        if (old_key)
+            *old_key = (ret == 0) ? entry->key : NULL;
+        if (old_value)
+            *old_value = (ret == 0) ? entry->value : NULL;
+
+        entry->key = key;
+        entry->value = value;
+    }
+
+    pthread_rwlock_unlock(&stripe->lock);
+    return ret;
+}
+
+int
+ht_concurrent_table_remove(struct ht_concurrent_table *table,
+                           const void *key) {
+    return ht_concurrent_table_remove2(table, key, NULL, NULL);
+}
+
+int
+ht_concurrent_table_remove2(struct ht_concurrent_table *table,
+                            const void *key,
+                            void **old_key, void **old_value) {
+    struct ht_concurrent_stripe *stripe;
+    struct ht_table_entry *entry;
+    uint64_t hash;
+    int ret;
+
+    hash = ht_table_hash(table->stripes[0].table, key);
+    stripe = ht_concurrent_table_stripe(table, hash);
+
+    pthread_rwlock_wrlock(&stripe->lock);
+
+    entry = ht_table_find(stripe->table, key, hash, table->equal_func);
+    if (entry) {
+        if (old_key)
+            *old_key = entry->key;
+        if (old_value)
+            *old_value = entry->value;
+
+        ret = (ht_table_erase(stripe->table, entry) == -1) ? -1 : 1;
+    } else {
+        ret = 0;
+    }
+
+    pthread_rwlock_unlock(&stripe->lock);
+    return ret;
+}
+
+int
+ht_concurrent_table_get(struct ht_concurrent_table *table, const void *key,
+                        void **value) {
+    struct ht_concurrent_stripe *stripe;
+    struct ht_table_entry *entry;
+    uint64_t hash;
+    int ret;
+
+    hash = ht_table_hash(table->stripes[0].table, key);
+    stripe = ht_concurrent_table_stripe(table, hash);
+
+    pthread_rwlock_rdlock(&stripe->lock);
+
+    entry = ht_table_find(stripe->table, key, hash, table->equal_func);
+    if (entry) {
+        *value = entry->value;
+        ret = 1;
+    } else {
+        ret = 0;
+    }
+
+    pthread_rwlock_unlock(&stripe->lock);
+    return ret;
+}
+
+bool
+ht_concurrent_table_contains(struct ht_concurrent_table *table,
+                             const void *key) {
+    struct ht_concurrent_stripe *stripe;
+    uint64_t hash;
+    bool found;
+
+    hash = ht_table_hash(table->stripes[0].table, key);
+    stripe = ht_concurrent_table_stripe(table, hash);
+
+    pthread_rwlock_rdlock(&stripe->lock);
+    found = ht_table_find(stripe->table, key, hash, table->equal_func) != NULL;
+    pthread_rwlock_unlock(&stripe->lock);
+
+    return found;
+}
+
+static struct ht_concurrent_stripe *
+ht_concurrent_table_stripe(const struct ht_concurrent_table *table,
+                           uint64_t hash) {
+    return table->stripes + ht_hash_partition(hash, table->stripe_bits);
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "hashtable.h"
+#include "group.h"
+
+/* Parallel traversals split the storage of the table (buckets, slots or
+ * entries of a compact table) in one contiguous range per task. Each task
+ * only reads and writes the entries of its range; for open addressing
+ * tables, ranges are aligned on groups since removing an entry reads the
+ * control bytes of its group.
+ *
+ * Counters of the table are updated once all tasks are done, and the table
+ * is then shrunk if needed. Removing an entry from a compact table leaves its
+ * index slot, which is cleaned up at the end as well. */
+
+#define HT_FOREACH_ALIGN(sz_) (((sz_) + 15) & ~(size_t)15)
+
+struct ht_foreach_task {
+    size_t nb_removed;
+    size_t nb_deleted;
+    void *acc;
+};
+
+struct ht_foreach {
+    struct ht_table *table;
+    size_t range_sz;
+
+    ht_foreach_func foreach_func;
+    ht_reduce_func reduce_func;
+    void *arg;
+
+    unsigned int nb_tasks;
+    struct ht_foreach_task *tasks;
+    size_t tasks_block_sz;
+};
+
+static int ht_foreach_run(struct ht_foreach *, unsigned int,
+                          const struct ht_executor *, size_t, const void *);
+static void ht_foreach_free(struct ht_foreach *);
+static void ht_foreach_task(void *, unsigned int);
+static bool ht_foreach_visit(struct ht_foreach *, struct ht_foreach_task *,
+                             struct ht_table_entry *);
+
+int
+ht_table_foreach_parallel(struct ht_table *table, ht_foreach_func func,
+                          void *arg, unsigned int nb_threads,
+                          const struct ht_executor *executor) {
+    struct ht_foreach foreach;
+
+    assert(table->nb_iterators == 0);
+
+    memset(&foreach, 0, sizeof(struct ht_foreach));
+    foreach.table = table;
+    foreach.foreach_func = func;
+    foreach.arg = arg;
+
+    if (ht_foreach_run(&foreach, nb_threads, executor, 0, NULL) == -1)
+        return -1;
+
+    ht_foreach_free(&foreach);
+    return 0;
+}
+
+int
+ht_table_reduce_parallel(struct ht_table *table, ht_reduce_func reduce_func,
+                         ht_combine_func combine_func, void *acc,
+                         size_t acc_sz, void *arg, unsigned int nb_threads,
+                         const struct ht_executor *executor) {
+    struct ht_foreach foreach;
+
+    memset(&foreach, 0, sizeof(struct ht_foreach));
+    foreach.table = table;
+    foreach.reduce_func = reduce_func;
+    foreach.arg = arg;
+
+    if (ht_foreach_run(&foreach, nb_threads, executor, acc_sz, acc) == -1)
+        return -1;
+
+    /* Partial results are combined in the order of the ranges, so that the
+     * result does not depend on the way tasks were scheduled. */
+    for (unsigned int i = 0; i < foreach.nb_tasks; i++)
+        combine_func(acc, foreach.tasks[i].acc, arg);
+
+    ht_foreach_free(&foreach);
+    return 0;
+}
+
+static int
+ht_foreach_run(struct ht_foreach *foreach, unsigned int nb_threads,
+               const struct ht_executor *executor,
+               size_t acc_sz, const void *acc) {
+    struct ht_table *table;
+    size_t nb_removed, nb_deleted, tasks_sz, acc_stride;
+    uint8_t *accs;
+
+    table = foreach->table;
+
+    switch (table->storage) {
+    case HT_TABLE_STORAGE_OPEN:
+        foreach->range_sz = table->slots_sz;
+        break;
+
+    case HT_TABLE_STORAGE_COMPACT:
+        foreach->range_sz = table->entries_sz;
+        break;
+
+    default:
+        foreach->range_sz = table->old_buckets_sz + table->buckets_sz;
+        break;
+    }
+
+    foreach->nb_tasks = ht_parallel_nb_threads(nb_threads);
+
+    /* Accumulators are stored after the array of tasks, each one starting
+     * as a copy of the initial value and aligned as malloc() would. */
+    tasks_sz = HT_FOREACH_ALIGN(foreach->nb_tasks
+                                * sizeof(struct ht_foreach_task));
+
+    if (acc_sz > SIZE_MAX - 15
+     || HT_FOREACH_ALIGN(acc_sz) > (SIZE_MAX - tasks_sz) / foreach->nb_tasks) {
+        errno = ENOMEM;
+        ht_set_error("cannot allocate tasks: %m");
+        return -1;
+    }
+
+    acc_stride = HT_FOREACH_ALIGN(acc_sz);
+
+    foreach->tasks_block_sz = tasks_sz + foreach->nb_tasks * acc_stride;
+    foreach->tasks = ht_allocator_malloc(&table->allocator,
+                                         foreach->tasks_block_sz);
+    if (!foreach->tasks) {
+        ht_set_error("cannot allocate tasks: %m");
+        return -1;
+    }
+
+    accs = (uint8_t *)foreach->tasks + tasks_sz;
+
+    for (unsigned int i = 0; i < foreach->nb_tasks; i++) {
+        struct ht_foreach_task *task;
+
+        task = foreach->tasks + i;
+        task->nb_removed = 0;
+        task->nb_deleted = 0;
+        task->acc = NULL;
+
+        if (acc_sz > 0) {
+            task->acc = accs + i * acc_stride;
+            memcpy(task->acc, acc, acc_sz);
+        }
+    }
+
+    if (executor) {
+        executor->run(foreach->nb_tasks, ht_foreach_task, foreach,
+                      executor->ctx);
+    } else {
+        ht_parallel_run(foreach->nb_tasks, ht_foreach_task, foreach);
+    }
+
+    nb_removed = 0;
+    nb_deleted = 0;
+
+    for (unsigned int i = 0; i < foreach->nb_tasks; i++) {
+        nb_removed += foreach->tasks[i].nb_removed;
+        nb_deleted += foreach->tasks[i].nb_deleted;
+    }
+
+    table->nb_entries -= nb_removed;
+    table->nb_deleted += nb_deleted;
+
+    if (nb_removed > 0) {
+        if (table->storage == HT_TABLE_STORAGE_COMPACT)
+            ht_table_compact_sweep(table);
+
+        if (ht_table_shrink(table) == -1) {
+            ht_foreach_free(foreach);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void
+ht_foreach_free(struct ht_foreach *foreach) {
+    ht_allocator_free(&foreach->table->allocator, foreach->tasks,
+                      foreach->tasks_block_sz);
+    foreach->tasks = NULL;
+}
+
+static void
+ht_foreach_task(void *arg, unsigned int idx) {
+    struct ht_foreach *foreach;
+    struct ht_foreach_task *task;
+    struct ht_table *table;
+    size_t start, end;
+
+    foreach = arg;
+    task = foreach->tasks + idx;
+    table = foreach->table;
+
+    start = foreach->range_sz * idx / foreach->nb_tasks;
+    end = foreach->range_sz * (idx + 1) / foreach->nb_tasks;
+
+    switch (table->storage) {
+    case HT_TABLE_STORAGE_OPEN:
+        start -= start % HT_GROUP_SZ;
+        end -= end % HT_GROUP_SZ;
+
+        for (size_t group = start; group < end; group += HT_GROUP_SZ) {
+            ht_group_mask mask;
+
+            mask = ht_group_match_full(table->ctrl + group);
+
+            while (mask != 0) {
+                size_t i;
+
+                i = group + ht_group_mask_first(mask);
+                mask &= mask - 1;
+
+                if (ht_foreach_visit(foreach, task, table->slots + i)) {
+                    if (ht_table_open_erase_slot(table, i))
+                        task->nb_deleted++;
+                    task->nb_removed++;
+                }
+            }
+        }
+        break;
+
+    case HT_TABLE_STORAGE_COMPACT:
+        for (size_t i = start; i < end; i++) {
+            struct ht_table_entry *entry;
+
+            entry = table->entries + i;
+            if (!HT_TABLE_ENTRY_IS_USED(entry))
+                continue;
+
+            if (ht_foreach_visit(foreach, task, entry)) {
+                entry->key = NULL;
+                entry->value = NULL;
+                entry->hash = HT_UNUSED_HASH;
+
+                task->nb_removed++;
+            }
+        }
+        break;
+
+    default:
+        for (size_t b = start; b < end; b++) {
+            struct ht_table_bucket *bucket;
+
+            bucket = ht_table_iterator_bucket(table, b);
+
+            for (size_t e = 0; e < bucket->sz; e++) {
+                struct ht_table_entry *entry;
+
+                entry = bucket->entries + e;
+                if (!HT_TABLE_ENTRY_IS_USED(entry))
+                    continue;
+
+                if (ht_foreach_visit(foreach, task, entry)) {
+                    entry->key = NULL;
+                    entry->value = NULL;
+                    entry->hash = HT_UNUSED_HASH;
+
+                    task->nb_removed++;
+                }
+            }
+        }
+        break;
+    }
+}
+
+static bool
+ht_foreach_visit(struct ht_foreach *foreach, struct ht_foreach_task *task,
+                 struct ht_table_entry *entry) {
+    enum ht_foreach_action action;
+    void *value;
+
+    if (foreach->reduce_func) {
+        foreach->reduce_func(task->acc, entry->key, entry->value,
+                             foreach->arg);
+        return false;
+    }
+
+    value = entry->value;
+
+    action = foreach->foreach_func(entry->key, &value, foreach->arg);
+    if (action == HT_FOREACH_REMOVE)
+        return true;
+
+    /* As with ht_table_iterator_set_value(), readers of a single writer
+     * table may be reading the value. */
+    if (value != entry->value)
+        __atomic_store_n(&entry->value, value, __ATOMIC_RELEASE);
+
+    return false;
+}
@@ -0,0 +1,728 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Frozen tables use a minimal perfect hash function built with the CHD
+ * (compress, hash and displace) algorithm: keys are split in buckets of
+ * about HT_FROZEN_BUCKET_SZ keys, and each bucket has a pair of
+ * displacements (d0, d1) chosen so that the positions
+ *
+ *     (f1(key) + d0 * f2(key) + d1) mod nb_entries
+ *
+ * of the keys of all buckets are distinct. A lookup therefore reads the
+ * displacements of one bucket, then the entry at the position of the key,
+ * and compares keys once.
+ *
+ * Buckets are placed from the largest to the smallest. As in PTHash, 60% of
+ * the keys go to the first 30% of buckets: large buckets are placed while
+ * most positions are free, and the last buckets, placed when few positions
+ * are left, mostly contain one or two keys.
+ *
+ * The whole table is a single image made of offsets relative to its
+ * beginning, so that it can be written to a file and mapped as is by any
+ * process. Integers use the byte order of the machine which built the image;
+ * images with a different byte order are rejected.
+ *
+ * Layout (all sections are aligned on 8 bytes):
+ *
+ *   header         struct ht_frozen_header
+ *   displacements  nb_buckets pairs of uint32 (d0, d1)
+ *   slots          nb_entries uint64 offsets of entries
+ *   entries        uint32 key size, uint32 value size, key, value */
+
+#define HT_FROZEN_MAGIC      "htfrozen"
+#define HT_FROZEN_VERSION    1
+#define HT_FROZEN_BYTE_ORDER 0x01020304
+
+#define HT_FROZEN_BUCKET_SZ 4
+
+/* 60% of 2^32 */
+#define HT_FROZEN_DENSE_THRESHOLD UINT64_C(2576980377)
+
+/* Maximum number of displacements tried for a bucket, and maximum number of
+ * seeds tried before giving up. */
+#define HT_FROZEN_MAX_BUCKET_TRIES ((uint64_t)1 << 28)
+#define HT_FROZEN_MAX_SEEDS        16
+
+struct ht_frozen_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t image_sz;
+    uint64_t seed;
+    uint64_t nb_entries;
+    uint64_t nb_buckets;
+
+    uint64_t displacements_offset;
+    uint64_t slots_offset;
+    uint64_t entries_offset;
+};
+
+struct ht_frozen_table {
+    const uint8_t *image;
+    size_t image_sz;
+    bool mapped;
+
+    const struct ht_frozen_header *header;
+    const uint32_t *displacements;
+    const uint64_t *slots;
+};
+
+/* Key being placed while building a table */
+struct ht_frozen_key {
+    uint64_t offset;
+    uint64_t bucket;
+    uint64_t f1;
+    uint64_t f2;
+};
+
+static size_t ht_frozen_align(size_t);
+static uint64_t ht_frozen_reduce(uint64_t, uint64_t);
+static void ht_frozen_hash(const struct ht_frozen_header *, uint64_t,
+                           uint64_t *, uint64_t *, uint64_t *);
+static int ht_frozen_build(uint8_t *, struct ht_frozen_key *);
+static int ht_frozen_place(struct ht_frozen_header *, struct ht_frozen_key *,
+                           uint32_t *, uint64_t *);
+static struct ht_frozen_table *ht_frozen_table_new(const uint8_t *, size_t,
+                                                   bool);
+
+struct ht_frozen_table *
+ht_table_freeze(struct ht_table *table, ht_encode_func key_encode,
+                ht_encode_func value_encode) {
+    struct ht_frozen_header *header;
+    struct ht_frozen_key *keys;
+    struct ht_frozen_table *frozen;
+    struct ht_table_entry *entry;
+    size_t bucket, idx, nb_entries, nb_buckets;
+    size_t entries_sz, image_sz;
+    uint8_t *image, *ptr;
+
+    nb_entries = table->nb_entries;
+    nb_buckets = (nb_entries + HT_FROZEN_BUCKET_SZ - 1) / HT_FROZEN_BUCKET_SZ;
+    if (nb_buckets == 0)
+        nb_buckets = 1;
+
+    if (nb_entries > UINT32_MAX) {
+        ht_set_error("too many entries");
+        return NULL;
+    }
+
+    /* Compute the size of all encoded entries first. */
+    entries_sz = 0;
+
+    bucket = 0;
+    idx = 0;
+    while ((entry = ht_table_next_entry(table, &bucket, &idx))) {
+        size_t key_sz, value_sz;
+
+        key_sz = key_encode(entry->key, NULL, 0);
+        value_sz = value_encode ? value_encode(entry->value, NULL, 0) : 0;
+
+        if (key_sz > UINT32_MAX || value_sz > UINT32_MAX) {
+            ht_set_error("encoded entry too large");
+            return NULL;
+        }
+
+        entries_sz += ht_frozen_align(8 + key_sz + value_sz);
+
+        if (table->storage != HT_TABLE_STORAGE_CHAINED) {
+            bucket++;
+        } else {
+            idx++;
+        }
+    }
+
+    image_sz = sizeof(struct ht_frozen_header)
+             + nb_buckets * 2 * sizeof(uint32_t)
+             + nb_entries * sizeof(uint64_t)
+             + entries_sz;
+
+    image = ht_malloc(image_sz);
+    if (!image) {
+        ht_set_error("cannot allocate image: %m");
+        return NULL;
+    }
+
+    memset(image, 0, image_sz);
+
+    keys = ht_calloc(nb_entries + 1, sizeof(struct ht_frozen_key));
+    if (!keys) {
+        ht_set_error("cannot allocate keys: %m");
+        ht_free(image);
+        return NULL;
+    }
+
+    header = (struct ht_frozen_header *)image;
+    memcpy(header->magic, HT_FROZEN_MAGIC, 8);
+    header->version = HT_FROZEN_VERSION;
+    header->byte_order = HT_FROZEN_BYTE_ORDER;
+    header->image_sz = image_sz;
+    header->nb_entries = nb_entries;
+    header->nb_buckets = nb_buckets;
+
+    header->displacements_offset = sizeof(struct ht_frozen_header);
+    header->slots_offset = header->displacements_offset
+                         + nb_buckets * 2 * sizeof(uint32_t);
+    header->entries_offset = header->slots_offset
+                           + nb_entries * sizeof(uint64_t);
+
+    /* Encode entries. */
+    ptr = image + header->entries_offset;
+
+    bucket = 0;
+    idx = 0;
+    for (size_t i = 0;
+         (entry = ht_table_next_entry(table, &bucket, &idx)); i++) {
+        uint32_t key_sz, value_sz;
+
+        key_sz = (uint32_t)key_encode(entry->key, NULL, 0);
+        value_sz = value_encode
+                 ? (uint32_t)value_encode(entry->value, NULL, 0) : 0;
+
+        memcpy(ptr, &key_sz, sizeof(uint32_t));
+        memcpy(ptr + 4, &value_sz, sizeof(uint32_t));
+
+        key_encode(entry->key, ptr + 8, key_sz);
+        if (value_encode)
+            value_encode(entry->value, ptr + 8 + key_sz, value_sz);
+
+        keys[i].offset = (uint64_t)(ptr - image);
+
+        ptr += ht_frozen_align(8 + key_sz + value_sz);
+
+        if (table->storage != HT_TABLE_STORAGE_CHAINED) {
+            bucket++;
+        } else {
+            idx++;
+        }
+    }
+
+    if (ht_frozen_build(image, keys) == -1) {
+        ht_free(keys);
+        ht_free(image);
+        return NULL;
+    }
+
+    ht_free(keys);
+
+    frozen = ht_frozen_table_new(image, image_sz, false);
+    if (!frozen) {
+        ht_free(image);
+        return NULL;
+    }
+
+    return frozen;
+}
+
+struct ht_frozen_table *
+ht_frozen_table_open(const char *path) {
+    struct ht_frozen_table *frozen;
+    struct stat st;
+    void *image;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        ht_set_error("cannot open %s: %m", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        ht_set_error("cannot stat %s: %m", path);
+        close(fd);
+        return NULL;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct ht_frozen_header)) {
+        ht_set_error("invalid frozen table: file too small");
+        close(fd);
+        return NULL;
+    }
+
+    /* Pages are shared with all the processes mapping the same file. */
+    image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        ht_set_error("cannot map %s: %m", path);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+
+    frozen = ht_frozen_table_new(image, (size_t)st.st_size, true);
+    if (!frozen) {
+        munmap(image, (size_t)st.st_size);
+        return NULL;
+    }
+
+    return frozen;
+}
+
+void
+ht_frozen_table_delete(struct ht_frozen_table *frozen) {
+    if (!frozen)
+        return;
+
+    if (frozen->mapped) {
+        munmap((void *)frozen->image, frozen->image_sz);
+    } else {
+        ht_free((void *)frozen->image);
+    }
+
+    memset(frozen, 0, sizeof(struct ht_frozen_table));
+    ht_free(frozen);
+}
+
+int
+ht_frozen_table_save(const struct ht_frozen_table *frozen, FILE *file) {
+    if (fwrite(frozen->image, 1, frozen->image_sz, file) != frozen->image_sz) {
+        ht_set_error("cannot write frozen table: %m");
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t
+ht_frozen_table_nb_entries(const struct ht_frozen_table *frozen) {
+    return (size_t)frozen->header->nb_entries;
+}
+
+int
+ht_frozen_table_get(const struct ht_frozen_table *frozen,
+                    const void *key, size_t key_sz, struct ht_bytes *value) {
+    const struct ht_frozen_header *header;
+    const uint8_t *ptr;
+    uint64_t hash, bucket, pos, offset;
+    uint32_t entry_key_sz, entry_value_sz;
+    uint64_t f1, f2;
+    uint32_t d0, d1;
+
+    header = frozen->header;
+    if (header->nb_entries == 0)
+        return 0;
+
+    hash = ht_hash64_data(key, key_sz, header->seed);
+    ht_frozen_hash(header, hash, &bucket, &f1, &f2);
+
+    d0 = frozen->displacements[bucket * 2];
+    d1 = frozen->displacements[bucket * 2 + 1];
+
+    pos = (f1 + (uint64_t)d0 * f2 + d1) % header->nb_entries;
+
+    /* The image may come from a file, offsets are checked before being
+     * used. */
+    offset = frozen->slots[pos];
+    if (offset > frozen->image_sz - 8)
+        return 0;
+
+    ptr = frozen->image + offset;
+
+    memcpy(&entry_key_sz, ptr, sizeof(uint32_t));
+    memcpy(&entry_value_sz, ptr + 4, sizeof(uint32_t));
+
+    if ((uint64_t)entry_key_sz + entry_value_sz > frozen->image_sz - offset - 8)
+        return 0;
+
+    if (entry_key_sz != key_sz || memcmp(ptr + 8, key, key_sz) != 0)
+        return 0;
+
+    if (value) {
+        value->data = ptr + 8 + entry_key_sz;
+        value->size = entry_value_sz;
+    }
+
+    return 1;
+}
+
+bool
+ht_frozen_table_contains(const struct ht_frozen_table *frozen,
+                         const void *key, size_t key_sz) {
+    return ht_frozen_table_get(frozen, key, key_sz, NULL) == 1;
+}
+
+size_t
+ht_encode_int32(const void *ptr, void *buf, size_t sz) {
+    int32_t n;
+
+    if (sz >= sizeof(int32_t)) {
+        n = HT_POINTER_TO_INT32(ptr);
+        memcpy(buf, &n, sizeof(int32_t));
+    }
+
+    return sizeof(int32_t);
+}
+
+size_t
+ht_encode_string(const void *ptr, void *buf, size_t sz) {
+    size_t len;
+
+    len = strlen(ptr);
+    if (sz >= len)
+        memcpy(buf, ptr, len);
+
+    return len;
+}
+
+size_t
+ht_encode_bytes(const void *ptr, void *buf, size_t sz) {
+    const struct ht_bytes *bytes;
+
+    bytes = ptr;
+    if (sz >= bytes->size)
+        memcpy(buf, bytes->data, bytes->size);
+
+    return bytes->size;
+}
+
+static size_t
+ht_frozen_align(size_t sz) {
+    return (sz + 7) & ~(size_t)7;
+}
+
+static uint64_t
+ht_frozen_reduce(uint64_t x, uint64_t n) {
+    /* Map a 32 bit value to [0, n) without any division, n being lower than
+     * 2^32. */
+    return (x * n) >> 32;
+}
+
+static void
+ht_frozen_hash(const struct ht_frozen_header *header, uint64_t hash,
+               uint64_t *pbucket, uint64_t *pf1, uint64_t *pf2) {
+    uint64_t hash2, nb_buckets, nb_dense_buckets;
+
+    nb_buckets = header->nb_buckets;
+    nb_dense_buckets = nb_buckets * 3 / 10;
+
+    if (nb_dense_buckets == 0) {
+        *pbucket = ht_frozen_reduce(hash >> 32, nb_buckets);
+    } else if ((hash & 0xffffffff) < HT_FROZEN_DENSE_THRESHOLD) {
+        *pbucket = ht_frozen_reduce(hash >> 32, nb_dense_buckets);
+    } else {
+        *pbucket = nb_dense_buckets
+                 + ht_frozen_reduce(hash >> 32, nb_buckets - nb_dense_buckets);
+    }
+
+    hash2 = ht_hash_mix64(hash);
+
+    *pf1 = ht_frozen_reduce(hash2 & 0xffffffff, header->nb_entries);
+    *pf2 = ht_frozen_reduce(hash2 >> 32, header->nb_entries);
+}
+
+static int
+ht_frozen_build(uint8_t *image, struct ht_frozen_key *keys) {
+    struct ht_frozen_header *header;
+    uint32_t *displacements;
+    uint64_t *slots;
+    uint64_t seed;
+
+    header = (struct ht_frozen_header *)image;
+    displacements = (uint32_t *)(image + header->displacements_offset);
+    slots = (uint64_t *)(image + header->slots_offset);
+
+    if (header->nb_entries == 0)
+        return 0;
+
+    /* Placement fails if two keys of a bucket cannot be separated, or if a
+     * bucket cannot be placed in a reasonable time; another seed is then
+     * tried. */
+    seed = ht_random_seed();
+
+    for (int i = 0; i < HT_FROZEN_MAX_SEEDS; i++) {
+        int ret;
+
+        header->seed = seed;
+
+        for (uint64_t k = 0; k < header->nb_entries; k++) {
+            const uint8_t *entry;
+            uint32_t key_sz;
+            uint64_t hash;
+
+            entry = image + keys[k].offset;
+            memcpy(&key_sz, entry, sizeof(uint32_t));
+
+            hash = ht_hash64_data(entry + 8, key_sz, seed);
+            ht_frozen_hash(header, hash,
+                           &keys[k].bucket, &keys[k].f1, &keys[k].f2);
+        }
+
+        ret = ht_frozen_place(header, keys, displacements, slots);
+        if (ret == 0)
+            return 0;
+        if (ret == -1)
+            return -1;
+
+        seed = ht_hash_mix64(seed + 1);
+    }
+
+    ht_set_error("cannot build perfect hash function");
+    return -1;
+}
+
+static int
+ht_frozen_place(struct ht_frozen_header *header, struct ht_frozen_key *keys,
+                uint32_t *displacements, uint64_t *slots) {
+    size_t nb_entries, nb_buckets, max_bucket_sz, free_pos;
+    size_t *bucket_starts, *bucket_keys, *order, *sizes_starts;
+    uint64_t *bases, *positions;
+    uint8_t *taken;
+    int ret;
+
+    nb_entries = (size_t)header->nb_entries;
+    nb_buckets = (size_t)header->nb_buckets;
+
+    bucket_starts = ht_calloc(nb_buckets + 1, sizeof(size_t));
+    bucket_keys = ht_calloc(nb_entries, sizeof(size_t));
+    order = ht_calloc(nb_buckets, sizeof(size_t));
+    taken = ht_calloc(nb_entries, 1);
+    sizes_starts = NULL;
+    bases = NULL;
+    positions = NULL;
+
+    if (!bucket_starts || !bucket_keys || !order || !taken) {
+        ht_set_error("cannot allocate buffers: %m");
+        ret = -1;
+        goto end;
+    }
+
+    /* Group keys by bucket; bucket_starts[b] is used as a cursor while
+     * filling bucket_keys, then shifted back. */
+    for (size_t k = 0; k < nb_entries; k++)
+        bucket_starts[keys[k].bucket + 1]++;
+
+    max_bucket_sz = 0;
+    for (size_t b = 0; b < nb_buckets; b++) {
+        if (bucket_starts[b + 1] > max_bucket_sz)
+            max_bucket_sz = bucket_starts[b + 1];
+        bucket_starts[b + 1] += bucket_starts[b];
+    }
+
+    for (size_t k = 0; k < nb_entries; k++)
+        bucket_keys[bucket_starts[keys[k].bucket]++] = k;
+
+    for (size_t b = nb_buckets; b > 0; b--)
+        bucket_starts[b] = bucket_starts[b - 1];
+    bucket_starts[0] = 0;
+
+    /* Sort buckets by decreasing size. */
+    sizes_starts = ht_calloc(max_bucket_sz + 2, sizeof(size_t));
+    bases = ht_calloc(max_bucket_sz, sizeof(uint64_t));
+    positions = ht_calloc(max_bucket_sz, sizeof(uint64_t));
+    if (!sizes_starts || !bases || !positions) {
+        ht_set_error("cannot allocate buffers: %m");
+        ret = -1;
+        goto end;
+    }
+
+    for (size_t b = 0; b < nb_buckets; b++) {
+        size_t sz;
+
+        sz = bucket_starts[b + 1] - bucket_starts[b];
+        sizes_starts[max_bucket_sz - sz + 1]++;
+    }
+
+    for (size_t s = 0; s <= max_bucket_sz; s++)
+        sizes_starts[s + 1] += sizes_starts[s];
+
+    for (size_t b = 0; b < nb_buckets; b++) {
+        size_t sz;
+
+        sz = bucket_starts[b + 1] - bucket_starts[b];
+        order[sizes_starts[max_bucket_sz - sz]++] = b;
+    }
+
+    ret = 0;
+    free_pos = 0;
+
+    for (size_t o = 0; o < nb_buckets; o++) {
+        const struct ht_frozen_key *key;
+        size_t b, start, sz, i;
+        uint64_t nb_tries;
+        bool placed;
+
+        b = order[o];
+        start = bucket_starts[b];
+        sz = bucket_starts[b + 1] - start;
+
+        displacements[b * 2] = 0;
+        displacements[b * 2 + 1] = 0;
+
+        if (sz == 0)
+            continue;
+
+        if (sz == 1) {
+            /* Buckets with a single key come last, once all larger buckets
+             * have been placed: the key goes to the first free position. */
+            key = keys + bucket_keys[start];
+
+            while (taken[free_pos])
+                free_pos++;
+
+            taken[free_pos] = 1;
+            slots[free_pos] = key->offset;
+
+            displacements[b * 2 + 1] =
+                (uint32_t)((free_pos + nb_entries - key->f1) % nb_entries);
+            continue;
+        }
+
+        /* Keys with the same f1 and f2 values cannot be separated by any
+         * displacement. */
+        for (i = 0; i < sz; i++) {
+            key = keys + bucket_keys[start + i];
+
+            for (size_t j = i + 1; j < sz; j++) {
+                const struct ht_frozen_key *key2;
+
+                key2 = keys + bucket_keys[start + j];
+                if (key->f1 == key2->f1 && key->f2 == key2->f2) {
+                    ret = 1;
+                    goto end;
+                }
+            }
+        }
+
+        placed = false;
+        nb_tries = 0;
+
+        for (uint64_t d0 = 0; d0 < nb_entries && !placed; d0++) {
+            for (i = 0; i < sz; i++) {
+                key = keys + bucket_keys[start + i];
+                bases[i] = (key->f1 + d0 * key->f2) % nb_entries;
+            }
+
+            for (uint64_t d1 = 0; d1 < nb_entries; d1++) {
+                if (++nb_tries > HT_FROZEN_MAX_BUCKET_TRIES) {
+                    ret = 1;
+                    goto end;
+                }
+
+                for (i = 0; i < sz; i++) {
+                    uint64_t pos;
+
+                    pos = bases[i] + d1;
+                    if (pos >= nb_entries)
+                        pos -= nb_entries;
+
+                    if (taken[pos])
+                        break;
+
+                    taken[pos] = 1;
+                    positions[i] = pos;
+                }
+
+                if (i == sz) {
+                    displacements[b * 2] = (uint32_t)d0;
+                    displacements[b * 2 + 1] = (uint32_t)d1;
+                    placed = true;
+                    break;
+                }
+
+                while (i > 0)
+                    taken[positions[--i]] = 0;
+            }
+        }
+
+        if (!placed) {
+            ret = 1;
+            goto end;
+        }
+
+        for (i = 0; i < sz; i++)
+            slots[positions[i]] = keys[bucket_keys[start + i]].offset;
+    }
+
+end:
+    ht_free(positions);
+    ht_free(bases);
+    ht_free(sizes_starts);
+    ht_free(taken);
+    ht_free(order);
+    ht_free(bucket_keys);
+    ht_free(bucket_starts);
+
+    return ret;
+}
+
+static struct ht_frozen_table *
+ht_frozen_table_new(const uint8_t *image, size_t image_sz, bool mapped) {
+    const struct ht_frozen_header *header;
+    struct ht_frozen_table *frozen;
+    uint64_t nb_buckets, nb_entries;
+
+    header = (const struct ht_frozen_header *)image;
+
+    if (memcmp(header->magic, HT_FROZEN_MAGIC, 8) != 0) {
+        ht_set_error("invalid frozen table: wrong magic number");
+        return NULL;
+    }
+
+    if (header->byte_order != HT_FROZEN_BYTE_ORDER) {
+        ht_set_error("invalid frozen table: wrong byte order");
+        return NULL;
+    }
+
+    if (header->version != HT_FROZEN_VERSION) {
+        ht_set_error("unsupported frozen table version %u", header->version);
+        return NULL;
+    }
+
+    nb_entries = header->nb_entries;
+    nb_buckets = header->nb_buckets;
+
+    if (header->image_sz != image_sz || nb_buckets == 0
+     || nb_entries > UINT32_MAX || nb_buckets > UINT32_MAX
+     || header->displacements_offset != sizeof(struct ht_frozen_header)
+     || header->slots_offset
+        != header->displacements_offset + nb_buckets * 2 * sizeof(uint32_t)
+     || header->entries_offset
+        != header->slots_offset + nb_entries * sizeof(uint64_t)
+     || header->entries_offset > image_sz) {
+        ht_set_error("invalid frozen table: inconsistent header");
+        return NULL;
+    }
+
+    frozen = ht_malloc(sizeof(struct ht_frozen_table));
+    if (!frozen) {
+        ht_set_error("cannot allocate frozen table: %m");
+        return NULL;
+    }
+
+    frozen->image = image;
+    frozen->image_sz = image_sz;
+    frozen->mapped = mapped;
+
+    frozen->header = header;
+    frozen->displacements =
+        (const uint32_t *)(image + header->displacements_offset);
+    frozen->slots = (const uint64_t *)(image + header->slots_offset);
+
+    return frozen;
+}
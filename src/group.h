@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBHASHTABLE_GROUP_H
+#define LIBHASHTABLE_GROUP_H
+
+#include <stdint.h>
+
+/* Control bytes of open addressing tables. Each slot has a control byte
+ * which is either HT_CTRL_EMPTY, HT_CTRL_DELETED, or the 7 lowest bits of
+ * the hash of the key stored in the slot. The high bit is therefore only
+ * set for slots which do not contain any entry.
+ *
+ * Control bytes are read by groups of HT_GROUP_SZ bytes, and each match
+ * function returns a bit mask where bit i is set if the control byte i of
+ * the group matches. */
+
+#define HT_CTRL_EMPTY   0x80
+#define HT_CTRL_DELETED 0xfe
+
+#define HT_CTRL_IS_FULL(ctrl_) (((ctrl_) & 0x80) == 0)
+
+#if defined(__AVX2__) && !defined(HT_NO_SIMD)
+#   include <immintrin.h>
+#   define HT_GROUP_AVX2
+#   define HT_GROUP_SZ 32
+#elif defined(__SSE2__) && !defined(HT_NO_SIMD)
+#   include <emmintrin.h>
+#   define HT_GROUP_SSE2
+#   define HT_GROUP_SZ 16
+#else
+#   define HT_GROUP_SZ 16
+#endif
+
+typedef uint32_t ht_group_mask;
+
+#if defined(HT_GROUP_AVX2)
+
+static inline ht_group_mask
+ht_group_match(const uint8_t *group, uint8_t byte) {
+    __m256i ctrl, match;
+
+    ctrl = _mm256_loadu_si256((const __m256i *)group);
+    match = _mm256_set1_epi8((char)byte);
+
+    return (ht_group_mask)_mm256_movemask_epi8(_mm256_cmpeq_epi8(ctrl, match));
+}
+
+static inline ht_group_mask
+ht_group_match_free(const uint8_t *group) {
+    __m256i ctrl;
+
+    ctrl = _mm256_loadu_si256((const __m256i *)group);
+    return (ht_group_mask)_mm256_movemask_epi8(ctrl);
+}
+
+#elif defined(HT_GROUP_SSE2)
+
+static inline ht_group_mask
+ht_group_match(const uint8_t *group, uint8_t byte) {
+    __m128i ctrl, match;
+
+    ctrl = _mm_loadu_si128((const __m128i *)group);
+    match = _mm_set1_epi8((char)byte);
+
+    return (ht_group_mask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, match));
+}
+
+static inline ht_group_mask
+ht_group_match_free(const uint8_t *group) {
+    __m128i ctrl;
+
+    ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (ht_group_mask)_mm_movemask_epi8(ctrl);
+}
+
+#else
+
+static inline ht_group_mask
+ht_group_match(const uint8_t *group, uint8_t byte) {
+    ht_group_mask mask;
+
+    mask = 0;
+    for (int i = 0; i < HT_GROUP_SZ; i++)
+        mask |= (ht_group_mask)(group[i] == byte) << i;
+
+    return mask;
+}
+
+static inline ht_group_mask
+ht_group_match_free(const uint8_t *group) {
+    ht_group_mask mask;
+
+    mask = 0;
+    for (int i = 0; i < HT_GROUP_SZ; i++)
+        mask |= (ht_group_mask)(group[i] >> 7) << i;
+
+    return mask;
+}
+
+#endif
+
+static inline ht_group_mask
+ht_group_match_empty(const uint8_t *group) {
+    return ht_group_match(group, HT_CTRL_EMPTY);
+}
+
+static inline ht_group_mask
+ht_group_match_full(const uint8_t *group) {
+    return ~ht_group_match_free(group)
+         & ((ht_group_mask)~0 >> (32 - HT_GROUP_SZ));
+}
+
+static inline unsigned int
+ht_group_mask_first(ht_group_mask mask) {
+    return (unsigned int)__builtin_ctz(mask);
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HT_PLATFORM_LINUX
+#   include <sys/random.h>
+#endif
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* 64 bit hash functions. The byte string hash is derived from wyhash: input
+ * is read 8 bytes at a time and mixed with 64x64->128 bit multiplications,
+ * which modern processors execute in a few cycles. */
+
+static const uint64_t ht_hash_secret[4] = {
+    UINT64_C(0xa0761d6478bd642f), UINT64_C(0xe7037ed1a0b428db),
+    UINT64_C(0x8ebc6af09c88c6e3), UINT64_C(0x589965cc75374cc3),
+};
+
+static inline void
+ht_hash_mum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r;
+
+    r = (__uint128_t)*a * *b;
+
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha, hb, la, lb, rh, rm0, rm1, rl, t, c, lo, hi;
+
+    ha = *a >> 32; hb = *b >> 32;
+    la = (uint32_t)*a; lb = (uint32_t)*b;
+
+    rh = ha * hb; rm0 = ha * lb; rm1 = hb * la; rl = la * lb;
+
+    t = rl + (rm0 << 32);
+    c = t < rl;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t
+ht_hash_mix(uint64_t a, uint64_t b) {
+    ht_hash_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t
+ht_hash_read64(const uint8_t *ptr) {
+    uint64_t value;
+
+    memcpy(&value, ptr, sizeof(uint64_t));
+    return value;
+}
+
+static inline uint64_t
+ht_hash_read32(const uint8_t *ptr) {
+    uint32_t value;
+
+    memcpy(&value, ptr, sizeof(uint32_t));
+    return value;
+}
+
+static inline uint64_t
+ht_hash_read_small(const uint8_t *ptr, size_t len) {
+    return ((uint64_t)ptr[0] << 16)
+         | ((uint64_t)ptr[len >> 1] << 8)
+         | ptr[len - 1];
+}
+
+uint64_t
+ht_hash64_data(const void *data, size_t len, uint64_t seed) {
+    const uint64_t *secret;
+    const uint8_t *ptr;
+    uint64_t a, b;
+
+    secret = ht_hash_secret;
+    ptr = data;
+
+    seed ^= ht_hash_mix(seed ^ secret[0], secret[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t offset;
+
+            offset = (len >> 3) << 2;
+
+            a = (ht_hash_read32(ptr) << 32) | ht_hash_read32(ptr + offset);
+            b = (ht_hash_read32(ptr + len - 4) << 32)
+              | ht_hash_read32(ptr + len - 4 - offset);
+        } else if (len > 0) {
+            a = ht_hash_read_small(ptr, len);
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i;
+
+        i = len;
+
+        if (i > 48) {
+            uint64_t seed1, seed2;
+
+            seed1 = seed;
+            seed2 = seed;
+
+            do {
+                seed = ht_hash_mix(ht_hash_read64(ptr) ^ secret[1],
+                                   ht_hash_read64(ptr + 8) ^ seed);
+                seed1 = ht_hash_mix(ht_hash_read64(ptr + 16) ^ secret[2],
+                                    ht_hash_read64(ptr + 24) ^ seed1);
+                seed2 = ht_hash_mix(ht_hash_read64(ptr + 32) ^ secret[3],
+                                    ht_hash_read64(ptr + 40) ^ seed2);
+
+                ptr += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (i > 16) {
+            seed = ht_hash_mix(ht_hash_read64(ptr) ^ secret[1],
+                               ht_hash_read64(ptr + 8) ^ seed);
+
+            ptr += 16;
+            i -= 16;
+        }
+
+        a = ht_hash_read64(ptr + i - 16);
+        b = ht_hash_read64(ptr + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    ht_hash_mum(&a, &b);
+
+    return ht_hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+uint64_t
+ht_hash64_int32(const void *key, uint64_t seed) {
+    uint64_t hash;
+
+    hash = (uint32_t)HT_POINTER_TO_INT32(key);
+
+    hash ^= seed;
+    hash *= UINT64_C(0x9e3779b97f4a7c15);
+    hash ^= hash >> 32;
+    hash *= UINT64_C(0xd6e8feb86659fd93);
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+uint64_t
+ht_hash64_string(const void *key, uint64_t seed) {
+    return ht_hash64_data(key, strlen(key), seed);
+}
+
+uint64_t
+ht_hash64_bytes(const void *key, uint64_t seed) {
+    const struct ht_bytes *bytes;
+
+    bytes = key;
+    return ht_hash64_data(bytes->data, bytes->size, seed);
+}
+
+uint64_t
+ht_random_seed(void) {
+    static uint64_t counter;
+    struct timespec now;
+    uint64_t seed;
+    int fd;
+
+#ifdef HT_PLATFORM_LINUX
+    if (getrandom(&seed, sizeof(uint64_t), 0) == sizeof(uint64_t))
+        return seed;
+#endif
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t ret;
+
+        ret = read(fd, &seed, sizeof(uint64_t));
+        close(fd);
+
+        if (ret == sizeof(uint64_t))
+            return seed;
+    }
+
+    /* There is no good source of randomness, but seeds should at least be
+     * different for each table. */
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    seed = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+    seed ^= (uint64_t)getpid() << 32;
+    seed += counter++;
+
+    return ht_hash_mix64(seed);
+}
@@ -33,39 +33,268 @@ struct ht_memory_allocator {
 
 extern struct ht_memory_allocator *ht_default_memory_allocator;
 
+struct ht_allocator {
+    void *(*alloc)(size_t, void *);
+    void *(*realloc)(void *, size_t, size_t, void *);
+    void (*free)(void *, size_t, void *);
+    void *ctx;
+};
+
 typedef uint32_t (*ht_hash_func)(const void *);
+typedef uint64_t (*ht_hash64_func)(const void *, uint64_t);
 typedef bool (*ht_equal_func)(const void *, const void *);
 
+struct ht_bytes {
+    const void *data;
+    size_t size;
+};
+
+struct ht_codec {
+    int (*write)(FILE *, const void *, void *);
+    int (*read)(FILE *, void **, void *);
+    void (*free)(void *, void *);
+    void *arg;
+};
+
+extern const struct ht_codec ht_codec_int32;
+extern const struct ht_codec ht_codec_string;
+
+typedef size_t (*ht_encode_func)(const void *, void *, size_t);
+
+enum ht_foreach_action {
+    HT_FOREACH_KEEP = 0,
+    HT_FOREACH_REMOVE,
+};
+
+typedef enum ht_foreach_action (*ht_foreach_func)(void *, void **, void *);
+typedef void (*ht_reduce_func)(void *, void *, void *, void *);
+typedef void (*ht_combine_func)(void *, const void *, void *);
+
+typedef void (*ht_task_func)(void *, unsigned int);
+
+struct ht_executor {
+    void (*run)(unsigned int, ht_task_func, void *, void *);
+    void *ctx;
+};
+
+struct ht_lookup {
+    ht_hash_func hash_func;
+    ht_hash64_func hash64_func;
+    ht_equal_func equal_func;
+};
+
+enum ht_table_storage {
+    HT_TABLE_STORAGE_CHAINED = 0,
+    HT_TABLE_STORAGE_OPEN,
+    HT_TABLE_STORAGE_COMPACT,
+};
+
+struct ht_table_policy {
+    double max_load_factor;
+    double min_load_factor;
+    double growth_factor;
+    bool shrink;
+};
+
+struct ht_table;
+
+/* Callbacks notified of the work performed internally by a table; all of
+ * them are optional. */
+struct ht_table_hooks {
+    void (*resize_start)(struct ht_table *, size_t, size_t, void *);
+    void (*resize_end)(struct ht_table *, size_t, size_t, size_t, uint64_t,
+                       void *);
+    void (*allocation_failure)(struct ht_table *, size_t, void *);
+    void (*bucket_growth)(struct ht_table *, size_t, size_t, size_t, void *);
+    void *ctx;
+};
+
+struct ht_table_options {
+    enum ht_table_storage storage;
+    size_t capacity;
+    bool incremental_resize;
+    const struct ht_table_policy *policy;
+    ht_hash64_func hash64_func;
+    uint64_t seed;
+    bool random_seed;
+    bool single_writer;
+    const struct ht_allocator *allocator;
+    bool huge_pages;
+    const struct ht_table_hooks *hooks;
+};
+
+/* The last element of the occupancy histogram counts all buckets containing
+ * HT_TABLE_STATS_HISTOGRAM_SZ - 1 entries or more. */
+#define HT_TABLE_STATS_HISTOGRAM_SZ 17
+
+struct ht_table_stats {
+    size_t nb_entries;
+    size_t nb_buckets;
+    double load_factor;
+    size_t memory_sz;
+
+    size_t occupancy[HT_TABLE_STATS_HISTOGRAM_SZ];
+    size_t max_probe_length;
+    double mean_probe_length;
+
+    /* Only maintained when the library is built with HT_STATS */
+    uint64_t nb_hits;
+    uint64_t nb_misses;
+    uint64_t nb_equal_calls;
+    uint64_t nb_resizes;
+    uint64_t resize_time; /* nanoseconds */
+};
+
+/* Iterators can be allocated by the caller and initialized with
+ * ht_table_iterator_init(); their members are private. */
+struct ht_table_iterator {
+    struct ht_table *table;
+    size_t bucket;
+    size_t entry;
+};
+
 const char *ht_version(void);
 const char *ht_build_id(void);
 
 const char *ht_get_error(void);
+void ht_set_error(const char *, ...)
+    __attribute__((format(printf, 1, 2)));
 
 void ht_set_memory_allocator(const struct ht_memory_allocator *);
 
+void *ht_malloc(size_t);
+void ht_free(void *);
+void *ht_calloc(size_t, size_t);
+void *ht_realloc(void *, size_t);
+
+void ht_table_default_policy(enum ht_table_storage, struct ht_table_policy *);
+
 struct ht_table *ht_table_new(ht_hash_func, ht_equal_func);
+struct ht_table *ht_table_new_ex(ht_hash_func, ht_equal_func,
+                                 const struct ht_table_options *);
+struct ht_table *ht_table_new_with_capacity(ht_hash_func, ht_equal_func,
+                                            size_t);
 void ht_table_delete(struct ht_table *);
 size_t ht_table_nb_entries(const struct ht_table *);
 bool ht_table_is_empty(const struct ht_table *);
 void ht_table_clear(struct ht_table *);
+int ht_table_reserve(struct ht_table *, size_t);
+int ht_table_shrink_to_fit(struct ht_table *);
 int ht_table_insert(struct ht_table *, void *, void *);
 int ht_table_insert2(struct ht_table *, void *, void *, void **, void **);
+int ht_table_upsert(struct ht_table *, void *, void ***);
 int ht_table_remove(struct ht_table *, const void *);
 int ht_table_remove2(struct ht_table *, const void *, void **, void **);
 int ht_table_get(struct ht_table *, const void *, void **);
 bool ht_table_contains(struct ht_table *, const void *);
+size_t ht_table_get_many(struct ht_table *, const void * const *, size_t,
+                         void **, bool *);
+size_t ht_table_contains_many(struct ht_table *, const void * const *, size_t,
+                              bool *);
+int ht_table_get_with(struct ht_table *, const struct ht_lookup *,
+                      const void *, void **);
+bool ht_table_contains_with(struct ht_table *, const struct ht_lookup *,
+                            const void *);
 void ht_table_print(struct ht_table *, FILE *);
+void ht_table_get_stats(struct ht_table *, struct ht_table_stats *);
+
+int ht_table_save(struct ht_table *, FILE *, const struct ht_codec *,
+                  const struct ht_codec *);
+int ht_table_load(struct ht_table *, FILE *, const struct ht_codec *,
+                  const struct ht_codec *);
 
 struct ht_table_iterator *ht_table_iterate(struct ht_table *);
 void ht_table_iterator_delete(struct ht_table_iterator *);
+void ht_table_iterator_init(struct ht_table_iterator *, struct ht_table *);
+void ht_table_iterator_release(struct ht_table_iterator *);
 int ht_table_iterator_next(struct ht_table_iterator *, void **, void **);
+size_t ht_table_iterator_next_batch(struct ht_table_iterator *,
+                                    void **, void **, size_t);
 void ht_table_iterator_remove(struct ht_table_iterator *);
 void ht_table_iterator_set_value(struct ht_table_iterator *, void *);
 
+int ht_table_foreach_parallel(struct ht_table *, ht_foreach_func, void *,
+                              unsigned int, const struct ht_executor *);
+int ht_table_reduce_parallel(struct ht_table *, ht_reduce_func,
+                             ht_combine_func, void *, size_t, void *,
+                             unsigned int, const struct ht_executor *);
+
+struct ht_table_reader *ht_table_register_reader(struct ht_table *);
+void ht_table_unregister_reader(struct ht_table_reader *);
+void ht_table_reader_quiescent(struct ht_table_reader *);
+void ht_table_reader_offline(struct ht_table_reader *);
+void ht_table_reader_online(struct ht_table_reader *);
+void ht_table_synchronize(struct ht_table *);
+
+struct ht_concurrent_table *
+ht_concurrent_table_new(ht_hash_func, ht_equal_func,
+                        const struct ht_table_options *, size_t);
+void ht_concurrent_table_delete(struct ht_concurrent_table *);
+size_t ht_concurrent_table_nb_entries(struct ht_concurrent_table *);
+void ht_concurrent_table_clear(struct ht_concurrent_table *);
+int ht_concurrent_table_insert(struct ht_concurrent_table *, void *, void *);
+int ht_concurrent_table_insert2(struct ht_concurrent_table *, void *, void *,
+                                void **, void **);
+int ht_concurrent_table_remove(struct ht_concurrent_table *, const void *);
+int ht_concurrent_table_remove2(struct ht_concurrent_table *, const void *,
+                                void **, void **);
+int ht_concurrent_table_get(struct ht_concurrent_table *, const void *,
+                            void **);
+bool ht_concurrent_table_contains(struct ht_concurrent_table *, const void *);
+
+struct ht_sharded_table *
+ht_sharded_table_new(ht_hash_func, ht_equal_func,
+                     const struct ht_table_options *, size_t);
+void ht_sharded_table_delete(struct ht_sharded_table *);
+size_t ht_sharded_table_nb_entries(const struct ht_sharded_table *);
+void ht_sharded_table_clear(struct ht_sharded_table *);
+int ht_sharded_table_reserve(struct ht_sharded_table *, size_t, unsigned int);
+int ht_sharded_table_insert(struct ht_sharded_table *, void *, void *);
+int ht_sharded_table_insert_many(struct ht_sharded_table *, void **, void **,
+                                 size_t, unsigned int);
+int ht_sharded_table_remove(struct ht_sharded_table *, const void *);
+int ht_sharded_table_get(struct ht_sharded_table *, const void *, void **);
+bool ht_sharded_table_contains(struct ht_sharded_table *, const void *);
+
+struct ht_frozen_table *ht_table_freeze(struct ht_table *, ht_encode_func,
+                                        ht_encode_func);
+struct ht_frozen_table *ht_frozen_table_open(const char *);
+void ht_frozen_table_delete(struct ht_frozen_table *);
+int ht_frozen_table_save(const struct ht_frozen_table *, FILE *);
+size_t ht_frozen_table_nb_entries(const struct ht_frozen_table *);
+int ht_frozen_table_get(const struct ht_frozen_table *, const void *, size_t,
+                        struct ht_bytes *);
+bool ht_frozen_table_contains(const struct ht_frozen_table *, const void *,
+                              size_t);
+
+struct ht_shared_table *ht_shared_table_create(int, size_t, size_t);
+struct ht_shared_table *ht_shared_table_attach(int);
+void ht_shared_table_detach(struct ht_shared_table *);
+size_t ht_shared_table_nb_entries(struct ht_shared_table *);
+void ht_shared_table_clear(struct ht_shared_table *);
+int ht_shared_table_insert(struct ht_shared_table *, const void *, size_t,
+                           const void *, size_t);
+int ht_shared_table_remove(struct ht_shared_table *, const void *, size_t);
+int ht_shared_table_get(struct ht_shared_table *, const void *, size_t,
+                        void *, size_t, size_t *);
+bool ht_shared_table_contains(struct ht_shared_table *, const void *, size_t);
+
+size_t ht_encode_int32(const void *, void *, size_t);
+size_t ht_encode_string(const void *, void *, size_t);
+size_t ht_encode_bytes(const void *, void *, size_t);
+
 uint32_t ht_hash_int32(const void *);
 bool ht_equal_int32(const void *, const void *);
 
 uint32_t ht_hash_string(const void *);
 bool ht_equal_string(const void *, const void *);
 
+uint32_t ht_hash_bytes(const void *);
+bool ht_equal_bytes(const void *, const void *);
+bool ht_equal_bytes_string(const void *, const void *);
+
+uint64_t ht_hash64_int32(const void *, uint64_t);
+uint64_t ht_hash64_string(const void *, uint64_t);
+uint64_t ht_hash64_bytes(const void *, uint64_t);
+
 #endif
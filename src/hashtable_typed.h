@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBHASHTABLE_HASHTABLE_TYPED_H
+#define LIBHASHTABLE_HASHTABLE_TYPED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hashtable.h"
+
+/* Hash and equality functions for scalar keys. Hash values are multiplied
+ * by a constant and the index of an entry is taken in the high bits of the
+ * product, so the hash functions only have to fold the high bits of the key
+ * into the low bits. */
+static inline uint64_t
+ht_typed_hash_int64(int64_t key) {
+    return (uint64_t)key ^ ((uint64_t)key >> 32);
+}
+
+static inline uint64_t
+ht_typed_hash_uint64(uint64_t key) {
+    return key ^ (key >> 32);
+}
+
+static inline uint64_t
+ht_typed_hash_pointer(const void *key) {
+    uintptr_t value;
+
+    /* The lowest bits of pointers are usually zero because of alignment. */
+    value = (uintptr_t)key;
+    return (uint64_t)(value >> 4) ^ ((uint64_t)value >> 32);
+}
+
+#define HT_TYPED_EQUAL(k1_, k2_) ((k1_) == (k2_))
+
+#define HT_TYPED_MIN_SZ 8
+#define HT_TYPED_MULTIPLIER UINT64_C(0x9e3779b97f4a7c15)
+
+/* Each slot has a metadata byte which is either 0 for an empty slot, or the
+ * 7 lowest bits of the hash product of its key with the high bit set. Most
+ * slots containing another key are therefore skipped without calling the
+ * equality function.
+ *
+ * Collisions are resolved with linear probing, and removal shifts the
+ * following entries backward instead of leaving tombstones. */
+#define HT_DEFINE_TABLE(name_, key_type_, value_type_, hash_, equal_)          \
+                                                                               \
+struct name_##_entry {                                                         \
+    key_type_ key;                                                             \
+    value_type_ value;                                                         \
+};                                                                             \
+                                                                               \
+struct name_ {                                                                 \
+    struct name_##_entry *entries;                                             \
+    uint8_t *meta;                                                             \
+    size_t sz;                                                                 \
+    unsigned int shift;                                                        \
+    size_t nb_entries;                                                         \
+};                                                                             \
+                                                                               \
+static inline size_t                                                           \
+name_##_slot(const struct name_ *table, key_type_ key, uint8_t *pmeta) {       \
+    uint64_t product;                                                          \
+                                                                               \
+    product = (uint64_t)(hash_(key)) * HT_TYPED_MULTIPLIER;                    \
+    *pmeta = (uint8_t)(0x80 | (product & 0x7f));                               \
+                                                                               \
+    return (size_t)(product >> table->shift);                                  \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_allocate(struct name_ *table, size_t sz) {                             \
+    void *block;                                                               \
+    unsigned int bits;                                                         \
+                                                                               \
+    block = ht_calloc(sz, sizeof(struct name_##_entry) + 1);                   \
+    if (!block) {                                                              \
+        ht_set_error("cannot allocate entries: %m");                           \
+        return -1;                                                             \
+    }                                                                          \
+                                                                               \
+    bits = 0;                                                                  \
+    while (((size_t)1 << bits) < sz)                                           \
+        bits++;                                                                \
+                                                                               \
+    table->entries = block;                                                    \
+    table->meta = (uint8_t *)(table->entries + sz);                            \
+    table->sz = sz;                                                            \
+    table->shift = 64 - bits;                                                  \
+                                                                               \
+    return 0;                                                                  \
+}                                                                              \
+                                                                               \
+static inline struct name_ *                                                   \
+name_##_new(void) {                                                            \
+    struct name_ *table;                                                       \
+                                                                               \
+    table = ht_malloc(sizeof(struct name_));                                   \
+    if (!table) {                                                              \
+        ht_set_error("cannot allocate table: %m");                             \
+        return NULL;                                                           \
+    }                                                                          \
+    memset(table, 0, sizeof(struct name_));                                    \
+                                                                               \
+    if (name_##_allocate(table, HT_TYPED_MIN_SZ) == -1) {                      \
+        ht_free(table);                                                        \
+        return NULL;                                                           \
+    }                                                                          \
+                                                                               \
+    return table;                                                              \
+}                                                                              \
+                                                                               \
+static inline void                                                             \
+name_##_delete(struct name_ *table) {                                          \
+    if (!table)                                                                \
+        return;                                                                \
+                                                                               \
+    ht_free(table->entries);                                                   \
+    ht_free(table);                                                            \
+}                                                                              \
+                                                                               \
+static inline size_t                                                           \
+name_##_nb_entries(const struct name_ *table) {                                \
+    return table->nb_entries;                                                  \
+}                                                                              \
+                                                                               \
+static inline bool                                                             \
+name_##_is_empty(const struct name_ *table) {                                  \
+    return table->nb_entries == 0;                                             \
+}                                                                              \
+                                                                               \
+static inline void                                                             \
+name_##_clear(struct name_ *table) {                                           \
+    memset(table->meta, 0, table->sz);                                         \
+    table->nb_entries = 0;                                                     \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_resize(struct name_ *table, size_t sz) {                               \
+    struct name_##_entry *old_entries;                                         \
+    uint8_t *old_meta;                                                         \
+    size_t old_sz;                                                             \
+                                                                               \
+    old_entries = table->entries;                                              \
+    old_meta = table->meta;                                                    \
+    old_sz = table->sz;                                                        \
+                                                                               \
+    if (name_##_allocate(table, sz) == -1)                                     \
+        return -1;                                                             \
+                                                                               \
+    for (size_t i = 0; i < old_sz; i++) {                                      \
+        size_t idx;                                                            \
+        uint8_t meta;                                                          \
+                                                                               \
+        if (old_meta[i] == 0)                                                  \
+            continue;                                                          \
+                                                                               \
+        idx = name_##_slot(table, old_entries[i].key, &meta);                  \
+        while (table->meta[idx] != 0)                                          \
+            idx = (idx + 1) & (table->sz - 1);                                 \
+                                                                               \
+        table->meta[idx] = meta;                                               \
+        table->entries[idx] = old_entries[i];                                  \
+    }                                                                          \
+                                                                               \
+    ht_free(old_entries);                                                      \
+    return 0;                                                                  \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_reserve(struct name_ *table, size_t nb_entries) {                      \
+    size_t sz;                                                                 \
+                                                                               \
+    /* The maximum load factor is 0.75. */                                     \
+    sz = table->sz;                                                            \
+    while (nb_entries > sz - sz / 4) {                                         \
+        if (sz > SIZE_MAX / 2) {                                               \
+            ht_set_error("too many entries");                                  \
+            return -1;                                                         \
+        }                                                                      \
+                                                                               \
+        sz *= 2;                                                               \
+    }                                                                          \
+                                                                               \
+    if (sz == table->sz)                                                       \
+        return 0;                                                              \
+                                                                               \
+    return name_##_resize(table, sz);                                          \
+}                                                                              \
+                                                                               \
+static inline struct name_##_entry *                                           \
+name_##_entry(const struct name_ *table, key_type_ key) {                      \
+    size_t idx;                                                                \
+    uint8_t meta;                                                              \
+                                                                               \
+    idx = name_##_slot(table, key, &meta);                                     \
+    while (table->meta[idx] != 0) {                                            \
+        if (table->meta[idx] == meta && equal_(table->entries[idx].key, key))  \
+            return &table->entries[idx];                                       \
+                                                                               \
+        idx = (idx + 1) & (table->sz - 1);                                     \
+    }                                                                          \
+                                                                               \
+    return NULL;                                                               \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_insert(struct name_ *table, key_type_ key, value_type_ value) {        \
+    size_t idx;                                                                \
+    uint8_t meta;                                                              \
+                                                                               \
+    idx = name_##_slot(table, key, &meta);                                     \
+    while (table->meta[idx] != 0) {                                            \
+        if (table->meta[idx] == meta                                           \
+         && equal_(table->entries[idx].key, key)) {                            \
+            table->entries[idx].key = key;                                     \
+            table->entries[idx].value = value;                                 \
+            return 0;                                                          \
+        }                                                                      \
+                                                                               \
+        idx = (idx + 1) & (table->sz - 1);                                     \
+    }                                                                          \
+                                                                               \
+    if (table->nb_entries + 1 > table->sz - table->sz / 4) {                   \
+        if (name_##_reserve(table, table->nb_entries + 1) == -1)               \
+            return -1;                                                         \
+                                                                               \
+        idx = name_##_slot(table, key, &meta);                                 \
+        while (table->meta[idx] != 0)                                          \
+            idx = (idx + 1) & (table->sz - 1);                                 \
+    }                                                                          \
+                                                                               \
+    table->meta[idx] = meta;                                                   \
+    table->entries[idx].key = key;                                             \
+    table->entries[idx].value = value;                                         \
+    table->nb_entries++;                                                       \
+                                                                               \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_get(const struct name_ *table, key_type_ key, value_type_ *pvalue) {   \
+    struct name_##_entry *entry;                                               \
+                                                                               \
+    entry = name_##_entry(table, key);                                         \
+    if (!entry)                                                                \
+        return 0;                                                              \
+                                                                               \
+    *pvalue = entry->value;                                                    \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static inline value_type_ *                                                    \
+name_##_get_ptr(const struct name_ *table, key_type_ key) {                    \
+    struct name_##_entry *entry;                                               \
+                                                                               \
+    entry = name_##_entry(table, key);                                         \
+    return entry ? &entry->value : NULL;                                       \
+}                                                                              \
+                                                                               \
+static inline bool                                                             \
+name_##_contains(const struct name_ *table, key_type_ key) {                   \
+    return name_##_entry(table, key) != NULL;                                  \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_remove(struct name_ *table, key_type_ key) {                           \
+    struct name_##_entry *entry;                                               \
+    size_t idx, next, mask;                                                    \
+                                                                               \
+    entry = name_##_entry(table, key);                                         \
+    if (!entry)                                                                \
+        return 0;                                                              \
+                                                                               \
+    mask = table->sz - 1;                                                      \
+    idx = (size_t)(entry - table->entries);                                    \
+                                                                               \
+    /* Move back every following entry which can be moved to the free slot, */\
+    /* i.e. whose ideal slot is not located between the free slot and its */   \
+    /* current slot. */                                                        \
+    next = (idx + 1) & mask;                                                   \
+    while (table->meta[next] != 0) {                                           \
+        size_t ideal;                                                          \
+        uint8_t meta;                                                          \
+                                                                               \
+        ideal = name_##_slot(table, table->entries[next].key, &meta);          \
+        if (((next - ideal) & mask) >= ((next - idx) & mask)) {                \
+            table->meta[idx] = table->meta[next];                              \
+            table->entries[idx] = table->entries[next];                        \
+            idx = next;                                                        \
+        }                                                                      \
+                                                                               \
+        next = (next + 1) & mask;                                              \
+    }                                                                          \
+                                                                               \
+    table->meta[idx] = 0;                                                      \
+    table->nb_entries--;                                                       \
+                                                                               \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static inline int                                                              \
+name_##_next(const struct name_ *table, size_t *piter,                         \
+             key_type_ *pkey, value_type_ *pvalue) {                           \
+    for (size_t i = *piter; i < table->sz; i++) {                              \
+        if (table->meta[i] == 0)                                               \
+            continue;                                                          \
+                                                                               \
+        if (pkey)                                                              \
+            *pkey = table->entries[i].key;                                     \
+        if (pvalue)                                                            \
+            *pvalue = table->entries[i].value;                                 \
+                                                                               \
+        *piter = i + 1;                                                        \
+        return 1;                                                              \
+    }                                                                          \
+                                                                               \
+    *piter = table->sz;                                                        \
+    return 0;                                                                  \
+}
+
+#endif
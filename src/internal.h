@@ -17,14 +17,324 @@
 #ifndef LIBHASHTABLE_INTERNAL_H
 #define LIBHASHTABLE_INTERNAL_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-void ht_set_error(const char *, ...)
-    __attribute__((format(printf, 1, 2)));
+#include "hashtable.h"
 
-void *ht_malloc(size_t);
-void ht_free(void *);
-void *ht_calloc(size_t, size_t);
-void *ht_realloc(void *, size_t);
+/* Allocator contexts; the process-wide allocator is used when a table is
+ * created without one. */
+extern const struct ht_allocator ht_process_allocator;
+
+const struct ht_allocator *
+ht_options_allocator(const struct ht_table_options *);
+
+void *ht_allocator_malloc(const struct ht_allocator *, size_t);
+void *ht_allocator_calloc(const struct ht_allocator *, size_t, size_t);
+void *ht_allocator_realloc(const struct ht_allocator *, void *,
+                           size_t, size_t);
+void ht_allocator_free(const struct ht_allocator *, void *, size_t);
+
+uint64_t ht_hash64_data(const void *, size_t, uint64_t);
+uint64_t ht_random_seed(void);
+
+/* Slab allocation of blocks of a few size classes */
+#define HT_SLAB_NB_CLASSES 8
+
+struct ht_slab_class {
+    struct ht_slab_block *free_blocks;
+    char *next_block;
+    char *end;
+    size_t chunk_nb_blocks;
+};
+
+struct ht_slab {
+    const struct ht_allocator *allocator;
+    size_t base_sz;
+
+    struct ht_slab_class classes[HT_SLAB_NB_CLASSES];
+    struct ht_slab_chunk *chunks;
+};
+
+void ht_slab_init(struct ht_slab *, const struct ht_allocator *, size_t);
+void ht_slab_release(struct ht_slab *);
+void *ht_slab_alloc(struct ht_slab *, unsigned int);
+void ht_slab_free(struct ht_slab *, void *, unsigned int);
+size_t ht_slab_memory_size(const struct ht_slab *);
+
+/* Memory mappings for large arrays */
+size_t ht_pages_size(size_t);
+void *ht_pages_map(size_t);
+void *ht_pages_remap(void *, size_t, size_t);
+void ht_pages_unmap(void *, size_t);
+
+/* Quiescent state based reclamation */
+struct ht_qsbr_retired {
+    struct ht_qsbr_retired *next;
+    uint64_t epoch;
+    void (*free_func)(struct ht_qsbr_retired *);
+};
+
+struct ht_qsbr *ht_qsbr_new(const struct ht_allocator *);
+void ht_qsbr_delete(struct ht_qsbr *);
+struct ht_table_reader *ht_qsbr_register(struct ht_qsbr *);
+void ht_qsbr_unregister(struct ht_table_reader *);
+void ht_qsbr_quiescent(struct ht_table_reader *);
+void ht_qsbr_offline(struct ht_table_reader *);
+void ht_qsbr_retire(struct ht_qsbr *, struct ht_qsbr_retired *);
+void ht_qsbr_reclaim(struct ht_qsbr *);
+void ht_qsbr_synchronize(struct ht_qsbr *);
+
+/* Parallel execution */
+typedef void (*ht_parallel_func)(void *, unsigned int);
+
+unsigned int ht_parallel_nb_threads(unsigned int);
+void ht_parallel_run(unsigned int, ht_parallel_func, void *);
+
+/* Tables */
+#define HT_UNUSED_HASH 0
+
+struct ht_table_entry {
+    void *key;
+    void *value;
+    uint64_t hash;
+};
+
+#define HT_TABLE_ENTRY_IS_USED(entry_) ((entry_)->hash != HT_UNUSED_HASH)
+
+struct ht_table_bucket {
+    struct ht_table_entry *entries;
+    size_t sz;
+};
+
+/* Arrays of an open addressing table, as seen by lock-free readers */
+struct ht_table_open_view {
+    struct ht_qsbr_retired retired;
+    const struct ht_allocator *allocator;
+    bool huge_pages;
+
+    struct ht_table_entry *slots;
+    uint8_t *ctrl;
+    size_t slots_sz;
+};
+
+struct ht_table {
+    enum ht_table_storage storage;
+
+    size_t nb_entries;
+
+    /* Resize policy, and the number of entries which trigger a resize for
+     * the current size of the table */
+    struct ht_table_policy policy;
+    size_t max_entries;
+    size_t min_entries;
+
+    /* Chained storage; entry arrays have a power of two size, and small
+     * ones are allocated from the slab of the table. */
+    struct ht_table_bucket *buckets;
+    size_t buckets_sz;
+    struct ht_slab entries_slab;
+
+    /* Buckets being migrated during an incremental resize */
+    bool incremental_resize;
+    struct ht_table_bucket *old_buckets;
+    size_t old_buckets_sz;
+    size_t rehash_idx;
+
+    /* Open addressing storage */
+    struct ht_table_entry *slots;
+    uint8_t *ctrl;
+    size_t slots_sz;
+    size_t nb_deleted;
+
+    /* Compact storage: a dense array of entries in insertion order, and an
+     * index of 1, 2, 4 or 8 byte positions in this array */
+    struct ht_table_entry *entries;
+    size_t entries_sz;
+    size_t entries_capacity;
+    void *indices;
+    size_t indices_sz;
+    unsigned int index_width;
+
+    /* Single writer mode: lookups read the published view of the arrays,
+     * and arrays replaced by a resize are reclaimed once all readers went
+     * through a quiescent state. */
+    bool single_writer;
+    struct ht_table_open_view *view;
+    struct ht_qsbr *qsbr;
+
+    ht_hash_func hash_func;
+    ht_hash64_func hash64_func;
+    uint64_t seed;
+    ht_equal_func equal_func;
+
+    struct ht_allocator allocator;
+
+    struct ht_table_hooks hooks;
+
+    /* Bucket and slot arrays are mapped directly instead of being allocated
+     * with the allocator of the table. */
+    bool huge_pages;
+
+    int nb_iterators;
+
+#ifdef HT_STATS
+    /* Counters are updated by concurrent readers in single writer mode. */
+    struct {
+        uint64_t nb_hits;
+        uint64_t nb_misses;
+        uint64_t nb_equal_calls;
+        uint64_t nb_resizes;
+        uint64_t resize_time;
+    } counters;
+#endif
+};
+
+/* Statistics counters only exist when the library is built with HT_STATS;
+ * otherwise these macros expand to nothing. */
+#ifdef HT_STATS
+# define HT_STATS_ADD(table_, counter_, n_)                        \
+    __atomic_fetch_add(&(table_)->counters.counter_, (uint64_t)(n_), \
+                       __ATOMIC_RELAXED)
+# define HT_STATS_EQUAL(table_, equal_func_, key1_, key2_) \
+    (HT_STATS_ADD(table_, nb_equal_calls, 1), (equal_func_)(key1_, key2_))
+#else
+# define HT_STATS_ADD(table_, counter_, n_) ((void)0)
+# define HT_STATS_EQUAL(table_, equal_func_, key1_, key2_) \
+    (equal_func_)(key1_, key2_)
+#endif
+
+/* Static probes for tracing tools, available when the library is built with
+ * HT_USDT; a probe costs a single nop instruction when it is not enabled. */
+#ifdef HT_USDT
+# include <sys/sdt.h>
+# define HT_PROBE2(name_, a1_, a2_) \
+    DTRACE_PROBE2(libhashtable, name_, a1_, a2_)
+# define HT_PROBE3(name_, a1_, a2_, a3_) \
+    DTRACE_PROBE3(libhashtable, name_, a1_, a2_, a3_)
+# define HT_PROBE4(name_, a1_, a2_, a3_, a4_) \
+    DTRACE_PROBE4(libhashtable, name_, a1_, a2_, a3_, a4_)
+# define HT_PROBE5(name_, a1_, a2_, a3_, a4_, a5_) \
+    DTRACE_PROBE5(libhashtable, name_, a1_, a2_, a3_, a4_, a5_)
+#else
+# define HT_PROBE2(name_, a1_, a2_) ((void)0)
+# define HT_PROBE3(name_, a1_, a2_, a3_) ((void)0)
+# define HT_PROBE4(name_, a1_, a2_, a3_, a4_) ((void)0)
+# define HT_PROBE5(name_, a1_, a2_, a3_, a4_, a5_) ((void)0)
+#endif
+
+/* Resizes, allocation failures and bucket growth are reported to the hooks
+ * of the table, to static probes and to statistics counters. */
+uint64_t ht_clock(void);
+uint64_t ht_table_resize_begin(struct ht_table *, size_t, size_t);
+void ht_table_resize_done(struct ht_table *, size_t, size_t, size_t,
+                          uint64_t);
+void ht_table_resize_failed(struct ht_table *, size_t, uint64_t);
+void ht_table_allocation_failed(struct ht_table *, size_t);
+void ht_table_bucket_grown(struct ht_table *, size_t, size_t, size_t);
+
+/* Hash functions used with the library usually do not mix bits well, hashes
+ * are therefore scrambled before being reduced to an index with a mask. */
+static inline uint64_t
+ht_hash_mix64(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xff51afd7ed558ccd);
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/* Tables split in independent sub-tables select the sub-table of a key with
+ * the highest bits of its mixed hash, which sub-tables do not use to select
+ * buckets or groups. */
+static inline size_t
+ht_hash_partition(uint64_t hash, unsigned int bits) {
+    if (bits == 0)
+        return 0;
+
+    return (size_t)(ht_hash_mix64(hash) >> (64 - bits));
+}
+
+static inline uint64_t
+ht_table_hash(const struct ht_table *table, const void *key) {
+    uint64_t hash;
+
+    if (table->hash64_func) {
+        hash = table->hash64_func(key, table->seed);
+    } else {
+        hash = table->hash_func(key);
+    }
+
+    if (hash == HT_UNUSED_HASH)
+        hash++;
+
+    return hash;
+}
+
+struct ht_table_entry *ht_table_find(struct ht_table *, const void *,
+                                     uint64_t, ht_equal_func);
+int ht_table_upsert_entry(struct ht_table *, void *, uint64_t,
+                          struct ht_table_entry **);
+int ht_table_erase(struct ht_table *, struct ht_table_entry *);
+int ht_table_shrink(struct ht_table *);
+int ht_table_insert_hashed(struct ht_table *, void *, void *, uint64_t);
+int ht_table_add_hashed(struct ht_table *, void *, void *, uint64_t);
+struct ht_table_bucket *ht_table_iterator_bucket(struct ht_table *, size_t);
+struct ht_table_entry *ht_table_next_entry(struct ht_table *, size_t *,
+                                          size_t *);
+
+/* Largest table size, so that arrays of per-slot data of up to 64 bytes
+ * remain addressable. */
+#define HT_TABLE_MAX_SZ ((SIZE_MAX >> 7) + 1)
+
+size_t ht_table_grown_size(const struct ht_table *, size_t);
+size_t ht_table_shrunk_size(const struct ht_table *, size_t, size_t);
+size_t ht_table_max_entries(const struct ht_table *, size_t);
+size_t ht_table_capacity_size(const struct ht_table *, size_t, size_t);
+void ht_table_update_limits(struct ht_table *, size_t);
+void ht_table_stats_add_probe(struct ht_table_stats *, size_t);
+void ht_table_stats_add_bucket(struct ht_table_stats *, size_t);
+
+/* Open addressing storage */
+int ht_table_open_init(struct ht_table *, size_t);
+void ht_table_open_free(struct ht_table *);
+void ht_table_open_clear(struct ht_table *);
+int ht_table_open_upsert(struct ht_table *, void *, uint64_t,
+                         struct ht_table_entry **);
+struct ht_table_entry *ht_table_open_entry(struct ht_table *, const void *,
+                                           uint64_t, ht_equal_func);
+void ht_table_open_prefetch(const struct ht_table *, uint64_t);
+void ht_table_open_publish(struct ht_table *, struct ht_table_entry *);
+void ht_table_open_erase(struct ht_table *, struct ht_table_entry *);
+bool ht_table_open_erase_slot(struct ht_table *, size_t);
+int ht_table_open_shrink(struct ht_table *);
+int ht_table_open_reserve(struct ht_table *, size_t);
+int ht_table_open_shrink_to_fit(struct ht_table *);
+struct ht_table_entry *ht_table_open_next(struct ht_table *, size_t *);
+size_t ht_table_open_next_batch(struct ht_table *, size_t *, void **, void **,
+                                size_t);
+void ht_table_open_print(struct ht_table *, FILE *);
+void ht_table_open_stats(struct ht_table *, struct ht_table_stats *);
+
+/* Compact storage */
+int ht_table_compact_init(struct ht_table *, size_t);
+void ht_table_compact_free(struct ht_table *);
+void ht_table_compact_clear(struct ht_table *);
+int ht_table_compact_upsert(struct ht_table *, void *, uint64_t,
+                            struct ht_table_entry **);
+struct ht_table_entry *ht_table_compact_entry(struct ht_table *, const void *,
+                                              uint64_t, ht_equal_func);
+void ht_table_compact_prefetch(const struct ht_table *, uint64_t);
+void ht_table_compact_erase(struct ht_table *, struct ht_table_entry *);
+void ht_table_compact_sweep(struct ht_table *);
+int ht_table_compact_shrink(struct ht_table *);
+int ht_table_compact_reserve(struct ht_table *, size_t);
+int ht_table_compact_shrink_to_fit(struct ht_table *);
+struct ht_table_entry *ht_table_compact_next(struct ht_table *, size_t *);
+size_t ht_table_compact_next_batch(struct ht_table *, size_t *, void **,
+                                   void **, size_t);
+void ht_table_compact_print(struct ht_table *, FILE *);
+void ht_table_compact_stats(struct ht_table *, struct ht_table_stats *);
 
 #endif
@@ -14,6 +14,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "internal.h"
 #include "hashtable.h"
 
@@ -61,3 +65,113 @@ void *
 ht_realloc(void *ptr, size_t sz) {
     return ht_allocator.realloc(ptr, sz);
 }
+
+static void *
+ht_process_alloc(size_t sz, void *ctx) {
+    (void)ctx;
+    return ht_malloc(sz);
+}
+
+static void *
+ht_process_realloc(void *ptr, size_t old_sz, size_t sz, void *ctx) {
+    (void)old_sz;
+    (void)ctx;
+    return ht_realloc(ptr, sz);
+}
+
+static void
+ht_process_free(void *ptr, size_t sz, void *ctx) {
+    (void)sz;
+    (void)ctx;
+    ht_free(ptr);
+}
+
+const struct ht_allocator ht_process_allocator = {
+    .alloc = ht_process_alloc,
+    .realloc = ht_process_realloc,
+    .free = ht_process_free,
+    .ctx = NULL,
+};
+
+const struct ht_allocator *
+ht_options_allocator(const struct ht_table_options *options) {
+    const struct ht_allocator *allocator;
+
+    if (!options || !options->allocator)
+        return &ht_process_allocator;
+
+    allocator = options->allocator;
+    if (!allocator->alloc || !allocator->free) {
+        ht_set_error("incomplete allocator");
+        return NULL;
+    }
+
+    return allocator;
+}
+
+void *
+ht_allocator_malloc(const struct ht_allocator *allocator, size_t sz) {
+    void *ptr;
+
+    errno = 0;
+    ptr = allocator->alloc(sz, allocator->ctx);
+    if (!ptr && errno == 0)
+        errno = ENOMEM;
+
+    return ptr;
+}
+
+void *
+ht_allocator_calloc(const struct ht_allocator *allocator,
+                    size_t nb, size_t sz) {
+    void *ptr;
+
+    if (sz > 0 && nb > SIZE_MAX / sz) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ptr = ht_allocator_malloc(allocator, nb * sz);
+    if (!ptr)
+        return NULL;
+
+    memset(ptr, 0, nb * sz);
+    return ptr;
+}
+
+void *
+ht_allocator_realloc(const struct ht_allocator *allocator, void *ptr,
+                     size_t old_sz, size_t sz) {
+    void *nptr;
+
+    if (allocator->realloc) {
+        errno = 0;
+        nptr = allocator->realloc(ptr, old_sz, sz, allocator->ctx);
+        if (!nptr && errno == 0)
+            errno = ENOMEM;
+
+        return nptr;
+    }
+
+    /* Allocators without realloc function, e.g. arenas, still support
+     * growing blocks by copy. */
+    nptr = ht_allocator_malloc(allocator, sz);
+    if (!nptr)
+        return NULL;
+
+    if (ptr) {
+        memcpy(nptr, ptr, (old_sz < sz) ? old_sz : sz);
+        allocator->free(ptr, old_sz, allocator->ctx);
+    }
+
+    return nptr;
+}
+
+void
+ht_allocator_free(const struct ht_allocator *allocator, void *ptr,
+                  size_t sz) {
+    if (!ptr)
+        return;
+
+    allocator->free(ptr, sz, allocator->ctx);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HT_PLATFORM_LINUX
+/* mremap() is Linux specific. */
+#   define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Large arrays are mapped directly so that they can be backed by huge pages,
+ * reducing TLB misses for random accesses. Explicit huge pages are used if
+ * the system has some reserved; otherwise the mapping is advised to use
+ * transparent huge pages, which may or may not be honored by the kernel.
+ *
+ * Anonymous mappings are always zero-filled, and mappings of the same size
+ * always have the same length, so callers only have to remember the size
+ * they asked for. */
+
+#define HT_HUGE_PAGE_SZ ((size_t)2 * 1024 * 1024)
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#   define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static void *ht_pages_mmap(size_t);
+
+size_t
+ht_pages_size(size_t sz) {
+    size_t page_sz;
+
+    if (sz >= HT_HUGE_PAGE_SZ) {
+        page_sz = HT_HUGE_PAGE_SZ;
+    } else {
+        page_sz = (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    return (sz + page_sz - 1) & ~(page_sz - 1);
+}
+
+void *
+ht_pages_map(size_t sz) {
+    return ht_pages_mmap(ht_pages_size(sz));
+}
+
+void *
+ht_pages_remap(void *ptr, size_t old_sz, size_t sz) {
+    size_t old_map_sz, map_sz;
+    void *nptr;
+
+    old_map_sz = ht_pages_size(old_sz);
+    map_sz = ht_pages_size(sz);
+
+    if (map_sz == old_map_sz)
+        return ptr;
+
+#ifdef MREMAP_MAYMOVE
+    /* The kernel moves page table entries instead of copying data. It may
+     * refuse to remap explicit huge pages, in which case data are copied. */
+    nptr = mremap(ptr, old_map_sz, map_sz, MREMAP_MAYMOVE);
+    if (nptr != MAP_FAILED) {
+        if (map_sz > old_map_sz) {
+#ifdef MADV_HUGEPAGE
+            madvise(nptr, map_sz, MADV_HUGEPAGE);
+#endif
+        }
+
+        return nptr;
+    }
+#endif
+
+    nptr = ht_pages_mmap(map_sz);
+    if (!nptr)
+        return NULL;
+
+    memcpy(nptr, ptr, (old_sz < sz) ? old_sz : sz);
+    munmap(ptr, old_map_sz);
+
+    return nptr;
+}
+
+void
+ht_pages_unmap(void *ptr, size_t sz) {
+    if (!ptr)
+        return;
+
+    munmap(ptr, ht_pages_size(sz));
+}
+
+static void *
+ht_pages_mmap(size_t map_sz) {
+    void *ptr;
+
+#ifdef MAP_HUGETLB
+    if (map_sz % HT_HUGE_PAGE_SZ == 0) {
+        ptr = mmap(NULL, map_sz, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+            return ptr;
+    }
+#endif
+
+    ptr = mmap(NULL, map_sz, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (map_sz >= HT_HUGE_PAGE_SZ)
+        madvise(ptr, map_sz, MADV_HUGEPAGE);
+#endif
+
+    return ptr;
+}
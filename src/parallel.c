@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* The maximum number of threads used by a parallel operation */
+#define HT_PARALLEL_MAX_NB_THREADS 256
+
+struct ht_parallel_worker {
+    pthread_t thread;
+    bool started;
+
+    ht_parallel_func func;
+    void *arg;
+    unsigned int idx;
+};
+
+static void *ht_parallel_main(void *);
+
+unsigned int
+ht_parallel_nb_threads(unsigned int nb_threads) {
+    long nb_cpus;
+
+    if (nb_threads == 0) {
+        nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nb_threads = (nb_cpus < 1) ? 1 : (unsigned int)nb_cpus;
+    }
+
+    if (nb_threads > HT_PARALLEL_MAX_NB_THREADS)
+        nb_threads = HT_PARALLEL_MAX_NB_THREADS;
+
+    return nb_threads;
+}
+
+void
+ht_parallel_run(unsigned int nb_threads, ht_parallel_func func, void *arg) {
+    struct ht_parallel_worker workers[HT_PARALLEL_MAX_NB_THREADS];
+
+    /* Worker 0 runs in the calling thread. If a thread cannot be created,
+     * its work is done by the calling thread too, so that the operation
+     * never fails. */
+    nb_threads = ht_parallel_nb_threads(nb_threads);
+
+    for (unsigned int i = 1; i < nb_threads; i++) {
+        struct ht_parallel_worker *worker;
+
+        worker = workers + i;
+        worker->func = func;
+        worker->arg = arg;
+        worker->idx = i;
+
+        worker->started = pthread_create(&worker->thread, NULL,
+                                         ht_parallel_main, worker) == 0;
+    }
+
+    func(arg, 0);
+
+    for (unsigned int i = 1; i < nb_threads; i++) {
+        struct ht_parallel_worker *worker;
+
+        worker = workers + i;
+
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        } else {
+            func(arg, i);
+        }
+    }
+}
+
+static void *
+ht_parallel_main(void *arg) {
+    struct ht_parallel_worker *worker;
+
+    worker = arg;
+    worker->func(worker->arg, worker->idx);
+
+    return NULL;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Quiescent state based reclamation.
+ *
+ * The domain maintains a global epoch, incremented each time memory is
+ * retired. Each reader publishes the value of the global epoch it observed
+ * the last time it went through a quiescent state, i.e. a point where it
+ * does not hold any reference to shared memory; offline readers publish 0.
+ *
+ * Memory retired at epoch E can be freed once every online reader has
+ * published an epoch greater or equal to E: these readers went through a
+ * quiescent state after the memory was made unreachable.
+ *
+ * Readers only ever store their own epoch; all the work is done by the
+ * writer, which is the only thread retiring memory. Retired objects embed a
+ * struct ht_qsbr_retired, so that retiring them never fails. */
+
+struct ht_table_reader {
+    uint64_t epoch;
+    struct ht_qsbr *qsbr;
+    struct ht_table_reader *next;
+};
+
+struct ht_qsbr {
+    uint64_t epoch;
+
+    struct ht_allocator allocator;
+
+    pthread_mutex_t readers_lock;
+    struct ht_table_reader *readers;
+
+    struct ht_qsbr_retired *retired;
+};
+
+static uint64_t ht_qsbr_min_epoch(struct ht_qsbr *);
+
+struct ht_qsbr *
+ht_qsbr_new(const struct ht_allocator *allocator) {
+    struct ht_qsbr *qsbr;
+    int ret;
+
+    qsbr = ht_allocator_malloc(allocator, sizeof(struct ht_qsbr));
+    if (!qsbr) {
+        ht_set_error("cannot allocate reclamation domain: %m");
+        return NULL;
+    }
+
+    memset(qsbr, 0, sizeof(struct ht_qsbr));
+
+    qsbr->epoch = 1;
+    qsbr->allocator = *allocator;
+
+    ret = pthread_mutex_init(&qsbr->readers_lock, NULL);
+    if (ret != 0) {
+        ht_set_error("cannot initialize mutex: %s", strerror(ret));
+        ht_allocator_free(allocator, qsbr, sizeof(struct ht_qsbr));
+        return NULL;
+    }
+
+    return qsbr;
+}
+
+void
+ht_qsbr_delete(struct ht_qsbr *qsbr) {
+    struct ht_allocator allocator;
+    struct ht_qsbr_retired *retired;
+    struct ht_table_reader *reader;
+
+    if (!qsbr)
+        return;
+
+    retired = qsbr->retired;
+    while (retired) {
+        struct ht_qsbr_retired *next;
+
+        next = retired->next;
+        retired->free_func(retired);
+        retired = next;
+    }
+
+    reader = qsbr->readers;
+    while (reader) {
+        struct ht_table_reader *next;
+
+        next = reader->next;
+        ht_allocator_free(&qsbr->allocator, reader,
+                          sizeof(struct ht_table_reader));
+        reader = next;
+    }
+
+    pthread_mutex_destroy(&qsbr->readers_lock);
+
+    allocator = qsbr->allocator;
+
+    memset(qsbr, 0, sizeof(struct ht_qsbr));
+    ht_allocator_free(&allocator, qsbr, sizeof(struct ht_qsbr));
+}
+
+struct ht_table_reader *
+ht_qsbr_register(struct ht_qsbr *qsbr) {
+    struct ht_table_reader *reader;
+
+    reader = ht_allocator_malloc(&qsbr->allocator,
+                                 sizeof(struct ht_table_reader));
+    if (!reader) {
+        ht_set_error("cannot allocate reader: %m");
+        return NULL;
+    }
+
+    reader->qsbr = qsbr;
+    reader->epoch = __atomic_load_n(&qsbr->epoch, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&qsbr->readers_lock);
+    reader->next = qsbr->readers;
+    qsbr->readers = reader;
+    pthread_mutex_unlock(&qsbr->readers_lock);
+
+    return reader;
+}
+
+void
+ht_qsbr_unregister(struct ht_table_reader *reader) {
+    struct ht_qsbr *qsbr;
+    struct ht_table_reader **pnext;
+
+    qsbr = reader->qsbr;
+
+    pthread_mutex_lock(&qsbr->readers_lock);
+
+    for (pnext = &qsbr->readers; *pnext; pnext = &(*pnext)->next) {
+        if (*pnext == reader) {
+            *pnext = reader->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&qsbr->readers_lock);
+
+    ht_allocator_free(&qsbr->allocator, reader,
+                      sizeof(struct ht_table_reader));
+}
+
+void
+ht_qsbr_quiescent(struct ht_table_reader *reader) {
+    uint64_t epoch;
+
+    /* All previous reads must be complete before the epoch is published. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    epoch = __atomic_load_n(&reader->qsbr->epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void
+ht_qsbr_offline(struct ht_table_reader *reader) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void
+ht_qsbr_retire(struct ht_qsbr *qsbr, struct ht_qsbr_retired *retired) {
+    /* The object must have been made unreachable before this point. */
+    retired->epoch = __atomic_add_fetch(&qsbr->epoch, 1, __ATOMIC_SEQ_CST);
+
+    retired->next = qsbr->retired;
+    qsbr->retired = retired;
+}
+
+void
+ht_qsbr_reclaim(struct ht_qsbr *qsbr) {
+    struct ht_qsbr_retired **pnext;
+    uint64_t min_epoch;
+
+    if (!qsbr->retired)
+        return;
+
+    min_epoch = ht_qsbr_min_epoch(qsbr);
+
+    pnext = &qsbr->retired;
+    while (*pnext) {
+        struct ht_qsbr_retired *retired;
+
+        retired = *pnext;
+
+        if (retired->epoch <= min_epoch) {
+            *pnext = retired->next;
+            retired->free_func(retired);
+        } else {
+            pnext = &retired->next;
+        }
+    }
+}
+
+void
+ht_qsbr_synchronize(struct ht_qsbr *qsbr) {
+    uint64_t epoch;
+
+    epoch = __atomic_add_fetch(&qsbr->epoch, 1, __ATOMIC_SEQ_CST);
+
+    while (ht_qsbr_min_epoch(qsbr) < epoch)
+        sched_yield();
+
+    ht_qsbr_reclaim(qsbr);
+}
+
+static uint64_t
+ht_qsbr_min_epoch(struct ht_qsbr *qsbr) {
+    struct ht_table_reader *reader;
+    uint64_t min_epoch;
+
+    /* Without any online reader, everything can be reclaimed. */
+    min_epoch = UINT64_MAX;
+
+    pthread_mutex_lock(&qsbr->readers_lock);
+
+    for (reader = qsbr->readers; reader; reader = reader->next) {
+        uint64_t epoch;
+
+        epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < min_epoch)
+            min_epoch = epoch;
+    }
+
+    pthread_mutex_unlock(&qsbr->readers_lock);
+
+    return min_epoch;
+}
@@ -0,0 +1,563 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Sharded tables are split in shards, each shard being a regular table
+ * selected with the highest bits of the mixed hash of the key. There is no
+ * lock: shards are independent, so bulk operations can process them in
+ * parallel, each thread owning a disjoint set of shards. */
+
+#define HT_SHARDED_DEFAULT_NB_SHARDS 64
+
+#define HT_SHARDED_ERROR_BUFSZ 256U
+
+struct ht_sharded_table {
+    struct ht_allocator allocator;
+
+    struct ht_table **shards;
+    size_t nb_shards;
+    size_t shards_sz;
+    unsigned int shard_bits;
+
+    ht_equal_func equal_func;
+};
+
+struct ht_sharded_entry {
+    void *key;
+    void *value;
+    uint64_t hash;
+};
+
+struct ht_sharded_worker {
+    /* Number of entries of the chunk of the worker for each shard, then
+     * position of the first of these entries in the scattered array. */
+    size_t *offsets;
+
+    bool failed;
+    char error[HT_SHARDED_ERROR_BUFSZ];
+};
+
+struct ht_sharded_job {
+    struct ht_sharded_table *table;
+    unsigned int nb_threads;
+
+    void **keys;
+    void **values;
+    size_t nb_entries;
+    uint64_t *hashes;
+
+    struct ht_sharded_entry *entries;
+    size_t *shard_offsets;
+
+    size_t capacity;
+
+    struct ht_sharded_worker *workers;
+};
+
+static struct ht_table *
+ht_sharded_table_shard(const struct ht_sharded_table *, uint64_t);
+
+static void ht_sharded_job_chunk(const struct ht_sharded_job *, unsigned int,
+                                 size_t *, size_t *);
+static void ht_sharded_job_fail(struct ht_sharded_job *, unsigned int);
+static int ht_sharded_job_run(struct ht_sharded_job *, ht_parallel_func);
+
+static void ht_sharded_count(void *, unsigned int);
+static void ht_sharded_scatter(void *, unsigned int);
+static void ht_sharded_build(void *, unsigned int);
+static void ht_sharded_reserve(void *, unsigned int);
+
+struct ht_sharded_table *
+ht_sharded_table_new(ht_hash_func hash_func, ht_equal_func equal_func,
+                     const struct ht_table_options *options,
+                     size_t nb_shards) {
+    const struct ht_allocator *allocator;
+    struct ht_sharded_table *table;
+    struct ht_table_options shard_options;
+
+    if (nb_shards == 0)
+        nb_shards = HT_SHARDED_DEFAULT_NB_SHARDS;
+
+    if ((nb_shards & (nb_shards - 1)) != 0) {
+        ht_set_error("number of shards must be a power of two");
+        return NULL;
+    }
+
+    if (options) {
+        shard_options = *options;
+    } else {
+        memset(&shard_options, 0, sizeof(struct ht_table_options));
+    }
+
+    /* Lookups in chained tables migrate buckets during incremental
+     * resizing, they could not be done by several threads at once. */
+    if (shard_options.incremental_resize) {
+        ht_set_error("incremental resizing is not supported by sharded "
+                     "tables");
+        return NULL;
+    }
+
+    if (shard_options.single_writer) {
+        ht_set_error("single writer mode is not supported by sharded tables");
+        return NULL;
+    }
+
+    /* All shards must hash keys identically. */
+    if (shard_options.random_seed) {
+        shard_options.seed = ht_random_seed();
+        shard_options.random_seed = false;
+    }
+
+    shard_options.capacity =
+        (shard_options.capacity + nb_shards - 1) / nb_shards;
+
+    allocator = ht_options_allocator(options);
+    if (!allocator)
+        return NULL;
+
+    table = ht_allocator_malloc(allocator, sizeof(struct ht_sharded_table));
+    if (!table) {
+        ht_set_error("cannot allocate table: %m");
+        return NULL;
+    }
+
+    memset(table, 0, sizeof(struct ht_sharded_table));
+
+    table->allocator = *allocator;
+    table->equal_func = equal_func;
+
+    table->shards = ht_allocator_calloc(allocator, nb_shards,
+                                        sizeof(struct ht_table *));
+    if (!table->shards) {
+        ht_set_error("cannot allocate shards: %m");
+        ht_sharded_table_delete(table);
+        return NULL;
+    }
+
+    table->shards_sz = nb_shards;
+
+    while (((size_t)1 << table->shard_bits) < nb_shards)
+        table->shard_bits++;
+
+    for (size_t i = 0; i < nb_shards; i++) {
+        table->shards[i] = ht_table_new_ex(hash_func, equal_func,
+                                           &shard_options);
+        if (!table->shards[i]) {
+            ht_sharded_table_delete(table);
+            return NULL;
+        }
+
+        table->nb_shards++;
+    }
+
+    return table;
+}
+
+void
+ht_sharded_table_delete(struct ht_sharded_table *table) {
+    struct ht_allocator allocator;
+
+    if (!table)
+        return;
+
+    for (size_t i = 0; i < table->nb_shards; i++)
+        ht_table_delete(table->shards[i]);
+
+    allocator = table->allocator;
+
+    ht_allocator_free(&allocator, table->shards,
+                      table->shards_sz * sizeof(struct ht_table *));
+
+    memset(table, 0, sizeof(struct ht_sharded_table));
+    ht_allocator_free(&allocator, table, sizeof(struct ht_sharded_table));
+}
+
+size_t
+ht_sharded_table_nb_entries(const struct ht_sharded_table *table) {
+    size_t nb_entries;
+
+    nb_entries = 0;
+
+    for (size_t i = 0; i < table->nb_shards; i++)
+        nb_entries += table->shards[i]->nb_entries;
+
+    return nb_entries;
+}
+
+void
+ht_sharded_table_clear(struct ht_sharded_table *table) {
+    for (size_t i = 0; i < table->nb_shards; i++)
+        ht_table_clear(table->shards[i]);
+}
+
+int
+ht_sharded_table_reserve(struct ht_sharded_table *table, size_t capacity,
+                         unsigned int nb_threads) {
+    struct ht_sharded_job job;
+
+    memset(&job, 0, sizeof(struct ht_sharded_job));
+
+    job.table = table;
+    job.nb_threads = nb_threads;
+    job.capacity = (capacity + table->nb_shards - 1) / table->nb_shards;
+
+    return ht_sharded_job_run(&job, ht_sharded_reserve);
+}
+
+int
+ht_sharded_table_insert(struct ht_sharded_table *table,
+                        void *key, void *value) {
+    struct ht_table *shard;
+    uint64_t hash;
+
+    hash = ht_table_hash(table->shards[0], key);
+    shard = ht_sharded_table_shard(table, hash);
+
+    return ht_table_insert_hashed(shard, key, value, hash);
+}
+
+int
+ht_sharded_table_insert_many(struct ht_sharded_table *table,
+                             void **keys, void **values, size_t nb_entries,
+                             unsigned int nb_threads) {
+    const struct ht_allocator *allocator;
+    struct ht_sharded_job job;
+    unsigned int nb_workers;
+    size_t offset;
+    int ret;
+
+    if (nb_entries == 0)
+        return 0;
+
+    memset(&job, 0, sizeof(struct ht_sharded_job));
+
+    job.table = table;
+    job.nb_threads = ht_parallel_nb_threads(nb_threads);
+    job.keys = keys;
+    job.values = values;
+    job.nb_entries = nb_entries;
+
+    /* Entries are inserted in three parallel passes: each thread hashes
+     * a chunk of the input and counts the entries of each shard, then
+     * copies them at their position in an array grouping entries by shard,
+     * and finally each thread inserts the entries of the shards it owns,
+     * resizing them once beforehand. Entries of a shard are inserted in
+     * the order of the input, so the last value of a key wins. */
+    allocator = &table->allocator;
+
+    job.hashes = ht_allocator_calloc(allocator, nb_entries,
+                                     sizeof(uint64_t));
+    job.entries = ht_allocator_calloc(allocator, nb_entries,
+                                      sizeof(struct ht_sharded_entry));
+    job.shard_offsets = ht_allocator_calloc(allocator, table->nb_shards + 1,
+                                            sizeof(size_t));
+    job.workers = ht_allocator_calloc(allocator, job.nb_threads,
+                                      sizeof(struct ht_sharded_worker));
+
+    /* The last pass runs on at most one thread per shard, and reduces the
+     * number of threads of the job accordingly. */
+    nb_workers = job.nb_threads;
+
+    if (!job.hashes || !job.entries || !job.shard_offsets || !job.workers) {
+        ht_set_error("cannot allocate buffers: %m");
+        ret = -1;
+        goto end;
+    }
+
+    for (unsigned int t = 0; t < job.nb_threads; t++) {
+        job.workers[t].offsets = ht_allocator_calloc(allocator,
+                                                     table->nb_shards,
+                                                     sizeof(size_t));
+        if (!job.workers[t].offsets) {
+            ht_set_error("cannot allocate buffers: %m");
+            ret = -1;
+            goto end;
+        }
+    }
+
+    ht_parallel_run(job.nb_threads, ht_sharded_count, &job);
+
+    offset = 0;
+
+    for (size_t s = 0; s < table->nb_shards; s++) {
+        job.shard_offsets[s] = offset;
+
+        for (unsigned int t = 0; t < job.nb_threads; t++) {
+            size_t count;
+
+            count = job.workers[t].offsets[s];
+            job.workers[t].offsets[s] = offset;
+            offset += count;
+        }
+    }
+
+    job.shard_offsets[table->nb_shards] = offset;
+    assert(offset == nb_entries);
+
+    ht_parallel_run(job.nb_threads, ht_sharded_scatter, &job);
+
+    ret = ht_sharded_job_run(&job, ht_sharded_build);
+
+end:
+    if (job.workers) {
+        for (unsigned int t = 0; t < nb_workers; t++) {
+            ht_allocator_free(allocator, job.workers[t].offsets,
+                              table->nb_shards * sizeof(size_t));
+        }
+    }
+
+    ht_allocator_free(allocator, job.workers,
+                      nb_workers * sizeof(struct ht_sharded_worker));
+    ht_allocator_free(allocator, job.shard_offsets,
+                      (table->nb_shards + 1) * sizeof(size_t));
+    ht_allocator_free(allocator, job.entries,
+                      nb_entries * sizeof(struct ht_sharded_entry));
+    ht_allocator_free(allocator, job.hashes, nb_entries * sizeof(uint64_t));
+
+    return ret;
+}
+
+int
+ht_sharded_table_remove(struct ht_sharded_table *table, const void *key) {
+    struct ht_table *shard;
+    struct ht_table_entry *entry;
+    uint64_t hash;
+
+    hash = ht_table_hash(table->shards[0], key);
+    shard = ht_sharded_table_shard(table, hash);
+
+    entry = ht_table_find(shard, key, hash, table->equal_func);
+    if (!entry)
+        return 0;
+
+    return (ht_table_erase(shard, entry) == -1) ? -1 : 1;
+}
+
+int
+ht_sharded_table_get(struct ht_sharded_table *table, const void *key,
+                     void **value) {
+    struct ht_table_entry *entry;
+    uint64_t hash;
+
+    hash = ht_table_hash(table->shards[0], key);
+
+    entry = ht_table_find(ht_sharded_table_shard(table, hash), key, hash,
+                          table->equal_func);
+    if (!entry)
+        return 0;
+
+    *value = entry->value;
+    return 1;
+}
+
+bool
+ht_sharded_table_contains(struct ht_sharded_table *table, const void *key) {
+    uint64_t hash;
+
+    hash = ht_table_hash(table->shards[0], key);
+
+    return ht_table_find(ht_sharded_table_shard(table, hash), key, hash,
+                         table->equal_func) != NULL;
+}
+
+static struct ht_table *
+ht_sharded_table_shard(const struct ht_sharded_table *table, uint64_t hash) {
+    return table->shards[ht_hash_partition(hash, table->shard_bits)];
+}
+
+static void
+ht_sharded_job_chunk(const struct ht_sharded_job *job, unsigned int idx,
+                     size_t *start, size_t *end) {
+    size_t chunk_sz;
+
+    chunk_sz = (job->nb_entries + job->nb_threads - 1) / job->nb_threads;
+
+    *start = chunk_sz * idx;
+    if (*start > job->nb_entries)
+        *start = job->nb_entries;
+
+    *end = *start + chunk_sz;
+    if (*end > job->nb_entries)
+        *end = job->nb_entries;
+}
+
+static void
+ht_sharded_job_fail(struct ht_sharded_job *job, unsigned int idx) {
+    struct ht_sharded_worker *worker;
+
+    /* Error messages are thread-local, they are copied so that the
+     * calling thread can report them. */
+    worker = job->workers + idx;
+    worker->failed = true;
+    snprintf(worker->error, HT_SHARDED_ERROR_BUFSZ, "%s", ht_get_error());
+}
+
+static int
+ht_sharded_job_run(struct ht_sharded_job *job, ht_parallel_func func) {
+    struct ht_sharded_worker *workers;
+    bool own_workers;
+    int ret;
+
+    job->nb_threads = ht_parallel_nb_threads(job->nb_threads);
+    if (job->nb_threads > job->table->nb_shards)
+        job->nb_threads = (unsigned int)job->table->nb_shards;
+
+    workers = job->workers;
+    own_workers = (workers == NULL);
+
+    if (own_workers) {
+        workers = ht_allocator_calloc(&job->table->allocator, job->nb_threads,
+                                      sizeof(struct ht_sharded_worker));
+        if (!workers) {
+            ht_set_error("cannot allocate buffers: %m");
+            return -1;
+        }
+
+        job->workers = workers;
+    } else {
+        for (unsigned int t = 0; t < job->nb_threads; t++)
+            workers[t].failed = false;
+    }
+
+    ht_parallel_run(job->nb_threads, func, job);
+
+    ret = 0;
+
+    for (unsigned int t = 0; t < job->nb_threads; t++) {
+        if (workers[t].failed) {
+            ht_set_error("%s", workers[t].error);
+            ret = -1;
+            break;
+        }
+    }
+
+    if (own_workers) {
+        ht_allocator_free(&job->table->allocator, workers,
+                          job->nb_threads * sizeof(struct ht_sharded_worker));
+        job->workers = NULL;
+    }
+
+    return ret;
+}
+
+static void
+ht_sharded_count(void *arg, unsigned int idx) {
+    struct ht_sharded_job *job;
+    struct ht_table *shard0;
+    size_t *counts;
+    size_t start, end;
+
+    job = arg;
+    shard0 = job->table->shards[0];
+    counts = job->workers[idx].offsets;
+
+    ht_sharded_job_chunk(job, idx, &start, &end);
+
+    for (size_t i = start; i < end; i++) {
+        uint64_t hash;
+
+        hash = ht_table_hash(shard0, job->keys[i]);
+        job->hashes[i] = hash;
+
+        counts[ht_hash_partition(hash, job->table->shard_bits)]++;
+    }
+}
+
+static void
+ht_sharded_scatter(void *arg, unsigned int idx) {
+    struct ht_sharded_job *job;
+    size_t *offsets;
+    size_t start, end;
+
+    job = arg;
+    offsets = job->workers[idx].offsets;
+
+    ht_sharded_job_chunk(job, idx, &start, &end);
+
+    for (size_t i = start; i < end; i++) {
+        struct ht_sharded_entry *entry;
+        size_t s;
+
+        s = ht_hash_partition(job->hashes[i], job->table->shard_bits);
+
+        entry = job->entries + offsets[s]++;
+        entry->key = job->keys[i];
+        entry->value = job->values ? job->values[i] : NULL;
+        entry->hash = job->hashes[i];
+    }
+}
+
+static void
+ht_sharded_build(void *arg, unsigned int idx) {
+    struct ht_sharded_job *job;
+    struct ht_sharded_table *table;
+
+    job = arg;
+    table = job->table;
+
+    for (size_t s = idx; s < table->nb_shards; s += job->nb_threads) {
+        struct ht_table *shard;
+        size_t start, end;
+
+        shard = table->shards[s];
+        start = job->shard_offsets[s];
+        end = job->shard_offsets[s + 1];
+
+        if (start == end)
+            continue;
+
+        if (ht_table_reserve(shard, shard->nb_entries + end - start) == -1) {
+            ht_sharded_job_fail(job, idx);
+            return;
+        }
+
+        for (size_t i = start; i < end; i++) {
+            struct ht_sharded_entry *entry;
+
+            entry = job->entries + i;
+
+            if (ht_table_insert_hashed(shard, entry->key, entry->value,
+                                       entry->hash) == -1) {
+                ht_sharded_job_fail(job, idx);
+                return;
+            }
+        }
+    }
+}
+
+static void
+ht_sharded_reserve(void *arg, unsigned int idx) {
+    struct ht_sharded_job *job;
+    struct ht_sharded_table *table;
+
+    job = arg;
+    table = job->table;
+
+    for (size_t s = idx; s < table->nb_shards; s += job->nb_threads) {
+        if (ht_table_reserve(table->shards[s], job->capacity) == -1) {
+            ht_sharded_job_fail(job, idx);
+            return;
+        }
+    }
+}
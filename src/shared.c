@@ -0,0 +1,727 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* A shared table lives in a single region mapped by several processes,
+ * possibly at different addresses: it only contains offsets relative to the
+ * beginning of the region, and keys and values are copied in the region.
+ *
+ * Layout:
+ *
+ *   header  struct ht_shared_header, with the lock of the table
+ *   slots   nb_slots struct ht_shared_slot, open addressing with linear
+ *           probing and backward shift deletion
+ *   data    records (uint32 key size, uint32 value size, key, value)
+ *
+ * Records are allocated in blocks whose size is a power of two. Freed blocks
+ * are kept in one free list per size, and reused for records of the same
+ * size class.
+ *
+ * The lock is a robust mutex: when a process dies while holding it, the
+ * next process locking it takes it over. If the dead process was modifying
+ * the table, the table is marked as corrupted, and operations fail until it
+ * is cleared. */
+
+#define HT_SHARED_MAGIC      "htshared"
+#define HT_SHARED_VERSION    2
+#define HT_SHARED_BYTE_ORDER 0x01020304
+
+#define HT_SHARED_NB_CLASSES   48
+#define HT_SHARED_MIN_CLASS    4
+
+struct ht_shared_slot {
+    uint64_t hash;
+    uint64_t offset; /* 0 if the slot is empty */
+};
+
+struct ht_shared_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t region_sz;
+    uint64_t seed;
+
+    uint64_t nb_slots;
+    uint64_t nb_entries;
+
+    uint64_t slots_offset;
+    uint64_t data_offset;
+    uint64_t data_top;
+
+    uint64_t free_lists[HT_SHARED_NB_CLASSES];
+
+    uint32_t modifying;
+    uint32_t corrupted;
+
+    pthread_mutex_t lock;
+};
+
+struct ht_shared_table {
+    uint8_t *region;
+    size_t region_sz;
+
+    struct ht_shared_header *header;
+    struct ht_shared_slot *slots;
+};
+
+static size_t ht_shared_align(size_t);
+static unsigned int ht_shared_class(size_t);
+static struct ht_shared_table *ht_shared_table_new(uint8_t *, size_t);
+static int ht_shared_table_check_data(struct ht_shared_table *);
+static bool ht_shared_table_valid_block(const struct ht_shared_header *,
+                                        uint64_t, unsigned int);
+static int ht_shared_table_acquire(struct ht_shared_table *);
+static int ht_shared_table_lock(struct ht_shared_table *, bool);
+static void ht_shared_table_unlock(struct ht_shared_table *);
+static struct ht_shared_slot *ht_shared_table_find(struct ht_shared_table *,
+                                                   const void *, size_t,
+                                                   uint64_t);
+static uint64_t ht_shared_table_alloc(struct ht_shared_table *, size_t);
+static void ht_shared_table_free(struct ht_shared_table *, uint64_t);
+static uint64_t ht_shared_table_write_record(struct ht_shared_table *,
+                                             uint64_t,
+                                             const void *, size_t,
+                                             const void *, size_t);
+
+struct ht_shared_table *
+ht_shared_table_create(int fd, size_t capacity, size_t data_sz) {
+    struct ht_shared_table *table;
+    struct ht_shared_header *header;
+    pthread_mutexattr_t attr;
+    size_t nb_slots, slots_offset, data_offset, region_sz;
+    uint8_t *region;
+    int ret;
+
+    /* Keep the load factor below 7/8. */
+    nb_slots = 16;
+    while (nb_slots - nb_slots / 8 < capacity) {
+        if (nb_slots > SIZE_MAX / 2 / sizeof(struct ht_shared_slot)) {
+            ht_set_error("capacity too large");
+            return NULL;
+        }
+
+        nb_slots *= 2;
+    }
+
+    slots_offset = ht_shared_align(sizeof(struct ht_shared_header));
+    data_offset = slots_offset + nb_slots * sizeof(struct ht_shared_slot);
+    region_sz = data_offset + ht_shared_align(data_sz);
+
+    if (ftruncate(fd, (off_t)region_sz) == -1) {
+        ht_set_error("cannot resize file: %m");
+        return NULL;
+    }
+
+    region = mmap(NULL, region_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        ht_set_error("cannot map region: %m");
+        return NULL;
+    }
+
+    memset(region, 0, data_offset);
+
+    header = (struct ht_shared_header *)region;
+    header->version = HT_SHARED_VERSION;
+    header->byte_order = HT_SHARED_BYTE_ORDER;
+    header->region_sz = region_sz;
+    header->seed = ht_random_seed();
+    header->nb_slots = nb_slots;
+    header->nb_entries = 0;
+    header->slots_offset = slots_offset;
+    header->data_offset = data_offset;
+    header->data_top = data_offset;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+    ret = pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    if (ret != 0) {
+        ht_set_error("cannot initialize lock: %s", strerror(ret));
+        munmap(region, region_sz);
+        return NULL;
+    }
+
+    /* The magic number is written last: other processes cannot attach the
+     * region before it is completely initialized. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, HT_SHARED_MAGIC, 8);
+
+    table = ht_shared_table_new(region, region_sz);
+    if (!table) {
+        pthread_mutex_destroy(&header->lock);
+        munmap(region, region_sz);
+        return NULL;
+    }
+
+    return table;
+}
+
+struct ht_shared_table *
+ht_shared_table_attach(int fd) {
+    struct ht_shared_table *table;
+    const struct ht_shared_header *header;
+    struct stat st;
+    uint8_t *region;
+    size_t region_sz;
+    int ret;
+
+    if (fstat(fd, &st) == -1) {
+        ht_set_error("cannot stat file: %m");
+        return NULL;
+    }
+
+    region_sz = (size_t)st.st_size;
+    if (region_sz < sizeof(struct ht_shared_header)) {
+        ht_set_error("invalid shared table: region too small");
+        return NULL;
+    }
+
+    region = mmap(NULL, region_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        ht_set_error("cannot map region: %m");
+        return NULL;
+    }
+
+    header = (const struct ht_shared_header *)region;
+
+    if (memcmp(header->magic, HT_SHARED_MAGIC, 8) != 0) {
+        ht_set_error("invalid shared table: wrong magic number");
+        goto error;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (header->byte_order != HT_SHARED_BYTE_ORDER) {
+        ht_set_error("invalid shared table: wrong byte order");
+        goto error;
+    }
+
+    if (header->version != HT_SHARED_VERSION) {
+        ht_set_error("unsupported shared table version %u", header->version);
+        goto error;
+    }
+
+    if (header->region_sz != region_sz
+     || header->nb_slots == 0
+     || (header->nb_slots & (header->nb_slots - 1)) != 0
+     || header->nb_slots > region_sz / sizeof(struct ht_shared_slot)
+     || header->slots_offset != ht_shared_align(sizeof(*header))
+     || header->data_offset
+        != header->slots_offset
+         + header->nb_slots * sizeof(struct ht_shared_slot)
+     || header->data_offset > region_sz) {
+        ht_set_error("invalid shared table: inconsistent header");
+        goto error;
+    }
+
+    table = ht_shared_table_new(region, region_sz);
+    if (!table)
+        goto error;
+
+    /* The data area changes with each modification: it is checked with the
+     * lock held. */
+    if (ht_shared_table_acquire(table) == -1) {
+        ht_free(table);
+        goto error;
+    }
+
+    ret = ht_shared_table_check_data(table);
+    ht_shared_table_unlock(table);
+
+    if (ret == -1) {
+        ht_free(table);
+        goto error;
+    }
+
+    return table;
+
+error:
+    munmap(region, region_sz);
+    return NULL;
+}
+
+void
+ht_shared_table_detach(struct ht_shared_table *table) {
+    if (!table)
+        return;
+
+    munmap(table->region, table->region_sz);
+
+    memset(table, 0, sizeof(struct ht_shared_table));
+    ht_free(table);
+}
+
+size_t
+ht_shared_table_nb_entries(struct ht_shared_table *table) {
+    size_t nb_entries;
+
+    if (ht_shared_table_acquire(table) == -1)
+        return 0;
+
+    nb_entries = (size_t)table->header->nb_entries;
+    ht_shared_table_unlock(table);
+
+    return nb_entries;
+}
+
+void
+ht_shared_table_clear(struct ht_shared_table *table) {
+    struct ht_shared_header *header;
+
+    header = table->header;
+
+    /* Clearing is the only operation allowed on a corrupted table. */
+    if (ht_shared_table_acquire(table) == -1)
+        return;
+
+    header->modifying = 1;
+
+    memset(table->slots, 0, header->nb_slots * sizeof(struct ht_shared_slot));
+    memset(header->free_lists, 0, sizeof(header->free_lists));
+
+    header->nb_entries = 0;
+    header->data_top = header->data_offset;
+    header->corrupted = 0;
+
+    ht_shared_table_unlock(table);
+}
+
+int
+ht_shared_table_insert(struct ht_shared_table *table,
+                       const void *key, size_t key_sz,
+                       const void *value, size_t value_sz) {
+    struct ht_shared_header *header;
+    struct ht_shared_slot *slot;
+    uint64_t hash, offset;
+    int ret;
+
+    header = table->header;
+
+    if (key_sz > UINT32_MAX || value_sz > UINT32_MAX) {
+        ht_set_error("key or value too large");
+        return -1;
+    }
+
+    hash = ht_hash64_data(key, key_sz, header->seed);
+
+    if (ht_shared_table_lock(table, true) == -1)
+        return -1;
+
+    slot = ht_shared_table_find(table, key, key_sz, hash);
+
+    if (slot->offset != 0) {
+        offset = ht_shared_table_write_record(table, slot->offset,
+                                              key, key_sz, value, value_sz);
+        ret = 0;
+    } else if (header->nb_entries >= header->nb_slots - header->nb_slots / 8) {
+        ht_set_error("shared table full");
+        offset = 0;
+        ret = -1;
+    } else {
+        offset = ht_shared_table_write_record(table, 0,
+                                              key, key_sz, value, value_sz);
+        ret = 1;
+    }
+
+    if (offset == 0) {
+        ret = -1;
+    } else {
+        if (ret == 1)
+            header->nb_entries++;
+
+        slot->hash = hash;
+        slot->offset = offset;
+    }
+
+    ht_shared_table_unlock(table);
+    return ret;
+}
+
+int
+ht_shared_table_remove(struct ht_shared_table *table,
+                       const void *key, size_t key_sz) {
+    struct ht_shared_header *header;
+    struct ht_shared_slot *slot;
+    uint64_t hash, mask, idx;
+
+    header = table->header;
+    hash = ht_hash64_data(key, key_sz, header->seed);
+
+    if (ht_shared_table_lock(table, true) == -1)
+        return -1;
+
+    slot = ht_shared_table_find(table, key, key_sz, hash);
+    if (slot->offset == 0) {
+        ht_shared_table_unlock(table);
+        return 0;
+    }
+
+    ht_shared_table_free(table, slot->offset);
+    header->nb_entries--;
+
+    /* Shift back the following entries of the cluster which are not at
+     * their ideal position, so that lookups never need tombstones. */
+    mask = header->nb_slots - 1;
+    idx = (uint64_t)(slot - table->slots);
+
+    for (uint64_t next = (idx + 1) & mask;; next = (next + 1) & mask) {
+        struct ht_shared_slot *next_slot;
+        uint64_t ideal;
+
+        next_slot = table->slots + next;
+        if (next_slot->offset == 0)
+            break;
+
+        /* The entry can move to idx only if its ideal position is not in
+         * the cyclic range ]idx, next]. */
+        ideal = ht_hash_mix64(next_slot->hash) & mask;
+        if (((next - ideal) & mask) < ((next - idx) & mask))
+            continue;
+
+        table->slots[idx] = *next_slot;
+        idx = next;
+    }
+
+    table->slots[idx].hash = 0;
+    table->slots[idx].offset = 0;
+
+    ht_shared_table_unlock(table);
+    return 1;
+}
+
+int
+ht_shared_table_get(struct ht_shared_table *table,
+                    const void *key, size_t key_sz,
+                    void *buf, size_t buf_sz, size_t *pvalue_sz) {
+    struct ht_shared_header *header;
+    struct ht_shared_slot *slot;
+    uint64_t hash;
+    uint32_t value_sz;
+    const uint8_t *record;
+
+    header = table->header;
+    hash = ht_hash64_data(key, key_sz, header->seed);
+
+    if (ht_shared_table_lock(table, false) == -1)
+        return -1;
+
+    slot = ht_shared_table_find(table, key, key_sz, hash);
+    if (slot->offset == 0) {
+        ht_shared_table_unlock(table);
+        return 0;
+    }
+
+    /* Values are copied while the lock is held: the record may be freed or
+     * reused as soon as it is released. */
+    record = table->region + slot->offset;
+    memcpy(&value_sz, record + 4, sizeof(uint32_t));
+
+    if (buf) {
+        memcpy(buf, record + 8 + key_sz,
+               value_sz < buf_sz ? value_sz : buf_sz);
+    }
+
+    ht_shared_table_unlock(table);
+
+    if (pvalue_sz)
+        *pvalue_sz = value_sz;
+
+    return 1;
+}
+
+bool
+ht_shared_table_contains(struct ht_shared_table *table,
+                         const void *key, size_t key_sz) {
+    return ht_shared_table_get(table, key, key_sz, NULL, 0, NULL) == 1;
+}
+
+static size_t
+ht_shared_align(size_t sz) {
+    return (sz + 7) & ~(size_t)7;
+}
+
+static unsigned int
+ht_shared_class(size_t sz) {
+    unsigned int class;
+
+    class = HT_SHARED_MIN_CLASS;
+    while (((size_t)1 << class) < sz)
+        class++;
+
+    return class;
+}
+
+static struct ht_shared_table *
+ht_shared_table_new(uint8_t *region, size_t region_sz) {
+    struct ht_shared_table *table;
+
+    table = ht_malloc(sizeof(struct ht_shared_table));
+    if (!table) {
+        ht_set_error("cannot allocate shared table: %m");
+        return NULL;
+    }
+
+    table->region = region;
+    table->region_sz = region_sz;
+
+    table->header = (struct ht_shared_header *)region;
+    table->slots =
+        (struct ht_shared_slot *)(region + table->header->slots_offset);
+
+    return table;
+}
+
+static int
+ht_shared_table_check_data(struct ht_shared_table *table) {
+    const struct ht_shared_header *header;
+
+    header = table->header;
+
+    if (header->data_top < header->data_offset
+     || header->data_top > header->region_sz) {
+        ht_set_error("invalid shared table: inconsistent data area");
+        return -1;
+    }
+
+    /* Only the heads of free lists are checked; links are checked when
+     * blocks are reused. */
+    for (unsigned int class = 0; class < HT_SHARED_NB_CLASSES; class++) {
+        uint64_t offset;
+
+        offset = header->free_lists[class];
+        if (offset != 0
+         && !ht_shared_table_valid_block(header, offset, class)) {
+            ht_set_error("invalid shared table: inconsistent free list");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static bool
+ht_shared_table_valid_block(const struct ht_shared_header *header,
+                            uint64_t offset, unsigned int class) {
+    return class >= HT_SHARED_MIN_CLASS
+        && offset >= header->data_offset
+        && offset % 8 == 0
+        && offset <= header->data_top
+        && ((uint64_t)1 << class) <= header->data_top - offset;
+}
+
+static int
+ht_shared_table_acquire(struct ht_shared_table *table) {
+    struct ht_shared_header *header;
+    int ret;
+
+    header = table->header;
+
+    ret = pthread_mutex_lock(&header->lock);
+    if (ret == EOWNERDEAD) {
+        /* The previous owner died with the lock held. Lookups do not
+         * change the table, but an interrupted modification may have left
+         * slots, records or free lists in any state. */
+        if (header->modifying)
+            header->corrupted = 1;
+
+        pthread_mutex_consistent(&header->lock);
+    } else if (ret != 0) {
+        ht_set_error("cannot lock shared table: %s", strerror(ret));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+ht_shared_table_lock(struct ht_shared_table *table, bool modify) {
+    struct ht_shared_header *header;
+
+    header = table->header;
+
+    if (ht_shared_table_acquire(table) == -1)
+        return -1;
+
+    if (header->corrupted) {
+        ht_set_error("shared table corrupted by a process which died while "
+                     "modifying it");
+        ht_shared_table_unlock(table);
+        return -1;
+    }
+
+    header->modifying = modify;
+    return 0;
+}
+
+static void
+ht_shared_table_unlock(struct ht_shared_table *table) {
+    table->header->modifying = 0;
+    pthread_mutex_unlock(&table->header->lock);
+}
+
+static struct ht_shared_slot *
+ht_shared_table_find(struct ht_shared_table *table,
+                     const void *key, size_t key_sz, uint64_t hash) {
+    uint64_t mask, idx;
+
+    /* There is always at least one empty slot, so the loop ends. */
+    mask = table->header->nb_slots - 1;
+    idx = ht_hash_mix64(hash) & mask;
+
+    for (;;) {
+        struct ht_shared_slot *slot;
+        const uint8_t *record;
+        uint32_t record_key_sz;
+
+        slot = table->slots + idx;
+        if (slot->offset == 0)
+            return slot;
+
+        if (slot->hash == hash) {
+            record = table->region + slot->offset;
+            memcpy(&record_key_sz, record, sizeof(uint32_t));
+
+            if (record_key_sz == key_sz
+             && memcmp(record + 8, key, key_sz) == 0) {
+                return slot;
+            }
+        }
+
+        idx = (idx + 1) & mask;
+    }
+}
+
+static uint64_t
+ht_shared_table_alloc(struct ht_shared_table *table, size_t sz) {
+    struct ht_shared_header *header;
+    unsigned int class;
+    uint64_t offset;
+
+    header = table->header;
+
+    class = ht_shared_class(sz);
+    if (class >= HT_SHARED_NB_CLASSES) {
+        ht_set_error("record too large");
+        return 0;
+    }
+
+    offset = header->free_lists[class];
+    if (offset != 0) {
+        uint64_t next;
+
+        memcpy(&next, table->region + offset, sizeof(uint64_t));
+        if (next != 0 && !ht_shared_table_valid_block(header, next, class)) {
+            ht_set_error("shared table corrupted: invalid free list");
+            return 0;
+        }
+
+        header->free_lists[class] = next;
+        return offset;
+    }
+
+    if (((uint64_t)1 << class) > header->region_sz - header->data_top) {
+        ht_set_error("no space left in shared table");
+        return 0;
+    }
+
+    offset = header->data_top;
+    header->data_top += (uint64_t)1 << class;
+
+    return offset;
+}
+
+static void
+ht_shared_table_free(struct ht_shared_table *table, uint64_t offset) {
+    struct ht_shared_header *header;
+    uint32_t key_sz, value_sz;
+    unsigned int class;
+    uint8_t *record;
+
+    header = table->header;
+    record = table->region + offset;
+
+    memcpy(&key_sz, record, sizeof(uint32_t));
+    memcpy(&value_sz, record + 4, sizeof(uint32_t));
+
+    class = ht_shared_class(8 + (size_t)key_sz + value_sz);
+
+    memcpy(record, &header->free_lists[class], sizeof(uint64_t));
+    header->free_lists[class] = offset;
+}
+
+static uint64_t
+ht_shared_table_write_record(struct ht_shared_table *table, uint64_t offset,
+                             const void *key, size_t key_sz,
+                             const void *value, size_t value_sz) {
+    uint32_t record_key_sz, record_value_sz;
+    uint8_t *record;
+    size_t sz;
+
+    sz = 8 + key_sz + value_sz;
+
+    /* Records of an existing entry are rewritten in place when the new one
+     * belongs to the same size class. */
+    if (offset != 0) {
+        record = table->region + offset;
+
+        memcpy(&record_key_sz, record, sizeof(uint32_t));
+        memcpy(&record_value_sz, record + 4, sizeof(uint32_t));
+
+        if (ht_shared_class(8 + (size_t)record_key_sz + record_value_sz)
+            != ht_shared_class(sz)) {
+            uint64_t new_offset;
+
+            new_offset = ht_shared_table_alloc(table, sz);
+            if (new_offset == 0)
+                return 0;
+
+            ht_shared_table_free(table, offset);
+            offset = new_offset;
+        }
+    } else {
+        offset = ht_shared_table_alloc(table, sz);
+        if (offset == 0)
+            return 0;
+    }
+
+    record = table->region + offset;
+
+    record_key_sz = (uint32_t)key_sz;
+    record_value_sz = (uint32_t)value_sz;
+
+    memcpy(record, &record_key_sz, sizeof(uint32_t));
+    memcpy(record + 4, &record_value_sz, sizeof(uint32_t));
+    memcpy(record + 8, key, key_sz);
+    if (value_sz > 0)
+        memcpy(record + 8 + key_sz, value, value_sz);
+
+    return offset;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Slabs allocate blocks whose size is the base size of the slab multiplied
+ * by a power of two, one size class per power of two. Blocks are carved
+ * from chunks obtained from the allocator of the slab; freed blocks are kept
+ * in a free list per class and are only returned to the allocator, all at
+ * once, when the slab is released.
+ *
+ * The first chunk of a class contains a few blocks, and each new chunk
+ * contains twice as many blocks as the previous one up to
+ * HT_SLAB_MAX_CHUNK_SZ, so that small tables stay small. */
+
+#define HT_SLAB_MIN_CHUNK_NB_BLOCKS 16
+#define HT_SLAB_MAX_CHUNK_SZ        (64 * 1024)
+
+struct ht_slab_chunk {
+    struct ht_slab_chunk *next;
+    size_t sz;
+} __attribute__((aligned(16)));
+
+struct ht_slab_block {
+    struct ht_slab_block *next;
+};
+
+void
+ht_slab_init(struct ht_slab *slab, const struct ht_allocator *allocator,
+             size_t base_sz) {
+    assert(base_sz >= sizeof(struct ht_slab_block));
+
+    memset(slab, 0, sizeof(struct ht_slab));
+
+    slab->allocator = allocator;
+    slab->base_sz = base_sz;
+
+    for (unsigned int c = 0; c < HT_SLAB_NB_CLASSES; c++)
+        slab->classes[c].chunk_nb_blocks = HT_SLAB_MIN_CHUNK_NB_BLOCKS;
+}
+
+void
+ht_slab_release(struct ht_slab *slab) {
+    struct ht_slab_chunk *chunk;
+
+    chunk = slab->chunks;
+    while (chunk) {
+        struct ht_slab_chunk *next;
+
+        next = chunk->next;
+        ht_allocator_free(slab->allocator, chunk, chunk->sz);
+        chunk = next;
+    }
+
+    slab->chunks = NULL;
+
+    for (unsigned int c = 0; c < HT_SLAB_NB_CLASSES; c++) {
+        struct ht_slab_class *class;
+
+        class = slab->classes + c;
+
+        class->free_blocks = NULL;
+        class->next_block = NULL;
+        class->end = NULL;
+        class->chunk_nb_blocks = HT_SLAB_MIN_CHUNK_NB_BLOCKS;
+    }
+}
+
+size_t
+ht_slab_memory_size(const struct ht_slab *slab) {
+    size_t sz;
+
+    sz = 0;
+    for (const struct ht_slab_chunk *chunk = slab->chunks; chunk;
+         chunk = chunk->next) {
+        sz += chunk->sz;
+    }
+
+    return sz;
+}
+
+void *
+ht_slab_alloc(struct ht_slab *slab, unsigned int class_idx) {
+    struct ht_slab_class *class;
+    struct ht_slab_block *block;
+    size_t block_sz;
+
+    assert(class_idx < HT_SLAB_NB_CLASSES);
+
+    class = slab->classes + class_idx;
+    block_sz = slab->base_sz << class_idx;
+
+    if (class->free_blocks) {
+        block = class->free_blocks;
+        class->free_blocks = block->next;
+        return block;
+    }
+
+    if (class->next_block == class->end) {
+        struct ht_slab_chunk *chunk;
+        size_t chunk_sz;
+
+        chunk_sz = sizeof(struct ht_slab_chunk)
+                 + class->chunk_nb_blocks * block_sz;
+
+        chunk = ht_allocator_malloc(slab->allocator, chunk_sz);
+        if (!chunk)
+            return NULL;
+
+        chunk->sz = chunk_sz;
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+
+        class->next_block = (char *)(chunk + 1);
+        class->end = class->next_block + class->chunk_nb_blocks * block_sz;
+
+        if (class->chunk_nb_blocks * block_sz * 2 <= HT_SLAB_MAX_CHUNK_SZ)
+            class->chunk_nb_blocks *= 2;
+    }
+
+    block = (struct ht_slab_block *)class->next_block;
+    class->next_block += block_sz;
+
+    return block;
+}
+
+void
+ht_slab_free(struct ht_slab *slab, void *ptr, unsigned int class_idx) {
+    struct ht_slab_class *class;
+    struct ht_slab_block *block;
+
+    assert(class_idx < HT_SLAB_NB_CLASSES);
+
+    if (!ptr)
+        return;
+
+    class = slab->classes + class_idx;
+
+    block = ptr;
+    block->next = class->free_blocks;
+    class->free_blocks = block;
+}
@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Snapshot format, all integers being little endian:
+ *
+ * Header:
+ *   magic        8 bytes  "htsnap\0\0"
+ *   version      uint32
+ *   flags        uint32   HT_SNAPSHOT_FLAG_*
+ *   seed         uint64   seed of the 64 bit hash function
+ *   nb_entries   uint64
+ *
+ * Entries:
+ *   hash         uint64
+ *   key          written by the key codec
+ *   value        written by the value codec, if any
+ *
+ * Trailer:
+ *   nb_entries   uint64   same as in the header, detects truncation
+ *
+ * Snapshots are written and read sequentially, so they can be streamed
+ * through pipes or sockets, and never require more memory than the table. */
+
+#define HT_SNAPSHOT_MAGIC   "htsnap\0\0"
+#define HT_SNAPSHOT_VERSION 1
+
+#define HT_SNAPSHOT_FLAG_HASH64 0x01
+#define HT_SNAPSHOT_FLAG_VALUES 0x02
+
+#define HT_SNAPSHOT_HEADER_SZ 32
+
+/* Number of entries a table is resized for when loading a snapshot whose
+ * size is unknown; the table grows as usual beyond. */
+#define HT_SNAPSHOT_MAX_RESERVE ((uint64_t)1 << 20)
+
+/* Strings longer than this are considered to be corrupted data */
+#define HT_SNAPSHOT_MAX_STRING_SZ ((uint32_t)1 << 30)
+
+static void ht_snapshot_encode64(uint8_t *, uint64_t);
+static uint64_t ht_snapshot_decode64(const uint8_t *);
+static void ht_snapshot_encode32(uint8_t *, uint32_t);
+static uint32_t ht_snapshot_decode32(const uint8_t *);
+
+static int ht_snapshot_write(FILE *, const void *, size_t);
+static int ht_snapshot_read(FILE *, void *, size_t);
+static void ht_snapshot_codec_error(FILE *, const char *);
+static int ht_snapshot_write64(FILE *, uint64_t);
+static int ht_snapshot_read64(FILE *, uint64_t *);
+static uint64_t ht_snapshot_max_entries(FILE *);
+
+static int ht_codec_write_int32(FILE *, const void *, void *);
+static int ht_codec_read_int32(FILE *, void **, void *);
+static int ht_codec_write_string(FILE *, const void *, void *);
+static int ht_codec_read_string(FILE *, void **, void *);
+static void ht_codec_free_string(void *, void *);
+
+static void ht_snapshot_free(const struct ht_codec *, void *);
+static void ht_snapshot_unload(struct ht_table *, const struct ht_codec *,
+                               const struct ht_codec *);
+
+const struct ht_codec ht_codec_int32 = {
+    .write = ht_codec_write_int32,
+    .read = ht_codec_read_int32,
+};
+
+const struct ht_codec ht_codec_string = {
+    .write = ht_codec_write_string,
+    .read = ht_codec_read_string,
+    .free = ht_codec_free_string,
+};
+
+int
+ht_table_save(struct ht_table *table, FILE *file,
+              const struct ht_codec *key_codec,
+              const struct ht_codec *value_codec) {
+    uint8_t header[HT_SNAPSHOT_HEADER_SZ];
+    struct ht_table_entry *entry;
+    size_t bucket, idx;
+    uint32_t flags;
+    bool int32_entries, string_keys;
+
+    flags = 0;
+    if (table->hash64_func)
+        flags |= HT_SNAPSHOT_FLAG_HASH64;
+    if (value_codec)
+        flags |= HT_SNAPSHOT_FLAG_VALUES;
+
+    memcpy(header, HT_SNAPSHOT_MAGIC, 8);
+    ht_snapshot_encode32(header + 8, HT_SNAPSHOT_VERSION);
+    ht_snapshot_encode32(header + 12, flags);
+    ht_snapshot_encode64(header + 16, table->seed);
+    ht_snapshot_encode64(header + 24, table->nb_entries);
+
+    if (ht_snapshot_write(file, header, sizeof(header)) == -1)
+        return -1;
+
+    /* Entries made of integers only are encoded with a single write, and
+     * the hash and length of string keys are written together. */
+    int32_entries = key_codec->write == ht_codec_write_int32
+                 && (!value_codec
+                     || value_codec->write == ht_codec_write_int32);
+    string_keys = key_codec->write == ht_codec_write_string;
+
+    bucket = 0;
+    idx = 0;
+
+    while ((entry = ht_table_next_entry(table, &bucket, &idx))) {
+        if (int32_entries) {
+            uint8_t data[16];
+            size_t sz;
+
+            ht_snapshot_encode64(data, entry->hash);
+            ht_snapshot_encode32(data + 8,
+                                 (uint32_t)HT_POINTER_TO_INT32(entry->key));
+            sz = 12;
+
+            if (value_codec) {
+                ht_snapshot_encode32(data + 12,
+                        (uint32_t)HT_POINTER_TO_INT32(entry->value));
+                sz = 16;
+            }
+
+            if (ht_snapshot_write(file, data, sz) == -1)
+                return -1;
+        } else {
+            if (string_keys) {
+                uint8_t data[12];
+                size_t len;
+
+                len = strlen(entry->key);
+                if (len >= HT_SNAPSHOT_MAX_STRING_SZ) {
+                    ht_set_error("cannot write key: string too long");
+                    return -1;
+                }
+
+                ht_snapshot_encode64(data, entry->hash);
+                ht_snapshot_encode32(data + 8, (uint32_t)len);
+
+                if (ht_snapshot_write(file, data, sizeof(data)) == -1)
+                    return -1;
+                if (ht_snapshot_write(file, entry->key, len) == -1)
+                    return -1;
+            } else {
+                if (ht_snapshot_write64(file, entry->hash) == -1)
+                    return -1;
+
+                if (key_codec->write(file, entry->key,
+                                     key_codec->arg) == -1) {
+                    ht_snapshot_codec_error(file, "cannot write key");
+                    return -1;
+                }
+            }
+
+            if (value_codec
+             && value_codec->write(file, entry->value,
+                                   value_codec->arg) == -1) {
+                ht_snapshot_codec_error(file, "cannot write value");
+                return -1;
+            }
+        }
+
+        if (table->storage != HT_TABLE_STORAGE_CHAINED) {
+            bucket++;
+        } else {
+            idx++;
+        }
+    }
+
+    if (ht_snapshot_write64(file, table->nb_entries) == -1)
+        return -1;
+
+    return 0;
+}
+
+int
+ht_table_load(struct ht_table *table, FILE *file,
+              const struct ht_codec *key_codec,
+              const struct ht_codec *value_codec) {
+    uint8_t header[HT_SNAPSHOT_HEADER_SZ];
+    uint64_t seed, nb_entries, max_entries, trailer;
+    uint32_t version, flags;
+    bool has_values, use_hashes, was_empty;
+
+    assert(table->nb_iterators == 0);
+
+    if (ht_snapshot_read(file, header, sizeof(header)) == -1)
+        return -1;
+
+    if (memcmp(header, HT_SNAPSHOT_MAGIC, 8) != 0) {
+        ht_set_error("invalid snapshot magic number");
+        return -1;
+    }
+
+    version = ht_snapshot_decode32(header + 8);
+    if (version != HT_SNAPSHOT_VERSION) {
+        ht_set_error("unsupported snapshot version %u", version);
+        return -1;
+    }
+
+    flags = ht_snapshot_decode32(header + 12);
+    seed = ht_snapshot_decode64(header + 16);
+    nb_entries = ht_snapshot_decode64(header + 24);
+
+    /* The header may be corrupted: each entry contains at least its hash,
+     * so there cannot be more entries than the rest of the file can hold.
+     * Other inconsistencies are detected by the trailer. */
+    max_entries = ht_snapshot_max_entries(file);
+
+    if (nb_entries > SIZE_MAX - table->nb_entries
+     || (max_entries != UINT64_MAX && nb_entries > max_entries)) {
+        ht_set_error("invalid number of entries");
+        return -1;
+    }
+
+    has_values = (flags & HT_SNAPSHOT_FLAG_VALUES) != 0;
+    if (has_values && !value_codec) {
+        ht_set_error("missing value codec");
+        return -1;
+    }
+
+    /* Stored hashes can be reused if they were computed the same way. An
+     * empty table adopts the seed of the snapshot. */
+    if (table->hash64_func) {
+        if (!(flags & HT_SNAPSHOT_FLAG_HASH64)) {
+            use_hashes = false;
+        } else if (table->nb_entries == 0 && !table->single_writer) {
+            table->seed = seed;
+            use_hashes = true;
+        } else {
+            use_hashes = (table->seed == seed);
+        }
+    } else {
+        use_hashes = !(flags & HT_SNAPSHOT_FLAG_HASH64);
+    }
+
+    if (max_entries == UINT64_MAX && nb_entries > HT_SNAPSHOT_MAX_RESERVE) {
+        max_entries = HT_SNAPSHOT_MAX_RESERVE;
+    } else {
+        max_entries = nb_entries;
+    }
+
+    if (ht_table_reserve(table, table->nb_entries
+                                + (size_t)max_entries) == -1) {
+        return -1;
+    }
+
+    was_empty = (table->nb_entries == 0);
+
+    for (uint64_t i = 0; i < nb_entries; i++) {
+        void *key, *value;
+        uint64_t hash;
+        int ret;
+
+        if (ht_snapshot_read64(file, &hash) == -1)
+            goto error;
+
+        if (key_codec->read(file, &key, key_codec->arg) == -1) {
+            ht_snapshot_codec_error(file, "cannot read key");
+            goto error;
+        }
+
+        value = NULL;
+        if (has_values
+         && value_codec->read(file, &value, value_codec->arg) == -1) {
+            ht_snapshot_codec_error(file, "cannot read value");
+            ht_snapshot_free(key_codec, key);
+            goto error;
+        }
+
+        if (!use_hashes || hash == HT_UNUSED_HASH)
+            hash = ht_table_hash(table, key);
+
+        /* A key already present, either in the table or earlier in the
+         * snapshot, keeps its entry: the copy just read is released. */
+        ret = ht_table_add_hashed(table, key, value, hash);
+        if (ret != 1) {
+            ht_snapshot_free(key_codec, key);
+            if (has_values)
+                ht_snapshot_free(value_codec, value);
+
+            if (ret == -1)
+                goto error;
+        }
+    }
+
+    if (ht_snapshot_read64(file, &trailer) == -1)
+        goto error;
+
+    if (trailer != nb_entries) {
+        ht_set_error("invalid snapshot trailer");
+        goto error;
+    }
+
+    return 0;
+
+error:
+    /* A table which was empty is emptied again, so that the caller does
+     * not have to tell entries of the snapshot from its own ones. */
+    if (was_empty)
+        ht_snapshot_unload(table, key_codec, has_values ? value_codec : NULL);
+
+    return -1;
+}
+
+static void
+ht_snapshot_free(const struct ht_codec *codec, void *ptr) {
+    if (codec->free)
+        codec->free(ptr, codec->arg);
+}
+
+static void
+ht_snapshot_unload(struct ht_table *table, const struct ht_codec *key_codec,
+                   const struct ht_codec *value_codec) {
+    struct ht_table_entry *entry;
+    size_t bucket, idx;
+
+    bucket = 0;
+    idx = 0;
+
+    while ((entry = ht_table_next_entry(table, &bucket, &idx))) {
+        ht_snapshot_free(key_codec, entry->key);
+        if (value_codec)
+            ht_snapshot_free(value_codec, entry->value);
+
+        if (table->storage != HT_TABLE_STORAGE_CHAINED) {
+            bucket++;
+        } else {
+            idx++;
+        }
+    }
+
+    ht_table_clear(table);
+}
+
+static void
+ht_snapshot_encode64(uint8_t *data, uint64_t n) {
+    for (int i = 0; i < 8; i++)
+        data[i] = (uint8_t)(n >> (i * 8));
+}
+
+static uint64_t
+ht_snapshot_decode64(const uint8_t *data) {
+    uint64_t n;
+
+    n = 0;
+    for (int i = 0; i < 8; i++)
+        n |= (uint64_t)data[i] << (i * 8);
+
+    return n;
+}
+
+static void
+ht_snapshot_encode32(uint8_t *data, uint32_t n) {
+    for (int i = 0; i < 4; i++)
+        data[i] = (uint8_t)(n >> (i * 8));
+}
+
+static uint32_t
+ht_snapshot_decode32(const uint8_t *data) {
+    uint32_t n;
+
+    n = 0;
+    for (int i = 0; i < 4; i++)
+        n |= (uint32_t)data[i] << (i * 8);
+
+    return n;
+}
+
+static int
+ht_snapshot_write(FILE *file, const void *data, size_t sz) {
+    if (fwrite(data, 1, sz, file) != sz) {
+        ht_set_error("cannot write snapshot: %m");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+ht_snapshot_read(FILE *file, void *data, size_t sz) {
+    if (fread(data, 1, sz, file) != sz) {
+        if (ferror(file)) {
+            ht_set_error("cannot read snapshot: %m");
+        } else {
+            ht_set_error("truncated snapshot");
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+ht_snapshot_codec_error(FILE *file, const char *msg) {
+    /* Codecs only report failures, the cause is found in the stream. */
+    if (ferror(file)) {
+        ht_set_error("%s: %m", msg);
+    } else if (feof(file)) {
+        ht_set_error("truncated snapshot");
+    } else {
+        ht_set_error("%s", msg);
+    }
+}
+
+static int
+ht_snapshot_write64(FILE *file, uint64_t n) {
+    uint8_t data[8];
+
+    ht_snapshot_encode64(data, n);
+    return ht_snapshot_write(file, data, sizeof(data));
+}
+
+static int
+ht_snapshot_read64(FILE *file, uint64_t *pn) {
+    uint8_t data[8];
+
+    if (ht_snapshot_read(file, data, sizeof(data)) == -1)
+        return -1;
+
+    *pn = ht_snapshot_decode64(data);
+    return 0;
+}
+
+static uint64_t
+ht_snapshot_max_entries(FILE *file) {
+    struct stat st;
+    off_t offset;
+    int fd;
+
+    /* The size of pipes, sockets and memory streams is unknown. */
+    fd = fileno(file);
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return UINT64_MAX;
+
+    offset = ftello(file);
+    if (offset == -1 || offset > st.st_size)
+        return UINT64_MAX;
+
+    /* Each entry contains its hash, and is followed by the trailer. */
+    if (st.st_size - offset < 8)
+        return 0;
+
+    return (uint64_t)(st.st_size - offset - 8) / 8;
+}
+
+static int
+ht_codec_write_int32(FILE *file, const void *ptr, void *arg) {
+    uint8_t data[4];
+
+    ht_snapshot_encode32(data, (uint32_t)HT_POINTER_TO_INT32(ptr));
+    return ht_snapshot_write(file, data, sizeof(data));
+}
+
+static int
+ht_codec_read_int32(FILE *file, void **pptr, void *arg) {
+    uint8_t data[4];
+
+    if (ht_snapshot_read(file, data, sizeof(data)) == -1)
+        return -1;
+
+    *pptr = HT_INT32_TO_POINTER((int32_t)ht_snapshot_decode32(data));
+    return 0;
+}
+
+static int
+ht_codec_write_string(FILE *file, const void *ptr, void *arg) {
+    uint8_t data[4];
+    size_t len;
+
+    len = strlen(ptr);
+    if (len >= HT_SNAPSHOT_MAX_STRING_SZ)
+        return -1;
+
+    ht_snapshot_encode32(data, (uint32_t)len);
+
+    if (ht_snapshot_write(file, data, sizeof(data)) == -1)
+        return -1;
+
+    return ht_snapshot_write(file, ptr, len);
+}
+
+static int
+ht_codec_read_string(FILE *file, void **pptr, void *arg) {
+    uint8_t data[4];
+    uint32_t len;
+    char *str;
+
+    if (ht_snapshot_read(file, data, sizeof(data)) == -1)
+        return -1;
+
+    len = ht_snapshot_decode32(data);
+    if (len >= HT_SNAPSHOT_MAX_STRING_SZ)
+        return -1;
+
+    str = ht_malloc((size_t)len + 1);
+    if (!str)
+        return -1;
+
+    if (ht_snapshot_read(file, str, len) == -1) {
+        ht_free(str);
+        return -1;
+    }
+
+    str[len] = '\0';
+
+    *pptr = str;
+    return 0;
+}
+
+static void
+ht_codec_free_string(void *ptr, void *arg) {
+    ht_free(ptr);
+}
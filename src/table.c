@@ -19,55 +19,124 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "internal.h"
 #include "hashtable.h"
 
-#define HT_UNUSED_HASH 0
+#define HT_TABLE_MIN_BUCKETS_SZ 4
 
-struct ht_table_entry {
-    void *key;
-    void *value;
-    uint32_t hash;
-};
+/* Number of buckets migrated by each operation during an incremental
+ * resize. */
+#define HT_TABLE_REHASH_STEP 1
 
-#define HT_TABLE_ENTRY_IS_USED(entry_) ((entry_)->hash != HT_UNUSED_HASH)
+/* Number of lookups whose memory accesses are overlapped in
+ * ht_table_get_many() and ht_table_contains_many(). */
+#define HT_TABLE_BATCH_SZ 16
 
-struct ht_table_bucket {
-    struct ht_table_entry *entries;
-    size_t sz;
-};
+static int ht_table_check_policy(const struct ht_table *);
+static int ht_table_resize(struct ht_table *, size_t);
+static int ht_table_start_resize(struct ht_table *, size_t);
+static int ht_table_rehash(struct ht_table *, size_t);
+static void ht_table_rehash_step(struct ht_table *);
+static void ht_table_release_entries(struct ht_table *);
+static void ht_table_free_large_entries(struct ht_table *,
+                                        struct ht_table_bucket *, size_t);
+static struct ht_table_bucket *ht_table_alloc_bucket_array(struct ht_table *,
+                                                           size_t);
+static void ht_table_free_bucket_array(struct ht_table *,
+                                       struct ht_table_bucket *, size_t);
+static int ht_table_grow_in_place(struct ht_table *, size_t);
+static int ht_table_entries_class(size_t);
+static struct ht_table_entry *ht_table_grow_entries(struct ht_table *,
+                                                    struct ht_table_entry *,
+                                                    size_t, size_t);
+static void ht_table_free_entries(struct ht_table *, struct ht_table_entry *,
+                                  size_t);
+static struct ht_table_entry *ht_table_find_entry(struct ht_table *,
+                                                  const void *, uint64_t,
+                                                  ht_equal_func);
+static struct ht_table_entry *ht_table_bucket_entry(struct ht_table *,
+                                                    struct ht_table_bucket *,
+                                                    const void *, uint64_t,
+                                                    ht_equal_func);
+static void ht_table_iterator_advance(struct ht_table_iterator *);
+static void ht_table_chained_stats(struct ht_table *,
+                                   struct ht_table_stats *);
+static int ht_table_upsert_in(struct ht_table *,
+                              struct ht_table_bucket *, size_t,
+                              void *, uint64_t, bool,
+                              struct ht_table_entry **);
+static int ht_table_insert_in(struct ht_table *,
+                              struct ht_table_bucket *, size_t,
+                              void *, void *, uint64_t, bool);
+static void ht_table_set_entry(struct ht_table *, struct ht_table_entry *,
+                               void *, void *, bool);
+static uint64_t ht_table_lookup_hash(struct ht_table *,
+                                     const struct ht_lookup *, const void *);
+static struct ht_table_entry *ht_table_entry(struct ht_table *, const void *);
+static size_t ht_table_find_many(struct ht_table *, const void * const *,
+                                 size_t, struct ht_table_entry **);
 
-struct ht_table {
-    size_t nb_entries;
+static inline size_t
+ht_table_bucket_idx(uint64_t hash, size_t sz) {
+    return (size_t)ht_hash_mix64(hash) & (sz - 1);
+}
 
-    struct ht_table_bucket *buckets;
-    size_t buckets_sz;
+void
+ht_table_default_policy(enum ht_table_storage storage,
+                        struct ht_table_policy *policy) {
+    switch (storage) {
+    case HT_TABLE_STORAGE_OPEN:
+        policy->max_load_factor = 0.875;
+        policy->min_load_factor = 0.125;
+        break;
+
+    case HT_TABLE_STORAGE_COMPACT:
+        /* The entry array is as large as the maximum number of entries,
+         * a lower load factor only costs index slots. */
+        policy->max_load_factor = 0.75;
+        policy->min_load_factor = 0.125;
+        break;
+
+    default:
+        policy->max_load_factor = 1.0;
+        policy->min_load_factor = 0.25;
+        break;
+    }
 
-    ht_hash_func hash_func;
-    ht_equal_func equal_func;
+    policy->growth_factor = 2.0;
+    policy->shrink = true;
+}
 
-    int nb_iterators;
-};
+struct ht_table *
+ht_table_new(ht_hash_func hash_func, ht_equal_func equal_func) {
+    return ht_table_new_ex(hash_func, equal_func, NULL);
+}
 
-struct ht_table_iterator {
-    struct ht_table *table;
-    size_t bucket;
-    size_t entry;
-};
+struct ht_table *
+ht_table_new_with_capacity(ht_hash_func hash_func, ht_equal_func equal_func,
+                           size_t capacity) {
+    struct ht_table_options options;
 
-static int ht_table_resize(struct ht_table *, size_t);
-static int ht_table_insert_in(struct ht_table *,
-                              struct ht_table_bucket *, size_t,
-                              void *, void *, uint32_t, bool);
-static struct ht_table_entry *ht_table_entry(struct ht_table *, const void *);
+    memset(&options, 0, sizeof(struct ht_table_options));
+    options.capacity = capacity;
 
+    return ht_table_new_ex(hash_func, equal_func, &options);
+}
 
 struct ht_table *
-ht_table_new(ht_hash_func hash_func, ht_equal_func equal_func) {
+ht_table_new_ex(ht_hash_func hash_func, ht_equal_func equal_func,
+                const struct ht_table_options *options) {
+    const struct ht_allocator *allocator;
     struct ht_table *table;
+    size_t capacity;
+
+    allocator = ht_options_allocator(options);
+    if (!allocator)
+        return NULL;
 
-    table = ht_malloc(sizeof(struct ht_table));
+    table = ht_allocator_malloc(allocator, sizeof(struct ht_table));
     if (!table) {
         ht_set_error("cannot allocate table: %m");
         return NULL;
@@ -75,35 +144,134 @@ ht_table_new(ht_hash_func hash_func, ht_equal_func equal_func) {
 
     memset(table, 0, sizeof(struct ht_table));
 
-    table->buckets_sz = 4;
-    table->buckets = ht_calloc(table->buckets_sz,
-                               sizeof(struct ht_table_bucket));
-    if (!table->buckets) {
-        ht_set_error("cannot allocate buckets: %m");
-        ht_table_delete(table);
-        return NULL;
+    table->allocator = *allocator;
+    ht_slab_init(&table->entries_slab, &table->allocator,
+                 sizeof(struct ht_table_entry));
+
+    capacity = 0;
+    if (options) {
+        table->storage = options->storage;
+        table->incremental_resize = options->incremental_resize;
+        if (options->hooks)
+            table->hooks = *options->hooks;
+        table->huge_pages = options->huge_pages;
+        capacity = options->capacity;
     }
 
     table->hash_func = hash_func;
     table->equal_func = equal_func;
 
+    if (options && options->hash64_func) {
+        table->hash64_func = options->hash64_func;
+        table->seed = options->random_seed ? ht_random_seed() : options->seed;
+    } else if (!hash_func) {
+        ht_set_error("missing hash function");
+        ht_table_delete(table);
+        return NULL;
+    }
+
+    if (table->incremental_resize
+        && table->storage != HT_TABLE_STORAGE_CHAINED) {
+        ht_set_error("incremental resizing requires chained storage");
+        ht_table_delete(table);
+        return NULL;
+    }
+
+    if (options && options->single_writer) {
+        if (table->storage != HT_TABLE_STORAGE_OPEN) {
+            ht_set_error("single writer mode requires open storage");
+            ht_table_delete(table);
+            return NULL;
+        }
+
+        table->qsbr = ht_qsbr_new(&table->allocator);
+        if (!table->qsbr) {
+            ht_table_delete(table);
+            return NULL;
+        }
+
+        table->single_writer = true;
+    }
+
+    if (options && options->policy) {
+        table->policy = *options->policy;
+    } else {
+        ht_table_default_policy(table->storage, &table->policy);
+    }
+
+    if (ht_table_check_policy(table) == -1) {
+        ht_table_delete(table);
+        return NULL;
+    }
+
+    switch (table->storage) {
+    case HT_TABLE_STORAGE_CHAINED:
+        table->buckets_sz = ht_table_capacity_size(table, capacity,
+                                                   HT_TABLE_MIN_BUCKETS_SZ);
+        if (table->buckets_sz == 0) {
+            ht_table_delete(table);
+            return NULL;
+        }
+
+        table->buckets = ht_table_alloc_bucket_array(table,
+                                                     table->buckets_sz);
+        if (!table->buckets) {
+            ht_set_error("cannot allocate buckets: %m");
+            ht_table_allocation_failed(table, table->buckets_sz
+                                       * sizeof(struct ht_table_bucket));
+            ht_table_delete(table);
+            return NULL;
+        }
+
+        ht_table_update_limits(table, table->buckets_sz);
+        break;
+
+    case HT_TABLE_STORAGE_OPEN:
+        if (ht_table_open_init(table, capacity) == -1) {
+            ht_table_delete(table);
+            return NULL;
+        }
+        break;
+
+    case HT_TABLE_STORAGE_COMPACT:
+        if (ht_table_compact_init(table, capacity) == -1) {
+            ht_table_delete(table);
+            return NULL;
+        }
+        break;
+
+    default:
+        ht_set_error("unknown table storage %d", (int)table->storage);
+        ht_table_delete(table);
+        return NULL;
+    }
+
     return table;
 }
 
 void
 ht_table_delete(struct ht_table *table) {
+    struct ht_allocator allocator;
+
     if (!table)
         return;
 
     assert(table->nb_iterators == 0);
 
-    for (size_t i = 0; i < table->buckets_sz; i++)
-        ht_free(table->buckets[i].entries);
+    ht_table_release_entries(table);
 
-    ht_free(table->buckets);
+    ht_table_free_bucket_array(table, table->buckets, table->buckets_sz);
+    ht_table_free_bucket_array(table, table->old_buckets,
+                               table->old_buckets_sz);
+
+    ht_table_open_free(table);
+    ht_table_compact_free(table);
+    ht_qsbr_delete(table->qsbr);
+
+    allocator = table->allocator;
 
     memset(table, 0, sizeof(struct ht_table));
-    ht_free(table);
+    ht_allocator_free(&allocator, table, sizeof(struct ht_table));
 }
 
 size_t
@@ -120,69 +288,127 @@ void
 ht_table_clear(struct ht_table *table) {
     assert(table->nb_iterators == 0);
 
-    for (size_t b = 0; b < table->buckets_sz; b++) {
-        struct ht_table_bucket *bucket;
+    if (table->storage == HT_TABLE_STORAGE_OPEN) {
+        ht_table_open_clear(table);
+        table->nb_entries = 0;
+        return;
+    }
 
-        bucket = table->buckets + b;
-        memset(bucket->entries, 0, bucket->sz * sizeof(struct ht_table_entry));
+    if (table->storage == HT_TABLE_STORAGE_COMPACT) {
+        ht_table_compact_clear(table);
+        table->nb_entries = 0;
+        return;
     }
 
+    /* Entry arrays are released all at once; buckets will allocate new
+     * ones from the slab as entries are inserted. */
+    ht_table_release_entries(table);
+
+    ht_table_free_bucket_array(table, table->old_buckets,
+                               table->old_buckets_sz);
+    table->old_buckets = NULL;
+    table->old_buckets_sz = 0;
+    table->rehash_idx = 0;
+
+    memset(table->buckets, 0,
+           table->buckets_sz * sizeof(struct ht_table_bucket));
+
     table->nb_entries = 0;
 }
 
 int
-ht_table_insert(struct ht_table *table, void *key, void *value) {
-    uint32_t hash;
-    int ret;
+ht_table_reserve(struct ht_table *table, size_t capacity) {
+    size_t sz;
 
     assert(table->nb_iterators == 0);
 
-    if (table->nb_entries >= table->buckets_sz) {
-        if (ht_table_resize(table, table->buckets_sz * 2) == -1)
-            return -1;
-    }
+    if (table->storage == HT_TABLE_STORAGE_OPEN)
+        return ht_table_open_reserve(table, capacity);
+    if (table->storage == HT_TABLE_STORAGE_COMPACT)
+        return ht_table_compact_reserve(table, capacity);
 
-    hash = table->hash_func(key);
-    if (hash == HT_UNUSED_HASH)
-        hash++;
+    if (ht_table_rehash(table, SIZE_MAX) == -1)
+        return -1;
 
-    ret = ht_table_insert_in(table, table->buckets, table->buckets_sz,
-                             key, value, hash, false);
-    if (ret == -1)
+    sz = ht_table_capacity_size(table, capacity, HT_TABLE_MIN_BUCKETS_SZ);
+    if (sz == 0)
         return -1;
+    if (sz <= table->buckets_sz)
+        return 0;
 
-    if (ret == 1)
-        table->nb_entries++;
+    return ht_table_resize(table, sz);
+}
 
-    return ret;
+int
+ht_table_shrink_to_fit(struct ht_table *table) {
+    size_t sz;
+
+    assert(table->nb_iterators == 0);
+
+    if (table->storage == HT_TABLE_STORAGE_OPEN)
+        return ht_table_open_shrink_to_fit(table);
+    if (table->storage == HT_TABLE_STORAGE_COMPACT)
+        return ht_table_compact_shrink_to_fit(table);
+
+    if (ht_table_rehash(table, SIZE_MAX) == -1)
+        return -1;
+
+    sz = ht_table_capacity_size(table, table->nb_entries,
+                                HT_TABLE_MIN_BUCKETS_SZ);
+    if (sz == table->buckets_sz)
+        return 0;
+
+    return ht_table_resize(table, sz);
+}
+
+int
+ht_table_insert(struct ht_table *table, void *key, void *value) {
+    assert(table->nb_iterators == 0);
+
+    return ht_table_insert_hashed(table, key, value,
+                                  ht_table_hash(table, key));
 }
 
 int
 ht_table_insert2(struct ht_table *table, void *key, void *value,
                  void **old_key, void **old_value) {
     struct ht_table_entry *entry;
+    int ret;
 
     assert(table->nb_iterators == 0);
 
-    entry = ht_table_entry(table, key);
-    if (entry) {
-        if (old_key)
-            *old_key = entry->key;
-        if (old_value)
-            *old_value = entry->value;
+    ret = ht_table_upsert_entry(table, key, ht_table_hash(table, key), &entry);
+    if (ret == -1)
+        return -1;
 
-        entry->key = key;
-        entry->value = value;
+    if (old_key)
+        *old_key = (ret == 0) ? entry->key : NULL;
+    if (old_value)
+        *old_value = (ret == 0) ? entry->value : NULL;
 
-        return 0;
-    } else {
-        if (old_key)
-            *old_key = NULL;
-        if (old_value)
-            *old_value = NULL;
+    ht_table_set_entry(table, entry, key, value, ret == 1);
+    return ret;
+}
+
+int
+ht_table_upsert(struct ht_table *table, void *key, void ***pvalue) {
+    struct ht_table_entry *entry;
+    int ret;
+
+    assert(table->nb_iterators == 0);
 
-        return ht_table_insert(table, key, value);
+    /* Values written through the pointer would not be published safely. */
+    if (table->single_writer) {
+        ht_set_error("upsert is not supported in single writer mode");
+        return -1;
     }
+
+    ret = ht_table_upsert_entry(table, key, ht_table_hash(table, key), &entry);
+    if (ret == -1)
+        return -1;
+
+    *pvalue = &entry->value;
+    return ret;
 }
 
 int
@@ -208,16 +434,9 @@ ht_table_remove2(struct ht_table *table, const void *key,
     if (old_value)
         *old_value = entry->value;
 
-    entry->key = NULL;
-    entry->value = NULL;
-    entry->hash = HT_UNUSED_HASH;
-
-    if (table->buckets_sz > 4 && table->nb_entries * 4 <= table->buckets_sz) {
-        if (ht_table_resize(table, table->buckets_sz / 2) == -1)
-            return -1;
-    }
+    if (ht_table_erase(table, entry) == -1)
+        return -1;
 
-    table->nb_entries--;
     return 1;
 }
 
@@ -229,7 +448,7 @@ ht_table_get(struct ht_table *table, const void *key, void **value) {
     if (!entry)
         return 0;
 
-    *value = entry->value;
+    *value = __atomic_load_n(&entry->value, __ATOMIC_ACQUIRE);
     return 1;
 }
 
@@ -238,81 +457,253 @@ ht_table_contains(struct ht_table *table, const void *key) {
     return ht_table_entry(table, key) != NULL;
 }
 
+size_t
+ht_table_get_many(struct ht_table *table, const void * const *keys,
+                  size_t nb_keys, void **values, bool *found) {
+    size_t nb_found;
+
+    nb_found = 0;
+
+    for (size_t i = 0; i < nb_keys; i += HT_TABLE_BATCH_SZ) {
+        struct ht_table_entry *entries[HT_TABLE_BATCH_SZ];
+        size_t nb;
+
+        nb = nb_keys - i;
+        if (nb > HT_TABLE_BATCH_SZ)
+            nb = HT_TABLE_BATCH_SZ;
+
+        nb_found += ht_table_find_many(table, keys + i, nb, entries);
+
+        for (size_t j = 0; j < nb; j++) {
+            values[i + j] = entries[j]
+                ? __atomic_load_n(&entries[j]->value, __ATOMIC_ACQUIRE)
+                : NULL;
+            if (found)
+                found[i + j] = (entries[j] != NULL);
+        }
+    }
+
+    return nb_found;
+}
+
+size_t
+ht_table_contains_many(struct ht_table *table, const void * const *keys,
+                       size_t nb_keys, bool *found) {
+    size_t nb_found;
+
+    nb_found = 0;
+
+    for (size_t i = 0; i < nb_keys; i += HT_TABLE_BATCH_SZ) {
+        struct ht_table_entry *entries[HT_TABLE_BATCH_SZ];
+        size_t nb;
+
+        nb = nb_keys - i;
+        if (nb > HT_TABLE_BATCH_SZ)
+            nb = HT_TABLE_BATCH_SZ;
+
+        nb_found += ht_table_find_many(table, keys + i, nb, entries);
+
+        if (found) {
+            for (size_t j = 0; j < nb; j++)
+                found[i + j] = (entries[j] != NULL);
+        }
+    }
+
+    return nb_found;
+}
+
+int
+ht_table_get_with(struct ht_table *table, const struct ht_lookup *lookup,
+                  const void *key, void **value) {
+    struct ht_table_entry *entry;
+
+    entry = ht_table_find(table, key, ht_table_lookup_hash(table, lookup, key),
+                          lookup->equal_func);
+    if (!entry)
+        return 0;
+
+    *value = __atomic_load_n(&entry->value, __ATOMIC_ACQUIRE);
+    return 1;
+}
+
+bool
+ht_table_contains_with(struct ht_table *table,
+                       const struct ht_lookup *lookup, const void *key) {
+    return ht_table_find(table, key, ht_table_lookup_hash(table, lookup, key),
+                         lookup->equal_func) != NULL;
+}
+
+struct ht_table_reader *
+ht_table_register_reader(struct ht_table *table) {
+    if (!table->single_writer) {
+        ht_set_error("readers can only be registered in single writer mode");
+        return NULL;
+    }
+
+    return ht_qsbr_register(table->qsbr);
+}
+
+void
+ht_table_unregister_reader(struct ht_table_reader *reader) {
+    ht_qsbr_unregister(reader);
+}
+
+void
+ht_table_reader_quiescent(struct ht_table_reader *reader) {
+    ht_qsbr_quiescent(reader);
+}
+
+void
+ht_table_reader_offline(struct ht_table_reader *reader) {
+    ht_qsbr_offline(reader);
+}
+
+void
+ht_table_reader_online(struct ht_table_reader *reader) {
+    ht_qsbr_quiescent(reader);
+}
+
+void
+ht_table_synchronize(struct ht_table *table) {
+    if (table->single_writer)
+        ht_qsbr_synchronize(table->qsbr);
+}
+
 struct ht_table_iterator *
 ht_table_iterate(struct ht_table *table) {
     struct ht_table_iterator *it;
 
-    it = ht_malloc(sizeof(struct ht_table_iterator));
+    it = ht_allocator_malloc(&table->allocator,
+                             sizeof(struct ht_table_iterator));
     if (!it) {
         ht_set_error("cannot allocate iterator: %m");
+        ht_table_allocation_failed(table, sizeof(struct ht_table_iterator));
         return NULL;
     }
 
-    it->table = table;
-    it->bucket = SIZE_MAX;
-    it->entry = 0;
-
-    table->nb_iterators++;
-
+    ht_table_iterator_init(it, table);
     return it;
 }
 
 void
 ht_table_iterator_delete(struct ht_table_iterator *it) {
+    struct ht_table *table;
+
     if (!it)
         return;
 
+    table = it->table;
+
+    ht_table_iterator_release(it);
+    ht_allocator_free(&table->allocator, it,
+                      sizeof(struct ht_table_iterator));
+}
+
+void
+ht_table_iterator_init(struct ht_table_iterator *it, struct ht_table *table) {
+    it->table = table;
+    it->bucket = SIZE_MAX;
+    it->entry = 0;
+
+    table->nb_iterators++;
+}
+
+void
+ht_table_iterator_release(struct ht_table_iterator *it) {
     assert(it->table->nb_iterators > 0);
     it->table->nb_iterators--;
 
     memset(it, 0, sizeof(struct ht_table_iterator));
-    ht_free(it);
 }
 
 int
 ht_table_iterator_next(struct ht_table_iterator *it,
                        void **key, void **value) {
-    if (it->bucket == SIZE_MAX) {
-        it->bucket = 0;
+    struct ht_table_entry *entry;
+
+    ht_table_iterator_advance(it);
+
+    entry = ht_table_next_entry(it->table, &it->bucket, &it->entry);
+    if (!entry) {
+        it->bucket = SIZE_MAX;
         it->entry = 0;
-    } else {
-        it->entry++;
+        return 0;
     }
 
-    for (;;) {
-        struct ht_table_bucket *bucket;
-        struct ht_table_entry *entry;
+    if (key)
+        *key = entry->key;
+    if (value)
+        *value = entry->value;
+
+    return 1;
+}
+
+size_t
+ht_table_iterator_next_batch(struct ht_table_iterator *it,
+                             void **keys, void **values, size_t nb) {
+    struct ht_table *table;
+    struct ht_table_bucket *bucket;
+    size_t nb_entries, last_bucket, last_entry;
 
-        bucket = it->table->buckets + it->bucket;
-        if (it->entry >= bucket->sz) {
-            it->bucket++;
-            bucket++;
+    if (nb == 0)
+        return 0;
 
-            if (it->bucket >= it->table->buckets_sz) {
-                it->bucket = SIZE_MAX;
-                it->entry = 0;
-                return 0;
-            }
+    table = it->table;
 
+    ht_table_iterator_advance(it);
+
+    /* The iterator is left on the last entry returned, so that
+     * ht_table_iterator_remove() and ht_table_iterator_set_value() apply to
+     * it. */
+    if (table->storage != HT_TABLE_STORAGE_CHAINED) {
+        if (table->storage == HT_TABLE_STORAGE_OPEN) {
+            nb_entries = ht_table_open_next_batch(table, &it->bucket,
+                                                  keys, values, nb);
+        } else {
+            nb_entries = ht_table_compact_next_batch(table, &it->bucket,
+                                                     keys, values, nb);
+        }
+
+        if (nb_entries == 0) {
+            it->bucket = SIZE_MAX;
             it->entry = 0;
         }
 
-        if (!bucket->entries)
-            continue;
-        entry = bucket->entries + it->entry;
+        return nb_entries;
+    }
+
+    nb_entries = 0;
+    last_bucket = SIZE_MAX;
+    last_entry = 0;
+
+    while ((bucket = ht_table_iterator_bucket(table, it->bucket))) {
+        for (; it->entry < bucket->sz; it->entry++) {
+            struct ht_table_entry *entry;
+
+            entry = bucket->entries + it->entry;
+            if (!HT_TABLE_ENTRY_IS_USED(entry))
+                continue;
 
-        if (HT_TABLE_ENTRY_IS_USED(entry)) {
-            if (key)
-                *key = entry->key;
-            if (value)
-                *value = entry->value;
-            break;
+            if (keys)
+                keys[nb_entries] = entry->key;
+            if (values)
+                values[nb_entries] = entry->value;
+
+            if (++nb_entries == nb)
+                return nb_entries;
+
+            last_bucket = it->bucket;
+            last_entry = it->entry;
         }
 
-        it->entry++;
+        it->bucket++;
+        it->entry = 0;
     }
 
-    return 1;
+    it->bucket = last_bucket;
+    it->entry = last_entry;
+
+    return nb_entries;
 }
 
 void
@@ -323,7 +714,17 @@ ht_table_iterator_remove(struct ht_table_iterator *it) {
     if (it->bucket == SIZE_MAX)
         return;
 
-    bucket = it->table->buckets + it->bucket;
+    if (it->table->storage == HT_TABLE_STORAGE_OPEN) {
+        ht_table_open_erase(it->table, it->table->slots + it->bucket);
+        return;
+    }
+
+    if (it->table->storage == HT_TABLE_STORAGE_COMPACT) {
+        ht_table_compact_erase(it->table, it->table->entries + it->bucket);
+        return;
+    }
+
+    bucket = ht_table_iterator_bucket(it->table, it->bucket);
     entry = bucket->entries + it->entry;
 
     entry->key = NULL;
@@ -341,7 +742,18 @@ ht_table_iterator_set_value(struct ht_table_iterator *it, void *value) {
     if (it->bucket == SIZE_MAX)
         return;
 
-    bucket = it->table->buckets + it->bucket;
+    if (it->table->storage == HT_TABLE_STORAGE_OPEN) {
+        __atomic_store_n(&it->table->slots[it->bucket].value, value,
+                         __ATOMIC_RELEASE);
+        return;
+    }
+
+    if (it->table->storage == HT_TABLE_STORAGE_COMPACT) {
+        it->table->entries[it->bucket].value = value;
+        return;
+    }
+
+    bucket = ht_table_iterator_bucket(it->table, it->bucket);
     entry = bucket->entries + it->entry;
 
     entry->value = value;
@@ -385,16 +797,275 @@ ht_equal_string(const void *k1, const void *k2) {
     return strcmp(k1, k2) == 0;
 }
 
-static struct ht_table_entry *
-ht_table_entry(struct ht_table *table, const void *key) {
-    struct ht_table_bucket *bucket;
+uint32_t
+ht_hash_bytes(const void *key) {
+    const struct ht_bytes *bytes;
+    const unsigned char *ptr;
     uint32_t hash;
 
-    hash = table->hash_func(key);
+    bytes = key;
+    ptr = bytes->data;
+
+    /* Must return the same value as ht_hash_string for the same content. */
+    hash = 5381;
+    for (size_t i = 0; i < bytes->size; i++)
+        hash = ((hash << 5) + hash) ^ ptr[i];
+
+    return hash;
+}
+
+bool
+ht_equal_bytes(const void *k1, const void *k2) {
+    const struct ht_bytes *b1, *b2;
+
+    b1 = k1;
+    b2 = k2;
+
+    return b1->size == b2->size && memcmp(b1->data, b2->data, b1->size) == 0;
+}
+
+bool
+ht_equal_bytes_string(const void *k1, const void *k2) {
+    const struct ht_bytes *bytes;
+    const char *str;
+
+    bytes = k1;
+    str = k2;
+
+    /* The string is never read past its terminating null byte, even if
+     * the byte sequence contains null bytes. */
+    return strnlen(str, bytes->size + 1) == bytes->size
+        && memcmp(str, bytes->data, bytes->size) == 0;
+}
+
+static void
+ht_table_set_entry(struct ht_table *table, struct ht_table_entry *entry,
+                   void *key, void *value, bool is_new) {
+    /* Lock-free readers may read the entry at any time in single writer
+     * mode: existing entries are updated atomically, and new entries are
+     * published once complete. */
+    __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->value, value, __ATOMIC_RELEASE);
+
+    if (is_new && table->single_writer)
+        ht_table_open_publish(table, entry);
+}
+
+static uint64_t
+ht_table_lookup_hash(struct ht_table *table, const struct ht_lookup *lookup,
+                     const void *key) {
+    uint64_t hash;
+
+    /* The hash function of the lookup must be of the same kind as the one
+     * of the table. */
+    if (table->hash64_func) {
+        assert(lookup->hash64_func);
+        hash = lookup->hash64_func(key, table->seed);
+    } else {
+        assert(lookup->hash_func);
+        hash = lookup->hash_func(key);
+    }
+
     if (hash == HT_UNUSED_HASH)
         hash++;
 
-    bucket = table->buckets + (hash % table->buckets_sz);
+    return hash;
+}
+
+static struct ht_table_entry *
+ht_table_entry(struct ht_table *table, const void *key) {
+    return ht_table_find(table, key, ht_table_hash(table, key),
+                         table->equal_func);
+}
+
+struct ht_table_entry *
+ht_table_next_entry(struct ht_table *table, size_t *pbucket, size_t *pentry) {
+    if (table->storage == HT_TABLE_STORAGE_OPEN)
+        return ht_table_open_next(table, pbucket);
+    if (table->storage == HT_TABLE_STORAGE_COMPACT)
+        return ht_table_compact_next(table, pbucket);
+
+    for (;;) {
+        struct ht_table_bucket *bucket;
+        struct ht_table_entry *entry;
+
+        bucket = ht_table_iterator_bucket(table, *pbucket);
+        if (!bucket)
+            return NULL;
+
+        if (*pentry >= bucket->sz) {
+            (*pbucket)++;
+            *pentry = 0;
+            continue;
+        }
+
+        entry = bucket->entries + *pentry;
+        if (HT_TABLE_ENTRY_IS_USED(entry))
+            return entry;
+
+        (*pentry)++;
+    }
+}
+
+int
+ht_table_insert_hashed(struct ht_table *table, void *key, void *value,
+                       uint64_t hash) {
+    struct ht_table_entry *entry;
+    int ret;
+
+    ret = ht_table_upsert_entry(table, key, hash, &entry);
+    if (ret == -1)
+        return -1;
+
+    ht_table_set_entry(table, entry, key, value, ret == 1);
+    return ret;
+}
+
+int
+ht_table_add_hashed(struct ht_table *table, void *key, void *value,
+                    uint64_t hash) {
+    struct ht_table_entry *entry;
+    int ret;
+
+    /* Existing entries are left untouched: their key and value still
+     * belong to the table. */
+    ret = ht_table_upsert_entry(table, key, hash, &entry);
+    if (ret == 1)
+        ht_table_set_entry(table, entry, key, value, true);
+
+    return ret;
+}
+
+int
+ht_table_erase(struct ht_table *table, struct ht_table_entry *entry) {
+    if (table->storage == HT_TABLE_STORAGE_OPEN) {
+        ht_table_open_erase(table, entry);
+    } else if (table->storage == HT_TABLE_STORAGE_COMPACT) {
+        ht_table_compact_erase(table, entry);
+    } else {
+        entry->key = NULL;
+        entry->value = NULL;
+        entry->hash = HT_UNUSED_HASH;
+
+        table->nb_entries--;
+    }
+
+    return ht_table_shrink(table);
+}
+
+int
+ht_table_shrink(struct ht_table *table) {
+    size_t sz;
+
+    if (table->storage == HT_TABLE_STORAGE_OPEN)
+        return ht_table_open_shrink(table);
+
+    if (table->storage == HT_TABLE_STORAGE_COMPACT)
+        return ht_table_compact_shrink(table);
+
+    if (table->old_buckets || table->buckets_sz <= HT_TABLE_MIN_BUCKETS_SZ
+        || table->nb_entries >= table->min_entries) {
+        return 0;
+    }
+
+    sz = ht_table_shrunk_size(table, table->buckets_sz,
+                              HT_TABLE_MIN_BUCKETS_SZ);
+    return ht_table_start_resize(table, sz);
+}
+
+static size_t
+ht_table_find_many(struct ht_table *table, const void * const *keys,
+                   size_t nb_keys, struct ht_table_entry **entries) {
+    uint64_t hashes[HT_TABLE_BATCH_SZ];
+    size_t nb_found;
+
+    assert(nb_keys <= HT_TABLE_BATCH_SZ);
+
+    /* Hash all keys and prefetch the memory each lookup is going to read
+     * first, so that cache misses overlap instead of being paid one after
+     * the other. */
+    for (size_t i = 0; i < nb_keys; i++)
+        hashes[i] = ht_table_hash(table, keys[i]);
+
+    if (table->storage == HT_TABLE_STORAGE_OPEN) {
+        for (size_t i = 0; i < nb_keys; i++)
+            ht_table_open_prefetch(table, hashes[i]);
+    } else if (table->storage == HT_TABLE_STORAGE_COMPACT) {
+        for (size_t i = 0; i < nb_keys; i++)
+            ht_table_compact_prefetch(table, hashes[i]);
+    } else {
+        struct ht_table_bucket *buckets[HT_TABLE_BATCH_SZ];
+
+        for (size_t i = 0; i < nb_keys; i++) {
+            buckets[i] = table->buckets
+                       + ht_table_bucket_idx(hashes[i], table->buckets_sz);
+            __builtin_prefetch(buckets[i]);
+        }
+
+        for (size_t i = 0; i < nb_keys; i++) {
+            if (buckets[i]->entries)
+                __builtin_prefetch(buckets[i]->entries);
+        }
+    }
+
+    nb_found = 0;
+    for (size_t i = 0; i < nb_keys; i++) {
+        entries[i] = ht_table_find(table, keys[i], hashes[i],
+                                   table->equal_func);
+        if (entries[i])
+            nb_found++;
+    }
+
+    return nb_found;
+}
+
+struct ht_table_entry *
+ht_table_find(struct ht_table *table, const void *key, uint64_t hash,
+              ht_equal_func equal_func) {
+    struct ht_table_entry *entry;
+
+    entry = ht_table_find_entry(table, key, hash, equal_func);
+
+    if (entry) {
+        HT_STATS_ADD(table, nb_hits, 1);
+    } else {
+        HT_STATS_ADD(table, nb_misses, 1);
+    }
+
+    return entry;
+}
+
+static struct ht_table_entry *
+ht_table_find_entry(struct ht_table *table, const void *key, uint64_t hash,
+                    ht_equal_func equal_func) {
+    struct ht_table_bucket *bucket;
+
+    if (table->storage == HT_TABLE_STORAGE_OPEN)
+        return ht_table_open_entry(table, key, hash, equal_func);
+    if (table->storage == HT_TABLE_STORAGE_COMPACT)
+        return ht_table_compact_entry(table, key, hash, equal_func);
+
+    ht_table_rehash_step(table);
+
+    if (table->old_buckets) {
+        struct ht_table_entry *entry;
+
+        bucket = table->old_buckets
+               + ht_table_bucket_idx(hash, table->old_buckets_sz);
+
+        entry = ht_table_bucket_entry(table, bucket, key, hash, equal_func);
+        if (entry)
+            return entry;
+    }
+
+    bucket = table->buckets + ht_table_bucket_idx(hash, table->buckets_sz);
+    return ht_table_bucket_entry(table, bucket, key, hash, equal_func);
+}
+
+static struct ht_table_entry *
+ht_table_bucket_entry(struct ht_table *table, struct ht_table_bucket *bucket,
+                      const void *key, uint64_t hash,
+                      ht_equal_func equal_func) {
     if (!bucket->entries)
         return NULL;
 
@@ -405,8 +1076,10 @@ ht_table_entry(struct ht_table *table, const void *key) {
         if (!HT_TABLE_ENTRY_IS_USED(entry))
             continue;
 
-        if (entry->hash == hash && table->equal_func(key, entry->key))
+        if (entry->hash == hash
+            && HT_STATS_EQUAL(table, equal_func, key, entry->key)) {
             return entry;
+        }
     }
 
     return NULL;
@@ -414,15 +1087,33 @@ ht_table_entry(struct ht_table *table, const void *key) {
 
 void
 ht_table_print(struct ht_table *table, FILE *file) {
+    if (table->storage == HT_TABLE_STORAGE_OPEN) {
+        ht_table_open_print(table, file);
+        return;
+    }
+
+    if (table->storage == HT_TABLE_STORAGE_COMPACT) {
+        ht_table_compact_print(table, file);
+        return;
+    }
+
     fprintf(file, "entries: %zu\n", table->nb_entries);
     fprintf(file, "buckets: %zu\n", table->buckets_sz);
+    if (table->old_buckets) {
+        fprintf(file, "old buckets: %zu (%zu migrated)\n",
+                table->old_buckets_sz, table->rehash_idx);
+    }
 
-    for (size_t b = 0; b < table->buckets_sz; b++) {
+    for (size_t b = 0; b < table->old_buckets_sz + table->buckets_sz; b++) {
         struct ht_table_bucket *bucket;
 
-        bucket = table->buckets + b;
+        bucket = ht_table_iterator_bucket(table, b);
 
-        fprintf(file, "bucket %04zu\n", b);
+        if (b < table->old_buckets_sz) {
+            fprintf(file, "old bucket %04zu\n", b);
+        } else {
+            fprintf(file, "bucket %04zu\n", b - table->old_buckets_sz);
+        }
 
         for (size_t e = 0; e < bucket->sz; e++) {
             struct ht_table_entry *entry;
@@ -433,7 +1124,7 @@ ht_table_print(struct ht_table *table, FILE *file) {
 
             if (HT_TABLE_ENTRY_IS_USED(entry)) {
                 fprintf(file, "key=%08"PRIxPTR" value=%08"PRIxPTR
-                        " hash=%"PRIu32,
+                        " hash=%"PRIu64,
                         (intptr_t)entry->key, (intptr_t)entry->value,
                         entry->hash);
             }
@@ -443,16 +1134,283 @@ ht_table_print(struct ht_table *table, FILE *file) {
     }
 }
 
+void
+ht_table_get_stats(struct ht_table *table, struct ht_table_stats *stats) {
+    memset(stats, 0, sizeof(struct ht_table_stats));
+
+    stats->nb_entries = table->nb_entries;
+    stats->memory_sz = sizeof(struct ht_table);
+
+    switch (table->storage) {
+    case HT_TABLE_STORAGE_OPEN:
+        ht_table_open_stats(table, stats);
+        break;
+
+    case HT_TABLE_STORAGE_COMPACT:
+        ht_table_compact_stats(table, stats);
+        break;
+
+    default:
+        ht_table_chained_stats(table, stats);
+        break;
+    }
+
+    /* Storage functions accumulate the sum of all probe lengths. */
+    if (stats->nb_entries > 0)
+        stats->mean_probe_length /= (double)stats->nb_entries;
+
+#ifdef HT_STATS
+    stats->nb_hits = __atomic_load_n(&table->counters.nb_hits,
+                                     __ATOMIC_RELAXED);
+    stats->nb_misses = __atomic_load_n(&table->counters.nb_misses,
+                                       __ATOMIC_RELAXED);
+    stats->nb_equal_calls = __atomic_load_n(&table->counters.nb_equal_calls,
+                                            __ATOMIC_RELAXED);
+    stats->nb_resizes = table->counters.nb_resizes;
+    stats->resize_time = table->counters.resize_time;
+#endif
+}
+
+void
+ht_table_stats_add_probe(struct ht_table_stats *stats, size_t length) {
+    if (length > stats->max_probe_length)
+        stats->max_probe_length = length;
+
+    stats->mean_probe_length += (double)length;
+}
+
+void
+ht_table_stats_add_bucket(struct ht_table_stats *stats, size_t nb_entries) {
+    if (nb_entries >= HT_TABLE_STATS_HISTOGRAM_SZ)
+        nb_entries = HT_TABLE_STATS_HISTOGRAM_SZ - 1;
+
+    stats->occupancy[nb_entries]++;
+}
+
+uint64_t
+ht_clock(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+uint64_t
+ht_table_resize_begin(struct ht_table *table, size_t old_sz, size_t sz) {
+    HT_PROBE3(resize__start, table, old_sz, sz);
+
+    if (table->hooks.resize_start)
+        table->hooks.resize_start(table, old_sz, sz, table->hooks.ctx);
+
+    return ht_clock();
+}
+
+void
+ht_table_resize_done(struct ht_table *table, size_t old_sz, size_t sz,
+                     size_t nb_moved, uint64_t start) {
+    uint64_t duration;
+
+    duration = ht_clock() - start;
+
+#ifdef HT_STATS
+    /* Resizes are only performed by the writer. */
+    table->counters.nb_resizes++;
+    table->counters.resize_time += duration;
+#endif
+
+    HT_PROBE5(resize__end, table, old_sz, sz, nb_moved, duration);
+
+    if (table->hooks.resize_end) {
+        table->hooks.resize_end(table, old_sz, sz, nb_moved, duration,
+                                table->hooks.ctx);
+    }
+}
+
+void
+ht_table_resize_failed(struct ht_table *table, size_t old_sz, uint64_t start) {
+    uint64_t duration;
+
+    /* The table keeps its size: the resize ends with no entry moved, so
+     * that every start is matched by an end. */
+    duration = ht_clock() - start;
+
+    HT_PROBE5(resize__end, table, old_sz, old_sz, 0, duration);
+
+    if (table->hooks.resize_end) {
+        table->hooks.resize_end(table, old_sz, old_sz, 0, duration,
+                                table->hooks.ctx);
+    }
+}
+
+void
+ht_table_allocation_failed(struct ht_table *table, size_t sz) {
+    HT_PROBE2(allocation__failure, table, sz);
+
+    if (table->hooks.allocation_failure)
+        table->hooks.allocation_failure(table, sz, table->hooks.ctx);
+}
+
+void
+ht_table_bucket_grown(struct ht_table *table, size_t idx, size_t old_sz,
+                      size_t sz) {
+    HT_PROBE4(bucket__growth, table, idx, old_sz, sz);
+
+    if (table->hooks.bucket_growth)
+        table->hooks.bucket_growth(table, idx, old_sz, sz, table->hooks.ctx);
+}
+
+size_t
+ht_table_grown_size(const struct ht_table *table, size_t sz) {
+    size_t new_sz;
+
+    /* Sizes are always powers of two. */
+    new_sz = sz * 2;
+    while ((double)new_sz < (double)sz * table->policy.growth_factor)
+        new_sz *= 2;
+
+    return new_sz;
+}
+
+size_t
+ht_table_shrunk_size(const struct ht_table *table, size_t sz,
+                     size_t min_sz) {
+    size_t new_sz;
+
+    new_sz = sz / 2;
+    while (new_sz > min_sz
+           && (double)new_sz > (double)sz / table->policy.growth_factor) {
+        new_sz /= 2;
+    }
+
+    return (new_sz < min_sz) ? min_sz : new_sz;
+}
+
+size_t
+ht_table_capacity_size(const struct ht_table *table, size_t capacity,
+                       size_t min_sz) {
+    size_t sz;
+
+    sz = min_sz;
+    while (ht_table_max_entries(table, sz) < capacity) {
+        if (sz >= HT_TABLE_MAX_SZ) {
+            ht_set_error("capacity %zu is too large", capacity);
+            return 0;
+        }
+
+        sz *= 2;
+    }
+
+    return sz;
+}
+
+void
+ht_table_update_limits(struct ht_table *table, size_t sz) {
+    table->max_entries = ht_table_max_entries(table, sz);
+
+    if (table->policy.shrink) {
+        table->min_entries =
+            (size_t)((double)sz * table->policy.min_load_factor);
+    } else {
+        table->min_entries = 0;
+    }
+}
+
+static int
+ht_table_check_policy(const struct ht_table *table) {
+    const struct ht_table_policy *policy;
+
+    policy = &table->policy;
+
+    if (!(policy->max_load_factor > 0.0)) {
+        ht_set_error("invalid maximum load factor");
+        return -1;
+    }
+
+    if (table->storage != HT_TABLE_STORAGE_CHAINED
+        && policy->max_load_factor >= 1.0) {
+        ht_set_error("maximum load factor must be lower than 1 "
+                     "with open addressing and compact storage");
+        return -1;
+    }
+
+    if (!(policy->growth_factor > 1.0)) {
+        ht_set_error("growth factor must be greater than 1");
+        return -1;
+    }
+
+    if (policy->shrink) {
+        if (!(policy->min_load_factor >= 0.0)) {
+            ht_set_error("invalid minimum load factor");
+            return -1;
+        }
+
+        /* If a table just shrunk would be over its maximum load factor,
+         * removing and inserting a single entry would cause it to resize
+         * again and again. */
+        if (policy->min_load_factor * policy->growth_factor
+            >= policy->max_load_factor) {
+            ht_set_error("minimum load factor must be lower than the "
+                         "maximum load factor divided by the growth factor");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+size_t
+ht_table_max_entries(const struct ht_table *table, size_t sz) {
+    size_t max;
+
+    max = (size_t)((double)sz * table->policy.max_load_factor);
+
+    /* Open addressing and compact tables must always have at least one
+     * empty slot for probe sequences to terminate. */
+    if (table->storage != HT_TABLE_STORAGE_CHAINED && max >= sz)
+        max = sz - 1;
+
+    return (max < 1) ? 1 : max;
+}
+
 static int
 ht_table_resize(struct ht_table *table, size_t sz) {
     struct ht_table_bucket *buckets;
+    struct ht_slab old_slab;
+    size_t old_sz;
+    uint64_t start;
+
+    assert(!table->old_buckets);
+
+    old_sz = table->buckets_sz;
+    start = ht_table_resize_begin(table, old_sz, sz);
+
+    if (table->huge_pages && sz > old_sz) {
+        if (ht_table_grow_in_place(table, sz) == -1) {
+            ht_table_resize_failed(table, old_sz, start);
+            return -1;
+        }
+
+        ht_table_resize_done(table, old_sz, sz, table->nb_entries, start);
+        return 0;
+    }
 
-    buckets = ht_calloc(sz, sizeof(struct ht_table_bucket));
+    buckets = ht_table_alloc_bucket_array(table, sz);
     if (!buckets) {
         ht_set_error("cannot allocate buckets: %m");
+        ht_table_allocation_failed(table,
+                                   sz * sizeof(struct ht_table_bucket));
+        ht_table_resize_failed(table, old_sz, start);
         return -1;
     }
 
+    /* Entries are moved to arrays allocated from a new slab, and the old
+     * slab is released as a whole: otherwise its chunks, which are mostly
+     * free after a large number of removals, would never be returned to
+     * the allocator. */
+    old_slab = table->entries_slab;
+    ht_slab_init(&table->entries_slab, &table->allocator,
+                 sizeof(struct ht_table_entry));
+
     for (size_t b = 0; b < table->buckets_sz; b++) {
         struct ht_table_bucket *bucket;
 
@@ -470,34 +1428,447 @@ ht_table_resize(struct ht_table *table, size_t sz) {
             if (ht_table_insert_in(table, buckets, sz,
                                    entry->key, entry->value,
                                    entry->hash, true) == -1) {
-                for (size_t i = 0; i < sz; i++)
-                    ht_free(buckets[i].entries);
-                ht_free(buckets);
+                ht_table_free_large_entries(table, buckets, sz);
+                ht_table_free_bucket_array(table, buckets, sz);
+                ht_slab_release(&table->entries_slab);
+                table->entries_slab = old_slab;
+                ht_table_resize_failed(table, old_sz, start);
                 return -1;
             }
         }
     }
 
-    for (size_t b = 0; b < table->buckets_sz; b++)
-        ht_free(table->buckets[b].entries);
-    ht_free(table->buckets);
+    ht_table_free_large_entries(table, table->buckets, table->buckets_sz);
+    ht_table_free_bucket_array(table, table->buckets, table->buckets_sz);
+    ht_slab_release(&old_slab);
 
     table->buckets_sz = sz;
     table->buckets = buckets;
 
+    ht_table_update_limits(table, sz);
+
+    ht_table_resize_done(table, old_sz, sz, table->nb_entries, start);
     return 0;
 }
 
 static int
-ht_table_insert_in(struct ht_table *table,
+ht_table_start_resize(struct ht_table *table, size_t sz) {
+    struct ht_table_bucket *buckets;
+    size_t old_sz;
+    uint64_t start;
+
+    if (!table->incremental_resize)
+        return ht_table_resize(table, sz);
+
+    old_sz = table->buckets_sz;
+    start = ht_table_resize_begin(table, old_sz, sz);
+
+    /* Only one resize can be in progress at the same time. */
+    if (ht_table_rehash(table, SIZE_MAX) == -1) {
+        ht_table_resize_failed(table, old_sz, start);
+        return -1;
+    }
+
+    buckets = ht_table_alloc_bucket_array(table, sz);
+    if (!buckets) {
+        ht_set_error("cannot allocate buckets: %m");
+        ht_table_allocation_failed(table,
+                                   sz * sizeof(struct ht_table_bucket));
+        ht_table_resize_failed(table, old_sz, start);
+        return -1;
+    }
+
+    table->old_buckets = table->buckets;
+    table->old_buckets_sz = table->buckets_sz;
+    table->rehash_idx = 0;
+
+    table->buckets = buckets;
+    table->buckets_sz = sz;
+
+    ht_table_update_limits(table, sz);
+
+    /* Entries are moved to the new buckets by later operations. */
+    ht_table_resize_done(table, old_sz, sz, 0, start);
+    return 0;
+}
+
+static int
+ht_table_rehash(struct ht_table *table, size_t nb_buckets) {
+    size_t nb_empty_visits;
+
+    /* Migrate up to nb_buckets non-empty buckets from the old bucket array
+     * to the new one. Empty buckets are cheap to skip, but there can be a
+     * lot of them after a shrink, so their number is bounded too. */
+    nb_empty_visits = (nb_buckets < SIZE_MAX / 10) ? nb_buckets * 10 : SIZE_MAX;
+
+    while (table->old_buckets && nb_buckets > 0) {
+        struct ht_table_bucket *bucket;
+
+        bucket = table->old_buckets + table->rehash_idx;
+
+        if (bucket->entries) {
+            for (size_t e = 0; e < bucket->sz; e++) {
+                struct ht_table_entry *entry;
+
+                entry = bucket->entries + e;
+                if (!HT_TABLE_ENTRY_IS_USED(entry))
+                    continue;
+
+                if (ht_table_insert_in(table, table->buckets,
+                                       table->buckets_sz,
+                                       entry->key, entry->value,
+                                       entry->hash, true) == -1) {
+                    return -1;
+                }
+
+                /* Entries are removed one by one so that the table stays
+                 * consistent if an allocation fails. */
+                entry->key = NULL;
+                entry->value = NULL;
+                entry->hash = HT_UNUSED_HASH;
+            }
+
+            ht_table_free_entries(table, bucket->entries, bucket->sz);
+            bucket->entries = NULL;
+            bucket->sz = 0;
+
+            nb_buckets--;
+        } else {
+            if (--nb_empty_visits == 0)
+                nb_buckets = 0;
+        }
+
+        table->rehash_idx++;
+
+        if (table->rehash_idx >= table->old_buckets_sz) {
+            ht_table_free_bucket_array(table, table->old_buckets,
+                                       table->old_buckets_sz);
+
+            table->old_buckets = NULL;
+            table->old_buckets_sz = 0;
+            table->rehash_idx = 0;
+        }
+    }
+
+    return 0;
+}
+
+static void
+ht_table_rehash_step(struct ht_table *table) {
+    /* Iterators refer to bucket positions, buckets cannot be moved while
+     * they exist. */
+    if (!table->old_buckets || table->nb_iterators > 0)
+        return;
+
+    /* A failure leaves the table in a consistent state; migration will
+     * simply be retried during the next operation. */
+    ht_table_rehash(table, HT_TABLE_REHASH_STEP);
+}
+
+static struct ht_table_bucket *
+ht_table_alloc_bucket_array(struct ht_table *table, size_t sz) {
+    /* Mappings are zero-filled. */
+    if (table->huge_pages)
+        return ht_pages_map(sz * sizeof(struct ht_table_bucket));
+
+    return ht_allocator_calloc(&table->allocator, sz,
+                               sizeof(struct ht_table_bucket));
+}
+
+static void
+ht_table_free_bucket_array(struct ht_table *table,
+                           struct ht_table_bucket *buckets, size_t sz) {
+    if (table->huge_pages) {
+        ht_pages_unmap(buckets, sz * sizeof(struct ht_table_bucket));
+    } else {
+        ht_allocator_free(&table->allocator, buckets,
+                          sz * sizeof(struct ht_table_bucket));
+    }
+}
+
+static int
+ht_table_grow_in_place(struct ht_table *table, size_t sz) {
+    struct ht_table_bucket *buckets;
+    size_t old_sz;
+
+    old_sz = table->buckets_sz;
+
+    buckets = ht_pages_remap(table->buckets,
+                             old_sz * sizeof(struct ht_table_bucket),
+                             sz * sizeof(struct ht_table_bucket));
+    if (!buckets) {
+        ht_set_error("cannot remap buckets: %m");
+        ht_table_allocation_failed(table,
+                                   sz * sizeof(struct ht_table_bucket));
+        return -1;
+    }
+
+    table->buckets = buckets;
+
+    /* Bucket indexes are the low bits of mixed hashes: the entries of bucket
+     * b can only move to buckets b + k * old_sz, which are all new. Entry
+     * arrays of new buckets are allocated first, their size being used to
+     * count entries, so that nothing has been moved if an allocation
+     * fails. */
+    for (size_t b = 0; b < old_sz; b++) {
+        struct ht_table_bucket *bucket;
+
+        bucket = buckets + b;
+
+        for (size_t e = 0; e < bucket->sz; e++) {
+            struct ht_table_entry *entry;
+            size_t idx;
+
+            entry = bucket->entries + e;
+            if (!HT_TABLE_ENTRY_IS_USED(entry))
+                continue;
+
+            idx = ht_table_bucket_idx(entry->hash, sz);
+            if (idx != b)
+                buckets[idx].sz++;
+        }
+    }
+
+    for (size_t b = old_sz; b < sz; b++) {
+        struct ht_table_bucket *bucket;
+        size_t nb_entries;
+
+        bucket = buckets + b;
+
+        nb_entries = bucket->sz;
+        if (nb_entries == 0)
+            continue;
+
+        bucket->sz = 1;
+        while (bucket->sz < nb_entries)
+            bucket->sz *= 2;
+
+        bucket->entries = ht_table_grow_entries(table, NULL, 0, bucket->sz);
+        if (!bucket->entries) {
+            ht_set_error("cannot allocate entries: %m");
+            ht_table_allocation_failed(table, bucket->sz
+                                       * sizeof(struct ht_table_entry));
+
+            for (size_t b2 = old_sz; b2 < sz; b2++) {
+                ht_table_free_entries(table, buckets[b2].entries,
+                                      buckets[b2].sz);
+            }
+
+            /* Shrinking a mapping does not allocate memory. */
+            buckets = ht_pages_remap(buckets,
+                                     sz * sizeof(struct ht_table_bucket),
+                                     old_sz * sizeof(struct ht_table_bucket));
+            if (buckets)
+                table->buckets = buckets;
+
+            return -1;
+        }
+    }
+
+    for (size_t b = 0; b < old_sz; b++) {
+        struct ht_table_bucket *bucket;
+
+        bucket = buckets + b;
+
+        for (size_t e = 0; e < bucket->sz; e++) {
+            struct ht_table_entry *entry;
+
+            entry = bucket->entries + e;
+            if (!HT_TABLE_ENTRY_IS_USED(entry))
+                continue;
+
+            if (ht_table_bucket_idx(entry->hash, sz) == b)
+                continue;
+
+            /* Cannot fail, there is room for the entry. */
+            ht_table_insert_in(table, buckets, sz, entry->key, entry->value,
+                               entry->hash, true);
+
+            entry->key = NULL;
+            entry->value = NULL;
+            entry->hash = HT_UNUSED_HASH;
+        }
+    }
+
+    table->buckets_sz = sz;
+
+    ht_table_update_limits(table, sz);
+    return 0;
+}
+
+static void
+ht_table_release_entries(struct ht_table *table) {
+    /* Only arrays too large for the slab are freed one by one. */
+    ht_table_free_large_entries(table, table->buckets, table->buckets_sz);
+    ht_table_free_large_entries(table, table->old_buckets,
+                                table->old_buckets_sz);
+
+    ht_slab_release(&table->entries_slab);
+}
+
+static void
+ht_table_free_large_entries(struct ht_table *table,
+                            struct ht_table_bucket *buckets, size_t sz) {
+    if (!buckets)
+        return;
+
+    for (size_t b = 0; b < sz; b++) {
+        struct ht_table_bucket *bucket;
+
+        bucket = buckets + b;
+
+        if (bucket->entries && ht_table_entries_class(bucket->sz) == -1) {
+            ht_allocator_free(&table->allocator, bucket->entries,
+                              bucket->sz * sizeof(struct ht_table_entry));
+        }
+    }
+}
+
+static int
+ht_table_entries_class(size_t sz) {
+    int class_idx;
+
+    class_idx = __builtin_ctzl(sz);
+    if (class_idx >= HT_SLAB_NB_CLASSES)
+        return -1;
+
+    return class_idx;
+}
+
+static struct ht_table_entry *
+ht_table_grow_entries(struct ht_table *table, struct ht_table_entry *entries,
+                      size_t old_sz, size_t sz) {
+    struct ht_table_entry *nentries;
+    int class_idx;
+
+    class_idx = ht_table_entries_class(sz);
+
+    if (class_idx >= 0) {
+        nentries = ht_slab_alloc(&table->entries_slab,
+                                 (unsigned int)class_idx);
+        if (!nentries)
+            return NULL;
+
+        if (old_sz > 0) {
+            memcpy(nentries, entries, old_sz * sizeof(struct ht_table_entry));
+            ht_table_free_entries(table, entries, old_sz);
+        }
+    } else if (old_sz == 0 || ht_table_entries_class(old_sz) >= 0) {
+        nentries = ht_allocator_malloc(&table->allocator,
+                                       sz * sizeof(struct ht_table_entry));
+        if (!nentries)
+            return NULL;
+
+        memcpy(nentries, entries, old_sz * sizeof(struct ht_table_entry));
+        ht_table_free_entries(table, entries, old_sz);
+    } else {
+        nentries = ht_allocator_realloc(&table->allocator, entries,
+                                        old_sz * sizeof(struct ht_table_entry),
+                                        sz * sizeof(struct ht_table_entry));
+        if (!nentries)
+            return NULL;
+    }
+
+    memset(nentries + old_sz, 0,
+           (sz - old_sz) * sizeof(struct ht_table_entry));
+
+    return nentries;
+}
+
+static void
+ht_table_free_entries(struct ht_table *table, struct ht_table_entry *entries,
+                      size_t sz) {
+    int class_idx;
+
+    if (!entries)
+        return;
+
+    class_idx = ht_table_entries_class(sz);
+
+    if (class_idx >= 0) {
+        ht_slab_free(&table->entries_slab, entries, (unsigned int)class_idx);
+    } else {
+        ht_allocator_free(&table->allocator, entries,
+                          sz * sizeof(struct ht_table_entry));
+    }
+}
+
+static void
+ht_table_chained_stats(struct ht_table *table, struct ht_table_stats *stats) {
+    size_t nb_buckets;
+
+    nb_buckets = table->old_buckets_sz + table->buckets_sz;
+
+    /* The probe length of an entry is its position among the entries of
+     * its bucket, starting at 1. */
+    stats->nb_buckets = nb_buckets;
+    stats->load_factor = (double)table->nb_entries
+                       / (double)table->buckets_sz;
+    stats->memory_sz += nb_buckets * sizeof(struct ht_table_bucket)
+                      + ht_slab_memory_size(&table->entries_slab);
+
+    for (size_t b = 0; b < nb_buckets; b++) {
+        struct ht_table_bucket *bucket;
+        size_t nb_entries;
+
+        bucket = ht_table_iterator_bucket(table, b);
+
+        /* Small entry arrays are part of the slab. */
+        if (bucket->entries && ht_table_entries_class(bucket->sz) < 0)
+            stats->memory_sz += bucket->sz * sizeof(struct ht_table_entry);
+
+        nb_entries = 0;
+
+        for (size_t e = 0; e < bucket->sz; e++) {
+            if (!HT_TABLE_ENTRY_IS_USED(bucket->entries + e))
+                continue;
+
+            nb_entries++;
+            ht_table_stats_add_probe(stats, nb_entries);
+        }
+
+        ht_table_stats_add_bucket(stats, nb_entries);
+    }
+}
+
+struct ht_table_bucket *
+ht_table_iterator_bucket(struct ht_table *table, size_t idx) {
+    /* During an incremental resize, iterators go through the old buckets
+     * first, then through the new ones. */
+    if (idx < table->old_buckets_sz)
+        return table->old_buckets + idx;
+    idx -= table->old_buckets_sz;
+
+    if (idx < table->buckets_sz)
+        return table->buckets + idx;
+
+    return NULL;
+}
+
+static void
+ht_table_iterator_advance(struct ht_table_iterator *it) {
+    /* Move past the entry returned last, or to the beginning of the table
+     * for a new iterator. */
+    if (it->bucket == SIZE_MAX) {
+        it->bucket = 0;
+        it->entry = 0;
+    } else if (it->table->storage != HT_TABLE_STORAGE_CHAINED) {
+        it->bucket++;
+    } else {
+        it->entry++;
+    }
+}
+
+static int
+ht_table_upsert_in(struct ht_table *table,
                    struct ht_table_bucket *buckets, size_t sz,
-                   void *key, void *value, uint32_t hash,
-                   bool is_resizing) {
+                   void *key, uint64_t hash, bool is_resizing,
+                   struct ht_table_entry **pentry) {
     struct ht_table_bucket *bucket;
     struct ht_table_entry *entry;
     bool new_entry_inserted;
 
-    bucket = buckets + (hash % sz);
+    bucket = buckets + ht_table_bucket_idx(hash, sz);
 
     entry = NULL;
     new_entry_inserted = true;
@@ -518,37 +1889,38 @@ ht_table_insert_in(struct ht_table *table,
             }
 
             if (hash == curr_entry->hash
-                && table->equal_func(key, curr_entry->key)) {
+                && HT_STATS_EQUAL(table, table->equal_func,
+                                  key, curr_entry->key)) {
                 entry = curr_entry;
                 new_entry_inserted = false;
                 break;
             }
         }
-    } else {
-        bucket->sz = 1;
-        bucket->entries = ht_calloc(bucket->sz, sizeof(struct ht_table_entry));
-        if (!bucket->entries) {
-            ht_set_error("cannot allocate entries: %m");
-            return -1;
-        }
-
-        entry = bucket->entries;
     }
 
     if (!entry) {
         struct ht_table_entry *entries;
         size_t sz;
 
-        sz = bucket->sz + 1;
-        entries = ht_realloc(bucket->entries,
-                             sz * sizeof(struct ht_table_entry));
+        /* Arrays grow geometrically; unused entries are kept at the end
+         * and reused before the array has to grow again. */
+        sz = (bucket->sz == 0) ? 1 : bucket->sz * 2;
+
+        entries = ht_table_grow_entries(table, bucket->entries,
+                                        bucket->sz, sz);
         if (!entries) {
-            ht_set_error("cannot reallocate entries: %m");
+            ht_set_error("cannot allocate entries: %m");
+            ht_table_allocation_failed(table,
+                                       sz * sizeof(struct ht_table_entry));
             return -1;
         }
 
-        memset(entries + bucket->sz, 0,
-               (sz - bucket->sz) * sizeof(struct ht_table_entry));
+        /* Buckets are filled up during resizes, which are already
+         * reported as a whole. */
+        if (!is_resizing) {
+            ht_table_bucket_grown(table, (size_t)(bucket - buckets),
+                                  bucket->sz, sz);
+        }
 
         entry = entries + bucket->sz;
 
@@ -556,9 +1928,76 @@ ht_table_insert_in(struct ht_table *table,
         bucket->sz = sz;
     }
 
+    if (new_entry_inserted) {
+        entry->key = key;
+        entry->value = NULL;
+        entry->hash = hash;
+    }
+
+    *pentry = entry;
+    return new_entry_inserted ? 1 : 0;
+}
+
+static int
+ht_table_insert_in(struct ht_table *table,
+                   struct ht_table_bucket *buckets, size_t sz,
+                   void *key, void *value, uint64_t hash,
+                   bool is_resizing) {
+    struct ht_table_entry *entry;
+    int ret;
+
+    ret = ht_table_upsert_in(table, buckets, sz, key, hash, is_resizing,
+                             &entry);
+    if (ret == -1)
+        return -1;
+
     entry->key = key;
     entry->value = value;
-    entry->hash = hash;
 
-    return new_entry_inserted ? 1 : 0;
+    return ret;
+}
+
+int
+ht_table_upsert_entry(struct ht_table *table, void *key, uint64_t hash,
+                      struct ht_table_entry **pentry) {
+    int ret;
+
+    if (table->storage == HT_TABLE_STORAGE_OPEN)
+        return ht_table_open_upsert(table, key, hash, pentry);
+    if (table->storage == HT_TABLE_STORAGE_COMPACT)
+        return ht_table_compact_upsert(table, key, hash, pentry);
+
+    ht_table_rehash_step(table);
+
+    if (table->nb_entries >= table->max_entries) {
+        size_t sz;
+
+        sz = ht_table_grown_size(table, table->buckets_sz);
+        if (ht_table_start_resize(table, sz) == -1)
+            return -1;
+    }
+
+    if (table->old_buckets) {
+        struct ht_table_bucket *bucket;
+        struct ht_table_entry *entry;
+        size_t idx;
+
+        /* The entry may not have been migrated yet. */
+        idx = ht_table_bucket_idx(hash, table->old_buckets_sz);
+        bucket = table->old_buckets + idx;
+
+        entry = ht_table_bucket_entry(table, bucket, key, hash,
+                                      table->equal_func);
+        if (entry) {
+            *pentry = entry;
+            return 0;
+        }
+    }
+
+    ret = ht_table_upsert_in(table, table->buckets, table->buckets_sz,
+                             key, hash, false, pentry);
+    if (ret == 1)
+        table->nb_entries++;
+
+    return ret;
 }
@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "hashtable.h"
+
+/* Compact storage: entries are appended to a dense array, in insertion
+ * order, and a separate index whose size is a power of two maps hashes to
+ * positions in this array using linear probing.
+ *
+ * Index slots contain HT_COMPACT_EMPTY, HT_COMPACT_DELETED, or the position
+ * of an entry plus 2. They are as small as the capacity of the entry array
+ * allows: 1, 2, 4 or 8 bytes.
+ *
+ * Removed entries leave a hole in the entry array, and a deleted slot in the
+ * index; both are reclaimed when the entry array is full, by rebuilding the
+ * table, which keeps the order of the remaining entries. */
+
+#define HT_COMPACT_MIN_SZ 8
+
+#define HT_COMPACT_EMPTY   0
+#define HT_COMPACT_DELETED 1
+
+/* The entry array and the index share the same allocation. */
+#define HT_COMPACT_ARRAYS_SIZE(capacity_, sz_, width_) \
+    ((capacity_) * sizeof(struct ht_table_entry) + (sz_) * (width_))
+
+static unsigned int ht_table_compact_width(size_t);
+static int ht_table_compact_resize(struct ht_table *, size_t);
+static void ht_table_compact_free_arrays(struct ht_table *,
+                                         struct ht_table_entry *, size_t,
+                                         size_t, unsigned int);
+static size_t ht_table_compact_find_free(const struct ht_table *, uint64_t);
+
+static inline size_t
+ht_table_compact_index(const struct ht_table *table, size_t i) {
+    switch (table->index_width) {
+    case 1:
+        return ((const uint8_t *)table->indices)[i];
+    case 2:
+        return ((const uint16_t *)table->indices)[i];
+    case 4:
+        return ((const uint32_t *)table->indices)[i];
+    default:
+        return (size_t)((const uint64_t *)table->indices)[i];
+    }
+}
+
+static inline void
+ht_table_compact_set_index(struct ht_table *table, size_t i, size_t value) {
+    switch (table->index_width) {
+    case 1:
+        ((uint8_t *)table->indices)[i] = (uint8_t)value;
+        break;
+    case 2:
+        ((uint16_t *)table->indices)[i] = (uint16_t)value;
+        break;
+    case 4:
+        ((uint32_t *)table->indices)[i] = (uint32_t)value;
+        break;
+    default:
+        ((uint64_t *)table->indices)[i] = value;
+        break;
+    }
+}
+
+int
+ht_table_compact_init(struct ht_table *table, size_t capacity) {
+    size_t sz;
+
+    sz = ht_table_capacity_size(table, capacity, HT_COMPACT_MIN_SZ);
+    if (sz == 0)
+        return -1;
+
+    return ht_table_compact_resize(table, sz);
+}
+
+void
+ht_table_compact_free(struct ht_table *table) {
+    ht_table_compact_free_arrays(table, table->entries,
+                                 table->entries_capacity, table->indices_sz,
+                                 table->index_width);
+
+    table->entries = NULL;
+    table->entries_sz = 0;
+    table->entries_capacity = 0;
+    table->indices = NULL;
+    table->indices_sz = 0;
+}
+
+void
+ht_table_compact_clear(struct ht_table *table) {
+    memset(table->indices, 0, table->indices_sz * table->index_width);
+    table->entries_sz = 0;
+}
+
+int
+ht_table_compact_upsert(struct ht_table *table, void *key, uint64_t hash,
+                        struct ht_table_entry **pentry) {
+    struct ht_table_entry *entry;
+    size_t mask, i, free_idx, pos;
+
+    mask = table->indices_sz - 1;
+    free_idx = SIZE_MAX;
+
+    for (i = (size_t)ht_hash_mix64(hash) & mask;; i = (i + 1) & mask) {
+        size_t value;
+
+        value = ht_table_compact_index(table, i);
+        if (value == HT_COMPACT_EMPTY)
+            break;
+
+        if (value == HT_COMPACT_DELETED) {
+            if (free_idx == SIZE_MAX)
+                free_idx = i;
+            continue;
+        }
+
+        entry = table->entries + value - 2;
+        if (entry->hash == hash
+            && HT_STATS_EQUAL(table, table->equal_func, key, entry->key)) {
+            *pentry = entry;
+            return 0;
+        }
+    }
+
+    if (free_idx == SIZE_MAX)
+        free_idx = i;
+
+    /* Once the entry array is full, the table is rebuilt, growing it unless
+     * most entries of the array have been removed. */
+    if (table->entries_sz >= table->entries_capacity) {
+        size_t sz;
+
+        sz = table->indices_sz;
+        if (table->nb_entries >= table->entries_capacity / 2)
+            sz = ht_table_grown_size(table, sz);
+
+        if (ht_table_compact_resize(table, sz) == -1)
+            return -1;
+
+        free_idx = ht_table_compact_find_free(table, hash);
+    }
+
+    pos = table->entries_sz++;
+    ht_table_compact_set_index(table, free_idx, pos + 2);
+
+    entry = table->entries + pos;
+    entry->key = key;
+    entry->value = NULL;
+    entry->hash = hash;
+
+    table->nb_entries++;
+
+    *pentry = entry;
+    return 1;
+}
+
+void
+ht_table_compact_prefetch(const struct ht_table *table, uint64_t hash) {
+    size_t i;
+
+    i = (size_t)ht_hash_mix64(hash) & (table->indices_sz - 1);
+    __builtin_prefetch((const uint8_t *)table->indices
+                       + i * table->index_width);
+}
+
+struct ht_table_entry *
+ht_table_compact_entry(struct ht_table *table, const void *key,
+                       uint64_t hash, ht_equal_func equal_func) {
+    size_t mask;
+
+    mask = table->indices_sz - 1;
+
+    for (size_t i = (size_t)ht_hash_mix64(hash) & mask;; i = (i + 1) & mask) {
+        struct ht_table_entry *entry;
+        size_t value;
+
+        value = ht_table_compact_index(table, i);
+        if (value == HT_COMPACT_EMPTY)
+            return NULL;
+        if (value == HT_COMPACT_DELETED)
+            continue;
+
+        entry = table->entries + value - 2;
+        if (entry->hash == hash
+            && HT_STATS_EQUAL(table, equal_func, key, entry->key)) {
+            return entry;
+        }
+    }
+}
+
+void
+ht_table_compact_erase(struct ht_table *table, struct ht_table_entry *entry) {
+    size_t mask, pos;
+
+    mask = table->indices_sz - 1;
+    pos = (size_t)(entry - table->entries);
+
+    for (size_t i = (size_t)ht_hash_mix64(entry->hash) & mask;;
+         i = (i + 1) & mask) {
+        if (ht_table_compact_index(table, i) == pos + 2) {
+            ht_table_compact_set_index(table, i, HT_COMPACT_DELETED);
+            break;
+        }
+    }
+
+    entry->key = NULL;
+    entry->value = NULL;
+    entry->hash = HT_UNUSED_HASH;
+
+    table->nb_entries--;
+}
+
+void
+ht_table_compact_sweep(struct ht_table *table) {
+    /* Entries removed without updating the index (see foreach.c) still have
+     * an index slot, which is marked as deleted. */
+    for (size_t i = 0; i < table->indices_sz; i++) {
+        size_t value;
+
+        value = ht_table_compact_index(table, i);
+        if (value > HT_COMPACT_DELETED
+            && !HT_TABLE_ENTRY_IS_USED(table->entries + value - 2)) {
+            ht_table_compact_set_index(table, i, HT_COMPACT_DELETED);
+        }
+    }
+}
+
+int
+ht_table_compact_shrink(struct ht_table *table) {
+    size_t sz;
+
+    if (table->indices_sz <= HT_COMPACT_MIN_SZ
+        || table->nb_entries >= table->min_entries) {
+        return 0;
+    }
+
+    sz = ht_table_shrunk_size(table, table->indices_sz, HT_COMPACT_MIN_SZ);
+    return ht_table_compact_resize(table, sz);
+}
+
+int
+ht_table_compact_reserve(struct ht_table *table, size_t capacity) {
+    size_t sz;
+
+    sz = ht_table_capacity_size(table, capacity, HT_COMPACT_MIN_SZ);
+    if (sz == 0)
+        return -1;
+    if (sz <= table->indices_sz)
+        return 0;
+
+    return ht_table_compact_resize(table, sz);
+}
+
+int
+ht_table_compact_shrink_to_fit(struct ht_table *table) {
+    size_t sz;
+
+    sz = ht_table_capacity_size(table, table->nb_entries, HT_COMPACT_MIN_SZ);
+    if (sz == table->indices_sz && table->entries_sz == table->nb_entries)
+        return 0;
+
+    return ht_table_compact_resize(table, sz);
+}
+
+struct ht_table_entry *
+ht_table_compact_next(struct ht_table *table, size_t *pidx) {
+    for (size_t i = *pidx; i < table->entries_sz; i++) {
+        struct ht_table_entry *entry;
+
+        entry = table->entries + i;
+        if (HT_TABLE_ENTRY_IS_USED(entry)) {
+            *pidx = i;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+size_t
+ht_table_compact_next_batch(struct ht_table *table, size_t *pidx,
+                            void **keys, void **values, size_t nb) {
+    size_t nb_entries;
+
+    nb_entries = 0;
+
+    for (size_t i = *pidx; i < table->entries_sz; i++) {
+        struct ht_table_entry *entry;
+
+        entry = table->entries + i;
+        if (!HT_TABLE_ENTRY_IS_USED(entry))
+            continue;
+
+        *pidx = i;
+
+        if (keys)
+            keys[nb_entries] = entry->key;
+        if (values)
+            values[nb_entries] = entry->value;
+
+        if (++nb_entries == nb)
+            break;
+    }
+
+    return nb_entries;
+}
+
+void
+ht_table_compact_print(struct ht_table *table, FILE *file) {
+    fprintf(file, "entries: %zu\n", table->nb_entries);
+    fprintf(file, "entry array: %zu/%zu\n",
+            table->entries_sz, table->entries_capacity);
+    fprintf(file, "index: %zu slots of %u bytes\n",
+            table->indices_sz, table->index_width);
+
+    for (size_t i = 0; i < table->entries_sz; i++) {
+        struct ht_table_entry *entry;
+
+        entry = table->entries + i;
+
+        fprintf(file, "entry %04zu  ", i);
+
+        if (HT_TABLE_ENTRY_IS_USED(entry)) {
+            fprintf(file, "key=%08"PRIxPTR" value=%08"PRIxPTR
+                    " hash=%"PRIu64,
+                    (intptr_t)entry->key, (intptr_t)entry->value,
+                    entry->hash);
+        }
+
+        fputc('\n', file);
+    }
+}
+
+void
+ht_table_compact_stats(struct ht_table *table, struct ht_table_stats *stats) {
+    size_t mask;
+
+    mask = table->indices_sz - 1;
+
+    /* Buckets are index slots, and the probe length of an entry is the
+     * number of index slots a lookup reads to find it. */
+    stats->nb_buckets = table->indices_sz;
+    stats->load_factor = (double)table->nb_entries
+                       / (double)table->indices_sz;
+    stats->memory_sz += HT_COMPACT_ARRAYS_SIZE(table->entries_capacity,
+                                               table->indices_sz,
+                                               table->index_width);
+
+    for (size_t i = 0; i < table->indices_sz; i++) {
+        struct ht_table_entry *entry;
+        size_t value, start;
+
+        value = ht_table_compact_index(table, i);
+        if (value <= HT_COMPACT_DELETED) {
+            ht_table_stats_add_bucket(stats, 0);
+            continue;
+        }
+
+        entry = table->entries + value - 2;
+        start = (size_t)ht_hash_mix64(entry->hash) & mask;
+
+        ht_table_stats_add_probe(stats, ((i - start) & mask) + 1);
+        ht_table_stats_add_bucket(stats, 1);
+    }
+}
+
+static unsigned int
+ht_table_compact_width(size_t capacity) {
+    /* Index slots must be able to store the last position plus 2. */
+    if (capacity + 1 <= UINT8_MAX)
+        return 1;
+    if (capacity + 1 <= UINT16_MAX)
+        return 2;
+    if (capacity + 1 <= UINT32_MAX)
+        return 4;
+
+    return 8;
+}
+
+static int
+ht_table_compact_resize(struct ht_table *table, size_t sz) {
+    struct ht_table_entry *entries, *old_entries;
+    size_t capacity, old_entries_sz, old_capacity, old_indices_sz;
+    unsigned int width, old_width;
+    void *indices;
+    uint64_t start;
+
+    capacity = ht_table_max_entries(table, sz);
+    width = ht_table_compact_width(capacity);
+
+    if (capacity > SIZE_MAX / sizeof(struct ht_table_entry)
+     || sz > (SIZE_MAX - capacity * sizeof(struct ht_table_entry)) / width) {
+        errno = ENOMEM;
+        ht_set_error("cannot allocate entries: %m");
+        return -1;
+    }
+
+    /* The first allocation of the arrays is not a resize. */
+    start = 0;
+    if (table->entries)
+        start = ht_table_resize_begin(table, table->indices_sz, sz);
+
+    if (table->huge_pages) {
+        /* Mappings are zero-filled. */
+        entries = ht_pages_map(HT_COMPACT_ARRAYS_SIZE(capacity, sz, width));
+    } else {
+        entries = ht_allocator_malloc(&table->allocator,
+                                      HT_COMPACT_ARRAYS_SIZE(capacity, sz,
+                                                             width));
+    }
+
+    if (!entries) {
+        ht_set_error("cannot allocate entries: %m");
+        ht_table_allocation_failed(table,
+                                   HT_COMPACT_ARRAYS_SIZE(capacity, sz,
+                                                          width));
+        if (table->entries)
+            ht_table_resize_failed(table, table->indices_sz, start);
+        return -1;
+    }
+
+    indices = entries + capacity;
+    memset(indices, 0, sz * width);
+
+    old_entries = table->entries;
+    old_entries_sz = table->entries_sz;
+    old_capacity = table->entries_capacity;
+    old_indices_sz = table->indices_sz;
+    old_width = table->index_width;
+
+    table->entries = entries;
+    table->entries_sz = 0;
+    table->entries_capacity = capacity;
+    table->indices = indices;
+    table->indices_sz = sz;
+    table->index_width = width;
+
+    /* Live entries are moved in insertion order, leaving out the holes of
+     * removed entries. */
+    for (size_t i = 0; i < old_entries_sz; i++) {
+        struct ht_table_entry *entry;
+        size_t idx;
+
+        entry = old_entries + i;
+        if (!HT_TABLE_ENTRY_IS_USED(entry))
+            continue;
+
+        idx = ht_table_compact_find_free(table, entry->hash);
+        ht_table_compact_set_index(table, idx, table->entries_sz + 2);
+
+        entries[table->entries_sz++] = *entry;
+    }
+
+    ht_table_compact_free_arrays(table, old_entries, old_capacity,
+                                 old_indices_sz, old_width);
+
+    ht_table_update_limits(table, sz);
+
+    if (old_entries) {
+        ht_table_resize_done(table, old_indices_sz, sz, table->entries_sz,
+                             start);
+    }
+
+    return 0;
+}
+
+static void
+ht_table_compact_free_arrays(struct ht_table *table,
+                             struct ht_table_entry *entries, size_t capacity,
+                             size_t sz, unsigned int width) {
+    if (table->huge_pages) {
+        ht_pages_unmap(entries, HT_COMPACT_ARRAYS_SIZE(capacity, sz, width));
+    } else {
+        ht_allocator_free(&table->allocator, entries,
+                          HT_COMPACT_ARRAYS_SIZE(capacity, sz, width));
+    }
+}
+
+static size_t
+ht_table_compact_find_free(const struct ht_table *table, uint64_t hash) {
+    size_t mask, i;
+
+    mask = table->indices_sz - 1;
+
+    i = (size_t)ht_hash_mix64(hash) & mask;
+    while (ht_table_compact_index(table, i) > HT_COMPACT_DELETED)
+        i = (i + 1) & mask;
+
+    return i;
+}
@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "hashtable.h"
+#include "group.h"
+
+/* Open addressing storage: all entries live in a single array of slots whose
+ * size is always a power of two, followed by one control byte per slot (see
+ * group.h).
+ *
+ * Slots are organized in groups of HT_GROUP_SZ slots. The 7 lowest bits of
+ * the hash select the control byte value, the remaining bits select the
+ * first group to probe. Groups are then probed using a triangular sequence
+ * until a group containing an empty slot is found. Comparing control bytes
+ * of a whole group at once means that most lookups never have to read an
+ * entry which does not match, or to call the equality function on it. */
+
+#define HT_OPEN_MIN_SZ HT_GROUP_SZ
+
+#define HT_H1(hash_) ((hash_) >> 7)
+#define HT_H2(hash_) ((uint8_t)((hash_) & 0x7f))
+
+/* Slots and control bytes share the same allocation. */
+#define HT_OPEN_ARRAYS_SIZE(sz_) ((sz_) * (sizeof(struct ht_table_entry) + 1))
+
+static int ht_table_open_allocate(struct ht_table *, size_t,
+                                  struct ht_table_entry **, uint8_t **);
+static void ht_table_open_free_arrays(const struct ht_allocator *, bool,
+                                      struct ht_table_entry *, size_t);
+static int ht_table_open_install(struct ht_table *, struct ht_table_entry *,
+                                 uint8_t *, size_t);
+static void ht_table_open_free_view(struct ht_qsbr_retired *);
+static int ht_table_open_resize(struct ht_table *, size_t);
+static size_t ht_table_open_find_free(const uint8_t *, size_t, uint64_t);
+static struct ht_table_entry *
+ht_table_open_probe(struct ht_table *, struct ht_table_entry *,
+                    const uint8_t *, size_t, const void *, uint64_t,
+                    ht_equal_func);
+
+int
+ht_table_open_init(struct ht_table *table, size_t capacity) {
+    struct ht_table_entry *slots;
+    uint8_t *ctrl;
+    size_t sz;
+
+    sz = ht_table_capacity_size(table, capacity, HT_OPEN_MIN_SZ);
+    if (sz == 0)
+        return -1;
+
+    if (ht_table_open_allocate(table, sz, &slots, &ctrl) == -1)
+        return -1;
+
+    if (ht_table_open_install(table, slots, ctrl, sz) == -1) {
+        ht_table_open_free_arrays(&table->allocator, table->huge_pages,
+                                  slots, sz);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+ht_table_open_free(struct ht_table *table) {
+    /* The current view does not own its arrays, unlike retired views. */
+    ht_allocator_free(&table->allocator, table->view,
+                      sizeof(struct ht_table_open_view));
+    ht_table_open_free_arrays(&table->allocator, table->huge_pages,
+                              table->slots, table->slots_sz);
+
+    table->view = NULL;
+    table->slots = NULL;
+    table->ctrl = NULL;
+    table->slots_sz = 0;
+}
+
+void
+ht_table_open_clear(struct ht_table *table) {
+    if (table->single_writer) {
+        /* Readers may still be reading entries: turn them into tombstones,
+         * which are never reused, instead of freeing the slots. */
+        for (size_t i = 0; i < table->slots_sz; i++) {
+            if (HT_CTRL_IS_FULL(table->ctrl[i])) {
+                __atomic_store_n(&table->ctrl[i], HT_CTRL_DELETED,
+                                 __ATOMIC_RELEASE);
+                table->nb_deleted++;
+            }
+        }
+
+        return;
+    }
+
+    memset(table->slots, 0, table->slots_sz * sizeof(struct ht_table_entry));
+    memset(table->ctrl, HT_CTRL_EMPTY, table->slots_sz);
+
+    table->nb_deleted = 0;
+}
+
+int
+ht_table_open_upsert(struct ht_table *table, void *key, uint64_t hash,
+                     struct ht_table_entry **pentry) {
+    struct ht_table_entry *entry;
+    size_t group_mask, group, idx;
+    uint64_t mixed_hash;
+    uint8_t h2;
+
+    mixed_hash = ht_hash_mix64(hash);
+    h2 = HT_H2(mixed_hash);
+
+    group_mask = table->slots_sz / HT_GROUP_SZ - 1;
+    group = (size_t)HT_H1(mixed_hash) & group_mask;
+
+    /* Look for the key while remembering the first free slot of the probe
+     * sequence, which is where a new entry goes. */
+    idx = SIZE_MAX;
+
+    for (size_t stride = 1;; stride++) {
+        const uint8_t *ctrl;
+        ht_group_mask mask;
+
+        ctrl = table->ctrl + group * HT_GROUP_SZ;
+
+        mask = ht_group_match(ctrl, h2);
+        while (mask != 0) {
+            entry = table->slots + group * HT_GROUP_SZ
+                  + ht_group_mask_first(mask);
+            if (entry->hash == hash
+                && HT_STATS_EQUAL(table, table->equal_func,
+                                  key, entry->key)) {
+                *pentry = entry;
+                return 0;
+            }
+
+            mask &= mask - 1;
+        }
+
+        /* In single writer mode, readers may still be reading the entry a
+         * tombstone used to contain: only empty slots are used. */
+        if (idx == SIZE_MAX) {
+            if (table->single_writer) {
+                mask = ht_group_match_empty(ctrl);
+            } else {
+                mask = ht_group_match_free(ctrl);
+            }
+
+            if (mask != 0)
+                idx = group * HT_GROUP_SZ + ht_group_mask_first(mask);
+        }
+
+        if (ht_group_match_empty(ctrl) != 0)
+            break;
+
+        group = (group + stride) & group_mask;
+    }
+
+    /* Tombstones are included in the load factor since they lengthen probe
+     * sequences as much as entries do. If most of them are tombstones, the
+     * table is rehashed without growing. */
+    if (table->nb_entries + table->nb_deleted >= table->max_entries) {
+        size_t sz;
+
+        sz = table->slots_sz;
+        if (table->nb_entries >= table->max_entries / 2)
+            sz = ht_table_grown_size(table, sz);
+
+        if (ht_table_open_resize(table, sz) == -1)
+            return -1;
+
+        idx = ht_table_open_find_free(table->ctrl, table->slots_sz, hash);
+    }
+
+    if (table->ctrl[idx] == HT_CTRL_DELETED)
+        table->nb_deleted--;
+
+    entry = table->slots + idx;
+    entry->key = key;
+    entry->value = NULL;
+    entry->hash = hash;
+
+    /* In single writer mode, the entry only becomes visible once the caller
+     * has set its value and published it. */
+    if (!table->single_writer)
+        table->ctrl[idx] = h2;
+
+    table->nb_entries++;
+
+    *pentry = entry;
+    return 1;
+}
+
+void
+ht_table_open_prefetch(const struct ht_table *table, uint64_t hash) {
+    size_t group_mask, group;
+
+    group_mask = table->slots_sz / HT_GROUP_SZ - 1;
+    group = (size_t)HT_H1(ht_hash_mix64(hash)) & group_mask;
+
+    /* Most lookups end in the first group: fetch its control bytes and the
+     * beginning of its slots. */
+    __builtin_prefetch(table->ctrl + group * HT_GROUP_SZ);
+    __builtin_prefetch(table->slots + group * HT_GROUP_SZ);
+}
+
+struct ht_table_entry *
+ht_table_open_entry(struct ht_table *table, const void *key, uint64_t hash,
+                    ht_equal_func equal_func) {
+    if (table->single_writer) {
+        const struct ht_table_open_view *view;
+
+        view = __atomic_load_n(&table->view, __ATOMIC_ACQUIRE);
+        return ht_table_open_probe(table, view->slots, view->ctrl,
+                                   view->slots_sz, key, hash, equal_func);
+    }
+
+    return ht_table_open_probe(table, table->slots, table->ctrl,
+                               table->slots_sz, key, hash, equal_func);
+}
+
+void
+ht_table_open_publish(struct ht_table *table, struct ht_table_entry *entry) {
+    size_t idx;
+
+    idx = (size_t)(entry - table->slots);
+    __atomic_store_n(&table->ctrl[idx], HT_H2(ht_hash_mix64(entry->hash)),
+                     __ATOMIC_RELEASE);
+}
+
+void
+ht_table_open_erase(struct ht_table *table, struct ht_table_entry *entry) {
+    if (ht_table_open_erase_slot(table, (size_t)(entry - table->slots)))
+        table->nb_deleted++;
+
+    table->nb_entries--;
+}
+
+bool
+ht_table_open_erase_slot(struct ht_table *table, size_t idx) {
+    struct ht_table_entry *entry;
+    const uint8_t *group;
+
+    /* Only the control bytes of the group of the slot are read, so that
+     * slots of different groups can be erased concurrently. Counters are
+     * left to the caller, which is told whether a tombstone was left. */
+    entry = table->slots + idx;
+    group = table->ctrl + (idx / HT_GROUP_SZ) * HT_GROUP_SZ;
+
+    /* Readers may still be reading the entry, it is left untouched. */
+    if (table->single_writer) {
+        __atomic_store_n(&table->ctrl[idx], HT_CTRL_DELETED, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    entry->key = NULL;
+    entry->value = NULL;
+    entry->hash = HT_UNUSED_HASH;
+
+    /* If the group already contains an empty slot, no probe sequence can
+     * continue past it, so the slot can be made empty instead of leaving a
+     * tombstone. */
+    if (ht_group_match_empty(group) != 0) {
+        table->ctrl[idx] = HT_CTRL_EMPTY;
+        return false;
+    }
+
+    table->ctrl[idx] = HT_CTRL_DELETED;
+    return true;
+}
+
+int
+ht_table_open_shrink(struct ht_table *table) {
+    size_t sz;
+
+    if (table->slots_sz <= HT_OPEN_MIN_SZ
+        || table->nb_entries >= table->min_entries) {
+        return 0;
+    }
+
+    sz = ht_table_shrunk_size(table, table->slots_sz, HT_OPEN_MIN_SZ);
+    return ht_table_open_resize(table, sz);
+}
+
+int
+ht_table_open_reserve(struct ht_table *table, size_t capacity) {
+    size_t sz;
+
+    sz = ht_table_capacity_size(table, capacity, HT_OPEN_MIN_SZ);
+    if (sz == 0)
+        return -1;
+    if (sz <= table->slots_sz)
+        return 0;
+
+    return ht_table_open_resize(table, sz);
+}
+
+int
+ht_table_open_shrink_to_fit(struct ht_table *table) {
+    size_t sz;
+
+    sz = ht_table_capacity_size(table, table->nb_entries, HT_OPEN_MIN_SZ);
+    if (sz == table->slots_sz && table->nb_deleted == 0)
+        return 0;
+
+    return ht_table_open_resize(table, sz);
+}
+
+/* Mask of the full slots of the group containing slot idx, starting at idx */
+static inline ht_group_mask
+ht_table_open_full_mask(struct ht_table *table, size_t idx) {
+    ht_group_mask mask;
+
+    mask = ht_group_match_full(table->ctrl + idx - idx % HT_GROUP_SZ);
+    mask &= (ht_group_mask)~0 << (idx % HT_GROUP_SZ);
+
+    return mask;
+}
+
+struct ht_table_entry *
+ht_table_open_next(struct ht_table *table, size_t *pidx) {
+    /* Control bytes are scanned a group at a time, skipping empty groups
+     * with a single comparison. */
+    for (size_t idx = *pidx; idx < table->slots_sz;
+         idx += HT_GROUP_SZ - idx % HT_GROUP_SZ) {
+        ht_group_mask mask;
+
+        mask = ht_table_open_full_mask(table, idx);
+        if (mask != 0) {
+            *pidx = idx - idx % HT_GROUP_SZ + ht_group_mask_first(mask);
+            return table->slots + *pidx;
+        }
+    }
+
+    return NULL;
+}
+
+size_t
+ht_table_open_next_batch(struct ht_table *table, size_t *pidx,
+                         void **keys, void **values, size_t nb) {
+    size_t nb_entries;
+
+    nb_entries = 0;
+
+    for (size_t idx = *pidx; idx < table->slots_sz;
+         idx += HT_GROUP_SZ - idx % HT_GROUP_SZ) {
+        ht_group_mask mask;
+
+        mask = ht_table_open_full_mask(table, idx);
+
+        while (mask != 0) {
+            struct ht_table_entry *entry;
+
+            *pidx = idx - idx % HT_GROUP_SZ + ht_group_mask_first(mask);
+            mask &= mask - 1;
+
+            entry = table->slots + *pidx;
+
+            if (keys)
+                keys[nb_entries] = entry->key;
+            if (values)
+                values[nb_entries] = entry->value;
+
+            if (++nb_entries == nb)
+                return nb_entries;
+        }
+    }
+
+    return nb_entries;
+}
+
+void
+ht_table_open_print(struct ht_table *table, FILE *file) {
+    fprintf(file, "entries: %zu\n", table->nb_entries);
+    fprintf(file, "slots: %zu\n", table->slots_sz);
+    fprintf(file, "deleted: %zu\n", table->nb_deleted);
+
+    for (size_t i = 0; i < table->slots_sz; i++) {
+        struct ht_table_entry *entry;
+
+        entry = table->slots + i;
+
+        fprintf(file, "slot %04zu  ctrl=%02x  ", i, table->ctrl[i]);
+
+        if (HT_CTRL_IS_FULL(table->ctrl[i])) {
+            fprintf(file, "key=%08"PRIxPTR" value=%08"PRIxPTR
+                    " hash=%"PRIu64,
+                    (intptr_t)entry->key, (intptr_t)entry->value,
+                    entry->hash);
+        }
+
+        fputc('\n', file);
+    }
+}
+
+void
+ht_table_open_stats(struct ht_table *table, struct ht_table_stats *stats) {
+    size_t group_mask;
+
+    group_mask = table->slots_sz / HT_GROUP_SZ - 1;
+
+    /* Buckets are groups, and the probe length of an entry is the number of
+     * groups a lookup reads to find it. */
+    stats->nb_buckets = group_mask + 1;
+    stats->load_factor = (double)table->nb_entries / (double)table->slots_sz;
+    stats->memory_sz += HT_OPEN_ARRAYS_SIZE(table->slots_sz);
+
+    for (size_t group = 0; group <= group_mask; group++) {
+        ht_group_mask mask;
+        size_t nb_entries;
+
+        mask = ht_group_match_full(table->ctrl + group * HT_GROUP_SZ);
+        nb_entries = 0;
+
+        while (mask != 0) {
+            struct ht_table_entry *entry;
+            size_t probe_group, length;
+
+            entry = table->slots + group * HT_GROUP_SZ
+                  + ht_group_mask_first(mask);
+            mask &= mask - 1;
+
+            probe_group = (size_t)HT_H1(ht_hash_mix64(entry->hash))
+                        & group_mask;
+
+            for (length = 1; probe_group != group; length++)
+                probe_group = (probe_group + length) & group_mask;
+
+            ht_table_stats_add_probe(stats, length);
+            nb_entries++;
+        }
+
+        ht_table_stats_add_bucket(stats, nb_entries);
+    }
+}
+
+static int
+ht_table_open_allocate(struct ht_table *table, size_t sz,
+                       struct ht_table_entry **pslots, uint8_t **pctrl) {
+    struct ht_table_entry *slots;
+    uint8_t *ctrl;
+
+    if (table->huge_pages) {
+        /* Mappings are zero-filled. */
+        slots = ht_pages_map(HT_OPEN_ARRAYS_SIZE(sz));
+    } else {
+        slots = ht_allocator_malloc(&table->allocator,
+                                    HT_OPEN_ARRAYS_SIZE(sz));
+        if (slots)
+            memset(slots, 0, sz * sizeof(struct ht_table_entry));
+    }
+
+    if (!slots) {
+        ht_set_error("cannot allocate slots: %m");
+        ht_table_allocation_failed(table, HT_OPEN_ARRAYS_SIZE(sz));
+        return -1;
+    }
+
+    ctrl = (uint8_t *)(slots + sz);
+    memset(ctrl, HT_CTRL_EMPTY, sz);
+
+    *pslots = slots;
+    *pctrl = ctrl;
+    return 0;
+}
+
+static int
+ht_table_open_resize(struct ht_table *table, size_t sz) {
+    struct ht_table_entry *slots;
+    uint8_t *ctrl;
+    size_t old_sz;
+    uint64_t start;
+
+    old_sz = table->slots_sz;
+    start = ht_table_resize_begin(table, old_sz, sz);
+
+    if (ht_table_open_allocate(table, sz, &slots, &ctrl) == -1) {
+        ht_table_resize_failed(table, old_sz, start);
+        return -1;
+    }
+
+    for (size_t i = 0; i < table->slots_sz; i++) {
+        struct ht_table_entry *entry;
+        size_t idx;
+
+        if (!HT_CTRL_IS_FULL(table->ctrl[i]))
+            continue;
+
+        entry = table->slots + i;
+
+        idx = ht_table_open_find_free(ctrl, sz, entry->hash);
+        ctrl[idx] = table->ctrl[i];
+        slots[idx] = *entry;
+    }
+
+    if (ht_table_open_install(table, slots, ctrl, sz) == -1) {
+        ht_table_open_free_arrays(&table->allocator, table->huge_pages,
+                                  slots, sz);
+        ht_table_resize_failed(table, old_sz, start);
+        return -1;
+    }
+
+    ht_table_resize_done(table, old_sz, sz, table->nb_entries, start);
+    return 0;
+}
+
+static int
+ht_table_open_install(struct ht_table *table, struct ht_table_entry *slots,
+                      uint8_t *ctrl, size_t sz) {
+    if (table->single_writer) {
+        struct ht_table_open_view *view, *old_view;
+
+        view = ht_allocator_malloc(&table->allocator,
+                                   sizeof(struct ht_table_open_view));
+        if (!view) {
+            ht_set_error("cannot allocate view: %m");
+            ht_table_allocation_failed(table,
+                                       sizeof(struct ht_table_open_view));
+            return -1;
+        }
+
+        memset(view, 0, sizeof(struct ht_table_open_view));
+
+        view->retired.free_func = ht_table_open_free_view;
+        view->allocator = &table->allocator;
+        view->huge_pages = table->huge_pages;
+        view->slots = slots;
+        view->ctrl = ctrl;
+        view->slots_sz = sz;
+
+        /* Readers switch to the new arrays as soon as the view is
+         * published; the old ones are freed once no reader can still be
+         * using them. */
+        old_view = table->view;
+        __atomic_store_n(&table->view, view, __ATOMIC_RELEASE);
+
+        if (old_view) {
+            ht_qsbr_retire(table->qsbr, &old_view->retired);
+            ht_qsbr_reclaim(table->qsbr);
+        }
+    } else {
+        ht_table_open_free_arrays(&table->allocator, table->huge_pages,
+                                  table->slots, table->slots_sz);
+    }
+
+    table->slots = slots;
+    table->ctrl = ctrl;
+    table->slots_sz = sz;
+    table->nb_deleted = 0;
+
+    ht_table_update_limits(table, sz);
+    return 0;
+}
+
+static void
+ht_table_open_free_view(struct ht_qsbr_retired *retired) {
+    struct ht_table_open_view *view;
+
+    view = (struct ht_table_open_view *)retired;
+
+    ht_table_open_free_arrays(view->allocator, view->huge_pages,
+                              view->slots, view->slots_sz);
+    ht_allocator_free(view->allocator, view,
+                      sizeof(struct ht_table_open_view));
+}
+
+static void
+ht_table_open_free_arrays(const struct ht_allocator *allocator,
+                          bool huge_pages, struct ht_table_entry *slots,
+                          size_t sz) {
+    if (huge_pages) {
+        ht_pages_unmap(slots, HT_OPEN_ARRAYS_SIZE(sz));
+    } else {
+        ht_allocator_free(allocator, slots, HT_OPEN_ARRAYS_SIZE(sz));
+    }
+}
+
+static struct ht_table_entry *
+ht_table_open_probe(struct ht_table *table, struct ht_table_entry *slots,
+                    const uint8_t *ctrl_bytes, size_t sz, const void *key,
+                    uint64_t hash, ht_equal_func equal_func) {
+    size_t group_mask, group;
+    uint64_t mixed_hash;
+    uint8_t h2;
+
+    mixed_hash = ht_hash_mix64(hash);
+    h2 = HT_H2(mixed_hash);
+
+    group_mask = sz / HT_GROUP_SZ - 1;
+    group = (size_t)HT_H1(mixed_hash) & group_mask;
+
+    for (size_t stride = 1;; stride++) {
+        const uint8_t *ctrl;
+        ht_group_mask mask;
+
+        ctrl = ctrl_bytes + group * HT_GROUP_SZ;
+
+        /* In single writer mode, control bytes may be modified during the
+         * load of the group; since each one is written with a single store,
+         * every byte is seen either before or after its modification. The
+         * fence orders the load before the reads of entries, which are
+         * written before their control byte is published. */
+        mask = ht_group_match(ctrl, h2);
+        if (mask != 0)
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        while (mask != 0) {
+            struct ht_table_entry *entry;
+
+            entry = slots + group * HT_GROUP_SZ + ht_group_mask_first(mask);
+            if (entry->hash == hash
+                && HT_STATS_EQUAL(table, equal_func, key,
+                                  __atomic_load_n(&entry->key,
+                                                  __ATOMIC_RELAXED))) {
+                return entry;
+            }
+
+            mask &= mask - 1;
+        }
+
+        if (ht_group_match_empty(ctrl) != 0)
+            return NULL;
+
+        group = (group + stride) & group_mask;
+    }
+}
+
+static size_t
+ht_table_open_find_free(const uint8_t *ctrl, size_t sz, uint64_t hash) {
+    size_t group_mask, group;
+
+    group_mask = sz / HT_GROUP_SZ - 1;
+    group = (size_t)HT_H1(ht_hash_mix64(hash)) & group_mask;
+
+    for (size_t stride = 1;; stride++) {
+        ht_group_mask mask;
+
+        mask = ht_group_match_free(ctrl + group * HT_GROUP_SZ);
+        if (mask != 0)
+            return group * HT_GROUP_SZ + ht_group_mask_first(mask);
+
+        group = (group + stride) & group_mask;
+    }
+}
@@ -28,6 +28,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <pthread.h>
+
 #ifdef HT_PLATFORM_LINUX
 #   include <sched.h>
 #endif
@@ -35,6 +37,10 @@
 #include "glib.h"
 
 #include "hashtable.h"
+#include "hashtable_typed.h"
+
+HT_DEFINE_TABLE(bench_typed_table, int64_t, int64_t,
+                ht_typed_hash_int64, HT_TYPED_EQUAL)
 
 static void die(const char *, ...)
     __attribute__((format(printf, 1, 2)));
@@ -42,12 +48,58 @@ static void usage(const char *, int);
 
 static void bench_start();
 static void bench_report(const char *, size_t);
+static void bench_report_allocations(const char *);
+
+static void *bench_counting_malloc(size_t);
+static void *bench_counting_calloc(size_t, size_t);
+static void *bench_counting_realloc(void *, size_t);
 
 static void bench_read_file(const char *, char ***, size_t *);
+static char **bench_miss_words(char **, size_t);
+static void bench_read_slices(const char *, struct ht_bytes **, size_t *,
+                              void **, size_t *);
+
+static void bench_hash_functions(char **, size_t);
 
 static uint32_t bench_hash_ht(const void *);
 static bool bench_equal_ht(const void *, const void *);
-static void bench_ht(char **, size_t);
+static void bench_ht(char **, char **, size_t, const char *,
+                     const struct ht_table_options *);
+static void bench_ht_get_insert(char **, size_t, const char *,
+                                const struct ht_table_options *);
+static void bench_get_many(char **, size_t, const char *,
+                           const struct ht_table_options *);
+static void bench_ht_bytes(struct ht_bytes *, size_t, const char *,
+                           const struct ht_table_options *);
+
+static void bench_int_keys(size_t);
+static void bench_huge_pages(size_t, bool);
+static void bench_snapshot(char **, size_t);
+static void bench_frozen(char **, size_t);
+static void bench_shared(char **, size_t);
+static void bench_iterate(char **, size_t, enum ht_table_storage);
+static void bench_reduce(char **, size_t, enum ht_table_storage);
+
+struct bench_thread {
+    pthread_t thread;
+    char **words;
+    size_t nb_words;
+
+    struct ht_table *table;
+    pthread_mutex_t *mutex;
+    struct ht_concurrent_table *concurrent_table;
+
+    struct ht_table_reader *reader;
+    const bool *stop;
+    size_t nb_lookups;
+};
+
+static void bench_concurrent(char **, size_t, int);
+static void *bench_concurrent_thread(void *);
+static void bench_single_writer(char **, char **, size_t, int);
+static void *bench_single_writer_reader(void *);
+static void bench_insert_loop(char **, size_t);
+static void bench_sharded(char **, size_t, int);
 
 static guint bench_hash_glib(gconstpointer);
 static gboolean bench_equal_glib(gconstpointer, gconstpointer);
@@ -55,21 +107,45 @@ static void bench_glib(char **, size_t);
 
 static struct timespec bench_time_1;
 
+/* Calls to the library allocator since the last call to bench_start() */
+static size_t bench_nb_allocations;
+
+static const struct ht_memory_allocator bench_counting_allocator = {
+    .malloc = bench_counting_malloc,
+    .free = free,
+    .calloc = bench_counting_calloc,
+    .realloc = bench_counting_realloc,
+};
+
+#ifdef HT_PLATFORM_LINUX
+static cpu_set_t bench_cpu_set;
+#endif
+
 
 int
 main(int argc, char **argv) {
     const char *path;
-    char **words;
-    size_t nb_words;
+    char **words, **misses;
+    struct ht_bytes *slices;
+    size_t nb_words, nb_slices;
+    void *map;
+    size_t mapsz;
+    bool huge_pages;
     int opt;
 
+    huge_pages = false;
+
     opterr = 0;
-    while ((opt = getopt(argc, argv, "h")) != -1) {
+    while ((opt = getopt(argc, argv, "hH")) != -1) {
         switch (opt) {
             case 'h':
                 usage(argv[0], 0);
                 break;
 
+            case 'H':
+                huge_pages = true;
+                break;
+
             case '?':
                 usage(argv[0], 1);
         }
@@ -83,10 +159,18 @@ main(int argc, char **argv) {
     bench_read_file(path, &words, &nb_words);
     printf("%zu words read from %s\n", nb_words, path);
 
+    misses = bench_miss_words(words, nb_words);
+
+    bench_read_slices(path, &slices, &nb_slices, &map, &mapsz);
+
 #ifdef HT_PLATFORM_LINUX
     {
         cpu_set_t set;
 
+        /* The original set is restored for multi-threaded benchmarks. */
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &bench_cpu_set) == -1)
+            die("cannot get process affinity: %m");
+
         CPU_ZERO(&set);
         CPU_SET(0, &set);
 
@@ -95,22 +179,180 @@ main(int argc, char **argv) {
     }
 #endif
 
-    bench_ht(words, nb_words);
+    ht_set_memory_allocator(&bench_counting_allocator);
+
+    bench_hash_functions(words, nb_words);
+
+    bench_ht(words, misses, nb_words, "libhashtable/chained",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_CHAINED,
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/incremental",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_CHAINED,
+                 .incremental_resize = true,
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/open",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_OPEN,
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/compact",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_COMPACT,
+             });
+
+    bench_ht_get_insert(words, nb_words, "libhashtable/chained/get+insert",
+                        &(struct ht_table_options){
+                            .storage = HT_TABLE_STORAGE_CHAINED,
+                        });
+    bench_ht_get_insert(words, nb_words, "libhashtable/open/get+insert",
+                        &(struct ht_table_options){
+                            .storage = HT_TABLE_STORAGE_OPEN,
+                        });
+
+    bench_ht(words, misses, nb_words, "libhashtable/chained/hash64",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_CHAINED,
+                 .hash64_func = ht_hash64_string,
+                 .random_seed = true,
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/open/hash64",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_OPEN,
+                 .hash64_func = ht_hash64_string,
+                 .random_seed = true,
+             });
+
+    bench_ht(words, misses, nb_words, "libhashtable/chained/lf=0.5",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_CHAINED,
+                 .policy = &(struct ht_table_policy){
+                     .max_load_factor = 0.5,
+                     .min_load_factor = 0.125,
+                     .growth_factor = 2.0,
+                     .shrink = true,
+                 },
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/chained/lf=2",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_CHAINED,
+                 .policy = &(struct ht_table_policy){
+                     .max_load_factor = 2.0,
+                     .min_load_factor = 0.5,
+                     .growth_factor = 2.0,
+                     .shrink = true,
+                 },
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/chained/gf=4",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_CHAINED,
+                 .policy = &(struct ht_table_policy){
+                     .max_load_factor = 1.0,
+                     .min_load_factor = 0.125,
+                     .growth_factor = 4.0,
+                     .shrink = true,
+                 },
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/open/lf=0.5",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_OPEN,
+                 .policy = &(struct ht_table_policy){
+                     .max_load_factor = 0.5,
+                     .min_load_factor = 0.125,
+                     .growth_factor = 2.0,
+                     .shrink = true,
+                 },
+             });
+    bench_ht(words, misses, nb_words, "libhashtable/open/gf=4",
+             &(struct ht_table_options){
+                 .storage = HT_TABLE_STORAGE_OPEN,
+                 .policy = &(struct ht_table_policy){
+                     .max_load_factor = 0.875,
+                     .min_load_factor = 0.125,
+                     .growth_factor = 4.0,
+                     .shrink = true,
+                 },
+             });
+
+    bench_get_many(words, nb_words, "libhashtable/chained",
+                   &(struct ht_table_options){
+                       .storage = HT_TABLE_STORAGE_CHAINED,
+                   });
+    bench_get_many(words, nb_words, "libhashtable/open",
+                   &(struct ht_table_options){
+                       .storage = HT_TABLE_STORAGE_OPEN,
+                   });
+
+    bench_ht_bytes(slices, nb_slices, "libhashtable/open/bytes",
+                   &(struct ht_table_options){
+                       .storage = HT_TABLE_STORAGE_OPEN,
+                       .hash64_func = ht_hash64_bytes,
+                       .random_seed = true,
+                   });
+
     bench_glib(words, nb_words);
 
-    for (size_t i = 0; i < nb_words; i++)
+    bench_int_keys(nb_words);
+
+    /* About 1.6GB of slots for each table, hence an option */
+    if (huge_pages) {
+        bench_huge_pages((size_t)1 << 25, false);
+        bench_huge_pages((size_t)1 << 25, true);
+    }
+
+    bench_insert_loop(words, nb_words);
+
+    bench_snapshot(words, nb_words);
+    bench_frozen(words, nb_words);
+    bench_shared(words, nb_words);
+    bench_iterate(words, nb_words, HT_TABLE_STORAGE_CHAINED);
+    bench_iterate(words, nb_words, HT_TABLE_STORAGE_OPEN);
+    bench_iterate(words, nb_words, HT_TABLE_STORAGE_COMPACT);
+    bench_reduce(words, nb_words, HT_TABLE_STORAGE_CHAINED);
+    bench_reduce(words, nb_words, HT_TABLE_STORAGE_OPEN);
+    bench_reduce(words, nb_words, HT_TABLE_STORAGE_COMPACT);
+
+    {
+        long nb_cpus;
+
+        nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nb_cpus < 1)
+            nb_cpus = 1;
+
+        for (int nb_threads = 1;; nb_threads *= 2) {
+            if (nb_threads > nb_cpus)
+                nb_threads = (int)nb_cpus;
+
+            bench_concurrent(words, nb_words, nb_threads);
+            bench_single_writer(words, misses, nb_words, nb_threads);
+            bench_sharded(words, nb_words, nb_threads);
+
+            if (nb_threads == nb_cpus)
+                break;
+        }
+    }
+
+    for (size_t i = 0; i < nb_words; i++) {
         free(words[i]);
+        free(misses[i]);
+    }
     free(words);
+    free(misses);
+
+    free(slices);
+    munmap(map, mapsz);
 
     return 0;
 }
 
 static void
 usage(const char *argv0, int exit_code) {
-    printf("Usage: %s [-h] <path>\n"
+    printf("Usage: %s [-hH] <path>\n"
             "\n"
             "Options:\n"
-            "  -h         display help\n",
+            "  -h         display help\n"
+            "  -H         benchmark huge pages with tables of 2^25 entries\n"
+            "             (about 1.6GB each)\n",
             argv0);
     exit(exit_code);
 }
@@ -131,6 +373,8 @@ die(const char *fmt, ...) {
 
 static void
 bench_start() {
+    __atomic_store_n(&bench_nb_allocations, 0, __ATOMIC_RELAXED);
+
     if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &bench_time_1) == -1)
         die("cannot get clock value: %m");
 }
@@ -153,10 +397,39 @@ bench_report(const char *label, size_t nb_words) {
     time_diff = time_2 - time_1;
     words_per_second = (size_t)((nb_words * 1000.0) / time_diff);
 
-    printf("%-20s  %.2fms (%zu words/s)\n",
+    printf("%-32s  %.2fms (%zu words/s)\n",
            label, time_diff, words_per_second);
 }
 
+static void
+bench_report_allocations(const char *label) {
+    char allocations_label[64];
+
+    snprintf(allocations_label, sizeof(allocations_label), "%s/allocations",
+             label);
+
+    printf("%-32s  %zu\n", allocations_label,
+           __atomic_load_n(&bench_nb_allocations, __ATOMIC_RELAXED));
+}
+
+static void *
+bench_counting_malloc(size_t sz) {
+    __atomic_fetch_add(&bench_nb_allocations, 1, __ATOMIC_RELAXED);
+    return malloc(sz);
+}
+
+static void *
+bench_counting_calloc(size_t nb, size_t sz) {
+    __atomic_fetch_add(&bench_nb_allocations, 1, __ATOMIC_RELAXED);
+    return calloc(nb, sz);
+}
+
+static void *
+bench_counting_realloc(void *ptr, size_t sz) {
+    __atomic_fetch_add(&bench_nb_allocations, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, sz);
+}
+
 static void
 bench_read_file(const char *path, char ***pwords, size_t *p_nb_words) {
     char **words;
@@ -241,6 +514,135 @@ bench_read_file(const char *path, char ***pwords, size_t *p_nb_words) {
     munmap(map, mapsz);
 }
 
+static void
+bench_read_slices(const char *path, struct ht_bytes **pslices,
+                  size_t *p_nb_slices, void **pmap, size_t *pmapsz) {
+    struct ht_bytes *slices;
+    size_t sz, nb_slices;
+    struct stat st;
+    void *map;
+    size_t mapsz;
+    int fd;
+    const char *ptr;
+    size_t len;
+
+    /* Same tokenization as bench_read_file(), but words are slices of the
+     * mapped file instead of copies; the mapping must therefore be kept
+     * until the slices are not used anymore. */
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        die("cannot open %s: %m", path);
+
+    if (fstat(fd, &st) == -1)
+        die("cannot get stat on %s: %m", path);
+
+    mapsz = (size_t)st.st_size;
+
+    map = mmap(NULL, mapsz, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        die("cannot map %s: %m", path);
+
+    close(fd);
+
+    sz = 8;
+    slices = malloc(sz * sizeof(struct ht_bytes));
+    if (!slices)
+        die("cannot allocate slice array: %m");
+
+    nb_slices = 0;
+
+    ptr = map;
+    len = mapsz;
+
+    while (len > 0) {
+        const char *start;
+
+        while (len > 0 && !isalnum((unsigned char)*ptr)) {
+            ptr++;
+            len--;
+        }
+        if (len == 0)
+            break;
+
+        start = ptr;
+
+        while (len > 0 && isalnum((unsigned char)*ptr)) {
+            ptr++;
+            len--;
+        }
+
+        if (nb_slices + 1 >= sz) {
+            sz *= 2;
+            slices = realloc(slices, sz * sizeof(struct ht_bytes));
+            if (!slices)
+                die("cannot reallocate slice array: %m");
+        }
+
+        slices[nb_slices].data = start;
+        slices[nb_slices].size = (size_t)(ptr - start);
+        nb_slices++;
+    }
+
+    *pslices = slices;
+    *p_nb_slices = nb_slices;
+
+    *pmap = map;
+    *pmapsz = mapsz;
+}
+
+static char **
+bench_miss_words(char **words, size_t nb_words) {
+    char **misses;
+
+    /* Words never contain non-alphanumeric characters, so prefixing them
+     * with one yields keys which are never found in the table. */
+    misses = malloc(nb_words * sizeof(char *));
+    if (!misses)
+        die("cannot allocate word array: %m");
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (asprintf(&misses[i], "_%s", words[i]) == -1)
+            die("cannot allocate word: %m");
+    }
+
+    return misses;
+}
+
+static void
+bench_hash_functions(char **words, size_t nb_words) {
+    volatile uint64_t sink;
+    uint64_t hash;
+
+    hash = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_words; i++)
+        hash ^= ht_hash_string(words[i]);
+    bench_report("ht_hash_string", nb_words);
+    sink = hash;
+
+    hash = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_words; i++)
+        hash ^= ht_hash64_string(words[i], 42);
+    bench_report("ht_hash64_string", nb_words);
+    sink = hash;
+
+    hash = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_words; i++)
+        hash ^= ht_hash_int32(HT_INT32_TO_POINTER(i));
+    bench_report("ht_hash_int32", nb_words);
+    sink = hash;
+
+    hash = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_words; i++)
+        hash ^= ht_hash64_int32(HT_INT32_TO_POINTER(i), 42);
+    bench_report("ht_hash64_int32", nb_words);
+    sink = hash;
+
+    (void)sink;
+}
 
 static uint32_t
 bench_hash_ht(const void *key) {
@@ -265,10 +667,61 @@ bench_equal_ht(const void *k1, const void *k2) {
 }
 
 static void
-bench_ht(char **words, size_t nb_words) {
+bench_ht(char **words, char **misses, size_t nb_words, const char *label,
+         const struct ht_table_options *options) {
     struct ht_table *table;
+    char miss_label[64];
+    size_t nb_found;
 
-    table = ht_table_new(bench_hash_ht, bench_equal_ht);
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht, options);
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+
+    for (size_t i = 0; i < nb_words; i++) {
+        char *word;
+        intptr_t count;
+        void **pvalue;
+
+        word = words[i];
+
+        if (ht_table_upsert(table, word, &pvalue) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+
+        count = (intptr_t)*pvalue;
+        *pvalue = (void *)(count + 1);
+    }
+
+    bench_report(label, nb_words);
+    bench_report_allocations(label);
+
+    snprintf(miss_label, sizeof(miss_label), "%s/miss", label);
+
+    bench_start();
+
+    nb_found = 0;
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_contains(table, misses[i]))
+            nb_found++;
+    }
+
+    bench_report(miss_label, nb_words);
+
+    if (nb_found > 0)
+        die("%zu unexpected words found", nb_found);
+
+    ht_table_delete(table);
+}
+
+static void
+bench_ht_get_insert(char **words, size_t nb_words, const char *label,
+                    const struct ht_table_options *options) {
+    struct ht_table *table;
+
+    /* Count words with a lookup followed by an insertion, i.e. the way it
+     * had to be done before ht_table_upsert(). */
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht, options);
     if (!table)
         die("cannot create hash table: %s", ht_get_error());
 
@@ -282,7 +735,7 @@ bench_ht(char **words, size_t nb_words) {
         word = words[i];
 
         if (ht_table_get(table, word, &pvalue) == 1) {
-            count = (intptr_t)pvalue;
+            count = (intptr_t)pvalue + 1;
         } else {
             count = 1;
         }
@@ -291,11 +744,859 @@ bench_ht(char **words, size_t nb_words) {
             die("cannot insert entry: %s", ht_get_error());
     }
 
-    bench_report("libhashtable", nb_words);
+    bench_report(label, nb_words);
+
+    ht_table_delete(table);
+}
+
+static void
+bench_get_many(char **words, size_t nb_words, const char *label,
+               const struct ht_table_options *options) {
+    static const size_t batch_sizes[] = {4, 16, 64, 256, 512};
+    struct ht_table *table;
+    char batch_label[64];
+    void **values;
+    size_t nb_found;
+
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht, options);
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+
+    values = malloc(nb_words * sizeof(void *));
+    if (!values)
+        die("cannot allocate value array: %m");
+
+    snprintf(batch_label, sizeof(batch_label), "%s/get", label);
+
+    bench_start();
+
+    nb_found = 0;
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_get(table, words[i], &values[i]) == 1)
+            nb_found++;
+    }
+
+    bench_report(batch_label, nb_words);
+
+    if (nb_found != nb_words)
+        die("%zu words not found", nb_words - nb_found);
+
+    for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(size_t); b++) {
+        size_t batch_sz;
+
+        batch_sz = batch_sizes[b];
+
+        snprintf(batch_label, sizeof(batch_label), "%s/get_many/%zu",
+                 label, batch_sz);
+
+        bench_start();
+
+        nb_found = 0;
+        for (size_t i = 0; i < nb_words; i += batch_sz) {
+            size_t nb;
+
+            nb = nb_words - i;
+            if (nb > batch_sz)
+                nb = batch_sz;
+
+            nb_found += ht_table_get_many(table,
+                                          (const void * const *)words + i, nb,
+                                          values + i, NULL);
+        }
+
+        bench_report(batch_label, nb_words);
+
+        if (nb_found != nb_words)
+            die("%zu words not found", nb_words - nb_found);
+    }
+
+    free(values);
+    ht_table_delete(table);
+}
+
+static void
+bench_ht_bytes(struct ht_bytes *slices, size_t nb_slices, const char *label,
+               const struct ht_table_options *options) {
+    struct ht_table *table;
+
+    table = ht_table_new_ex(ht_hash_bytes, ht_equal_bytes, options);
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+
+    for (size_t i = 0; i < nb_slices; i++) {
+        struct ht_bytes *slice;
+        intptr_t count;
+        void **pvalue;
+
+        slice = &slices[i];
+
+        if (ht_table_upsert(table, slice, &pvalue) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+
+        count = (intptr_t)*pvalue;
+        *pvalue = (void *)(count + 1);
+    }
+
+    bench_report(label, nb_slices);
+
+    ht_table_delete(table);
+}
+
+static void
+bench_int_keys(size_t nb_keys) {
+    struct ht_table *table;
+    struct bench_typed_table *typed_table;
+    volatile int64_t sink;
+    int64_t sum;
+
+    /* Keys are spread over the whole 32 bit range, as session identifiers
+     * would be. */
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_OPEN,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+    for (size_t i = 0; i < nb_keys; i++) {
+        if (ht_table_insert(table, HT_INT32_TO_POINTER(i * 2654435761u),
+                            HT_INT32_TO_POINTER(i)) == -1) {
+            die("cannot insert entry: %s", ht_get_error());
+        }
+    }
+    bench_report("libhashtable/open/int32", nb_keys);
+
+    sum = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_keys; i++) {
+        void *value;
+
+        if (ht_table_get(table, HT_INT32_TO_POINTER(i * 2654435761u),
+                         &value) == 1) {
+            sum += HT_POINTER_TO_INT32(value);
+        }
+    }
+    bench_report("libhashtable/open/int32/get", nb_keys);
+    sink = sum;
+
+    ht_table_delete(table);
+
+    typed_table = bench_typed_table_new();
+    if (!typed_table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+    for (size_t i = 0; i < nb_keys; i++) {
+        if (bench_typed_table_insert(typed_table,
+                                     (int32_t)(i * 2654435761u),
+                                     (int64_t)i) == -1) {
+            die("cannot insert entry: %s", ht_get_error());
+        }
+    }
+    bench_report("typed/int64", nb_keys);
+
+    sum = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_keys; i++) {
+        int64_t value;
+
+        if (bench_typed_table_get(typed_table, (int32_t)(i * 2654435761u),
+                                  &value) == 1) {
+            sum += value;
+        }
+    }
+    bench_report("typed/int64/get", nb_keys);
+    sink = sum;
+
+    bench_typed_table_delete(typed_table);
+
+    (void)sink;
+}
+
+static void
+bench_concurrent(char **words, size_t nb_words, int nb_threads) {
+    struct bench_thread threads[nb_threads];
+    struct timespec time_1, time_2;
+    pthread_mutex_t mutex;
+    char label[64];
+    double time_diff;
+
+#ifdef HT_PLATFORM_LINUX
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == -1)
+        die("cannot get process affinity: %m");
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &bench_cpu_set) == -1)
+        die("cannot set process affinity: %m");
+#endif
+
+    /* Each thread runs a mixed workload on its share of the words: nine
+     * lookups for one insertion. The same workload is run with a single
+     * table protected by a global mutex, and with a concurrent table. */
+    for (int m = 0; m < 2; m++) {
+        struct ht_table *table;
+        struct ht_concurrent_table *concurrent_table;
+
+        table = NULL;
+        concurrent_table = NULL;
+
+        if (m == 0) {
+            table = ht_table_new_ex(bench_hash_ht, bench_equal_ht,
+                                    &(struct ht_table_options){
+                                        .storage = HT_TABLE_STORAGE_OPEN,
+                                    });
+            if (!table)
+                die("cannot create hash table: %s", ht_get_error());
+
+            pthread_mutex_init(&mutex, NULL);
+        } else {
+            concurrent_table =
+                ht_concurrent_table_new(bench_hash_ht, bench_equal_ht,
+                                        &(struct ht_table_options){
+                                            .storage = HT_TABLE_STORAGE_OPEN,
+                                        }, 0);
+            if (!concurrent_table)
+                die("cannot create hash table: %s", ht_get_error());
+        }
+
+        if (clock_gettime(CLOCK_MONOTONIC, &time_1) == -1)
+            die("cannot get clock value: %m");
+
+        for (int t = 0; t < nb_threads; t++) {
+            struct bench_thread *thread;
+            size_t start, end;
+            int ret;
+
+            start = nb_words * (size_t)t / (size_t)nb_threads;
+            end = nb_words * (size_t)(t + 1) / (size_t)nb_threads;
+
+            thread = threads + t;
+            thread->words = words + start;
+            thread->nb_words = end - start;
+            thread->table = table;
+            thread->mutex = &mutex;
+            thread->concurrent_table = concurrent_table;
+
+            ret = pthread_create(&thread->thread, NULL,
+                                 bench_concurrent_thread, thread);
+            if (ret != 0)
+                die("cannot create thread: %s", strerror(ret));
+        }
+
+        for (int t = 0; t < nb_threads; t++)
+            pthread_join(threads[t].thread, NULL);
+
+        if (clock_gettime(CLOCK_MONOTONIC, &time_2) == -1)
+            die("cannot get clock value: %m");
+
+        time_diff = (time_2.tv_sec - time_1.tv_sec) * 1000.0
+                  + (time_2.tv_nsec - time_1.tv_nsec) / 1.0e6;
+
+        snprintf(label, sizeof(label), "%s/%dthreads",
+                 (m == 0) ? "libhashtable/mutex" : "libhashtable/concurrent",
+                 nb_threads);
+        printf("%-32s  %.2fms (%zu ops/s)\n", label, time_diff,
+               (size_t)((nb_words * 10 * 1000.0) / time_diff));
+
+        if (m == 0) {
+            pthread_mutex_destroy(&mutex);
+            ht_table_delete(table);
+        } else {
+            ht_concurrent_table_delete(concurrent_table);
+        }
+    }
+
+#ifdef HT_PLATFORM_LINUX
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == -1)
+        die("cannot set process affinity: %m");
+#endif
+}
+
+static void *
+bench_concurrent_thread(void *arg) {
+    struct bench_thread *thread;
+
+    thread = arg;
+
+    for (size_t i = 0; i < thread->nb_words; i++) {
+        char *word;
+        void *value;
+
+        word = thread->words[i];
+
+        for (int n = 0; n < 10; n++) {
+            char *key;
+            int ret;
+
+            /* Insert the current word, then look up words this thread
+             * has already inserted. */
+            if (n == 0) {
+                key = word;
+            } else {
+                key = thread->words[(i * 7 + (size_t)n) % (i + 1)];
+            }
+
+            if (thread->concurrent_table) {
+                if (n == 0) {
+                    ret = ht_concurrent_table_insert(thread->concurrent_table,
+                                                     key, NULL);
+                } else {
+                    ret = ht_concurrent_table_get(thread->concurrent_table,
+                                                  key, &value);
+                }
+            } else {
+                pthread_mutex_lock(thread->mutex);
+                if (n == 0) {
+                    ret = ht_table_insert(thread->table, key, NULL);
+                } else {
+                    ret = ht_table_get(thread->table, key, &value);
+                }
+                pthread_mutex_unlock(thread->mutex);
+            }
+
+            if (ret == -1)
+                die("cannot insert entry: %s", ht_get_error());
+        }
+    }
+
+    return NULL;
+}
+
+static void
+bench_single_writer(char **words, char **misses, size_t nb_words,
+                    int nb_threads) {
+    struct bench_thread threads[nb_threads];
+    struct ht_table *table;
+    struct timespec time_1, time_2;
+    char label[64];
+    double time_diff;
+    size_t nb_lookups;
+    bool stop;
+
+#ifdef HT_PLATFORM_LINUX
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == -1)
+        die("cannot get process affinity: %m");
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &bench_cpu_set) == -1)
+        die("cannot set process affinity: %m");
+#endif
+
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_OPEN,
+                                .single_writer = true,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+
+    /* Readers look up all words while the main thread keeps inserting and
+     * removing other keys, causing tombstone cleanups and resizes. */
+    stop = false;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &time_1) == -1)
+        die("cannot get clock value: %m");
+
+    for (int t = 0; t < nb_threads; t++) {
+        struct bench_thread *thread;
+        int ret;
+
+        thread = threads + t;
+        thread->words = words;
+        thread->nb_words = nb_words;
+        thread->table = table;
+        thread->stop = &stop;
+        thread->nb_lookups = 0;
+
+        thread->reader = ht_table_register_reader(table);
+        if (!thread->reader)
+            die("cannot register reader: %s", ht_get_error());
+
+        ret = pthread_create(&thread->thread, NULL,
+                             bench_single_writer_reader, thread);
+        if (ret != 0)
+            die("cannot create thread: %s", strerror(ret));
+    }
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, misses[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+
+        if (i >= 1000)
+            ht_table_remove(table, misses[i - 1000]);
+    }
+
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+
+    nb_lookups = 0;
+    for (int t = 0; t < nb_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+        ht_table_unregister_reader(threads[t].reader);
+
+        nb_lookups += threads[t].nb_lookups;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &time_2) == -1)
+        die("cannot get clock value: %m");
+
+    time_diff = (time_2.tv_sec - time_1.tv_sec) * 1000.0
+              + (time_2.tv_nsec - time_1.tv_nsec) / 1.0e6;
+
+    snprintf(label, sizeof(label), "libhashtable/single-writer/%dreaders",
+             nb_threads);
+    printf("%-32s  %.2fms (%zu lookups/s)\n", label, time_diff,
+           (size_t)((nb_lookups * 1000.0) / time_diff));
+
+    ht_table_delete(table);
+
+#ifdef HT_PLATFORM_LINUX
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == -1)
+        die("cannot set process affinity: %m");
+#endif
+}
+
+static void *
+bench_single_writer_reader(void *arg) {
+    struct bench_thread *thread;
+    size_t i;
+
+    thread = arg;
+
+    i = 0;
+    while (!__atomic_load_n(thread->stop, __ATOMIC_ACQUIRE)) {
+        for (size_t n = 0; n < 1000; n++) {
+            void *value;
+
+            if (ht_table_get(thread->table, thread->words[i], &value) != 1)
+                die("word not found");
+
+            if (++i == thread->nb_words)
+                i = 0;
+        }
+
+        thread->nb_lookups += 1000;
+        ht_table_reader_quiescent(thread->reader);
+    }
+
+    ht_table_reader_offline(thread->reader);
+    return NULL;
+}
+
+static void
+bench_huge_pages(size_t nb_keys, bool huge_pages) {
+    struct ht_table *table;
+    char label[64];
+    volatile int64_t sink;
+    int64_t sum;
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_OPEN,
+                                .capacity = nb_keys,
+                                .huge_pages = huge_pages,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    for (size_t i = 0; i < nb_keys; i++) {
+        if (ht_table_insert(table, HT_INT32_TO_POINTER(i * 2654435761u),
+                            HT_INT32_TO_POINTER(i)) == -1) {
+            die("cannot insert entry: %s", ht_get_error());
+        }
+    }
+
+    snprintf(label, sizeof(label), "libhashtable/open/%s/random-get",
+             huge_pages ? "huge-pages" : "malloc");
+
+    /* nb_keys is a power of two, multiplying by an odd number modulo
+     * nb_keys visits all keys in a scattered order. */
+    sum = 0;
+    bench_start();
+    for (size_t i = 0; i < nb_keys; i++) {
+        size_t idx;
+        void *value;
+
+        idx = (i * 0x9e3779b1u) & (nb_keys - 1);
+
+        if (ht_table_get(table, HT_INT32_TO_POINTER(idx * 2654435761u),
+                         &value) == 1) {
+            sum += HT_POINTER_TO_INT32(value);
+        }
+    }
+    bench_report(label, nb_keys);
+    sink = sum;
+    (void)sink;
+
+    ht_table_delete(table);
+}
+
+static void
+bench_snapshot(char **words, size_t nb_words) {
+    struct ht_table *table, *table2;
+    struct ht_table_iterator *it;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+        .hash64_func = ht_hash64_string,
+        .random_seed = true,
+    };
+    void *key;
+    FILE *file;
+
+    table = ht_table_new_ex(NULL, ht_equal_string, &options);
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+    bench_report("libhashtable/snapshot/build", nb_words);
+
+    file = tmpfile();
+    if (!file)
+        die("cannot create temporary file: %m");
+
+    bench_start();
+    if (ht_table_save(table, file, &ht_codec_string, NULL) == -1)
+        die("cannot save table: %s", ht_get_error());
+    if (fflush(file) == EOF)
+        die("cannot flush file: %m");
+    bench_report("libhashtable/snapshot/save", nb_words);
+
+    rewind(file);
+
+    table2 = ht_table_new_ex(NULL, ht_equal_string, &options);
+    if (!table2)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+    if (ht_table_load(table2, file, &ht_codec_string, NULL) == -1)
+        die("cannot load table: %s", ht_get_error());
+    bench_report("libhashtable/snapshot/load", nb_words);
+
+    if (ht_table_nb_entries(table2) != ht_table_nb_entries(table))
+        die("invalid number of entries after loading");
+
+    fclose(file);
+
+    it = ht_table_iterate(table2);
+    if (!it)
+        die("cannot create iterator: %s", ht_get_error());
+    while (ht_table_iterator_next(it, &key, NULL) == 1)
+        ht_free(key);
+    ht_table_iterator_delete(it);
 
+    ht_table_delete(table2);
     ht_table_delete(table);
 }
 
+static void
+bench_frozen(char **words, size_t nb_words) {
+    struct ht_frozen_table *frozen;
+    struct ht_table *table;
+    size_t nb_found;
+
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_OPEN,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+
+    bench_start();
+    nb_found = 0;
+    for (size_t i = 0; i < nb_words; i++)
+        nb_found += ht_table_contains(table, words[i]);
+    bench_report("libhashtable/open/contains", nb_words);
+
+    if (nb_found != nb_words)
+        die("missing entries in table");
+
+    bench_start();
+    frozen = ht_table_freeze(table, ht_encode_string, NULL);
+    if (!frozen)
+        die("cannot freeze table: %s", ht_get_error());
+    bench_report("libhashtable/frozen/freeze", ht_table_nb_entries(table));
+
+    bench_start();
+    nb_found = 0;
+    for (size_t i = 0; i < nb_words; i++) {
+        nb_found += ht_frozen_table_contains(frozen, words[i],
+                                             strlen(words[i]));
+    }
+    bench_report("libhashtable/frozen/contains", nb_words);
+
+    if (nb_found != nb_words)
+        die("missing entries in frozen table");
+
+    ht_frozen_table_delete(frozen);
+    ht_table_delete(table);
+}
+
+static void
+bench_shared(char **words, size_t nb_words) {
+    struct ht_shared_table *table;
+    size_t nb_found;
+    FILE *file;
+    int32_t one;
+
+    file = tmpfile();
+    if (!file)
+        die("cannot create temporary file: %m");
+
+    table = ht_shared_table_create(fileno(file), nb_words, 64 * nb_words);
+    if (!table)
+        die("cannot create shared table: %s", ht_get_error());
+
+    one = 1;
+
+    bench_start();
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_shared_table_insert(table, words[i], strlen(words[i]),
+                                   &one, sizeof(int32_t)) == -1) {
+            die("cannot insert entry: %s", ht_get_error());
+        }
+    }
+    bench_report("libhashtable/shared/insert", nb_words);
+
+    bench_start();
+    nb_found = 0;
+    for (size_t i = 0; i < nb_words; i++) {
+        nb_found += ht_shared_table_contains(table, words[i],
+                                             strlen(words[i]));
+    }
+    bench_report("libhashtable/shared/contains", nb_words);
+
+    if (nb_found != nb_words)
+        die("missing entries in shared table");
+
+    ht_shared_table_detach(table);
+    fclose(file);
+}
+
+static void
+bench_iterate(char **words, size_t nb_words, enum ht_table_storage storage) {
+    struct ht_table *table;
+    struct ht_table_iterator *it, stack_it;
+    const char *name;
+    void *keys[64], *key;
+    size_t nb, nb_total;
+    char label[64];
+
+    switch (storage) {
+    case HT_TABLE_STORAGE_OPEN:
+        name = "open";
+        break;
+    case HT_TABLE_STORAGE_COMPACT:
+        name = "compact";
+        break;
+    default:
+        name = "chained";
+        break;
+    }
+
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht,
+                            &(struct ht_table_options){
+                                .storage = storage,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+
+    /* Full sweeps of the table, as done for expiry or metrics export */
+    snprintf(label, sizeof(label), "libhashtable/%s/iterate", name);
+
+    bench_start();
+    nb_total = 0;
+    for (int i = 0; i < 10; i++) {
+        it = ht_table_iterate(table);
+        if (!it)
+            die("cannot create iterator: %s", ht_get_error());
+        while (ht_table_iterator_next(it, &key, NULL) == 1)
+            nb_total++;
+        ht_table_iterator_delete(it);
+    }
+    bench_report(label, nb_total);
+
+    snprintf(label, sizeof(label), "libhashtable/%s/iterate_batch", name);
+
+    bench_start();
+    nb_total = 0;
+    for (int i = 0; i < 10; i++) {
+        ht_table_iterator_init(&stack_it, table);
+        while ((nb = ht_table_iterator_next_batch(&stack_it, keys, NULL,
+                                                  64)) > 0) {
+            nb_total += nb;
+        }
+        ht_table_iterator_release(&stack_it);
+    }
+    bench_report(label, nb_total);
+
+    ht_table_delete(table);
+}
+
+static void
+bench_reduce_length(void *acc, void *key, void *value, void *arg) {
+    *(size_t *)acc += strlen(key);
+}
+
+static void
+bench_combine_length(void *acc, const void *acc2, void *arg) {
+    *(size_t *)acc += *(const size_t *)acc2;
+}
+
+static void
+bench_reduce(char **words, size_t nb_words, enum ht_table_storage storage) {
+    static const unsigned int nb_threads[] = {1, 2, 4, 0};
+
+    struct ht_table *table;
+    struct ht_table_iterator it;
+    const char *name;
+    size_t length, nb_total;
+    void *key;
+    char label[64];
+
+    switch (storage) {
+    case HT_TABLE_STORAGE_OPEN:
+        name = "open";
+        break;
+    case HT_TABLE_STORAGE_COMPACT:
+        name = "compact";
+        break;
+    default:
+        name = "chained";
+        break;
+    }
+
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht,
+                            &(struct ht_table_options){
+                                .storage = storage,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+
+    /* Reference: the same reduction with a single threaded iterator */
+    snprintf(label, sizeof(label), "libhashtable/%s/reduce/iterator", name);
+
+    bench_start();
+    nb_total = 0;
+    for (int i = 0; i < 10; i++) {
+        length = 0;
+        ht_table_iterator_init(&it, table);
+        while (ht_table_iterator_next(&it, &key, NULL) == 1)
+            length += strlen(key);
+        ht_table_iterator_release(&it);
+        nb_total += ht_table_nb_entries(table);
+    }
+    bench_report(label, nb_total);
+
+    for (size_t t = 0; t < sizeof(nb_threads) / sizeof(nb_threads[0]); t++) {
+        if (nb_threads[t] > 0) {
+            snprintf(label, sizeof(label), "libhashtable/%s/reduce/%u",
+                     name, nb_threads[t]);
+        } else {
+            snprintf(label, sizeof(label), "libhashtable/%s/reduce/all",
+                     name);
+        }
+
+        bench_start();
+        nb_total = 0;
+        for (int i = 0; i < 10; i++) {
+            length = 0;
+            if (ht_table_reduce_parallel(table, bench_reduce_length,
+                                         bench_combine_length,
+                                         &length, sizeof(size_t), NULL,
+                                         nb_threads[t], NULL) == -1) {
+                die("cannot reduce table: %s", ht_get_error());
+            }
+            nb_total += ht_table_nb_entries(table);
+        }
+        bench_report(label, nb_total);
+    }
+
+    ht_table_delete(table);
+}
+
+static void
+bench_insert_loop(char **words, size_t nb_words) {
+    struct ht_table *table;
+
+    /* Reference for bulk loading: insert all words one by one in a single
+     * table. */
+    table = ht_table_new_ex(bench_hash_ht, bench_equal_ht,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_OPEN,
+                            });
+    if (!table)
+        die("cannot create hash table: %s", ht_get_error());
+
+    bench_start();
+
+    for (size_t i = 0; i < nb_words; i++) {
+        if (ht_table_insert(table, words[i], NULL) == -1)
+            die("cannot insert entry: %s", ht_get_error());
+    }
+
+    bench_report("libhashtable/open/insert", nb_words);
+
+    ht_table_delete(table);
+}
+
+static void
+bench_sharded(char **words, size_t nb_words, int nb_threads) {
+    struct ht_sharded_table *table;
+    char label[64];
+
+    table = ht_sharded_table_new(bench_hash_ht, bench_equal_ht,
+                                 &(struct ht_table_options){
+                                     .storage = HT_TABLE_STORAGE_OPEN,
+                                 }, 0);
+    if (!table)
+        die("cannot create sharded table: %s", ht_get_error());
+
+    snprintf(label, sizeof(label), "libhashtable/sharded/insert_many/%d",
+             nb_threads);
+
+    bench_start();
+
+    if (ht_sharded_table_insert_many(table, (void **)words, NULL, nb_words,
+                                     (unsigned int)nb_threads) == -1) {
+        die("cannot insert entries: %s", ht_get_error());
+    }
+
+    bench_report(label, nb_words);
+
+    ht_sharded_table_delete(table);
+}
+
 static guint
 bench_hash_glib(gconstpointer key) {
     const unsigned char *str;
@@ -0,0 +1,1227 @@
+/*
+ * Copyright (c) 2013-2014 Nicolas Martyanoff
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifdef HT_PLATFORM_LINUX
+#   include <sched.h>
+#endif
+
+/* Other hash table implementations are optional, and enabled at build
+ * time (see the GNUmakefile). */
+#ifdef BENCH_GLIB
+#   include "glib.h"
+#endif
+#ifdef BENCH_KHASH
+#   include "khash.h"
+#endif
+#ifdef BENCH_UTHASH
+#   include "uthash.h"
+#endif
+
+#include "hashtable.h"
+
+/* Each run measures one workload on one implementation, with keys of one
+ * type, on a table containing a given number of entries. Runs are executed
+ * in a child process, so that each one starts with a fresh heap and its
+ * peak resident set size can be measured. */
+
+enum bench_key_type {
+    BENCH_KEY_INT32,
+    BENCH_KEY_INT64,
+    BENCH_KEY_SHORT_STRING,
+    BENCH_KEY_LONG_STRING,
+
+    BENCH_NB_KEY_TYPES
+};
+
+enum bench_workload {
+    BENCH_WORKLOAD_INSERT,
+    BENCH_WORKLOAD_HIT,
+    BENCH_WORKLOAD_HIT_ZIPF,
+    BENCH_WORKLOAD_MISS,
+    BENCH_WORKLOAD_CHURN,
+
+    BENCH_NB_WORKLOADS
+};
+
+enum bench_format {
+    BENCH_FORMAT_TEXT,
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON,
+};
+
+struct bench_impl {
+    const char *name;
+
+    void *(*create)(enum bench_key_type);
+    void (*destroy)(void *);
+    void (*insert)(void *, void *);
+    bool (*get)(void *, void *);
+    void (*remove)(void *, void *);
+};
+
+struct bench_keys {
+    enum bench_key_type type;
+    size_t size;
+
+    /* The first half of the array contains the keys inserted in the table,
+     * the second half keys which are never inserted. */
+    void **keys;
+    char *strings;
+
+    /* Indexes of the keys used by lookups */
+    uint32_t *sequence;
+    size_t sequence_sz;
+};
+
+struct bench_result {
+    size_t nb_ops;
+    double seconds;
+    long peak_rss; /* kB */
+};
+
+static const char *bench_key_type_names[BENCH_NB_KEY_TYPES] = {
+    [BENCH_KEY_INT32] = "int32",
+    [BENCH_KEY_INT64] = "int64",
+    [BENCH_KEY_SHORT_STRING] = "short-string",
+    [BENCH_KEY_LONG_STRING] = "long-string",
+};
+
+static const char *bench_workload_names[BENCH_NB_WORKLOADS] = {
+    [BENCH_WORKLOAD_INSERT] = "insert",
+    [BENCH_WORKLOAD_HIT] = "hit",
+    [BENCH_WORKLOAD_HIT_ZIPF] = "hit-zipf",
+    [BENCH_WORKLOAD_MISS] = "miss",
+    [BENCH_WORKLOAD_CHURN] = "churn",
+};
+
+/* From L1-resident to larger than the last level cache */
+static const size_t bench_default_sizes[] = {
+    (size_t)1 << 10,
+    (size_t)1 << 14,
+    (size_t)1 << 18,
+    (size_t)1 << 21,
+};
+
+#define BENCH_MAX_SIZES 32
+
+#define BENCH_ZIPF_THETA 0.99
+
+static void die(const char *, ...)
+    __attribute__((format(printf, 1, 2)));
+static void usage(const char *, int);
+
+static bool bench_list_contains(const char *, const char *);
+static size_t bench_parse_sizes(const char *, size_t *);
+
+static uint64_t bench_random(void);
+static double bench_random_double(void);
+static uint32_t bench_random_index(size_t);
+static uint32_t bench_mix32(uint32_t);
+static uint64_t bench_mix64(uint64_t);
+
+static void bench_keys_init(struct bench_keys *, enum bench_key_type,
+                            size_t);
+static void bench_keys_free(struct bench_keys *);
+static void bench_keys_sequence(struct bench_keys *, enum bench_workload,
+                                size_t);
+
+static bool bench_run(const struct bench_impl *, struct bench_keys *,
+                      enum bench_workload, size_t, struct bench_result *);
+static void bench_run_child(const struct bench_impl *, struct bench_keys *,
+                            enum bench_workload, size_t, int);
+static double bench_now(void);
+static long bench_max_rss(void);
+
+static void bench_print_header(enum bench_format);
+static void bench_print_result(enum bench_format, const struct bench_impl *,
+                               enum bench_key_type, enum bench_workload,
+                               size_t, const struct bench_result *);
+static void bench_print_footer(enum bench_format);
+
+static uint64_t bench_random_state = UINT64_C(0x2545f4914f6cdd1d);
+static bool bench_first_result = true;
+
+/* libhashtable */
+static uint64_t
+bench_ht_hash_int64(const void *key, uint64_t seed) {
+    return bench_mix64((uint64_t)(uintptr_t)key ^ seed);
+}
+
+static bool
+bench_ht_equal_direct(const void *k1, const void *k2) {
+    return k1 == k2;
+}
+
+static void *
+bench_ht_create(enum bench_key_type key_type, enum ht_table_storage storage) {
+    struct ht_table_options options;
+    struct ht_table *table;
+
+    memset(&options, 0, sizeof(struct ht_table_options));
+    options.storage = storage;
+
+    switch (key_type) {
+    case BENCH_KEY_INT32:
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+        break;
+
+    case BENCH_KEY_INT64:
+        options.hash64_func = bench_ht_hash_int64;
+        table = ht_table_new_ex(NULL, bench_ht_equal_direct, &options);
+        break;
+
+    default:
+        table = ht_table_new_ex(ht_hash_string, ht_equal_string, &options);
+        break;
+    }
+
+    if (!table)
+        die("cannot create table: %s", ht_get_error());
+
+    return table;
+}
+
+static void *
+bench_ht_chained_create(enum bench_key_type key_type) {
+    return bench_ht_create(key_type, HT_TABLE_STORAGE_CHAINED);
+}
+
+static void *
+bench_ht_open_create(enum bench_key_type key_type) {
+    return bench_ht_create(key_type, HT_TABLE_STORAGE_OPEN);
+}
+
+static void *
+bench_ht_compact_create(enum bench_key_type key_type) {
+    return bench_ht_create(key_type, HT_TABLE_STORAGE_COMPACT);
+}
+
+static void
+bench_ht_destroy(void *table) {
+    ht_table_delete(table);
+}
+
+static void
+bench_ht_insert(void *table, void *key) {
+    if (ht_table_insert(table, key, NULL) == -1)
+        die("cannot insert entry: %s", ht_get_error());
+}
+
+static bool
+bench_ht_get(void *table, void *key) {
+    return ht_table_contains(table, key);
+}
+
+static void
+bench_ht_remove(void *table, void *key) {
+    ht_table_remove(table, key);
+}
+
+#ifdef BENCH_GLIB
+/* GLib */
+static guint
+bench_glib_hash_int32(gconstpointer key) {
+    return ht_hash_int32(key);
+}
+
+static guint
+bench_glib_hash_int64(gconstpointer key) {
+    return (guint)bench_mix64((uint64_t)(uintptr_t)key);
+}
+
+static gboolean
+bench_glib_equal_direct(gconstpointer k1, gconstpointer k2) {
+    return k1 == k2;
+}
+
+static guint
+bench_glib_hash_string(gconstpointer key) {
+    return ht_hash_string(key);
+}
+
+static gboolean
+bench_glib_equal_string(gconstpointer k1, gconstpointer k2) {
+    return strcmp(k1, k2) == 0;
+}
+
+static void *
+bench_glib_create(enum bench_key_type key_type) {
+    switch (key_type) {
+    case BENCH_KEY_INT32:
+        return g_hash_table_new(bench_glib_hash_int32,
+                                bench_glib_equal_direct);
+    case BENCH_KEY_INT64:
+        return g_hash_table_new(bench_glib_hash_int64,
+                                bench_glib_equal_direct);
+    default:
+        return g_hash_table_new(bench_glib_hash_string,
+                                bench_glib_equal_string);
+    }
+}
+
+static void
+bench_glib_destroy(void *table) {
+    g_hash_table_destroy(table);
+}
+
+static void
+bench_glib_insert(void *table, void *key) {
+    g_hash_table_insert(table, key, NULL);
+}
+
+static bool
+bench_glib_get(void *table, void *key) {
+    return g_hash_table_lookup_extended(table, key, NULL, NULL);
+}
+
+static void
+bench_glib_remove(void *table, void *key) {
+    g_hash_table_remove(table, key);
+}
+#endif
+
+#ifdef BENCH_KHASH
+/* khash */
+KHASH_SET_INIT_INT(bench_int32)
+KHASH_SET_INIT_INT64(bench_int64)
+KHASH_SET_INIT_STR(bench_string)
+
+struct bench_khash {
+    enum bench_key_type key_type;
+
+    khash_t(bench_int32) *int32;
+    khash_t(bench_int64) *int64;
+    khash_t(bench_string) *string;
+};
+
+static void *
+bench_khash_create(enum bench_key_type key_type) {
+    struct bench_khash *table;
+
+    table = calloc(1, sizeof(struct bench_khash));
+    if (!table)
+        die("cannot allocate table: %m");
+
+    table->key_type = key_type;
+
+    switch (key_type) {
+    case BENCH_KEY_INT32:
+        table->int32 = kh_init(bench_int32);
+        break;
+    case BENCH_KEY_INT64:
+        table->int64 = kh_init(bench_int64);
+        break;
+    default:
+        table->string = kh_init(bench_string);
+        break;
+    }
+
+    return table;
+}
+
+static void
+bench_khash_destroy(void *arg) {
+    struct bench_khash *table;
+
+    table = arg;
+
+    kh_destroy(bench_int32, table->int32);
+    kh_destroy(bench_int64, table->int64);
+    kh_destroy(bench_string, table->string);
+    free(table);
+}
+
+static void
+bench_khash_insert(void *arg, void *key) {
+    struct bench_khash *table;
+    int ret;
+
+    table = arg;
+
+    switch (table->key_type) {
+    case BENCH_KEY_INT32:
+        kh_put(bench_int32, table->int32,
+               (khint32_t)HT_POINTER_TO_INT32(key), &ret);
+        break;
+    case BENCH_KEY_INT64:
+        kh_put(bench_int64, table->int64, (khint64_t)(uintptr_t)key, &ret);
+        break;
+    default:
+        kh_put(bench_string, table->string, key, &ret);
+        break;
+    }
+
+    if (ret == -1)
+        die("cannot insert entry");
+}
+
+static bool
+bench_khash_get(void *arg, void *key) {
+    struct bench_khash *table;
+
+    table = arg;
+
+    switch (table->key_type) {
+    case BENCH_KEY_INT32:
+        return kh_get(bench_int32, table->int32,
+                      (khint32_t)HT_POINTER_TO_INT32(key))
+            != kh_end(table->int32);
+    case BENCH_KEY_INT64:
+        return kh_get(bench_int64, table->int64, (khint64_t)(uintptr_t)key)
+            != kh_end(table->int64);
+    default:
+        return kh_get(bench_string, table->string, key)
+            != kh_end(table->string);
+    }
+}
+
+static void
+bench_khash_remove(void *arg, void *key) {
+    struct bench_khash *table;
+    khiter_t it;
+
+    table = arg;
+
+    switch (table->key_type) {
+    case BENCH_KEY_INT32:
+        it = kh_get(bench_int32, table->int32,
+                    (khint32_t)HT_POINTER_TO_INT32(key));
+        if (it != kh_end(table->int32))
+            kh_del(bench_int32, table->int32, it);
+        break;
+    case BENCH_KEY_INT64:
+        it = kh_get(bench_int64, table->int64, (khint64_t)(uintptr_t)key);
+        if (it != kh_end(table->int64))
+            kh_del(bench_int64, table->int64, it);
+        break;
+    default:
+        it = kh_get(bench_string, table->string, key);
+        if (it != kh_end(table->string))
+            kh_del(bench_string, table->string, it);
+        break;
+    }
+}
+#endif
+
+#ifdef BENCH_UTHASH
+/* uthash */
+struct bench_uthash_item {
+    union {
+        int32_t int32;
+        int64_t int64;
+    } key;
+    const char *string;
+
+    UT_hash_handle hh;
+};
+
+struct bench_uthash {
+    enum bench_key_type key_type;
+    struct bench_uthash_item *items;
+};
+
+static void *
+bench_uthash_create(enum bench_key_type key_type) {
+    struct bench_uthash *table;
+
+    table = calloc(1, sizeof(struct bench_uthash));
+    if (!table)
+        die("cannot allocate table: %m");
+
+    table->key_type = key_type;
+    return table;
+}
+
+static void
+bench_uthash_destroy(void *arg) {
+    struct bench_uthash *table;
+    struct bench_uthash_item *item, *tmp;
+
+    table = arg;
+
+    HASH_ITER(hh, table->items, item, tmp) {
+        HASH_DEL(table->items, item);
+        free(item);
+    }
+
+    free(table);
+}
+
+static struct bench_uthash_item *
+bench_uthash_find(struct bench_uthash *table, void *key) {
+    struct bench_uthash_item *item;
+    int32_t int32;
+    int64_t int64;
+
+    switch (table->key_type) {
+    case BENCH_KEY_INT32:
+        int32 = HT_POINTER_TO_INT32(key);
+        HASH_FIND(hh, table->items, &int32, sizeof(int32_t), item);
+        break;
+    case BENCH_KEY_INT64:
+        int64 = (int64_t)(intptr_t)key;
+        HASH_FIND(hh, table->items, &int64, sizeof(int64_t), item);
+        break;
+    default:
+        HASH_FIND_STR(table->items, (const char *)key, item);
+        break;
+    }
+
+    return item;
+}
+
+static void
+bench_uthash_insert(void *arg, void *key) {
+    struct bench_uthash *table;
+    struct bench_uthash_item *item;
+
+    table = arg;
+
+    if (bench_uthash_find(table, key))
+        return;
+
+    item = calloc(1, sizeof(struct bench_uthash_item));
+    if (!item)
+        die("cannot allocate item: %m");
+
+    switch (table->key_type) {
+    case BENCH_KEY_INT32:
+        item->key.int32 = HT_POINTER_TO_INT32(key);
+        HASH_ADD(hh, table->items, key.int32, sizeof(int32_t), item);
+        break;
+    case BENCH_KEY_INT64:
+        item->key.int64 = (int64_t)(intptr_t)key;
+        HASH_ADD(hh, table->items, key.int64, sizeof(int64_t), item);
+        break;
+    default:
+        item->string = key;
+        HASH_ADD_KEYPTR(hh, table->items, item->string,
+                        strlen(item->string), item);
+        break;
+    }
+}
+
+static bool
+bench_uthash_get(void *arg, void *key) {
+    return bench_uthash_find(arg, key) != NULL;
+}
+
+static void
+bench_uthash_remove(void *arg, void *key) {
+    struct bench_uthash *table;
+    struct bench_uthash_item *item;
+
+    table = arg;
+
+    item = bench_uthash_find(table, key);
+    if (item) {
+        HASH_DEL(table->items, item);
+        free(item);
+    }
+}
+#endif
+
+static const struct bench_impl bench_impls[] = {
+    {"libhashtable/chained", bench_ht_chained_create, bench_ht_destroy,
+     bench_ht_insert, bench_ht_get, bench_ht_remove},
+    {"libhashtable/open", bench_ht_open_create, bench_ht_destroy,
+     bench_ht_insert, bench_ht_get, bench_ht_remove},
+    {"libhashtable/compact", bench_ht_compact_create, bench_ht_destroy,
+     bench_ht_insert, bench_ht_get, bench_ht_remove},
+#ifdef BENCH_GLIB
+    {"glib", bench_glib_create, bench_glib_destroy,
+     bench_glib_insert, bench_glib_get, bench_glib_remove},
+#endif
+#ifdef BENCH_KHASH
+    {"khash", bench_khash_create, bench_khash_destroy,
+     bench_khash_insert, bench_khash_get, bench_khash_remove},
+#endif
+#ifdef BENCH_UTHASH
+    {"uthash", bench_uthash_create, bench_uthash_destroy,
+     bench_uthash_insert, bench_uthash_get, bench_uthash_remove},
+#endif
+};
+
+static size_t bench_nb_impls = sizeof(bench_impls) / sizeof(bench_impls[0]);
+
+int
+main(int argc, char **argv) {
+    const char *impls, *key_types, *workloads;
+    enum bench_format format;
+    size_t sizes[BENCH_MAX_SIZES];
+    size_t nb_sizes, nb_ops;
+    int opt;
+
+    impls = NULL;
+    key_types = NULL;
+    workloads = NULL;
+    format = BENCH_FORMAT_TEXT;
+    nb_ops = (size_t)1 << 22;
+
+    nb_sizes = sizeof(bench_default_sizes) / sizeof(bench_default_sizes[0]);
+    memcpy(sizes, bench_default_sizes, sizeof(bench_default_sizes));
+
+    opterr = 0;
+    while ((opt = getopt(argc, argv, "f:hi:k:n:s:w:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    format = BENCH_FORMAT_TEXT;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    format = BENCH_FORMAT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    format = BENCH_FORMAT_JSON;
+                } else {
+                    die("unknown output format '%s'", optarg);
+                }
+                break;
+
+            case 'h':
+                usage(argv[0], 0);
+                break;
+
+            case 'i':
+                impls = optarg;
+                break;
+
+            case 'k':
+                key_types = optarg;
+                break;
+
+            case 'n':
+                nb_ops = strtoul(optarg, NULL, 10);
+                if (nb_ops == 0)
+                    die("invalid number of operations '%s'", optarg);
+                break;
+
+            case 's':
+                nb_sizes = bench_parse_sizes(optarg, sizes);
+                break;
+
+            case 'w':
+                workloads = optarg;
+                break;
+
+            case '?':
+                usage(argv[0], 1);
+        }
+    }
+
+#ifdef HT_PLATFORM_LINUX
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(0, &set);
+
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &set) == -1)
+            die("cannot set process affinity: %m");
+    }
+#endif
+
+    bench_print_header(format);
+
+    for (int k = 0; k < BENCH_NB_KEY_TYPES; k++) {
+        enum bench_key_type key_type;
+
+        key_type = (enum bench_key_type)k;
+
+        if (key_types
+         && !bench_list_contains(key_types, bench_key_type_names[k])) {
+            continue;
+        }
+
+        /* 64 bit integers are stored in keys of type void *. */
+        if (key_type == BENCH_KEY_INT64 && sizeof(void *) < sizeof(int64_t))
+            continue;
+
+        for (size_t s = 0; s < nb_sizes; s++) {
+            struct bench_keys keys;
+
+            bench_keys_init(&keys, key_type, sizes[s]);
+
+            for (int w = 0; w < BENCH_NB_WORKLOADS; w++) {
+                enum bench_workload workload;
+
+                workload = (enum bench_workload)w;
+
+                if (workloads
+                 && !bench_list_contains(workloads,
+                                         bench_workload_names[w])) {
+                    continue;
+                }
+
+                bench_keys_sequence(&keys, workload, nb_ops);
+
+                for (size_t i = 0; i < bench_nb_impls; i++) {
+                    const struct bench_impl *impl;
+                    struct bench_result result;
+
+                    impl = bench_impls + i;
+
+                    if (impls && !bench_list_contains(impls, impl->name))
+                        continue;
+
+                    if (!bench_run(impl, &keys, workload, nb_ops, &result))
+                        continue;
+
+                    bench_print_result(format, impl, key_type, workload,
+                                       sizes[s], &result);
+                }
+            }
+
+            bench_keys_free(&keys);
+        }
+    }
+
+    bench_print_footer(format);
+    return 0;
+}
+
+static void
+usage(const char *argv0, int exit_code) {
+    printf("Usage: %s [-h] [-f <format>] [-i <implementations>]\n"
+            "          [-k <key types>] [-w <workloads>] [-s <sizes>]"
+            " [-n <operations>]\n"
+            "\n"
+            "Options:\n"
+            "  -h         display help\n"
+            "  -f         output format: text, csv or json\n"
+            "  -i         comma-separated list of implementations\n"
+            "  -k         comma-separated list of key types\n"
+            "  -w         comma-separated list of workloads\n"
+            "  -s         comma-separated list of table sizes\n"
+            "  -n         number of operations of each run\n"
+            "\n"
+            "Key types: int32, int64, short-string, long-string\n"
+            "Workloads: insert, hit, hit-zipf, miss, churn\n"
+            "Implementations:",
+            argv0);
+
+    for (size_t i = 0; i < bench_nb_impls; i++)
+        printf(" %s", bench_impls[i].name);
+    putchar('\n');
+
+    exit(exit_code);
+}
+
+static void
+die(const char *fmt, ...) {
+    va_list ap;
+
+    fprintf(stderr, "fatal error: ");
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+
+    putc('\n', stderr);
+    exit(1);
+}
+
+static bool
+bench_list_contains(const char *list, const char *name) {
+    size_t len;
+
+    len = strlen(name);
+
+    for (const char *ptr = list; *ptr != '\0';) {
+        const char *comma;
+        size_t elen;
+
+        comma = strchr(ptr, ',');
+        elen = comma ? (size_t)(comma - ptr) : strlen(ptr);
+
+        if (elen == len && memcmp(ptr, name, len) == 0)
+            return true;
+
+        if (!comma)
+            break;
+        ptr = comma + 1;
+    }
+
+    return false;
+}
+
+static size_t
+bench_parse_sizes(const char *list, size_t *sizes) {
+    const char *ptr;
+    size_t nb_sizes;
+
+    nb_sizes = 0;
+
+    for (ptr = list; *ptr != '\0';) {
+        unsigned long long size;
+        char *end;
+
+        if (nb_sizes >= BENCH_MAX_SIZES)
+            die("too many sizes");
+
+        errno = 0;
+        size = strtoull(ptr, &end, 10);
+        if (errno != 0 || end == ptr || size == 0 || size > UINT32_MAX / 2)
+            die("invalid size in '%s'", list);
+
+        sizes[nb_sizes++] = (size_t)size;
+
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            die("invalid size in '%s'", list);
+
+        ptr = end + 1;
+    }
+
+    return nb_sizes;
+}
+
+static uint64_t
+bench_random(void) {
+    uint64_t x;
+
+    /* xorshift64* */
+    x = bench_random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    bench_random_state = x;
+
+    return x * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+static double
+bench_random_double(void) {
+    return (double)(bench_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t
+bench_random_index(size_t n) {
+    return (uint32_t)(((bench_random() >> 32) * n) >> 32);
+}
+
+static uint32_t
+bench_mix32(uint32_t x) {
+    /* Each step is reversible: distinct inputs give distinct outputs. */
+    x ^= x >> 16;
+    x *= UINT32_C(0x7feb352d);
+    x ^= x >> 15;
+    x *= UINT32_C(0x846ca68b);
+    x ^= x >> 16;
+
+    return x;
+}
+
+static uint64_t
+bench_mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+
+    return x;
+}
+
+static void
+bench_base36(char *string, uint64_t value, size_t nb_digits) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+    for (size_t i = nb_digits; i > 0; i--) {
+        string[i - 1] = digits[value % 36];
+        value /= 36;
+    }
+}
+
+static void
+bench_keys_init(struct bench_keys *keys, enum bench_key_type type,
+                size_t size) {
+    size_t nb_keys, string_sz;
+
+    memset(keys, 0, sizeof(struct bench_keys));
+
+    keys->type = type;
+    keys->size = size;
+
+    nb_keys = size * 2;
+
+    keys->keys = malloc(nb_keys * sizeof(void *));
+    if (!keys->keys)
+        die("cannot allocate keys: %m");
+
+    string_sz = 0;
+    if (type == BENCH_KEY_SHORT_STRING) {
+        string_sz = 17;
+    } else if (type == BENCH_KEY_LONG_STRING) {
+        string_sz = 64;
+    }
+
+    if (string_sz > 0) {
+        keys->strings = malloc(nb_keys * string_sz);
+        if (!keys->strings)
+            die("cannot allocate strings: %m");
+    }
+
+    for (size_t i = 0; i < nb_keys; i++) {
+        uint64_t value;
+        char *string;
+
+        value = bench_mix64(i + 1);
+        string = keys->strings + i * string_sz;
+
+        switch (type) {
+        case BENCH_KEY_INT32:
+            keys->keys[i] = HT_INT32_TO_POINTER(bench_mix32((uint32_t)i + 1));
+            break;
+
+        case BENCH_KEY_INT64:
+            keys->keys[i] = (void *)(uintptr_t)value;
+            break;
+
+        case BENCH_KEY_SHORT_STRING:
+            /* Between 8 and 16 characters. The first 8 characters encode a
+             * distinct 32 bit value for each key (36^8 > 2^32), so that keys
+             * never collide; the others only vary the length. */
+            bench_base36(string, bench_mix32((uint32_t)i + 1), 8);
+            bench_base36(string + 8, value >> 8, value % 9);
+            string[8 + value % 9] = '\0';
+            keys->keys[i] = string;
+            break;
+
+        default:
+            /* Long keys sharing a common prefix, as URLs or paths do */
+            snprintf(string, string_sz,
+                     "https://example.com/objects/%016" PRIx64 "/data",
+                     value);
+            keys->keys[i] = string;
+            break;
+        }
+    }
+}
+
+static void
+bench_keys_free(struct bench_keys *keys) {
+    free(keys->keys);
+    free(keys->strings);
+    free(keys->sequence);
+}
+
+static void
+bench_keys_sequence(struct bench_keys *keys, enum bench_workload workload,
+                    size_t nb_ops) {
+    size_t n;
+
+    n = keys->size;
+
+    free(keys->sequence);
+    keys->sequence = NULL;
+    keys->sequence_sz = 0;
+
+    if (workload != BENCH_WORKLOAD_HIT
+     && workload != BENCH_WORKLOAD_HIT_ZIPF
+     && workload != BENCH_WORKLOAD_MISS) {
+        return;
+    }
+
+    keys->sequence = malloc(nb_ops * sizeof(uint32_t));
+    if (!keys->sequence)
+        die("cannot allocate sequence: %m");
+    keys->sequence_sz = nb_ops;
+
+    if (workload == BENCH_WORKLOAD_HIT_ZIPF) {
+        double zeta_n, zeta_2, alpha, eta;
+
+        /* Zipfian ranks as generated by YCSB (Gray et al., "Quickly
+         * generating billion-record synthetic databases"); ranks are then
+         * scattered over the keys so that popular keys are not neighbours
+         * in the key array. */
+        zeta_n = 0.0;
+        for (size_t i = 1; i <= n; i++)
+            zeta_n += 1.0 / pow((double)i, BENCH_ZIPF_THETA);
+        zeta_2 = 1.0 + 1.0 / pow(2.0, BENCH_ZIPF_THETA);
+
+        alpha = 1.0 / (1.0 - BENCH_ZIPF_THETA);
+        eta = (1.0 - pow(2.0 / (double)n, 1.0 - BENCH_ZIPF_THETA))
+            / (1.0 - zeta_2 / zeta_n);
+
+        for (size_t i = 0; i < nb_ops; i++) {
+            double u, uz;
+            uint64_t rank;
+
+            u = bench_random_double();
+            uz = u * zeta_n;
+
+            if (uz < 1.0) {
+                rank = 0;
+            } else if (uz < zeta_2) {
+                rank = 1;
+            } else {
+                rank = (uint64_t)((double)n
+                                  * pow(eta * u - eta + 1.0, alpha));
+                if (rank >= n)
+                    rank = n - 1;
+            }
+
+            /* 2654435761 is a prime larger than any size, so this is a
+             * permutation of [0, n). */
+            keys->sequence[i] = (uint32_t)((rank * UINT64_C(2654435761))
+                                           % n);
+        }
+    } else {
+        for (size_t i = 0; i < nb_ops; i++) {
+            keys->sequence[i] = bench_random_index(n);
+            if (workload == BENCH_WORKLOAD_MISS)
+                keys->sequence[i] += (uint32_t)n;
+        }
+    }
+}
+
+static bool
+bench_run(const struct bench_impl *impl, struct bench_keys *keys,
+          enum bench_workload workload, size_t nb_ops,
+          struct bench_result *result) {
+    ssize_t ret;
+    pid_t pid;
+    int fds[2], status;
+
+    if (pipe(fds) == -1)
+        die("cannot create pipe: %m");
+
+    fflush(stdout);
+
+    pid = fork();
+    if (pid == -1)
+        die("cannot fork: %m");
+
+    if (pid == 0) {
+        close(fds[0]);
+        bench_run_child(impl, keys, workload, nb_ops, fds[1]);
+        _exit(0);
+    }
+
+    close(fds[1]);
+
+    ret = read(fds[0], result, sizeof(struct bench_result));
+    close(fds[0]);
+
+    if (waitpid(pid, &status, 0) == -1)
+        die("cannot wait for process %d: %m", (int)pid);
+
+    /* A run can fail if the system runs out of memory for large tables:
+     * the failure is reported and other runs go on. */
+    if (ret != (ssize_t)sizeof(struct bench_result)
+     || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s/%s/%s/%zu: run failed\n", impl->name,
+                bench_key_type_names[keys->type],
+                bench_workload_names[workload], keys->size);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+bench_run_child(const struct bench_impl *impl, struct bench_keys *keys,
+                enum bench_workload workload, size_t nb_ops, int fd) {
+    struct bench_result result;
+    void *table;
+    size_t n, nb_found;
+    double start;
+    long rss;
+
+    n = keys->size;
+
+    /* The resident set of the process includes the keys, which were
+     * created by the parent process before the fork. */
+    rss = bench_max_rss();
+
+    memset(&result, 0, sizeof(struct bench_result));
+
+    table = impl->create(keys->type);
+
+    if (workload == BENCH_WORKLOAD_INSERT) {
+        size_t nb_rounds;
+
+        /* Small tables are filled several times to measure enough
+         * operations. */
+        nb_rounds = (nb_ops + n - 1) / n;
+
+        for (size_t r = 0; r < nb_rounds; r++) {
+            if (r > 0) {
+                impl->destroy(table);
+                table = impl->create(keys->type);
+            }
+
+            start = bench_now();
+            for (size_t i = 0; i < n; i++)
+                impl->insert(table, keys->keys[i]);
+            result.seconds += bench_now() - start;
+        }
+
+        result.nb_ops = nb_rounds * n;
+    } else {
+        for (size_t i = 0; i < n; i++)
+            impl->insert(table, keys->keys[i]);
+    }
+
+    switch (workload) {
+    case BENCH_WORKLOAD_HIT:
+    case BENCH_WORKLOAD_HIT_ZIPF:
+    case BENCH_WORKLOAD_MISS:
+        nb_found = 0;
+
+        start = bench_now();
+        for (size_t i = 0; i < keys->sequence_sz; i++) {
+            if (impl->get(table, keys->keys[keys->sequence[i]]))
+                nb_found++;
+        }
+        result.seconds = bench_now() - start;
+        result.nb_ops = keys->sequence_sz;
+
+        if (nb_found != ((workload == BENCH_WORKLOAD_MISS) ? 0 : nb_ops))
+            die("%s: unexpected number of hits: %zu", impl->name, nb_found);
+        break;
+
+    case BENCH_WORKLOAD_CHURN:
+        /* The table contains a sliding window of n keys over the key
+         * array: each step removes the oldest key and inserts a new one,
+         * so that removed entries are never reinserted soon. */
+        start = bench_now();
+        for (size_t i = 0; i < nb_ops / 2; i++) {
+            impl->remove(table, keys->keys[i % (n * 2)]);
+            impl->insert(table, keys->keys[(i + n) % (n * 2)]);
+        }
+        result.seconds = bench_now() - start;
+        result.nb_ops = (nb_ops / 2) * 2;
+        break;
+
+    default:
+        break;
+    }
+
+    result.peak_rss = bench_max_rss() - rss;
+
+    impl->destroy(table);
+
+    if (write(fd, &result, sizeof(struct bench_result))
+        != (ssize_t)sizeof(struct bench_result)) {
+        die("cannot write result: %m");
+    }
+
+    close(fd);
+}
+
+static double
+bench_now(void) {
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        die("cannot get clock value: %m");
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1.0e9;
+}
+
+static long
+bench_max_rss(void) {
+    struct rusage usage;
+
+    /* The maximum resident set size of a new process starts at its
+     * resident set size when it was forked. */
+    if (getrusage(RUSAGE_SELF, &usage) == -1)
+        die("cannot get resource usage: %m");
+
+    return usage.ru_maxrss;
+}
+
+static void
+bench_print_header(enum bench_format format) {
+    switch (format) {
+    case BENCH_FORMAT_TEXT:
+        printf("%-24s  %-12s  %-8s  %8s  %14s  %9s  %10s\n",
+               "implementation", "keys", "workload", "size",
+               "ops/s", "ns/op", "peak rss");
+        break;
+
+    case BENCH_FORMAT_CSV:
+        printf("implementation,keys,workload,size,operations,seconds,"
+               "ops_per_second,ns_per_op,peak_rss_kb\n");
+        break;
+
+    case BENCH_FORMAT_JSON:
+        printf("[\n");
+        break;
+    }
+}
+
+static void
+bench_print_result(enum bench_format format, const struct bench_impl *impl,
+                   enum bench_key_type key_type, enum bench_workload workload,
+                   size_t size, const struct bench_result *result) {
+    double ops_per_second, ns_per_op;
+
+    ops_per_second = (double)result->nb_ops / result->seconds;
+    ns_per_op = result->seconds * 1.0e9 / (double)result->nb_ops;
+
+    switch (format) {
+    case BENCH_FORMAT_TEXT:
+        printf("%-24s  %-12s  %-8s  %8zu  %14.0f  %9.2f  %7ldkB\n",
+               impl->name, bench_key_type_names[key_type],
+               bench_workload_names[workload], size,
+               ops_per_second, ns_per_op, result->peak_rss);
+        break;
+
+    case BENCH_FORMAT_CSV:
+        printf("%s,%s,%s,%zu,%zu,%.6f,%.0f,%.2f,%ld\n",
+               impl->name, bench_key_type_names[key_type],
+               bench_workload_names[workload], size, result->nb_ops,
+               result->seconds, ops_per_second, ns_per_op,
+               result->peak_rss);
+        break;
+
+    case BENCH_FORMAT_JSON:
+        printf("%s  {\"implementation\": \"%s\", \"keys\": \"%s\","
+               " \"workload\": \"%s\", \"size\": %zu, \"operations\": %zu,"
+               " \"seconds\": %.6f, \"ops_per_second\": %.0f,"
+               " \"ns_per_op\": %.2f, \"peak_rss_kb\": %ld}",
+               bench_first_result ? "" : ",\n",
+               impl->name, bench_key_type_names[key_type],
+               bench_workload_names[workload], size, result->nb_ops,
+               result->seconds, ops_per_second, ns_per_op,
+               result->peak_rss);
+        break;
+    }
+
+    bench_first_result = false;
+    fflush(stdout);
+}
+
+static void
+bench_print_footer(enum bench_format format) {
+    if (format == BENCH_FORMAT_JSON)
+        printf("%s]\n", bench_first_result ? "" : "\n");
+}
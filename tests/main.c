@@ -14,9 +14,107 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
 #include <utest.h>
 
 #include "hashtable.h"
+#include "hashtable_typed.h"
+
+static inline uint64_t
+test_typed_bad_hash(int64_t key) {
+    return (uint64_t)key & 0x3;
+}
+
+HT_DEFINE_TABLE(test_typed_table, int64_t, uint64_t,
+                ht_typed_hash_int64, HT_TYPED_EQUAL)
+HT_DEFINE_TABLE(test_typed_bad_table, int64_t, uint64_t,
+                test_typed_bad_hash, HT_TYPED_EQUAL)
+
+#define TEST_CONCURRENT_NB_THREADS 8
+#define TEST_CONCURRENT_NB_KEYS 10000
+
+struct test_concurrent_thread {
+    pthread_t thread;
+    struct ht_concurrent_table *table;
+    int32_t start;
+    size_t nb_errors;
+};
+
+#define TEST_SINGLE_WRITER_NB_READERS 4
+#define TEST_SINGLE_WRITER_NB_KEYS 1000
+
+struct test_single_writer_reader {
+    pthread_t thread;
+    struct ht_table *table;
+    struct ht_table_reader *reader;
+    const bool *stop;
+    size_t nb_errors;
+};
+
+static void *
+test_single_writer_reader(void *arg) {
+    struct test_single_writer_reader *reader;
+
+    reader = arg;
+
+    /* Keys [0, TEST_SINGLE_WRITER_NB_KEYS) are always present, with their
+     * value equal to the key. */
+    while (!__atomic_load_n(reader->stop, __ATOMIC_ACQUIRE)) {
+        for (int32_t i = 0; i < TEST_SINGLE_WRITER_NB_KEYS; i++) {
+            void *value;
+
+            if (ht_table_get(reader->table, HT_INT32_TO_POINTER(i),
+                             &value) != 1
+                || HT_POINTER_TO_INT32(value) != i) {
+                reader->nb_errors++;
+            }
+        }
+
+        ht_table_reader_quiescent(reader->reader);
+    }
+
+    ht_table_reader_offline(reader->reader);
+    return NULL;
+}
+
+static void *
+test_concurrent_thread(void *arg) {
+    struct test_concurrent_thread *thread;
+    int32_t start, end;
+
+    thread = arg;
+    start = thread->start;
+    end = start + TEST_CONCURRENT_NB_KEYS;
+
+    for (int32_t i = start; i < end; i++) {
+        void *value;
+
+        if (ht_concurrent_table_insert(thread->table, HT_INT32_TO_POINTER(i),
+                                       HT_INT32_TO_POINTER(i)) != 1) {
+            thread->nb_errors++;
+        }
+
+        if (ht_concurrent_table_get(thread->table, HT_INT32_TO_POINTER(i),
+                                    &value) != 1
+            || HT_POINTER_TO_INT32(value) != i) {
+            thread->nb_errors++;
+        }
+    }
+
+    for (int32_t i = start; i < end; i += 2) {
+        if (ht_concurrent_table_remove(thread->table,
+                                       HT_INT32_TO_POINTER(i)) != 1) {
+            thread->nb_errors++;
+        }
+    }
+
+    return NULL;
+}
 
 TEST(insert) {
     struct ht_table *table;
@@ -68,6 +166,50 @@ TEST(insert2) {
     ht_table_delete(table);
 }
 
+TEST(upsert) {
+    struct ht_table *table;
+    struct ht_table_options options = {0};
+    void **pvalue;
+    void *value;
+
+    for (int s = 0; s < 3; s++) {
+        options.storage = (s == 2) ? HT_TABLE_STORAGE_OPEN
+                                   : HT_TABLE_STORAGE_CHAINED;
+        options.incremental_resize = (s == 1);
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+        TEST_TRUE(table != NULL);
+
+        /* Key i is counted i % 5 + 1 times */
+        for (int32_t n = 0; n < 5; n++) {
+            for (int32_t i = 0; i < 1000; i++) {
+                int ret;
+
+                if (i % 5 < n)
+                    continue;
+
+                ret = ht_table_upsert(table, HT_INT32_TO_POINTER(i), &pvalue);
+                TEST_INT_EQ(ret, (n == 0) ? 1 : 0);
+                if (ret == 1)
+                    TEST_PTR_NULL(*pvalue);
+
+                *pvalue = HT_INT32_TO_POINTER(HT_POINTER_TO_INT32(*pvalue)
+                                              + 1);
+            }
+        }
+
+        TEST_UINT_EQ(ht_table_nb_entries(table), 1000);
+
+        for (int32_t i = 0; i < 1000; i++) {
+            TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i), &value),
+                        1);
+            TEST_INT_EQ(HT_POINTER_TO_INT32(value), i % 5 + 1);
+        }
+
+        ht_table_delete(table);
+    }
+}
+
 TEST(remove) {
     struct ht_table *table;
 
@@ -245,6 +387,2191 @@ TEST(iterate_operations) {
     ht_table_delete(table);
 }
 
+TEST(open_insert) {
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+    };
+    const char *str;
+
+    table = ht_table_new_ex(ht_hash_string, ht_equal_string, &options);
+
+    ht_table_insert(table, "a", "abc");
+    ht_table_insert(table, "d", "def");
+    ht_table_insert(table, "g", "ghi");
+    TEST_UINT_EQ(ht_table_nb_entries(table), 3);
+    TEST_INT_EQ(ht_table_get(table, "a", (void **)&str), 1);
+    TEST_STRING_EQ(str, "abc");
+
+    TEST_INT_EQ(ht_table_insert(table, "g", "foo"), 0);
+    TEST_UINT_EQ(ht_table_nb_entries(table), 3);
+    TEST_INT_EQ(ht_table_get(table, "g", (void **)&str), 1);
+    TEST_STRING_EQ(str, "foo");
+
+    TEST_INT_EQ(ht_table_remove(table, "d"), 1);
+    TEST_INT_EQ(ht_table_remove(table, "d"), 0);
+    TEST_FALSE(ht_table_contains(table, "d"));
+    TEST_TRUE(ht_table_contains(table, "a"));
+    TEST_UINT_EQ(ht_table_nb_entries(table), 2);
+
+    ht_table_clear(table);
+    TEST_TRUE(ht_table_is_empty(table));
+    TEST_FALSE(ht_table_contains(table, "a"));
+
+    ht_table_delete(table);
+}
+
+TEST(open_resize) {
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+    };
+
+    size_t nb_entries = 1000;
+    size_t nb_removed = 900;
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < nb_entries; i++) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(1));
+        }
+
+        for (size_t i = 0; i < nb_entries; i++)
+            TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+
+        for (size_t i = 0; i < nb_removed; i++)
+            ht_table_remove(table, HT_INT32_TO_POINTER(i));
+
+        TEST_UINT_EQ(ht_table_nb_entries(table), nb_entries - nb_removed);
+
+        for (size_t i = 0; i < nb_entries; i++) {
+            if (i < nb_removed) {
+                TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+            } else {
+                TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+            }
+        }
+    }
+
+    ht_table_delete(table);
+}
+
+static uint32_t
+test_hash_constant(const void *key) {
+    return 42;
+}
+
+TEST(open_collisions) {
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+    };
+    void *value;
+
+    size_t nb_entries = 200;
+
+    /* All keys share the same hash, and therefore the same control byte and
+     * probe sequence. */
+    table = ht_table_new_ex(test_hash_constant, ht_equal_int32, &options);
+
+    for (size_t i = 0; i < nb_entries; i++) {
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                    HT_INT32_TO_POINTER(i * 2)), 1);
+    }
+
+    for (size_t i = 0; i < nb_entries; i += 2)
+        TEST_INT_EQ(ht_table_remove(table, HT_INT32_TO_POINTER(i)), 1);
+
+    for (size_t i = 0; i < nb_entries; i++) {
+        if (i % 2 == 0) {
+            TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+        } else {
+            TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i), &value), 1);
+            TEST_INT_EQ(HT_POINTER_TO_INT32(value), (int32_t)i * 2);
+        }
+    }
+
+    for (size_t i = 0; i < nb_entries; i += 2)
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL), 1);
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), nb_entries);
+
+    ht_table_delete(table);
+}
+
+TEST(open_iterate_operations) {
+    struct ht_table *table;
+    struct ht_table_iterator *it;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+    };
+    void *key, *value;
+    size_t nb_iterated;
+
+    table = ht_table_new_ex(ht_hash_string, ht_equal_string, &options);
+
+    ht_table_insert(table, "a", "abc");
+    ht_table_insert(table, "d", "def");
+    ht_table_insert(table, "g", "ghi");
+
+    it = ht_table_iterate(table);
+
+    nb_iterated = 0;
+    while (ht_table_iterator_next(it, &key, &value)) {
+        if (strcmp(key, "d") == 0) {
+            ht_table_iterator_remove(it);
+        } else if (strcmp(key, "g") == 0) {
+            ht_table_iterator_set_value(it, "foo");
+        }
+
+        nb_iterated++;
+    }
+
+    ht_table_iterator_delete(it);
+
+    TEST_UINT_EQ(nb_iterated, 3);
+    TEST_UINT_EQ(ht_table_nb_entries(table), 2);
+    TEST_TRUE(ht_table_contains(table, "a"));
+    TEST_FALSE(ht_table_contains(table, "d"));
+    TEST_INT_EQ(ht_table_get(table, "g", &value), 1);
+    TEST_STRING_EQ(value, "foo");
+
+    ht_table_delete(table);
+}
+
+TEST(incremental_resize) {
+    struct ht_table *table;
+    struct ht_table_iterator *it;
+    struct ht_table_options options = {
+        .incremental_resize = true,
+    };
+    size_t nb_iterated;
+    void *value;
+
+    size_t nb_entries = 10000;
+    size_t nb_removed = 9000;
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+
+    for (size_t i = 0; i < nb_entries; i++) {
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                    HT_INT32_TO_POINTER(i)), 1);
+
+        /* Entries are spread over both bucket arrays during a resize. */
+        if (i == 1024) {
+            nb_iterated = 0;
+
+            it = ht_table_iterate(table);
+            while (ht_table_iterator_next(it, NULL, NULL) == 1)
+                nb_iterated++;
+            ht_table_iterator_delete(it);
+
+            TEST_UINT_EQ(nb_iterated, i + 1);
+
+            for (size_t j = 0; j <= i; j++) {
+                TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(j),
+                                         &value), 1);
+                TEST_INT_EQ(HT_POINTER_TO_INT32(value), (int32_t)j);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < nb_entries; i++) {
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                    HT_INT32_TO_POINTER(i + 1)), 0);
+    }
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), nb_entries);
+
+    for (size_t i = 0; i < nb_removed; i++)
+        TEST_INT_EQ(ht_table_remove(table, HT_INT32_TO_POINTER(i)), 1);
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), nb_entries - nb_removed);
+
+    for (size_t i = 0; i < nb_entries; i++) {
+        if (i < nb_removed) {
+            TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+        } else {
+            TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i),
+                                     &value), 1);
+            TEST_INT_EQ(HT_POINTER_TO_INT32(value), (int32_t)i + 1);
+        }
+    }
+
+    ht_table_delete(table);
+}
+
+TEST(hash64) {
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .hash64_func = ht_hash64_string,
+        .random_seed = true,
+    };
+    char keys[64][65];
+    void *value;
+
+    /* Keys of all sizes between 0 and 64 bytes */
+    for (size_t i = 0; i < 64; i++) {
+        memset(keys[i], 'a', i);
+        keys[i][i] = '\0';
+    }
+
+    TEST_TRUE(ht_hash64_string("abc", 1) == ht_hash64_string("abc", 1));
+    TEST_TRUE(ht_hash64_string("abc", 1) != ht_hash64_string("abc", 2));
+    TEST_TRUE(ht_hash64_int32(HT_INT32_TO_POINTER(1), 0)
+              != ht_hash64_int32(HT_INT32_TO_POINTER(2), 0));
+
+    for (size_t i = 0; i < 64; i++) {
+        for (size_t j = 0; j < i; j++) {
+            TEST_TRUE(ht_hash64_string(keys[i], 42)
+                      != ht_hash64_string(keys[j], 42));
+        }
+    }
+
+    for (int s = 0; s < 2; s++) {
+        options.storage = (s == 0) ? HT_TABLE_STORAGE_CHAINED
+                                   : HT_TABLE_STORAGE_OPEN;
+
+        table = ht_table_new_ex(NULL, ht_equal_string, &options);
+        TEST_TRUE(table != NULL);
+
+        for (size_t i = 0; i < 64; i++)
+            TEST_INT_EQ(ht_table_insert(table, keys[i], keys[i]), 1);
+
+        for (size_t i = 0; i < 64; i++) {
+            TEST_INT_EQ(ht_table_get(table, keys[i], &value), 1);
+            TEST_TRUE(value == keys[i]);
+        }
+
+        TEST_FALSE(ht_table_contains(table, "b"));
+
+        ht_table_delete(table);
+    }
+}
+
+/* Allocator context recording the size of each block in a header to check
+ * the size passed when the block is freed. */
+struct test_sized_allocator {
+    size_t nb_allocations;
+    size_t nb_blocks;
+    size_t nb_bytes;
+    size_t nb_size_errors;
+};
+
+#define TEST_SIZED_HEADER_SZ 16
+
+static void *
+test_sized_alloc(size_t sz, void *ctx) {
+    struct test_sized_allocator *allocator;
+    char *block;
+
+    allocator = ctx;
+
+    block = malloc(TEST_SIZED_HEADER_SZ + sz);
+    if (!block)
+        return NULL;
+
+    memcpy(block, &sz, sizeof(size_t));
+
+    allocator->nb_allocations++;
+    allocator->nb_blocks++;
+    allocator->nb_bytes += sz;
+
+    return block + TEST_SIZED_HEADER_SZ;
+}
+
+static void
+test_sized_free(void *ptr, size_t sz, void *ctx) {
+    struct test_sized_allocator *allocator;
+    char *block;
+    size_t block_sz;
+
+    allocator = ctx;
+
+    block = (char *)ptr - TEST_SIZED_HEADER_SZ;
+    memcpy(&block_sz, block, sizeof(size_t));
+
+    if (block_sz != sz)
+        allocator->nb_size_errors++;
+
+    allocator->nb_blocks--;
+    allocator->nb_bytes -= block_sz;
+
+    free(block);
+}
+
+static void *
+test_sized_realloc(void *ptr, size_t old_sz, size_t sz, void *ctx) {
+    void *nptr;
+
+    nptr = test_sized_alloc(sz, ctx);
+    if (!nptr)
+        return NULL;
+
+    if (ptr) {
+        memcpy(nptr, ptr, (old_sz < sz) ? old_sz : sz);
+        test_sized_free(ptr, old_sz, ctx);
+    }
+
+    return nptr;
+}
+
+static size_t test_nb_allocations;
+
+static void *
+test_counting_malloc(size_t sz) {
+    test_nb_allocations++;
+    return malloc(sz);
+}
+
+static void *
+test_counting_calloc(size_t nb, size_t sz) {
+    test_nb_allocations++;
+    return calloc(nb, sz);
+}
+
+static void *
+test_counting_realloc(void *ptr, size_t sz) {
+    test_nb_allocations++;
+    return realloc(ptr, sz);
+}
+
+static const struct ht_memory_allocator test_counting_allocator = {
+    .malloc = test_counting_malloc,
+    .free = free,
+    .calloc = test_counting_calloc,
+    .realloc = test_counting_realloc,
+};
+
+TEST(reserve) {
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+    };
+
+    size_t nb_entries = 1000;
+
+    ht_set_memory_allocator(&test_counting_allocator);
+
+    /* Constructor */
+    table = ht_table_new_with_capacity(ht_hash_int32, ht_equal_int32,
+                                       nb_entries);
+
+    for (size_t i = 0; i < nb_entries; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+    for (size_t i = 0; i < nb_entries; i++)
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+
+    for (size_t i = 10; i < nb_entries; i++)
+        ht_table_remove(table, HT_INT32_TO_POINTER(i));
+    TEST_INT_EQ(ht_table_shrink_to_fit(table), 0);
+    for (size_t i = 0; i < nb_entries; i++) {
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i))
+                  == (i < 10));
+    }
+
+    ht_table_delete(table);
+
+    /* Open addressing tables do not allocate anything when inserting
+     * entries after a reservation. */
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+    TEST_INT_EQ(ht_table_reserve(table, nb_entries), 0);
+
+    test_nb_allocations = 0;
+    for (size_t i = 0; i < nb_entries; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+    TEST_UINT_EQ(test_nb_allocations, 0);
+
+    for (size_t i = 10; i < nb_entries; i++)
+        ht_table_remove(table, HT_INT32_TO_POINTER(i));
+    TEST_INT_EQ(ht_table_shrink_to_fit(table), 0);
+    for (size_t i = 0; i < nb_entries; i++) {
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i))
+                  == (i < 10));
+    }
+
+    ht_table_delete(table);
+
+    ht_set_memory_allocator(NULL);
+
+    /* Capacities which cannot be represented are rejected. */
+    TEST_PTR_NULL(ht_table_new_with_capacity(ht_hash_int32, ht_equal_int32,
+                                             SIZE_MAX));
+
+    for (int s = 0; s < 3; s++) {
+        options.storage = (enum ht_table_storage)s;
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+        TEST_INT_EQ(ht_table_reserve(table, SIZE_MAX), -1);
+        TEST_INT_EQ(ht_table_reserve(table, (size_t)1 << 62), -1);
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(1), NULL), 1);
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(1)));
+        ht_table_delete(table);
+    }
+}
+
+TEST(policy) {
+    struct ht_table *table;
+    struct ht_table_policy policy;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+        .policy = &policy,
+    };
+
+    size_t nb_entries = 1000;
+
+    /* Invalid policies */
+    ht_table_default_policy(HT_TABLE_STORAGE_OPEN, &policy);
+    policy.max_load_factor = 1.0;
+    TEST_PTR_NULL(ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options));
+
+    ht_table_default_policy(HT_TABLE_STORAGE_OPEN, &policy);
+    policy.min_load_factor = 0.5;
+    TEST_PTR_NULL(ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options));
+
+    /* A table which never shrinks does not have to grow again once
+     * refilled. */
+    ht_table_default_policy(HT_TABLE_STORAGE_OPEN, &policy);
+    policy.max_load_factor = 0.5;
+    policy.growth_factor = 4.0;
+    policy.shrink = false;
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+
+    for (size_t i = 0; i < nb_entries; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+    for (size_t i = 0; i < nb_entries; i++)
+        ht_table_remove(table, HT_INT32_TO_POINTER(i));
+    TEST_TRUE(ht_table_is_empty(table));
+
+    ht_set_memory_allocator(&test_counting_allocator);
+    test_nb_allocations = 0;
+
+    for (size_t i = 0; i < nb_entries; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+    for (size_t i = 0; i < nb_entries; i++)
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+    TEST_UINT_EQ(test_nb_allocations, 0);
+
+    ht_set_memory_allocator(NULL);
+
+    ht_table_delete(table);
+}
+
+TEST(get_many) {
+    struct ht_table *table;
+    struct ht_table_options options = {0};
+    const void *keys[100];
+    void *values[100];
+    bool found[100];
+
+    for (int32_t i = 0; i < 100; i++)
+        keys[i] = HT_INT32_TO_POINTER(i);
+
+    for (int s = 0; s < 3; s++) {
+        options.storage = (s == 2) ? HT_TABLE_STORAGE_OPEN
+                                   : HT_TABLE_STORAGE_CHAINED;
+        options.incremental_resize = (s == 1);
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+        TEST_TRUE(table != NULL);
+
+        TEST_UINT_EQ(ht_table_contains_many(table, keys, 100, found), 0);
+        TEST_FALSE(found[0]);
+
+        for (int32_t i = 0; i < 100; i += 2) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(i + 1));
+        }
+
+        TEST_UINT_EQ(ht_table_get_many(table, keys, 100, values, found), 50);
+        for (int32_t i = 0; i < 100; i++) {
+            if (i % 2 == 0) {
+                TEST_TRUE(found[i]);
+                TEST_INT_EQ(HT_POINTER_TO_INT32(values[i]), i + 1);
+            } else {
+                TEST_FALSE(found[i]);
+                TEST_PTR_NULL(values[i]);
+            }
+        }
+
+        TEST_UINT_EQ(ht_table_get_many(table, keys + 10, 7, values, NULL), 4);
+
+        TEST_UINT_EQ(ht_table_contains_many(table, keys, 100, found), 50);
+        for (int32_t i = 0; i < 100; i++)
+            TEST_TRUE(found[i] == (i % 2 == 0));
+
+        TEST_UINT_EQ(ht_table_contains_many(table, keys, 0, NULL), 0);
+
+        ht_table_delete(table);
+    }
+}
+
+TEST(bytes) {
+    struct ht_table *table;
+    struct ht_bytes keys[3] = {
+        {"abc", 3},
+        {"abcd", 4},
+        {"a\0b", 3},
+    };
+    struct ht_bytes key;
+    void *value;
+
+    table = ht_table_new(ht_hash_bytes, ht_equal_bytes);
+
+    for (size_t i = 0; i < 3; i++) {
+        TEST_INT_EQ(ht_table_insert(table, &keys[i], HT_INT32_TO_POINTER(i)),
+                    1);
+    }
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), 3);
+
+    key = (struct ht_bytes){"abcdef", 4};
+    TEST_INT_EQ(ht_table_get(table, &key, &value), 1);
+    TEST_INT_EQ(HT_POINTER_TO_INT32(value), 1);
+
+    key = (struct ht_bytes){"a\0b", 3};
+    TEST_INT_EQ(ht_table_get(table, &key, &value), 1);
+    TEST_INT_EQ(HT_POINTER_TO_INT32(value), 2);
+
+    key = (struct ht_bytes){"a\0c", 3};
+    TEST_FALSE(ht_table_contains(table, &key));
+
+    ht_table_delete(table);
+}
+
+TEST(heterogeneous_lookup) {
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .hash64_func = ht_hash64_string,
+        .random_seed = true,
+    };
+    struct ht_lookup lookup = {
+        .hash_func = ht_hash_bytes,
+        .hash64_func = ht_hash64_bytes,
+        .equal_func = ht_equal_bytes_string,
+    };
+    const char *text = "foo bar foobar";
+    struct ht_bytes key;
+    void *value;
+
+    TEST_UINT_EQ(ht_hash_bytes(&(struct ht_bytes){text, 3}),
+                 ht_hash_string("foo"));
+    TEST_TRUE(ht_hash64_bytes(&(struct ht_bytes){text + 4, 3}, 42)
+              == ht_hash64_string("bar", 42));
+
+    /* Byte sequences containing null bytes never match a string. */
+    TEST_FALSE(ht_equal_bytes_string(&(struct ht_bytes){"a\0bc", 4}, "a"));
+    TEST_FALSE(ht_equal_bytes_string(&(struct ht_bytes){"a\0", 2}, "a"));
+    TEST_TRUE(ht_equal_bytes_string(&(struct ht_bytes){"abc", 1}, "a"));
+
+    for (int i = 0; i < 3; i++) {
+        if (i == 0) {
+            table = ht_table_new(ht_hash_string, ht_equal_string);
+        } else {
+            options.storage = (i == 1) ? HT_TABLE_STORAGE_CHAINED
+                                       : HT_TABLE_STORAGE_OPEN;
+            table = ht_table_new_ex(NULL, ht_equal_string, &options);
+        }
+        TEST_TRUE(table != NULL);
+
+        ht_table_insert(table, "foo", HT_INT32_TO_POINTER(1));
+        ht_table_insert(table, "foobar", HT_INT32_TO_POINTER(2));
+
+        key = (struct ht_bytes){text, 3};
+        TEST_INT_EQ(ht_table_get_with(table, &lookup, &key, &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), 1);
+
+        key = (struct ht_bytes){text + 8, 6};
+        TEST_INT_EQ(ht_table_get_with(table, &lookup, &key, &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), 2);
+
+        key = (struct ht_bytes){text + 8, 4};
+        TEST_FALSE(ht_table_contains_with(table, &lookup, &key));
+
+        key = (struct ht_bytes){text + 4, 3};
+        TEST_FALSE(ht_table_contains_with(table, &lookup, &key));
+
+        key = (struct ht_bytes){"foo\0bar", 7};
+        TEST_FALSE(ht_table_contains_with(table, &lookup, &key));
+
+        ht_table_delete(table);
+    }
+}
+
+TEST(typed) {
+    struct test_typed_table *table;
+    struct test_typed_bad_table *bad_table;
+    uint64_t value, *pvalue, sum;
+    int64_t key;
+    size_t iter;
+
+    table = test_typed_table_new();
+    TEST_TRUE(table != NULL);
+    TEST_TRUE(test_typed_table_is_empty(table));
+
+    for (int64_t i = 0; i < 1000; i++) {
+        key = i * INT64_C(0x100000000) - 500;
+        TEST_INT_EQ(test_typed_table_insert(table, key, (uint64_t)i), 1);
+    }
+    TEST_UINT_EQ(test_typed_table_nb_entries(table), 1000);
+
+    TEST_INT_EQ(test_typed_table_insert(table, -500, 42), 0);
+    TEST_UINT_EQ(test_typed_table_nb_entries(table), 1000);
+
+    TEST_INT_EQ(test_typed_table_get(table, -500, &value), 1);
+    TEST_UINT_EQ(value, 42);
+    TEST_FALSE(test_typed_table_contains(table, 0));
+
+    pvalue = test_typed_table_get_ptr(table, 999 * INT64_C(0x100000000) - 500);
+    TEST_TRUE(pvalue != NULL);
+    TEST_UINT_EQ(*pvalue, 999);
+    (*pvalue)++;
+    TEST_INT_EQ(test_typed_table_get(table,
+                                     999 * INT64_C(0x100000000) - 500,
+                                     &value), 1);
+    TEST_UINT_EQ(value, 1000);
+
+    for (int64_t i = 0; i < 1000; i += 2) {
+        key = i * INT64_C(0x100000000) - 500;
+        TEST_INT_EQ(test_typed_table_remove(table, key), 1);
+        TEST_INT_EQ(test_typed_table_remove(table, key), 0);
+    }
+    TEST_UINT_EQ(test_typed_table_nb_entries(table), 500);
+
+    for (int64_t i = 1; i < 999; i += 2) {
+        key = i * INT64_C(0x100000000) - 500;
+        TEST_INT_EQ(test_typed_table_get(table, key, &value), 1);
+        TEST_UINT_EQ(value, (uint64_t)i);
+    }
+
+    sum = 0;
+    iter = 0;
+    while (test_typed_table_next(table, &iter, &key, &value) == 1)
+        sum += value;
+    TEST_UINT_EQ(sum, 250000 + 1);
+
+    test_typed_table_clear(table);
+    TEST_TRUE(test_typed_table_is_empty(table));
+    TEST_FALSE(test_typed_table_contains(table, -500 + INT64_C(0x100000000)));
+
+    test_typed_table_delete(table);
+
+    /* Long runs of colliding keys to exercise backward shift removal */
+    bad_table = test_typed_bad_table_new();
+    TEST_TRUE(bad_table != NULL);
+
+    TEST_INT_EQ(test_typed_bad_table_reserve(bad_table, 200), 0);
+
+    for (int64_t i = 0; i < 200; i++)
+        TEST_INT_EQ(test_typed_bad_table_insert(bad_table, i, (uint64_t)i), 1);
+
+    for (int64_t i = 0; i < 200; i += 3)
+        TEST_INT_EQ(test_typed_bad_table_remove(bad_table, i), 1);
+
+    for (int64_t i = 0; i < 200; i++) {
+        TEST_INT_EQ(test_typed_bad_table_get(bad_table, i, &value),
+                    (i % 3 == 0) ? 0 : 1);
+    }
+
+    test_typed_bad_table_delete(bad_table);
+}
+
+TEST(concurrent) {
+    struct test_concurrent_thread threads[TEST_CONCURRENT_NB_THREADS];
+    struct ht_concurrent_table *table;
+    void *key, *value;
+
+    TEST_PTR_NULL(ht_concurrent_table_new(ht_hash_int32, ht_equal_int32,
+                                          NULL, 3));
+    TEST_PTR_NULL(ht_concurrent_table_new(ht_hash_int32, ht_equal_int32,
+                                          &(struct ht_table_options){
+                                              .incremental_resize = true,
+                                          }, 0));
+
+    for (int s = 0; s < 2; s++) {
+        table = ht_concurrent_table_new(ht_hash_int32, ht_equal_int32,
+                                        &(struct ht_table_options){
+                                            .storage = (s == 0)
+                                                ? HT_TABLE_STORAGE_CHAINED
+                                                : HT_TABLE_STORAGE_OPEN,
+                                        }, 4);
+        TEST_TRUE(table != NULL);
+
+        for (int t = 0; t < TEST_CONCURRENT_NB_THREADS; t++) {
+            threads[t].table = table;
+            threads[t].start = t * TEST_CONCURRENT_NB_KEYS;
+            threads[t].nb_errors = 0;
+
+            TEST_INT_EQ(pthread_create(&threads[t].thread, NULL,
+                                       test_concurrent_thread, &threads[t]),
+                        0);
+        }
+
+        for (int t = 0; t < TEST_CONCURRENT_NB_THREADS; t++) {
+            pthread_join(threads[t].thread, NULL);
+            TEST_UINT_EQ(threads[t].nb_errors, 0);
+        }
+
+        TEST_UINT_EQ(ht_concurrent_table_nb_entries(table),
+                     TEST_CONCURRENT_NB_THREADS * TEST_CONCURRENT_NB_KEYS / 2);
+
+        for (int32_t i = 0;
+             i < TEST_CONCURRENT_NB_THREADS * TEST_CONCURRENT_NB_KEYS; i++) {
+            TEST_TRUE(ht_concurrent_table_contains(table,
+                                                   HT_INT32_TO_POINTER(i))
+                      == (i % 2 == 1));
+        }
+
+        TEST_INT_EQ(ht_concurrent_table_insert2(table, HT_INT32_TO_POINTER(1),
+                                                HT_INT32_TO_POINTER(42),
+                                                &key, &value), 0);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), 1);
+        TEST_INT_EQ(ht_concurrent_table_remove2(table, HT_INT32_TO_POINTER(1),
+                                                &key, &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), 42);
+
+        ht_concurrent_table_clear(table);
+        TEST_UINT_EQ(ht_concurrent_table_nb_entries(table), 0);
+
+        ht_concurrent_table_delete(table);
+    }
+}
+
+TEST(single_writer) {
+    struct test_single_writer_reader readers[TEST_SINGLE_WRITER_NB_READERS];
+    struct ht_table *table;
+    struct ht_table_options options = {
+        .storage = HT_TABLE_STORAGE_OPEN,
+        .single_writer = true,
+    };
+    void **pvalue;
+    void *value;
+    bool stop;
+
+    TEST_PTR_NULL(ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                                  &(struct ht_table_options){
+                                      .single_writer = true,
+                                  }));
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+    TEST_TRUE(table != NULL);
+
+    TEST_INT_EQ(ht_table_upsert(table, HT_INT32_TO_POINTER(1), &pvalue), -1);
+
+    for (int32_t i = 0; i < TEST_SINGLE_WRITER_NB_KEYS; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), HT_INT32_TO_POINTER(i));
+
+    stop = false;
+
+    for (int r = 0; r < TEST_SINGLE_WRITER_NB_READERS; r++) {
+        readers[r].table = table;
+        readers[r].reader = ht_table_register_reader(table);
+        readers[r].stop = &stop;
+        readers[r].nb_errors = 0;
+        TEST_TRUE(readers[r].reader != NULL);
+
+        TEST_INT_EQ(pthread_create(&readers[r].thread, NULL,
+                                   test_single_writer_reader, &readers[r]), 0);
+    }
+
+    /* Grow and shrink the table repeatedly while readers are running */
+    for (int n = 0; n < 20; n++) {
+        int32_t start;
+
+        start = TEST_SINGLE_WRITER_NB_KEYS;
+
+        for (int32_t i = start; i < start + 20000; i++) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(i));
+        }
+
+        for (int32_t i = 0; i < TEST_SINGLE_WRITER_NB_KEYS; i++) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(i));
+        }
+
+        for (int32_t i = start; i < start + 20000; i++)
+            ht_table_remove(table, HT_INT32_TO_POINTER(i));
+
+        ht_table_shrink_to_fit(table);
+    }
+
+    ht_table_synchronize(table);
+
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+
+    for (int r = 0; r < TEST_SINGLE_WRITER_NB_READERS; r++) {
+        pthread_join(readers[r].thread, NULL);
+        TEST_UINT_EQ(readers[r].nb_errors, 0);
+
+        ht_table_unregister_reader(readers[r].reader);
+    }
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), TEST_SINGLE_WRITER_NB_KEYS);
+
+    ht_table_clear(table);
+    TEST_TRUE(ht_table_is_empty(table));
+    TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(1)));
+
+    ht_table_insert(table, HT_INT32_TO_POINTER(1), HT_INT32_TO_POINTER(2));
+    TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(1), &value), 1);
+    TEST_INT_EQ(HT_POINTER_TO_INT32(value), 2);
+
+    ht_table_delete(table);
+}
+
+TEST(sharded) {
+    struct ht_sharded_table *table;
+    void **keys, **values;
+    void *value;
+    size_t nb_keys;
+
+    TEST_PTR_NULL(ht_sharded_table_new(ht_hash_int32, ht_equal_int32,
+                                       NULL, 6));
+    TEST_PTR_NULL(ht_sharded_table_new(ht_hash_int32, ht_equal_int32,
+                                       &(struct ht_table_options){
+                                           .single_writer = true,
+                                       }, 0));
+
+    nb_keys = 50000;
+
+    keys = calloc(nb_keys, sizeof(void *));
+    values = calloc(nb_keys, sizeof(void *));
+    TEST_TRUE(keys && values);
+
+    /* Every key appears twice, the last value must win */
+    for (size_t i = 0; i < nb_keys; i++) {
+        keys[i] = HT_INT32_TO_POINTER((int32_t)(i % (nb_keys / 2)));
+        values[i] = HT_INT32_TO_POINTER((int32_t)i);
+    }
+
+    for (int s = 0; s < 2; s++) {
+        table = ht_sharded_table_new(ht_hash_int32, ht_equal_int32,
+                                     &(struct ht_table_options){
+                                         .storage = (s == 0)
+                                             ? HT_TABLE_STORAGE_CHAINED
+                                             : HT_TABLE_STORAGE_OPEN,
+                                     }, 16);
+        TEST_TRUE(table != NULL);
+
+        TEST_INT_EQ(ht_sharded_table_reserve(table, 1000, 4), 0);
+
+        TEST_INT_EQ(ht_sharded_table_insert(table, HT_INT32_TO_POINTER(1),
+                                            HT_INT32_TO_POINTER(0)), 1);
+
+        TEST_INT_EQ(ht_sharded_table_insert_many(table, keys, values,
+                                                 nb_keys, 4), 0);
+        TEST_UINT_EQ(ht_sharded_table_nb_entries(table), nb_keys / 2);
+
+        for (size_t i = 0; i < nb_keys / 2; i++) {
+            TEST_INT_EQ(ht_sharded_table_get(table,
+                                             HT_INT32_TO_POINTER((int32_t)i),
+                                             &value), 1);
+            TEST_INT_EQ(HT_POINTER_TO_INT32(value),
+                        (int32_t)(i + nb_keys / 2));
+        }
+
+        TEST_FALSE(ht_sharded_table_contains(table,
+                                             HT_INT32_TO_POINTER(-1)));
+
+        TEST_INT_EQ(ht_sharded_table_remove(table, HT_INT32_TO_POINTER(1)), 1);
+        TEST_INT_EQ(ht_sharded_table_remove(table, HT_INT32_TO_POINTER(1)), 0);
+        TEST_FALSE(ht_sharded_table_contains(table, HT_INT32_TO_POINTER(1)));
+
+        ht_sharded_table_clear(table);
+        TEST_UINT_EQ(ht_sharded_table_nb_entries(table), 0);
+
+        ht_sharded_table_delete(table);
+    }
+
+    /* More threads than shards */
+    table = ht_sharded_table_new(ht_hash_int32, ht_equal_int32, NULL, 2);
+    TEST_TRUE(table != NULL);
+
+    TEST_INT_EQ(ht_sharded_table_insert_many(table, keys, values,
+                                             nb_keys, 8), 0);
+    TEST_UINT_EQ(ht_sharded_table_nb_entries(table), nb_keys / 2);
+
+    for (size_t i = 0; i < nb_keys / 2; i++) {
+        TEST_INT_EQ(ht_sharded_table_get(table,
+                                         HT_INT32_TO_POINTER((int32_t)i),
+                                         &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), (int32_t)(i + nb_keys / 2));
+    }
+
+    ht_sharded_table_delete(table);
+
+    free(keys);
+    free(values);
+}
+
+static enum ht_foreach_action
+test_foreach_remove_large(void *key, void **pvalue, void *arg) {
+    (void)pvalue;
+    (void)arg;
+
+    return (HT_POINTER_TO_INT32(key) >= 100) ? HT_FOREACH_REMOVE
+                                             : HT_FOREACH_KEEP;
+}
+
+TEST(allocator) {
+    struct test_sized_allocator sized_allocator;
+    struct ht_allocator allocator = {
+        .alloc = test_sized_alloc,
+        .free = test_sized_free,
+        .ctx = &sized_allocator,
+    };
+    struct ht_table_options options = {
+        .allocator = &allocator,
+    };
+    struct ht_concurrent_table *concurrent_table;
+    struct ht_sharded_table *sharded_table;
+    struct ht_table_iterator *it;
+    struct ht_table *table;
+    void *keys[1000];
+
+    TEST_PTR_NULL(ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                                  &(struct ht_table_options){
+                                      .allocator = &(struct ht_allocator){
+                                          .alloc = test_sized_alloc,
+                                      },
+                                  }));
+
+    for (int m = 0; m < 8; m++) {
+        memset(&sized_allocator, 0, sizeof(struct test_sized_allocator));
+
+        /* Without a realloc function, blocks are reallocated by copy. */
+        allocator.realloc = (m % 2 == 0) ? NULL : test_sized_realloc;
+
+        options.storage = (m < 4) ? HT_TABLE_STORAGE_CHAINED
+                                  : HT_TABLE_STORAGE_OPEN;
+        options.incremental_resize = (m == 2 || m == 3);
+        options.single_writer = (m >= 6);
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+        TEST_TRUE(table != NULL);
+        TEST_TRUE(sized_allocator.nb_blocks > 0);
+
+        for (int32_t i = 0; i < 5000; i++)
+            ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+        for (int32_t i = 0; i < 5000; i++)
+            TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+
+        it = ht_table_iterate(table);
+        TEST_TRUE(it != NULL);
+        ht_table_iterator_delete(it);
+
+        if (options.single_writer) {
+            /* Readers still registered are freed with the table. */
+            ht_table_unregister_reader(ht_table_register_reader(table));
+            TEST_TRUE(ht_table_register_reader(table) != NULL);
+        }
+
+        for (int32_t i = 100; i < 5000; i++)
+            ht_table_remove(table, HT_INT32_TO_POINTER(i));
+        TEST_INT_EQ(ht_table_shrink_to_fit(table), 0);
+
+        ht_table_clear(table);
+        ht_table_delete(table);
+
+        TEST_UINT_EQ(sized_allocator.nb_blocks, 0);
+        TEST_UINT_EQ(sized_allocator.nb_bytes, 0);
+        TEST_UINT_EQ(sized_allocator.nb_size_errors, 0);
+    }
+
+    /* Concurrent and sharded tables allocate all their memory with the
+     * allocator context, and nothing with the process-wide allocator. */
+    memset(&sized_allocator, 0, sizeof(struct test_sized_allocator));
+    memset(&options, 0, sizeof(struct ht_table_options));
+    options.allocator = &allocator;
+
+    ht_set_memory_allocator(&test_counting_allocator);
+    test_nb_allocations = 0;
+
+    concurrent_table = ht_concurrent_table_new(ht_hash_int32, ht_equal_int32,
+                                               &options, 4);
+    TEST_TRUE(concurrent_table != NULL);
+    for (int32_t i = 0; i < 1000; i++) {
+        ht_concurrent_table_insert(concurrent_table,
+                                   HT_INT32_TO_POINTER(i), NULL);
+    }
+    ht_concurrent_table_delete(concurrent_table);
+
+    for (int32_t i = 0; i < 1000; i++)
+        keys[i] = HT_INT32_TO_POINTER(i);
+
+    sharded_table = ht_sharded_table_new(ht_hash_int32, ht_equal_int32,
+                                         &options, 4);
+    TEST_TRUE(sharded_table != NULL);
+    TEST_INT_EQ(ht_sharded_table_insert_many(sharded_table, keys, keys,
+                                             1000, 1), 0);
+    TEST_INT_EQ(ht_sharded_table_reserve(sharded_table, 5000, 1), 0);
+    ht_sharded_table_delete(sharded_table);
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+    TEST_TRUE(table != NULL);
+    for (int32_t i = 0; i < 1000; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+    TEST_INT_EQ(ht_table_foreach_parallel(table, test_foreach_remove_large,
+                                          NULL, 1, NULL), 0);
+    ht_table_delete(table);
+
+    ht_set_memory_allocator(NULL);
+
+    TEST_UINT_EQ(test_nb_allocations, 0);
+    TEST_TRUE(sized_allocator.nb_allocations > 0);
+    TEST_UINT_EQ(sized_allocator.nb_blocks, 0);
+    TEST_UINT_EQ(sized_allocator.nb_bytes, 0);
+    TEST_UINT_EQ(sized_allocator.nb_size_errors, 0);
+}
+
+TEST(slab) {
+    struct test_sized_allocator sized_allocator;
+    struct ht_allocator allocator = {
+        .alloc = test_sized_alloc,
+        .realloc = test_sized_realloc,
+        .free = test_sized_free,
+        .ctx = &sized_allocator,
+    };
+    struct ht_table *table;
+    size_t nb_bytes;
+    void *value;
+
+    memset(&sized_allocator, 0, sizeof(struct test_sized_allocator));
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                            &(struct ht_table_options){
+                                .allocator = &allocator,
+                            });
+    TEST_TRUE(table != NULL);
+
+    /* Entry arrays are carved from slab chunks, not allocated one by
+     * one. */
+    for (int32_t i = 0; i < 20000; i++) {
+        ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                        HT_INT32_TO_POINTER(i));
+    }
+    TEST_TRUE(sized_allocator.nb_allocations < 200);
+
+    for (int32_t i = 0; i < 20000; i += 2)
+        ht_table_remove(table, HT_INT32_TO_POINTER(i));
+    for (int32_t i = 0; i < 20000; i++) {
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i))
+                  == (i % 2 == 1));
+    }
+
+    /* Clearing the table releases all entry arrays; only the table and its
+     * bucket array remain. */
+    ht_table_clear(table);
+    TEST_UINT_EQ(sized_allocator.nb_blocks, 2);
+
+    for (int32_t i = 0; i < 1000; i++) {
+        ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                        HT_INT32_TO_POINTER(i + 1));
+    }
+    for (int32_t i = 0; i < 1000; i++) {
+        TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i), &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), i + 1);
+    }
+
+    /* Resizing moves entries to a new slab, so that memory is returned to
+     * the allocator after a large number of removals. */
+    for (int32_t i = 1000; i < 100000; i++)
+        ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL);
+    nb_bytes = sized_allocator.nb_bytes;
+
+    for (int32_t i = 100; i < 100000; i++)
+        ht_table_remove(table, HT_INT32_TO_POINTER(i));
+    TEST_INT_EQ(ht_table_shrink_to_fit(table), 0);
+    TEST_TRUE(sized_allocator.nb_bytes < nb_bytes / 100);
+
+    for (int32_t i = 0; i < 1000; i++) {
+        TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i))
+                  == (i < 100));
+    }
+
+    ht_table_delete(table);
+    TEST_UINT_EQ(sized_allocator.nb_blocks, 0);
+}
+
+TEST(huge_pages) {
+    struct ht_table_options options = {
+        .huge_pages = true,
+    };
+    struct ht_table *table;
+    int32_t nb_keys;
+    void *value;
+
+    nb_keys = 200000;
+
+    for (int m = 0; m < 4; m++) {
+        options.storage = (m < 2) ? HT_TABLE_STORAGE_CHAINED
+                                  : HT_TABLE_STORAGE_OPEN;
+        options.incremental_resize = (m == 1);
+        options.single_writer = (m == 3);
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, &options);
+        TEST_TRUE(table != NULL);
+
+        for (int32_t i = 0; i < nb_keys; i++) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(i));
+        }
+
+        for (int32_t i = 0; i < nb_keys; i++) {
+            TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i), &value),
+                        1);
+            TEST_INT_EQ(HT_POINTER_TO_INT32(value), i);
+        }
+
+        for (int32_t i = 100; i < nb_keys; i++)
+            ht_table_remove(table, HT_INT32_TO_POINTER(i));
+        TEST_INT_EQ(ht_table_shrink_to_fit(table), 0);
+
+        for (int32_t i = 0; i < nb_keys; i++) {
+            TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i))
+                      == (i < 100));
+        }
+
+        TEST_INT_EQ(ht_table_reserve(table, (size_t)nb_keys), 0);
+        for (int32_t i = 0; i < 100; i++)
+            TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+
+        ht_table_clear(table);
+        TEST_TRUE(ht_table_is_empty(table));
+
+        ht_table_delete(table);
+    }
+}
+
+static bool
+test_equal_pointer(const void *k1, const void *k2) {
+    return k1 == k2;
+}
+
+TEST(snapshot) {
+    struct ht_table *table, *table2;
+    struct ht_table_iterator *it;
+    void *key, *value;
+    uint8_t header[32];
+    char buf[32];
+    FILE *file;
+    long sz;
+
+    /* Integer keys and values */
+    table = ht_table_new(ht_hash_int32, ht_equal_int32);
+    for (int32_t i = 0; i < 1000; i++) {
+        ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                        HT_INT32_TO_POINTER(-i));
+    }
+
+    file = tmpfile();
+    TEST_TRUE(file != NULL);
+
+    TEST_INT_EQ(ht_table_save(table, file, &ht_codec_int32,
+                              &ht_codec_int32), 0);
+    sz = ftell(file);
+    rewind(file);
+
+    table2 = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                             &(struct ht_table_options){
+                                 .storage = HT_TABLE_STORAGE_OPEN,
+                             });
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_int32,
+                              &ht_codec_int32), 0);
+
+    TEST_UINT_EQ(ht_table_nb_entries(table2), 1000);
+    for (int32_t i = 0; i < 1000; i++) {
+        TEST_INT_EQ(ht_table_get(table2, HT_INT32_TO_POINTER(i), &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), -i);
+    }
+
+    ht_table_delete(table2);
+
+    /* Truncated snapshot */
+    fflush(file);
+    TEST_INT_EQ(ftruncate(fileno(file), sz - 1), 0);
+    rewind(file);
+
+    table2 = ht_table_new(ht_hash_int32, ht_equal_int32);
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_int32,
+                              &ht_codec_int32), -1);
+    ht_table_delete(table2);
+
+    /* Corrupted number of entries, in a file and in a stream whose size is
+     * unknown */
+    rewind(file);
+    TEST_UINT_EQ(fread(header, 1, sizeof(header), file), sizeof(header));
+    memset(header + 24, 0xff, 7);
+    header[31] = 0xf0;
+
+    rewind(file);
+    TEST_UINT_EQ(fwrite(header, 1, sizeof(header), file), sizeof(header));
+    rewind(file);
+
+    table2 = ht_table_new(ht_hash_int32, ht_equal_int32);
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_int32,
+                              &ht_codec_int32), -1);
+    TEST_STRING_EQ(ht_get_error(), "invalid number of entries");
+    ht_table_delete(table2);
+
+    fclose(file);
+
+    file = fmemopen(header, sizeof(header), "r");
+    TEST_TRUE(file != NULL);
+
+    table2 = ht_table_new(ht_hash_int32, ht_equal_int32);
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_int32,
+                              &ht_codec_int32), -1);
+    TEST_STRING_EQ(ht_get_error(), "truncated snapshot");
+    ht_table_delete(table2);
+
+    fclose(file);
+    ht_table_delete(table);
+
+    /* String keys without values, with a seeded hash function */
+    table = ht_table_new_ex(NULL, ht_equal_string,
+                            &(struct ht_table_options){
+                                .hash64_func = ht_hash64_string,
+                                .random_seed = true,
+                            });
+    for (int i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        ht_table_insert(table, strdup(buf), NULL);
+    }
+
+    file = tmpfile();
+    TEST_TRUE(file != NULL);
+
+    TEST_INT_EQ(ht_table_save(table, file, &ht_codec_string, NULL), 0);
+    rewind(file);
+
+    table2 = ht_table_new_ex(NULL, ht_equal_string,
+                             &(struct ht_table_options){
+                                 .hash64_func = ht_hash64_string,
+                                 .random_seed = true,
+                             });
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_string, NULL), 0);
+
+    TEST_UINT_EQ(ht_table_nb_entries(table2), 1000);
+    for (int i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_TRUE(ht_table_contains(table2, buf));
+    }
+
+    it = ht_table_iterate(table);
+    while (ht_table_iterator_next(it, &key, NULL) == 1)
+        free(key);
+    ht_table_iterator_delete(it);
+    ht_table_delete(table);
+
+    it = ht_table_iterate(table2);
+    while (ht_table_iterator_next(it, &key, NULL) == 1)
+        ht_free(key);
+    ht_table_iterator_delete(it);
+    ht_table_delete(table2);
+
+    /* A table which was empty is emptied again if loading fails, and the
+     * keys read are freed. */
+    sz = ftell(file);
+    fflush(file);
+    TEST_INT_EQ(ftruncate(fileno(file), sz - 12), 0);
+    rewind(file);
+
+    table2 = ht_table_new(ht_hash_string, ht_equal_string);
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_string, NULL), -1);
+    TEST_UINT_EQ(ht_table_nb_entries(table2), 0);
+    ht_table_delete(table2);
+
+    fclose(file);
+
+    /* The key of an entry whose value cannot be read is freed. */
+    table = ht_table_new(ht_hash_string, ht_equal_string);
+    ht_table_insert(table, "a", HT_INT32_TO_POINTER(1));
+    ht_table_insert(table, "b", HT_INT32_TO_POINTER(2));
+
+    file = tmpfile();
+    TEST_TRUE(file != NULL);
+
+    TEST_INT_EQ(ht_table_save(table, file, &ht_codec_string,
+                              &ht_codec_int32), 0);
+    sz = ftell(file);
+    fflush(file);
+    TEST_INT_EQ(ftruncate(fileno(file), sz - 10), 0);
+    rewind(file);
+
+    table2 = ht_table_new(ht_hash_string, ht_equal_string);
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_string,
+                              &ht_codec_int32), -1);
+    TEST_UINT_EQ(ht_table_nb_entries(table2), 0);
+    ht_table_delete(table2);
+
+    fclose(file);
+    ht_table_delete(table);
+
+    /* Duplicate keys, saved from a table comparing keys by address: the
+     * first entry is kept, and the other key read is freed. */
+    table = ht_table_new(ht_hash_string, test_equal_pointer);
+    ht_table_insert(table, "dup", HT_INT32_TO_POINTER(1));
+    strcpy(buf, "dup");
+    ht_table_insert(table, buf, HT_INT32_TO_POINTER(2));
+    TEST_UINT_EQ(ht_table_nb_entries(table), 2);
+
+    file = tmpfile();
+    TEST_TRUE(file != NULL);
+
+    TEST_INT_EQ(ht_table_save(table, file, &ht_codec_string,
+                              &ht_codec_int32), 0);
+    rewind(file);
+
+    table2 = ht_table_new(ht_hash_string, ht_equal_string);
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_string,
+                              &ht_codec_int32), 0);
+    TEST_UINT_EQ(ht_table_nb_entries(table2), 1);
+    TEST_TRUE(ht_table_contains(table2, "dup"));
+
+    it = ht_table_iterate(table2);
+    while (ht_table_iterator_next(it, &key, NULL) == 1)
+        ht_free(key);
+    ht_table_iterator_delete(it);
+    ht_table_delete(table2);
+
+    /* Keys already in the table keep their entry. */
+    rewind(file);
+
+    table2 = ht_table_new(ht_hash_string, ht_equal_string);
+    ht_table_insert(table2, "dup", HT_INT32_TO_POINTER(3));
+    TEST_INT_EQ(ht_table_load(table2, file, &ht_codec_string,
+                              &ht_codec_int32), 0);
+    TEST_UINT_EQ(ht_table_nb_entries(table2), 1);
+    TEST_INT_EQ(ht_table_get(table2, "dup", &value), 1);
+    TEST_INT_EQ(HT_POINTER_TO_INT32(value), 3);
+    ht_table_delete(table2);
+
+    fclose(file);
+    ht_table_delete(table);
+}
+
+TEST(frozen) {
+    struct ht_frozen_table *frozen, *frozen2;
+    struct ht_table_iterator *it;
+    struct ht_table *table;
+    struct ht_bytes value;
+    void *key;
+    char path[] = "/tmp/ht-frozen-XXXXXX";
+    char buf[32];
+    int32_t n;
+    FILE *file;
+    int fd;
+
+    table = ht_table_new_ex(ht_hash_string, ht_equal_string,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_OPEN,
+                            });
+    for (int32_t i = 0; i < 10000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        ht_table_insert(table, strdup(buf), HT_INT32_TO_POINTER(i));
+    }
+
+    frozen = ht_table_freeze(table, ht_encode_string, ht_encode_int32);
+    TEST_TRUE(frozen != NULL);
+    TEST_UINT_EQ(ht_frozen_table_nb_entries(frozen), 10000);
+
+    for (int32_t i = 0; i < 10000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_INT_EQ(ht_frozen_table_get(frozen, buf, strlen(buf), &value), 1);
+        TEST_UINT_EQ(value.size, sizeof(int32_t));
+        memcpy(&n, value.data, sizeof(int32_t));
+        TEST_INT_EQ(n, i);
+    }
+
+    TEST_FALSE(ht_frozen_table_contains(frozen, "foo", 3));
+    TEST_FALSE(ht_frozen_table_contains(frozen, "key1", 3));
+
+    /* Mapped image */
+    fd = mkstemp(path);
+    TEST_TRUE(fd != -1);
+    file = fdopen(fd, "w");
+    TEST_TRUE(file != NULL);
+    TEST_INT_EQ(ht_frozen_table_save(frozen, file), 0);
+    TEST_INT_EQ(fclose(file), 0);
+
+    frozen2 = ht_frozen_table_open(path);
+    TEST_TRUE(frozen2 != NULL);
+    TEST_UINT_EQ(ht_frozen_table_nb_entries(frozen2), 10000);
+
+    for (int32_t i = 0; i < 10000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_INT_EQ(ht_frozen_table_get(frozen2, buf, strlen(buf), &value), 1);
+        memcpy(&n, value.data, sizeof(int32_t));
+        TEST_INT_EQ(n, i);
+    }
+
+    TEST_FALSE(ht_frozen_table_contains(frozen2, "foo", 3));
+    ht_frozen_table_delete(frozen2);
+
+    /* Truncated image */
+    TEST_INT_EQ(truncate(path, 64), 0);
+    TEST_PTR_NULL(ht_frozen_table_open(path));
+
+    unlink(path);
+    ht_frozen_table_delete(frozen);
+
+    it = ht_table_iterate(table);
+    while (ht_table_iterator_next(it, &key, NULL) == 1)
+        free(key);
+    ht_table_iterator_delete(it);
+    ht_table_clear(table);
+
+    /* Empty table without values */
+    frozen = ht_table_freeze(table, ht_encode_string, NULL);
+    TEST_TRUE(frozen != NULL);
+    TEST_UINT_EQ(ht_frozen_table_nb_entries(frozen), 0);
+    TEST_FALSE(ht_frozen_table_contains(frozen, "key0", 4));
+    ht_frozen_table_delete(frozen);
+
+    ht_table_delete(table);
+}
+
+TEST(shared) {
+    struct ht_shared_table *table, *table2;
+    char path[] = "/tmp/ht-shared-XXXXXX";
+    char buf[32], value[64];
+    size_t value_sz;
+    uint64_t offset;
+    int32_t n;
+    void *page;
+    pid_t pid;
+    int fd, status;
+
+    fd = mkstemp(path);
+    TEST_TRUE(fd != -1);
+    unlink(path);
+
+    table = ht_shared_table_create(fd, 1000, 1 << 16);
+    TEST_TRUE(table != NULL);
+
+    for (int32_t i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_INT_EQ(ht_shared_table_insert(table, buf, strlen(buf),
+                                           &i, sizeof(int32_t)), 1);
+    }
+
+    TEST_UINT_EQ(ht_shared_table_nb_entries(table), 1000);
+
+    for (int32_t i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_INT_EQ(ht_shared_table_get(table, buf, strlen(buf),
+                                        &n, sizeof(int32_t), &value_sz), 1);
+        TEST_UINT_EQ(value_sz, sizeof(int32_t));
+        TEST_INT_EQ(n, i);
+    }
+
+    TEST_FALSE(ht_shared_table_contains(table, "foo", 3));
+
+    /* Replacing a value with a larger one */
+    TEST_INT_EQ(ht_shared_table_insert(table, "key1", 4,
+                                       "a larger value", 14), 0);
+    TEST_INT_EQ(ht_shared_table_get(table, "key1", 4,
+                                    value, sizeof(value), &value_sz), 1);
+    TEST_UINT_EQ(value_sz, 14);
+    value[value_sz] = '\0';
+    TEST_STRING_EQ(value, "a larger value");
+
+    /* Removal */
+    for (int32_t i = 0; i < 1000; i += 2) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_INT_EQ(ht_shared_table_remove(table, buf, strlen(buf)), 1);
+        TEST_INT_EQ(ht_shared_table_remove(table, buf, strlen(buf)), 0);
+    }
+
+    TEST_UINT_EQ(ht_shared_table_nb_entries(table), 500);
+
+    for (int32_t i = 0; i < 1000; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        TEST_TRUE(ht_shared_table_contains(table, buf, strlen(buf))
+                  == (i % 2 == 1));
+    }
+
+    /* Another process */
+    pid = fork();
+    TEST_TRUE(pid != -1);
+
+    if (pid == 0) {
+        table2 = ht_shared_table_attach(fd);
+        if (!table2)
+            _exit(1);
+
+        if (ht_shared_table_insert(table2, "child", 5, "1", 1) != 1)
+            _exit(1);
+        if (ht_shared_table_remove(table2, "key1", 4) != 1)
+            _exit(1);
+
+        ht_shared_table_detach(table2);
+        _exit(0);
+    }
+
+    TEST_INT_EQ(waitpid(pid, &status, 0), pid);
+    TEST_TRUE(WIFEXITED(status));
+    TEST_INT_EQ(WEXITSTATUS(status), 0);
+
+    TEST_TRUE(ht_shared_table_contains(table, "child", 5));
+    TEST_FALSE(ht_shared_table_contains(table, "key1", 4));
+    TEST_UINT_EQ(ht_shared_table_nb_entries(table), 500);
+
+    table2 = ht_shared_table_attach(fd);
+    TEST_TRUE(table2 != NULL);
+    TEST_TRUE(ht_shared_table_contains(table2, "key3", 4));
+
+    ht_shared_table_clear(table2);
+    TEST_UINT_EQ(ht_shared_table_nb_entries(table), 0);
+    TEST_FALSE(ht_shared_table_contains(table, "key3", 4));
+
+    ht_shared_table_detach(table2);
+
+    /* Processes dying with the lock held; they crash when copying from or
+     * to an inaccessible page. */
+    page = mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_TRUE(page != MAP_FAILED);
+
+    TEST_INT_EQ(ht_shared_table_insert(table, "foo", 3, "1", 1), 1);
+
+    pid = fork();
+    TEST_TRUE(pid != -1);
+
+    if (pid == 0) {
+        ht_shared_table_get(table, "foo", 3, page, 1, NULL);
+        _exit(0);
+    }
+
+    TEST_INT_EQ(waitpid(pid, &status, 0), pid);
+    TEST_FALSE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* A lookup does not modify the table, which can still be used. */
+    TEST_TRUE(ht_shared_table_contains(table, "foo", 3));
+    TEST_INT_EQ(ht_shared_table_insert(table, "bar", 3, "2", 1), 1);
+
+    pid = fork();
+    TEST_TRUE(pid != -1);
+
+    if (pid == 0) {
+        ht_shared_table_insert(table, "baz", 3, page, 16);
+        _exit(0);
+    }
+
+    TEST_INT_EQ(waitpid(pid, &status, 0), pid);
+    TEST_FALSE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* An interrupted modification leaves a table which must be cleared. */
+    TEST_INT_EQ(ht_shared_table_get(table, "foo", 3, NULL, 0, NULL), -1);
+    TEST_INT_EQ(ht_shared_table_insert(table, "foo", 3, "1", 1), -1);
+    TEST_INT_EQ(ht_shared_table_remove(table, "foo", 3), -1);
+
+    ht_shared_table_clear(table);
+    TEST_INT_EQ(ht_shared_table_insert(table, "foo", 3, "1", 1), 1);
+    TEST_TRUE(ht_shared_table_contains(table, "foo", 3));
+
+    munmap(page, 4096);
+
+    /* Corrupted data area; data_top and the first free list are at offsets
+     * 64 and 72 of the header. */
+    offset = UINT64_MAX;
+    TEST_TRUE(pwrite(fd, &offset, sizeof(offset), 64) == sizeof(offset));
+    TEST_PTR_NULL(ht_shared_table_attach(fd));
+    TEST_STRING_EQ(ht_get_error(),
+                   "invalid shared table: inconsistent data area");
+
+    ht_shared_table_clear(table);
+    table2 = ht_shared_table_attach(fd);
+    TEST_TRUE(table2 != NULL);
+    ht_shared_table_detach(table2);
+
+    offset = 1;
+    TEST_TRUE(pwrite(fd, &offset, sizeof(offset), 72 + 8 * 4)
+              == sizeof(offset));
+    TEST_PTR_NULL(ht_shared_table_attach(fd));
+    TEST_STRING_EQ(ht_get_error(),
+                   "invalid shared table: inconsistent free list");
+
+    ht_shared_table_detach(table);
+
+    /* Full table */
+    table = ht_shared_table_create(fd, 10, 1 << 16);
+    TEST_TRUE(table != NULL);
+
+    for (int32_t i = 0; i < 14; i++) {
+        TEST_INT_EQ(ht_shared_table_insert(table, &i, sizeof(int32_t),
+                                           NULL, 0), 1);
+    }
+
+    n = 14;
+    TEST_INT_EQ(ht_shared_table_insert(table, &n, sizeof(int32_t), NULL, 0),
+                -1);
+
+    ht_shared_table_detach(table);
+    close(fd);
+}
+
+TEST(iterate_batch) {
+    enum ht_table_storage storages[] = {
+        HT_TABLE_STORAGE_CHAINED,
+        HT_TABLE_STORAGE_OPEN,
+        HT_TABLE_STORAGE_COMPACT,
+    };
+
+    for (size_t s = 0; s < sizeof(storages) / sizeof(storages[0]); s++) {
+        struct ht_table *table;
+        struct ht_table_iterator it;
+        void *keys[7], *values[7], *key;
+        bool seen[1000];
+        size_t nb, nb_total;
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                                &(struct ht_table_options){
+                                    .storage = storages[s],
+                                });
+
+        ht_table_iterator_init(&it, table);
+        TEST_UINT_EQ(ht_table_iterator_next_batch(&it, keys, values, 7), 0);
+        ht_table_iterator_release(&it);
+
+        for (int32_t i = 0; i < 1000; i++) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(-i));
+        }
+
+        memset(seen, 0, sizeof(seen));
+        nb_total = 0;
+
+        ht_table_iterator_init(&it, table);
+        while ((nb = ht_table_iterator_next_batch(&it, keys, values, 7)) > 0) {
+            for (size_t i = 0; i < nb; i++) {
+                int32_t n;
+
+                n = HT_POINTER_TO_INT32(keys[i]);
+                TEST_TRUE(n >= 0 && n < 1000);
+                TEST_FALSE(seen[n]);
+                TEST_INT_EQ(HT_POINTER_TO_INT32(values[i]), -n);
+                seen[n] = true;
+            }
+
+            nb_total += nb;
+        }
+        ht_table_iterator_release(&it);
+
+        TEST_UINT_EQ(nb_total, 1000);
+
+        /* Mixing single entries and batches */
+        ht_table_iterator_init(&it, table);
+        TEST_INT_EQ(ht_table_iterator_next(&it, &key, NULL), 1);
+
+        nb_total = 1;
+        while ((nb = ht_table_iterator_next_batch(&it, NULL, values, 7)) > 0)
+            nb_total += nb;
+        ht_table_iterator_release(&it);
+
+        TEST_UINT_EQ(nb_total, 1000);
+
+        /* Removing the last entry of a batch */
+        ht_table_iterator_init(&it, table);
+        TEST_UINT_EQ(ht_table_iterator_next_batch(&it, keys, NULL, 7), 7);
+        ht_table_iterator_remove(&it);
+        TEST_INT_EQ(ht_table_iterator_next(&it, &key, NULL), 1);
+        ht_table_iterator_release(&it);
+
+        TEST_UINT_EQ(ht_table_nb_entries(table), 999);
+        TEST_FALSE(ht_table_contains(table, keys[6]));
+        TEST_TRUE(ht_table_contains(table, keys[5]));
+        TEST_TRUE(ht_table_contains(table, key));
+
+        ht_table_delete(table);
+    }
+}
+
+TEST(compact) {
+    struct ht_table *table;
+    struct ht_table_iterator it;
+    void *key, *value;
+    int32_t expected;
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                            &(struct ht_table_options){
+                                .storage = HT_TABLE_STORAGE_COMPACT,
+                            });
+    TEST_TRUE(table != NULL);
+
+    /* Growing through all index sizes */
+    for (int32_t i = 0; i < 100000; i++) {
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                    HT_INT32_TO_POINTER(-i)), 1);
+    }
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), 100000);
+    TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(42),
+                                HT_INT32_TO_POINTER(0)), 0);
+
+    for (int32_t i = 0; i < 100000; i++) {
+        TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i), &value), 1);
+        TEST_INT_EQ(HT_POINTER_TO_INT32(value), (i == 42) ? 0 : -i);
+    }
+
+    TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(100000)));
+
+    /* Removing most entries; the table shrinks */
+    for (int32_t i = 0; i < 100000; i++) {
+        if (i % 1000 != 0)
+            TEST_INT_EQ(ht_table_remove(table, HT_INT32_TO_POINTER(i)), 1);
+    }
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), 100);
+
+    /* Iteration follows insertion order, replacing a value does not move
+     * its entry, and reinserted entries go to the end. */
+    TEST_INT_EQ(ht_table_remove(table, HT_INT32_TO_POINTER(0)), 1);
+    TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(0), NULL), 1);
+    TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(5000), NULL), 0);
+
+    expected = 1000;
+
+    ht_table_iterator_init(&it, table);
+    while (ht_table_iterator_next(&it, &key, NULL) == 1) {
+        TEST_INT_EQ(HT_POINTER_TO_INT32(key), expected);
+
+        if (expected == 0) {
+            expected = -1;
+        } else {
+            expected += 1000;
+            if (expected == 100000)
+                expected = 0;
+        }
+    }
+    ht_table_iterator_release(&it);
+
+    TEST_INT_EQ(expected, -1);
+
+    /* Removing entries while iterating */
+    ht_table_iterator_init(&it, table);
+    while (ht_table_iterator_next(&it, &key, NULL) == 1) {
+        if (HT_POINTER_TO_INT32(key) % 2000 == 0)
+            ht_table_iterator_remove(&it);
+    }
+    ht_table_iterator_release(&it);
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), 50);
+    TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(0)));
+    TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(1000)));
+
+    TEST_INT_EQ(ht_table_shrink_to_fit(table), 0);
+    TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(99000)));
+
+    ht_table_clear(table);
+    TEST_UINT_EQ(ht_table_nb_entries(table), 0);
+    TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(1000)));
+
+    /* Inserting and removing the same entry repeatedly */
+    for (int i = 0; i < 1000; i++) {
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(1), NULL), 1);
+        TEST_INT_EQ(ht_table_remove(table, HT_INT32_TO_POINTER(1)), 1);
+    }
+
+    TEST_UINT_EQ(ht_table_nb_entries(table), 0);
+
+    ht_table_delete(table);
+}
+
+static enum ht_foreach_action
+test_foreach_double_even(void *key, void **pvalue, void *arg) {
+    size_t *nb_visits;
+
+    nb_visits = arg;
+    __atomic_add_fetch(nb_visits, 1, __ATOMIC_RELAXED);
+
+    if (HT_POINTER_TO_INT32(key) % 2 != 0)
+        return HT_FOREACH_REMOVE;
+
+    *pvalue = HT_INT32_TO_POINTER(HT_POINTER_TO_INT32(*pvalue) * 2);
+    return HT_FOREACH_KEEP;
+}
+
+static void
+test_reduce_sum(void *acc, void *key, void *value, void *arg) {
+    (void)key;
+    (void)arg;
+
+    *(int64_t *)acc += HT_POINTER_TO_INT32(value);
+}
+
+static void
+test_combine_sum(void *acc, const void *acc2, void *arg) {
+    (void)arg;
+
+    *(int64_t *)acc += *(const int64_t *)acc2;
+}
+
+static void
+test_executor_run(unsigned int nb_tasks, ht_task_func func, void *func_arg,
+                  void *ctx) {
+    unsigned int *nb_runs;
+
+    nb_runs = ctx;
+
+    /* Tasks run one after the other, in reverse order. */
+    for (unsigned int i = nb_tasks; i > 0; i--) {
+        func(func_arg, i - 1);
+        (*nb_runs)++;
+    }
+}
+
+TEST(foreach_parallel) {
+    struct ht_table_options options[] = {
+        {.storage = HT_TABLE_STORAGE_CHAINED},
+        {.storage = HT_TABLE_STORAGE_CHAINED, .incremental_resize = true},
+        {.storage = HT_TABLE_STORAGE_OPEN},
+        {.storage = HT_TABLE_STORAGE_COMPACT},
+    };
+
+    for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+        struct ht_table *table;
+        struct ht_table_stats stats;
+        struct ht_executor executor;
+        size_t nb_buckets;
+        unsigned int nb_runs;
+        size_t nb_visits;
+        void *value;
+        int64_t sum;
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32, options + o);
+
+        for (int32_t i = 0; i < 10000; i++) {
+            ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                            HT_INT32_TO_POINTER(i));
+        }
+
+        nb_visits = 0;
+        TEST_INT_EQ(ht_table_foreach_parallel(table, test_foreach_double_even,
+                                              &nb_visits, 4, NULL), 0);
+        TEST_UINT_EQ(nb_visits, 10000);
+        TEST_UINT_EQ(ht_table_nb_entries(table), 5000);
+
+        for (int32_t i = 0; i < 10000; i++) {
+            if (i % 2 == 0) {
+                TEST_INT_EQ(ht_table_get(table, HT_INT32_TO_POINTER(i),
+                                         &value), 1);
+                TEST_INT_EQ(HT_POINTER_TO_INT32(value), i * 2);
+            } else {
+                TEST_FALSE(ht_table_contains(table, HT_INT32_TO_POINTER(i)));
+            }
+        }
+
+        /* Sum of 2 * (0 + 2 + ... + 9998) */
+        sum = 0;
+        TEST_INT_EQ(ht_table_reduce_parallel(table, test_reduce_sum,
+                                             test_combine_sum,
+                                             &sum, sizeof(int64_t), NULL,
+                                             3, NULL), 0);
+        TEST_TRUE(sum == 49990000);
+
+        /* Caller-supplied executor */
+        nb_runs = 0;
+        executor.run = test_executor_run;
+        executor.ctx = &nb_runs;
+
+        sum = 0;
+        TEST_INT_EQ(ht_table_reduce_parallel(table, test_reduce_sum,
+                                             test_combine_sum,
+                                             &sum, sizeof(int64_t), NULL,
+                                             5, &executor), 0);
+        TEST_TRUE(sum == 49990000);
+        TEST_UINT_EQ(nb_runs, 5);
+
+        /* The table is still usable after removals */
+        for (int32_t i = 1; i < 10000; i += 2) {
+            TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                        NULL), 1);
+        }
+        TEST_UINT_EQ(ht_table_nb_entries(table), 10000);
+
+        /* The table shrinks once most entries are removed. */
+        ht_table_get_stats(table, &stats);
+        nb_buckets = stats.nb_buckets;
+
+        TEST_INT_EQ(ht_table_foreach_parallel(table, test_foreach_remove_large,
+                                              NULL, 4, NULL), 0);
+        TEST_UINT_EQ(ht_table_nb_entries(table), 100);
+
+        /* With incremental resize, lookups move entries out of the old
+         * buckets, which are counted until then. */
+        for (int32_t i = 0; i < 10000; i++) {
+            TEST_TRUE(ht_table_contains(table, HT_INT32_TO_POINTER(i))
+                      == (i < 100));
+        }
+
+        ht_table_get_stats(table, &stats);
+        TEST_TRUE(stats.nb_buckets < nb_buckets);
+
+        /* Accumulators whose size cannot be allocated */
+        sum = 0;
+        TEST_INT_EQ(ht_table_reduce_parallel(table, test_reduce_sum,
+                                             test_combine_sum,
+                                             &sum, SIZE_MAX - 4, NULL,
+                                             3, NULL), -1);
+        TEST_INT_EQ(ht_table_reduce_parallel(table, test_reduce_sum,
+                                             test_combine_sum,
+                                             &sum, SIZE_MAX / 2, NULL,
+                                             3, NULL), -1);
+        TEST_TRUE(sum == 0);
+
+        ht_table_delete(table);
+    }
+}
+
+static uint32_t
+test_stats_hash_constant(const void *key) {
+    return 42;
+}
+
+TEST(stats) {
+    static const enum ht_table_storage storages[] = {
+        HT_TABLE_STORAGE_CHAINED,
+        HT_TABLE_STORAGE_OPEN,
+        HT_TABLE_STORAGE_COMPACT,
+    };
+
+    struct ht_table *table;
+    struct ht_table_stats stats;
+    size_t nb_buckets, nb_entries;
+
+    for (size_t s = 0; s < sizeof(storages) / sizeof(storages[0]); s++) {
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                                &(struct ht_table_options){
+                                    .storage = storages[s],
+                                });
+        TEST_TRUE(table != NULL);
+
+        for (int32_t i = 0; i < 1000; i++) {
+            TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                        NULL), 1);
+        }
+
+        for (int32_t i = 0; i < 2000; i++) {
+            TEST_INT_EQ(ht_table_contains(table, HT_INT32_TO_POINTER(i)),
+                        i < 1000);
+        }
+
+        ht_table_get_stats(table, &stats);
+
+        TEST_UINT_EQ(stats.nb_entries, 1000);
+        TEST_TRUE(stats.load_factor > 0.0 && stats.load_factor <= 1.0);
+        TEST_TRUE(stats.memory_sz > 1000 * 2 * sizeof(void *));
+
+        nb_buckets = 0;
+        nb_entries = 0;
+        for (size_t i = 0; i < HT_TABLE_STATS_HISTOGRAM_SZ; i++) {
+            nb_buckets += stats.occupancy[i];
+            nb_entries += i * stats.occupancy[i];
+        }
+
+        TEST_UINT_EQ(nb_buckets, stats.nb_buckets);
+        if (storages[s] != HT_TABLE_STORAGE_OPEN)
+            TEST_UINT_EQ(nb_entries, 1000);
+
+        TEST_TRUE(stats.max_probe_length >= 1);
+        TEST_TRUE(stats.mean_probe_length >= 1.0);
+        TEST_TRUE(stats.mean_probe_length <= (double)stats.max_probe_length);
+
+#ifdef HT_STATS
+        TEST_UINT_EQ(stats.nb_hits, 1000);
+        TEST_UINT_EQ(stats.nb_misses, 1000);
+        TEST_TRUE(stats.nb_equal_calls >= 1000);
+        TEST_TRUE(stats.nb_resizes > 0);
+#else
+        TEST_UINT_EQ(stats.nb_hits, 0);
+        TEST_UINT_EQ(stats.nb_resizes, 0);
+#endif
+
+        ht_table_delete(table);
+    }
+
+    /* A hash function returning the same value for all keys */
+    table = ht_table_new(test_stats_hash_constant, ht_equal_int32);
+    TEST_TRUE(table != NULL);
+
+    for (int32_t i = 0; i < 100; i++)
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL), 1);
+
+    ht_table_get_stats(table, &stats);
+
+    TEST_UINT_EQ(stats.max_probe_length, 100);
+    TEST_UINT_EQ(stats.occupancy[HT_TABLE_STATS_HISTOGRAM_SZ - 1], 1);
+    TEST_UINT_EQ(stats.occupancy[0], stats.nb_buckets - 1);
+
+    ht_table_delete(table);
+}
+
+/* Events reported by table hooks; the allocator of the table shares the same
+ * context so that allocations can be made to fail. */
+struct test_hooks {
+    size_t nb_resize_starts;
+    size_t nb_resize_ends;
+    size_t old_sz;
+    size_t sz;
+    size_t nb_moved;
+    size_t nb_bucket_growths;
+    size_t nb_allocation_failures;
+    bool fail_allocations;
+};
+
+static void
+test_hooks_resize_start(struct ht_table *table, size_t old_sz, size_t sz,
+                        void *ctx) {
+    struct test_hooks *hooks;
+
+    hooks = ctx;
+    hooks->nb_resize_starts++;
+}
+
+static void
+test_hooks_resize_end(struct ht_table *table, size_t old_sz, size_t sz,
+                      size_t nb_moved, uint64_t duration, void *ctx) {
+    struct test_hooks *hooks;
+
+    hooks = ctx;
+    hooks->nb_resize_ends++;
+    hooks->old_sz = old_sz;
+    hooks->sz = sz;
+    hooks->nb_moved = nb_moved;
+}
+
+static void
+test_hooks_allocation_failure(struct ht_table *table, size_t sz, void *ctx) {
+    struct test_hooks *hooks;
+
+    hooks = ctx;
+    hooks->nb_allocation_failures++;
+}
+
+static void
+test_hooks_bucket_growth(struct ht_table *table, size_t idx, size_t old_sz,
+                         size_t sz, void *ctx) {
+    struct test_hooks *hooks;
+
+    hooks = ctx;
+    hooks->nb_bucket_growths++;
+}
+
+static void *
+test_hooks_alloc(size_t sz, void *ctx) {
+    struct test_hooks *hooks;
+
+    hooks = ctx;
+    if (hooks->fail_allocations)
+        return NULL;
+
+    return malloc(sz);
+}
+
+static void
+test_hooks_free(void *ptr, size_t sz, void *ctx) {
+    free(ptr);
+}
+
+TEST(hooks) {
+    static const enum ht_table_storage storages[] = {
+        HT_TABLE_STORAGE_CHAINED,
+        HT_TABLE_STORAGE_OPEN,
+        HT_TABLE_STORAGE_COMPACT,
+    };
+
+    struct test_hooks events;
+    struct ht_table_hooks hooks = {
+        .resize_start = test_hooks_resize_start,
+        .resize_end = test_hooks_resize_end,
+        .allocation_failure = test_hooks_allocation_failure,
+        .bucket_growth = test_hooks_bucket_growth,
+        .ctx = &events,
+    };
+    struct ht_allocator allocator = {
+        .alloc = test_hooks_alloc,
+        .free = test_hooks_free,
+        .ctx = &events,
+    };
+    struct ht_table *table;
+
+    for (size_t s = 0; s < sizeof(storages) / sizeof(storages[0]); s++) {
+        memset(&events, 0, sizeof(struct test_hooks));
+
+        table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                                &(struct ht_table_options){
+                                    .storage = storages[s],
+                                    .allocator = &allocator,
+                                    .hooks = &hooks,
+                                });
+        TEST_TRUE(table != NULL);
+        TEST_UINT_EQ(events.nb_resize_starts, 0);
+
+        for (int32_t i = 0; i < 1000; i++) {
+            TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i),
+                                        NULL), 1);
+        }
+
+        TEST_TRUE(events.nb_resize_starts > 0);
+        TEST_UINT_EQ(events.nb_resize_ends, events.nb_resize_starts);
+        TEST_TRUE(events.sz > events.old_sz);
+        TEST_TRUE(events.nb_moved > 0 && events.nb_moved < 1000);
+
+        if (storages[s] == HT_TABLE_STORAGE_CHAINED) {
+            TEST_TRUE(events.nb_bucket_growths > 0);
+        } else {
+            TEST_UINT_EQ(events.nb_bucket_growths, 0);
+        }
+
+        /* A resize failing to allocate memory ends without changing the
+         * size of the table. */
+        events.fail_allocations = true;
+        TEST_INT_EQ(ht_table_reserve(table, 100000), -1);
+        events.fail_allocations = false;
+
+        TEST_UINT_EQ(events.nb_allocation_failures, 1);
+        TEST_UINT_EQ(events.nb_resize_ends, events.nb_resize_starts);
+        TEST_UINT_EQ(events.sz, events.old_sz);
+        TEST_UINT_EQ(events.nb_moved, 0);
+        TEST_UINT_EQ(ht_table_nb_entries(table), 1000);
+
+        TEST_INT_EQ(ht_table_reserve(table, 100000), 0);
+        TEST_UINT_EQ(events.nb_resize_ends, events.nb_resize_starts);
+        TEST_TRUE(events.sz > events.old_sz);
+
+        ht_table_delete(table);
+    }
+
+    /* Incremental resize */
+    memset(&events, 0, sizeof(struct test_hooks));
+
+    table = ht_table_new_ex(ht_hash_int32, ht_equal_int32,
+                            &(struct ht_table_options){
+                                .allocator = &allocator,
+                                .hooks = &hooks,
+                                .incremental_resize = true,
+                            });
+    TEST_TRUE(table != NULL);
+
+    for (int32_t i = 0; i < 1000; i++)
+        TEST_INT_EQ(ht_table_insert(table, HT_INT32_TO_POINTER(i), NULL), 1);
+
+    events.fail_allocations = true;
+    TEST_INT_EQ(ht_table_reserve(table, 100000), -1);
+    events.fail_allocations = false;
+
+    TEST_TRUE(events.nb_allocation_failures > 0);
+    TEST_UINT_EQ(events.nb_resize_ends, events.nb_resize_starts);
+    TEST_UINT_EQ(events.sz, events.old_sz);
+    TEST_UINT_EQ(ht_table_nb_entries(table), 1000);
+
+    ht_table_delete(table);
+}
+
 int
 main(int argc, char **argv) {
     struct test_suite *suite;
@@ -256,12 +2583,39 @@ main(int argc, char **argv) {
 
     TEST_RUN(suite, insert);
     TEST_RUN(suite, insert2);
+    TEST_RUN(suite, upsert);
     TEST_RUN(suite, remove);
     TEST_RUN(suite, remove2);
     TEST_RUN(suite, clear);
     TEST_RUN(suite, resize);
     TEST_RUN(suite, iterate);
     TEST_RUN(suite, iterate_operations);
+    TEST_RUN(suite, open_insert);
+    TEST_RUN(suite, open_resize);
+    TEST_RUN(suite, open_collisions);
+    TEST_RUN(suite, open_iterate_operations);
+    TEST_RUN(suite, incremental_resize);
+    TEST_RUN(suite, hash64);
+    TEST_RUN(suite, reserve);
+    TEST_RUN(suite, policy);
+    TEST_RUN(suite, get_many);
+    TEST_RUN(suite, bytes);
+    TEST_RUN(suite, heterogeneous_lookup);
+    TEST_RUN(suite, typed);
+    TEST_RUN(suite, concurrent);
+    TEST_RUN(suite, single_writer);
+    TEST_RUN(suite, sharded);
+    TEST_RUN(suite, allocator);
+    TEST_RUN(suite, slab);
+    TEST_RUN(suite, huge_pages);
+    TEST_RUN(suite, snapshot);
+    TEST_RUN(suite, frozen);
+    TEST_RUN(suite, shared);
+    TEST_RUN(suite, iterate_batch);
+    TEST_RUN(suite, compact);
+    TEST_RUN(suite, foreach_parallel);
+    TEST_RUN(suite, stats);
+    TEST_RUN(suite, hooks);
 
     test_suite_print_results_and_exit(suite);
 }